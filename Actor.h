@@ -7,9 +7,15 @@
 #ifndef INCLUDED_FRACTORP_ACTOR_H
 #define INCLUDED_FRACTORP_ACTOR_H
 
+#include <atomic>
 #include <cassert>
+#include <cstddef>
 #include <cstdint>
+#include <deque>
 #include <list>
+#include <new>
+#include <type_traits>
+#include <utility>
 
 namespace Fractorp {
 
@@ -21,153 +27,1783 @@ namespace Fractorp {
 // /message/ is treated as a value type. we need to be able to store it in a run queue.
 // (but its value could be "pointer to Request object" or whatever.
 // REVIEW: Agha calls this a communication rather than a message. that may be more appropriate.
+//
+// Optionally, P or world_policy_type selects implementation details of the World,
+// such as the DeferredSendQueue implementation (see DefaultWorldPolicy below).
 
-template<typename S, typename M>
-struct Actor;
+template<typename S, typename M, typename P>
+class DeferredSendQueue;
+
+template<typename S, typename M, typename P, std::size_t RingCapacity, std::size_t ChunkCapacity>
+class RingDeferredSendQueue;
+
+template<typename S, typename M, typename P, std::size_t LaneCount, std::size_t AgingLimit>
+class PriorityDeferredSendQueue;
 
 template<typename A>
 struct Endpoint;
 
-template<typename S, typename M>
+template<typename A>
+struct FatEndpoint;
+
+
+// DeferredSendOverflowAction selects what World does when the depth of its deferred send queue
+// reaches the high watermark (see World::set_deferred_send_watermarks()). The World is
+// /overflowed/ from then until the depth falls to the low watermark.
+enum DeferredSendOverflowAction {
+    DEFERRED_SEND_UNLIMITED, // no limit, watermarks are ignored. (the default)
+    DEFERRED_SEND_DROP_OLDEST, // discard the oldest queued send to make room for each new send
+    DEFERRED_SEND_DROP_NEWEST, // discard new sends while overflowed
+    DEFERRED_SEND_CALLBACK, // pass new sends to the overflow handler while overflowed
+    DEFERRED_SEND_ASSERT // fail fast: assert that the depth stays below the high watermark
+};
+
+
+// DeferredSendOrder selects the order in which World dispatches deferred sends.
+enum DeferredSendOrder {
+    DEFERRED_SEND_FIFO, // oldest first. (the default)
+    DEFERRED_SEND_LIFO, // newest first. depth-first traversal of fan-out keeps the queue short and the working set cache-hot
+    DEFERRED_SEND_RANDOM // uniformly random, from a seeded generator (see World::seed_deferred_send_order()). for stress testing
+};
+
+// XorShiftRandom is a small, fast pseudo-random generator (xorshift64*), used by DEFERRED_SEND_RANDOM.
+class XorShiftRandom {
+    std::uint64_t state_;
+
+public:
+    explicit XorShiftRandom(std::uint64_t seed = 1) { this->seed(seed); }
+
+    void seed(std::uint64_t seed) { state_ = seed ? seed : 0x9E3779B97F4A7C15ULL; } // the state must be non-zero
+
+    std::uint64_t next()
+    {
+        state_ ^= state_ >> 12;
+        state_ ^= state_ << 25;
+        state_ ^= state_ >> 27;
+        return state_ * 2685821657736338717ULL;
+    }
+
+    // uniform in [0, n). n > 0. (the modulo bias is negligible for queue-sized n)
+    std::size_t below(std::size_t n) { return static_cast<std::size_t>(next() % n); }
+};
+
+
+// NullTracer is the default tracer_type of a world policy. A tracer's static hooks are called on
+// the hot path: around behavior invocations (ActorT::behavior) and World::inject(), when deferred
+// sends are queued and dispatched, and by become() and delete_later(). A is the root actor type.
+// NullTracer's hooks are empty and inline, so tracing costs nothing unless a tracer is selected.
+// (see Trace.h for a tracer that records events for export, and BehaviorStats.h for statistics.)
+//
+// deferred_send_state is a base class of each deferred send queue entry, for per-message tracer
+// state (e.g. the time a message was queued). It is passed to deferred_push() and deferred_pop().
+struct NullTracer {
+    struct deferred_send_state {}; // no state. (empty base optimization applies)
+
+    template<typename A> static void behavior_begin(const A& /*a*/, typename A::behavior_fn_ptr_type /*behavior*/, int /*port*/) {}
+    template<typename A> static void behavior_end(const A& /*a*/, typename A::behavior_fn_ptr_type /*behavior*/) {}
+    template<typename A> static void inject_begin(const A& /*a*/, int /*port*/) {}
+    template<typename A> static void inject_end(const A& /*a*/) {}
+    template<typename A> static void deferred_push(const A& /*a*/, int /*port*/, deferred_send_state& /*state*/) {}
+    template<typename A> static void deferred_pop(const A& /*a*/, int /*port*/, deferred_send_state& /*state*/) {}
+    template<typename A> static void become(const A& /*a*/, typename A::behavior_fn_ptr_type /*behavior*/) {}
+    template<typename A> static void delete_later(const A& /*a*/) {}
+};
+
+
+// A world policy is a struct of member templates and typedefs that configure World.
+// To customise one aspect, derive from DefaultWorldPolicy and hide the relevant member.
+struct DefaultWorldPolicy {
+    // deferred_send_queue<S,M,P>::type is the type of queue used to store deferred (recursive) sends.
+    template<typename S, typename M, typename P>
+    struct deferred_send_queue { typedef DeferredSendQueue<S, M, P> type; };
+
+    // capacity of the queue used by World::post(). 0 disables post(). (must be a power of two)
+    enum { post_queue_capacity = 0 };
+
+    // number of levels of the timer wheel used by send_after(), each of 256 ticks. 0 disables
+    // send_after(). 4 levels span 2^32 ticks. (see TimerWheel)
+    enum { timer_wheel_levels = 0 };
+
+    // deferred send queue limits. the overflow action is a DeferredSendOverflowAction. the
+    // watermarks are the initial values for World::set_deferred_send_watermarks(). 0 is no limit.
+    enum {
+        deferred_send_overflow_action = DEFERRED_SEND_UNLIMITED,
+        deferred_send_high_watermark = 0,
+        deferred_send_low_watermark = 0
+    };
+
+    // dispatch order of deferred sends. a DeferredSendOrder
+    enum { deferred_send_order = DEFERRED_SEND_FIFO };
+
+    // endpoint<A>::type is the type of endpoint_type. Endpoint packs the port into the low bits of
+    // the actor address. FatEndpoint stores a 16-bit port (see FatEndpointWorldPolicy below).
+    template<typename A>
+    struct endpoint { typedef Endpoint<A> type; };
+
+    // alignment of every actor in the space. must be a power of two, at least pointer alignment.
+    // Endpoint provides alignof(Actor) ports, so e.g. 64 gives Endpoints 64 ports.
+    // NOTE: before C++17 operator new doesn't respect alignments greater than alignof(std::max_align_t).
+    // Allocate over-aligned heap actors with World::create(): the World's slab allocator and
+    // transaction arena allocate at the policy's actor_alignment.
+    enum { actor_alignment = alignof(void*) };
+
+    // tracer_type receives hot path instrumentation events (see NullTracer above).
+    typedef NullTracer tracer_type;
+};
+
+// Allocation-free deferred sends: a power-of-two ring buffer with a chunked overflow arena.
+template<std::size_t RingCapacity = 256, std::size_t ChunkCapacity = 256>
+struct RingBufferWorldPolicy : public DefaultWorldPolicy {
+    template<typename S, typename M, typename P>
+    struct deferred_send_queue { typedef RingDeferredSendQueue<S, M, P, RingCapacity, ChunkCapacity> type; };
+};
+
+// 16-bit ports, independent of actor alignment.
+struct FatEndpointWorldPolicy : public DefaultWorldPolicy {
+    template<typename A>
+    struct endpoint { typedef FatEndpoint<A> type; };
+};
+
+// Deferred sends in LaneCount priority lanes (see PriorityDeferredSendQueue). Lane 0 is the
+// highest priority. A lane can be chosen per send with Self::send_in_lane(), otherwise it is
+// chosen by port: to give some ports priority, derive from this policy and hide
+// deferred_send_lane(), e.g.
+//
+//      struct AudioWorldPolicy : public PriorityWorldPolicy<2> {
+//          static int deferred_send_lane(int port) { return (port == AUDIO_PORT) ? 0 : 1; }
+//      };
+template<std::size_t LaneCount = 2, std::size_t AgingLimit = 64>
+struct PriorityWorldPolicy : public DefaultWorldPolicy {
+    template<typename S, typename M, typename P>
+    struct deferred_send_queue { typedef PriorityDeferredSendQueue<S, M, P, LaneCount, AgingLimit> type; };
+
+    // the lane of a deferred send on port. by default the lowest priority lane
+    static int deferred_send_lane(int /*port*/) { return static_cast<int>(LaneCount) - 1; }
+};
+
+
+template<typename S, typename M, typename P = DefaultWorldPolicy>
+struct Actor;
+
+template<typename S, typename M, typename P = DefaultWorldPolicy>
 class World;
 
 
-template<typename S, typename M>
-struct Actor {
+template<typename S, typename M, typename P>
+struct alignas(P::actor_alignment) Actor {
     typedef S shared_context_type;
     typedef M message_type;
-    typedef Actor<shared_context_type, message_type> actor_type;
-    typedef Endpoint<actor_type> endpoint_type;
-    typedef World<shared_context_type, message_type> world_type;
+    typedef P world_policy_type;
+    typedef Actor<shared_context_type, message_type, world_policy_type> actor_type;
+    typedef typename world_policy_type::template endpoint<actor_type>::type endpoint_type;
+    typedef World<shared_context_type, message_type, world_policy_type> world_type;
     
-    typedef void (*behavior_fn_ptr_type)(world_type&, actor_type&, int port, message_type message);
+    // Messages are passed by rvalue reference: the behavior may move from the message (and so
+    // message_type may be move-only). see ActorT::behavior for the supported member signatures.
+    typedef void (*behavior_fn_ptr_type)(world_type&, actor_type&, int port, message_type&& message);
+
+    // batch behaviors receive count >= 1 consecutive messages sent to the same port (see ActorT::batch_behavior)
+    typedef void (*batch_behavior_fn_ptr_type)(world_type&, actor_type&, int port, const message_type *messages, std::size_t count);
 
     behavior_fn_ptr_type behaviorFn_;
 
     static Actor& null() { static Actor nullActor; return nullActor; }
 
-    Actor() : behaviorFn_(&actor_type::nullBehavior) {}
-    explicit Actor(const Actor& src) : behaviorFn_(src.behaviorFn_) {}
-    explicit Actor(behavior_fn_ptr_type behaviorFn) : behaviorFn_(behaviorFn) {}
-    Actor& operator=(const Actor& rhs) { behaviorFn_ = rhs.behaviorFn_; return *this; }
-    
-    // It's fatal to send a message to an uninitialized Actor or actor ref.
-    // Actor::null() and Endpoint::null() are like NULL pointers, not like /dev/null.
-    static void nullBehavior(world_type&, actor_type&, int /*port*/, message_type /*message*/)
-    {
-        assert(false && "sending message to uninitialized actor or endpoint");
+    Actor() : behaviorFn_(&actor_type::nullBehavior) {}
+    explicit Actor(const Actor& src) : behaviorFn_(src.behaviorFn_) {}
+    explicit Actor(behavior_fn_ptr_type behaviorFn) : behaviorFn_(behaviorFn) {}
+    Actor& operator=(const Actor& rhs) { behaviorFn_ = rhs.behaviorFn_; return *this; }
+    
+    // It's fatal to send a message to an uninitialized Actor or actor ref.
+    // Actor::null() and Endpoint::null() are like NULL pointers, not like /dev/null.
+    static void nullBehavior(world_type&, actor_type&, int /*port*/, message_type&& /*message*/)
+    {
+        assert(false && "sending message to uninitialized actor or endpoint");
+    }
+};
+
+
+// Endpoint packs a port index into the low bits of the actor's address. Hence there are
+// alignof(actor_type) ports: typically 8 on 64-bit platforms and 4 on 32-bit platforms.
+// For more ports raise the world policy's actor_alignment, or use FatEndpoint. Over-aligned
+// actors must be statically allocated, or allocated with World::create() (not operator new).
+template<typename actor_type>
+struct Endpoint {
+    enum { PORT_COUNT = alignof(actor_type), PORT_INDEX_MASK = PORT_COUNT - 1 };
+
+    std::intptr_t packed_;
+
+    static Endpoint null() { return Endpoint(actor_type::null()); }
+
+    Endpoint() : packed_(Endpoint::null().packed_) {}
+    explicit Endpoint(actor_type& a) : packed_(reinterpret_cast<std::intptr_t>(&a))
+    {
+        assert((packed_&PORT_INDEX_MASK) == 0); // check that the actor is aligned. (e.g. an over-aligned actor allocated with operator new)
+    }
+
+    Endpoint(actor_type& a, int port) : packed_(reinterpret_cast<std::intptr_t>(&a) | port)
+    {
+        assert((reinterpret_cast<std::intptr_t>(&a)&PORT_INDEX_MASK) == 0); // check that the actor is aligned
+        assert((port&PORT_INDEX_MASK) == port); // check for overflow of available port bits.
+    }
+
+    actor_type& actor() const { return *reinterpret_cast<actor_type*>(packed_&(~static_cast<std::intptr_t>(PORT_INDEX_MASK))); }
+    int port() const { return static_cast<int>(packed_&PORT_INDEX_MASK); }
+};
+
+
+// FatEndpoint stores a 16-bit port independently of the actor address, for actors that have
+// more ports than alignment bits. Where user-space addresses fit in 48 bits (x86-64, AArch64)
+// the port is packed into the top 16 bits, so a FatEndpoint is still a single word.
+// Elsewhere it is an address and a port. Define FRACTORP_FAT_ENDPOINT_PACKED=0 to force the latter.
+#ifndef FRACTORP_FAT_ENDPOINT_PACKED
+#if defined(__x86_64__) || defined(_M_X64) || defined(__aarch64__) || defined(_M_ARM64)
+#define FRACTORP_FAT_ENDPOINT_PACKED 1
+#else
+#define FRACTORP_FAT_ENDPOINT_PACKED 0
+#endif
+#endif
+
+template<typename actor_type>
+struct FatEndpoint {
+    enum { PORT_COUNT = 0x10000 };
+
+#if FRACTORP_FAT_ENDPOINT_PACKED
+    enum { PORT_SHIFT = 48 };
+
+    std::uint64_t packed_;
+
+    static std::uint64_t pack(actor_type& a, int port)
+    {
+        std::uint64_t address = reinterpret_cast<std::uintptr_t>(&a);
+        assert((address >> PORT_SHIFT) == 0); // check that the address leaves the top 16 bits free
+        return address | (static_cast<std::uint64_t>(port) << PORT_SHIFT);
+    }
+
+    actor_type& actor() const { return *reinterpret_cast<actor_type*>(static_cast<std::uintptr_t>(packed_ & ((std::uint64_t(1) << PORT_SHIFT) - 1))); }
+    int port() const { return static_cast<int>(packed_ >> PORT_SHIFT); }
+#else
+    struct Packed {
+        actor_type *actor_;
+        std::uint16_t port_;
+    };
+
+    Packed packed_;
+
+    static Packed pack(actor_type& a, int port) { Packed result = { &a, static_cast<std::uint16_t>(port) }; return result; }
+
+    actor_type& actor() const { return *packed_.actor_; }
+    int port() const { return packed_.port_; }
+#endif
+
+    static FatEndpoint null() { return FatEndpoint(actor_type::null()); }
+
+    FatEndpoint() : packed_(pack(actor_type::null(), 0)) {}
+    explicit FatEndpoint(actor_type& a) : packed_(pack(a, 0)) {}
+    FatEndpoint(actor_type& a, int port) : packed_(pack(a, port))
+    {
+        assert(port >= 0 && port < PORT_COUNT); // check for overflow of available port bits.
+    }
+};
+
+
+// Implementation of DeferredSendQueue is just a detail, selected by the world policy.
+// DeferredSendQueue allocates a list node per deferred send. RingDeferredSendQueue
+// avoids allocation in the steady state (see below). Both support every DeferredSendOrder.
+// DEFERRED_SEND_RANDOM costs O(n) per dispatch in DeferredSendQueue, and O(chunks) in
+// RingDeferredSendQueue. It's intended for testing.
+// FIXME runQueue_ doesn't need to be an instance variable.
+//  it could be pointer to queue allocated on the stack in inject().
+//  and we don't need a runqueue at all if there is no cyclic sending.
+// on the other hand, when we do need a runQueue_ we need to make it available
+// to all actors. hence why we pass World around.
+
+
+template<typename S, typename M, typename P>
+class DeferredSendQueue {
+    typedef S shared_context_type;
+    typedef M message_type;
+    typedef Actor<shared_context_type,message_type,P> actor_type;
+    typedef typename actor_type::endpoint_type endpoint_type;
+    typedef World<shared_context_type,message_type,P> world_type;
+
+    struct DeferredSend : public P::tracer_type::deferred_send_state {
+        endpoint_type endpoint;
+        message_type message;
+
+        DeferredSend(endpoint_type e, message_type&& m)
+            : endpoint(e)
+            , message(std::move(m)) {}
+    };
+
+    typedef std::list<DeferredSend> list_type;
+    list_type q_; // new entries are pushed at the front
+    list_type inFlight_; // the entry being dispatched, spliced out of q_
+    XorShiftRandom random_;
+
+    // the next entry to dispatch. precondition: !q_.empty()
+    typename list_type::iterator next_entry()
+    {
+        switch (static_cast<int>(P::deferred_send_order)) {
+        case DEFERRED_SEND_LIFO:
+            return q_.begin();
+        case DEFERRED_SEND_RANDOM: {
+            std::size_t i = random_.below(q_.size());
+            typename list_type::iterator result;
+            if (i < q_.size() / 2) {
+                result = q_.begin();
+                while (i--)
+                    ++result;
+            } else {
+                result = q_.end();
+                for (i = q_.size() - i; i > 0; --i)
+                    --result;
+            }
+            return result;
+        }
+        default:
+            return --q_.end();
+        }
+    }
+
+public:
+
+    std::size_t size() const { return q_.size(); }
+
+    void seed(std::uint64_t seed) { random_.seed(seed); }
+
+    void push(actor_type& a, int port, message_type&& m)
+    {
+        q_.emplace_front(endpoint_type(a, port), std::move(m));
+        P::tracer_type::deferred_push(a, port, q_.front());
+    }
+
+    // discard the oldest entry. precondition: !empty(). only used with DEFERRED_SEND_DROP_OLDEST
+    void drop_oldest() { q_.pop_back(); }
+
+    void send_all(world_type& world)
+    {
+        // NOTE: dispatching may cause additional entries to be queued. list nodes are stable,
+        // so entries are dispatched in place, whatever the order. the entry is spliced out of q_
+        // first, so that size() excludes it (as in the other queues) and drop_oldest() can't
+        // discard it while in use.
+        while (!q_.empty()) {
+            inFlight_.splice(inFlight_.end(), q_, next_entry());
+            DeferredSend &deferredSend = inFlight_.front();
+            actor_type& a = deferredSend.endpoint.actor();
+            int port = deferredSend.endpoint.port();
+            P::tracer_type::deferred_pop(a, port, deferredSend);
+            a.behaviorFn_(world, a, port, std::move(deferredSend.message));
+            inFlight_.pop_front();
+        }
+    }
+};
+
+
+// RingDeferredSendQueue stores deferred sends in a fixed-capacity power-of-two ring buffer.
+// When the ring is full, further sends spill into a FIFO of fixed-size chunks. Drained chunks
+// are kept on a spare list rather than freed, so once the queue has reached its peak size
+// no further allocation takes place, even across World::inject() calls.
+// While the overflow is non-empty all pushes go to the overflow, hence everything in the ring
+// is older than everything in the overflow. FIFO order pops from the front of the ring, LIFO
+// from the back of the overflow (or the ring, once the overflow is empty).
+// Every chunk other than the back chunk is full.
+template<typename S, typename M, typename P, std::size_t RingCapacity, std::size_t ChunkCapacity>
+class RingDeferredSendQueue {
+    typedef S shared_context_type;
+    typedef M message_type;
+    typedef Actor<shared_context_type,message_type,P> actor_type;
+    typedef typename actor_type::endpoint_type endpoint_type;
+    typedef World<shared_context_type,message_type,P> world_type;
+
+    static_assert(RingCapacity > 0 && (RingCapacity & (RingCapacity - 1)) == 0, "RingCapacity must be a power of two");
+    static_assert(ChunkCapacity > 0, "ChunkCapacity must be non-zero");
+
+    struct DeferredSend : public P::tracer_type::deferred_send_state {
+        endpoint_type endpoint;
+        message_type message;
+
+        DeferredSend(endpoint_type e, message_type&& m)
+            : endpoint(e)
+            , message(std::move(m)) {}
+    };
+
+    // uninitialized storage for a DeferredSend. slots are constructed on push and destroyed on pop.
+    typedef typename std::aligned_storage<sizeof(DeferredSend), alignof(DeferredSend)>::type slot_type;
+
+    struct Chunk {
+        Chunk *next_;
+        std::size_t begin_, end_; // [begin_, end_) are live slots
+        slot_type slots_[ChunkCapacity];
+    };
+
+    slot_type ring_[RingCapacity];
+    std::size_t ringFront_, ringBack_; // free-running counters, masked on access
+
+    Chunk *overflowFront_, *overflowBack_; // FIFO of chunks. null when no chunks are linked.
+    Chunk *spareChunks_; // drained chunks, retained for reuse
+
+    std::size_t size_;
+
+    XorShiftRandom random_;
+
+    RingDeferredSendQueue(const RingDeferredSendQueue&);
+    RingDeferredSendQueue& operator=(const RingDeferredSendQueue&);
+
+    static DeferredSend& slot(slot_type& s) { return *reinterpret_cast<DeferredSend*>(&s); }
+
+    bool ring_empty() const { return ringFront_ == ringBack_; }
+    bool ring_full() const { return ringBack_ - ringFront_ == RingCapacity; }
+    bool overflow_empty() const { return overflowFront_ == 0 || overflowFront_->begin_ == overflowFront_->end_; }
+
+    DeferredSend& push_overflow(endpoint_type e, message_type&& m)
+    {
+        if (overflowBack_ == 0 || overflowBack_->end_ == ChunkCapacity) {
+            Chunk *c = spareChunks_;
+            if (c)
+                spareChunks_ = c->next_;
+            else
+                c = new Chunk;
+            c->next_ = 0;
+            c->begin_ = c->end_ = 0;
+
+            if (overflowBack_)
+                overflowBack_->next_ = c;
+            else
+                overflowFront_ = c;
+            overflowBack_ = c;
+        }
+
+        DeferredSend *d = new (&overflowBack_->slots_[overflowBack_->end_]) DeferredSend(e, std::move(m));
+        ++overflowBack_->end_;
+        return *d;
+    }
+
+    // precondition: !empty()
+    DeferredSend& front()
+    {
+        if (!ring_empty())
+            return slot(ring_[ringFront_ & (RingCapacity - 1)]);
+        else
+            return slot(overflowFront_->slots_[overflowFront_->begin_]);
+    }
+
+    // precondition: !empty()
+    void pop_front()
+    {
+        --size_;
+        destroy_front();
+    }
+
+    // pop_front() without updating size_. precondition: !empty()
+    void destroy_front()
+    {
+        if (!ring_empty()) {
+            slot(ring_[ringFront_ & (RingCapacity - 1)]).~DeferredSend();
+            ++ringFront_;
+        } else {
+            Chunk *c = overflowFront_;
+            slot(c->slots_[c->begin_]).~DeferredSend();
+            if (++c->begin_ == ChunkCapacity) { // chunk fully consumed. retire it to the spare list
+                overflowFront_ = c->next_;
+                if (overflowFront_ == 0)
+                    overflowBack_ = 0;
+                c->next_ = spareChunks_;
+                spareChunks_ = c;
+            }
+        }
+    }
+
+    // precondition: !empty()
+    DeferredSend& back()
+    {
+        if (!overflow_empty())
+            return slot(overflowBack_->slots_[overflowBack_->end_ - 1]);
+        else
+            return slot(ring_[(ringBack_ - 1) & (RingCapacity - 1)]);
+    }
+
+    // precondition: !empty()
+    void pop_back()
+    {
+        --size_;
+        if (!overflow_empty()) {
+            Chunk *c = overflowBack_;
+            slot(c->slots_[--c->end_]).~DeferredSend();
+            if (c->end_ == 0 && c != overflowFront_) {
+                // unlink the empty back chunk. chunks are singly linked, so find its predecessor.
+                // O(chunks), once per ChunkCapacity pops
+                Chunk *prev = overflowFront_;
+                while (prev->next_ != c)
+                    prev = prev->next_;
+                prev->next_ = 0;
+                overflowBack_ = prev;
+                c->next_ = spareChunks_;
+                spareChunks_ = c;
+            }
+        } else {
+            --ringBack_;
+            slot(ring_[ringBack_ & (RingCapacity - 1)]).~DeferredSend();
+        }
+    }
+
+    // entry i in FIFO order. precondition: i < size(). O(chunks)
+    DeferredSend& at(std::size_t i)
+    {
+        const std::size_t ringCount = ringBack_ - ringFront_;
+        if (i < ringCount)
+            return slot(ring_[(ringFront_ + i) & (RingCapacity - 1)]);
+
+        i -= ringCount;
+        Chunk *c = overflowFront_;
+        i += c->begin_;
+        while (i >= c->end_) {
+            i -= c->end_;
+            c = c->next_;
+        }
+        return slot(c->slots_[i]);
+    }
+
+    // move entry i to the back (and the back entry to i) without requiring assignment
+    void swap_with_back(std::size_t i)
+    {
+        DeferredSend& a = at(i);
+        DeferredSend& b = back();
+        if (&a == &b)
+            return;
+        DeferredSend temp(std::move(a));
+        a.~DeferredSend();
+        new (&a) DeferredSend(std::move(b));
+        b.~DeferredSend();
+        new (&b) DeferredSend(std::move(temp));
+    }
+
+    static void free_chunks(Chunk *c)
+    {
+        while (c) {
+            Chunk *next = c->next_;
+            delete c;
+            c = next;
+        }
+    }
+
+public:
+
+    RingDeferredSendQueue()
+        : ringFront_(0)
+        , ringBack_(0)
+        , overflowFront_(0)
+        , overflowBack_(0)
+        , spareChunks_(0)
+        , size_(0) {}
+
+    ~RingDeferredSendQueue()
+    {
+        while (!empty())
+            pop_front();
+        free_chunks(overflowFront_);
+        free_chunks(spareChunks_);
+    }
+
+    bool empty() const { return ring_empty() && overflow_empty(); }
+
+    std::size_t size() const { return size_; }
+
+    // discard the oldest entry. precondition: !empty(). only used with DEFERRED_SEND_DROP_OLDEST
+    void drop_oldest() { pop_front(); }
+
+    void seed(std::uint64_t seed) { random_.seed(seed); }
+
+    void push(actor_type& a, int port, message_type&& m)
+    {
+        ++size_;
+        DeferredSend *d;
+        if (overflow_empty() && !ring_full()) {
+            d = new (&ring_[ringBack_ & (RingCapacity - 1)]) DeferredSend(endpoint_type(a, port), std::move(m));
+            ++ringBack_;
+        } else {
+            d = &push_overflow(endpoint_type(a, port), std::move(m));
+        }
+        P::tracer_type::deferred_push(a, port, *d);
+    }
+
+    void send_all(world_type& world)
+    {
+        // NOTE: dispatching may cause additional entries to be queued.
+        // in FIFO order the message is dispatched in place: new entries are pushed at the back,
+        // and neither ring slots nor chunks are reused until popped, so the front entry remains valid.
+        // otherwise the entry is removed before dispatch: in LIFO and random order, because new
+        // entries would be pushed after it, and with DEFERRED_SEND_DROP_OLDEST so that
+        // drop_oldest() can't discard it while in use. either way size() excludes the entry
+        // being dispatched.
+        const bool fifo = (static_cast<int>(P::deferred_send_order) == DEFERRED_SEND_FIFO);
+        while (!empty()) {
+            if (!fifo || static_cast<int>(P::deferred_send_overflow_action) == DEFERRED_SEND_DROP_OLDEST) {
+                if (static_cast<int>(P::deferred_send_order) == DEFERRED_SEND_RANDOM)
+                    swap_with_back(random_.below(size_));
+                DeferredSend deferredSend(std::move(fifo ? front() : back()));
+                if (fifo)
+                    pop_front();
+                else
+                    pop_back();
+                actor_type& a = deferredSend.endpoint.actor();
+                P::tracer_type::deferred_pop(a, deferredSend.endpoint.port(), deferredSend);
+                a.behaviorFn_(world, a, deferredSend.endpoint.port(), std::move(deferredSend.message));
+            } else {
+                DeferredSend &deferredSend = front();
+                --size_;
+                actor_type& a = deferredSend.endpoint.actor();
+                P::tracer_type::deferred_pop(a, deferredSend.endpoint.port(), deferredSend);
+                a.behaviorFn_(world, a, deferredSend.endpoint.port(), std::move(deferredSend.message));
+                destroy_front();
+            }
+        }
+    }
+};
+
+
+// PriorityDeferredSendQueue dispatches deferred sends from LaneCount FIFO lanes, highest
+// priority (lane 0) first, so that a latency-critical send doesn't wait behind a backlog of
+// bulk sends. push() places a send in the lane given by P::deferred_send_lane(port) (see
+// PriorityWorldPolicy), or in an explicit lane (see Self::send_in_lane()).
+//
+// Aging prevents starvation: each time a send is dispatched from a higher lane, every
+// non-empty lower lane is charged one skip. A lane that has been skipped AgingLimit times is
+// served next (the highest such lane first), after which its count restarts. So a lower lane
+// receives at least one dispatch per AgingLimit dispatches from the lanes above it. An
+// AgingLimit of 0 disables aging (strict priority).
+//
+// Only DEFERRED_SEND_FIFO order is supported. drop_oldest() discards the oldest send of the
+// lowest priority non-empty lane.
+template<typename S, typename M, typename P, std::size_t LaneCount, std::size_t AgingLimit>
+class PriorityDeferredSendQueue {
+    typedef S shared_context_type;
+    typedef M message_type;
+    typedef Actor<shared_context_type,message_type,P> actor_type;
+    typedef typename actor_type::endpoint_type endpoint_type;
+    typedef World<shared_context_type,message_type,P> world_type;
+
+    static_assert(LaneCount > 0, "LaneCount must be non-zero");
+    static_assert(static_cast<int>(P::deferred_send_order) == DEFERRED_SEND_FIFO, "PriorityDeferredSendQueue only supports DEFERRED_SEND_FIFO order");
+
+    struct DeferredSend : public P::tracer_type::deferred_send_state {
+        endpoint_type endpoint;
+        message_type message;
+
+        DeferredSend(endpoint_type e, message_type&& m)
+            : endpoint(e)
+            , message(std::move(m)) {}
+    };
+
+    // a deque rather than a list: entries are only added at the back and removed from the
+    // front, and references to the front entry survive push_back(), so dispatch is in place.
+    std::deque<DeferredSend> lanes_[LaneCount];
+    std::size_t skips_[LaneCount]; // aging counters
+    std::size_t size_;
+
+    // the lane to dispatch from next. precondition: size_ > 0
+    std::size_t next_lane()
+    {
+        std::size_t lane = 0;
+        while (lanes_[lane].empty())
+            ++lane;
+
+        if (AgingLimit > 0) {
+            for (std::size_t i = lane + 1; i < LaneCount; ++i) {
+                if (!lanes_[i].empty() && skips_[i] >= AgingLimit) {
+                    lane = i;
+                    break;
+                }
+            }
+            for (std::size_t i = lane + 1; i < LaneCount; ++i) {
+                if (!lanes_[i].empty())
+                    ++skips_[i];
+            }
+            skips_[lane] = 0;
+        }
+        return lane;
+    }
+
+public:
+    enum { lane_count = LaneCount };
+
+    PriorityDeferredSendQueue() : size_(0)
+    {
+        for (std::size_t i=0; i < LaneCount; ++i)
+            skips_[i] = 0;
+    }
+
+    std::size_t size() const { return size_; }
+    std::size_t lane_size(std::size_t lane) const { return lanes_[lane].size(); }
+
+    void seed(std::uint64_t) {} // no random order
+
+    void push(actor_type& a, int port, message_type&& m) { push(a, port, std::move(m), P::deferred_send_lane(port)); }
+
+    void push(actor_type& a, int port, message_type&& m, int lane)
+    {
+        assert(lane >= 0 && lane < static_cast<int>(LaneCount));
+        std::deque<DeferredSend>& q = lanes_[lane];
+        if (q.empty())
+            skips_[lane] = 0; // a lane ages only while it waits
+        q.emplace_back(endpoint_type(a, port), std::move(m));
+        ++size_;
+        P::tracer_type::deferred_push(a, port, q.back());
+    }
+
+    // discard the oldest entry of the lowest priority lane. precondition: size() > 0
+    void drop_oldest()
+    {
+        std::size_t lane = LaneCount - 1;
+        while (lanes_[lane].empty())
+            --lane;
+        lanes_[lane].pop_front();
+        --size_;
+    }
+
+    void send_all(world_type& world)
+    {
+        while (size_ > 0) {
+            std::deque<DeferredSend>& q = lanes_[next_lane()];
+            if (static_cast<int>(P::deferred_send_overflow_action) == DEFERRED_SEND_DROP_OLDEST) {
+                // the entry is removed before dispatch, so that drop_oldest() can't discard it while in use
+                DeferredSend deferredSend(std::move(q.front()));
+                q.pop_front();
+                --size_;
+                actor_type& a = deferredSend.endpoint.actor();
+                P::tracer_type::deferred_pop(a, deferredSend.endpoint.port(), deferredSend);
+                a.behaviorFn_(world, a, deferredSend.endpoint.port(), std::move(deferredSend.message));
+            } else {
+                DeferredSend &deferredSend = q.front();
+                --size_; // size() excludes the entry being dispatched, as in the other queues
+                actor_type& a = deferredSend.endpoint.actor();
+                int port = deferredSend.endpoint.port();
+                P::tracer_type::deferred_pop(a, port, deferredSend);
+                a.behaviorFn_(world, a, port, std::move(deferredSend.message));
+                q.pop_front();
+            }
+        }
+    }
+};
+
+// has_deferred_send_lanes<Q>::value is true if Q can push into an explicit lane (see Self::send_in_lane())
+template<typename Q>
+struct has_deferred_send_lanes : public std::false_type {};
+
+template<typename S, typename M, typename P, std::size_t LaneCount, std::size_t AgingLimit>
+struct has_deferred_send_lanes<PriorityDeferredSendQueue<S, M, P, LaneCount, AgingLimit> > : public std::true_type {};
+
+
+// PostQueue is a bounded multi-producer/single-consumer queue used by World::post() to
+// pass messages into a World from other threads.
+//
+// push() is wait-free: a producer first reserves space (so that the slot it is about to claim
+// is known to have been consumed) then claims a slot and publishes the message. It never
+// allocates, so it may be called from real-time threads. If the queue is full push() fails.
+// If a producer is preempted between claiming and publishing, pop() returns false until it
+// resumes: later messages are not lost, only delayed.
+template<typename E, typename M, std::size_t Capacity>
+class PostQueue {
+    typedef E endpoint_type;
+    typedef M message_type;
+
+    static_assert((Capacity & (Capacity - 1)) == 0, "post_queue_capacity must be a power of two");
+
+    struct Post {
+        endpoint_type endpoint;
+        message_type message;
+
+        Post(endpoint_type e, message_type&& m)
+            : endpoint(e)
+            , message(std::move(m)) {}
+    };
+
+    struct Slot {
+        typename std::aligned_storage<sizeof(Post), alignof(Post)>::type storage_;
+        std::atomic<bool> published_;
+    };
+
+    Slot *slots_; // allocated once, by the constructor
+    std::atomic<std::size_t> reserved_; // number of claimed-but-not-yet-consumed slots
+    std::atomic<std::size_t> back_; // next slot to claim
+    std::size_t front_; // next slot to consume. consumer only
+
+    PostQueue(const PostQueue&);
+    PostQueue& operator=(const PostQueue&);
+
+    static Post& post(Slot& slot) { return *reinterpret_cast<Post*>(&slot.storage_); }
+
+public:
+    PostQueue()
+        : slots_(new Slot[Capacity])
+        , reserved_(0)
+        , back_(0)
+        , front_(0)
+    {
+        for (std::size_t i=0; i < Capacity; ++i)
+            slots_[i].published_.store(false, std::memory_order_relaxed);
+    }
+
+    ~PostQueue()
+    {
+        while (pop(&discard))
+            ;
+        delete [] slots_;
+    }
+
+    static void discard(endpoint_type, message_type&&) {}
+
+    // may be called from any thread
+    bool push(endpoint_type e, message_type&& m)
+    {
+        if (reserved_.fetch_add(1, std::memory_order_acq_rel) >= Capacity) {
+            reserved_.fetch_sub(1, std::memory_order_relaxed);
+            return false; // full
+        }
+
+        Slot& slot = slots_[back_.fetch_add(1, std::memory_order_relaxed) & (Capacity - 1)];
+        new (&slot.storage_) Post(e, std::move(m));
+        slot.published_.store(true, std::memory_order_release);
+        return true;
+    }
+
+    // consumer only. passes the front message to deliver(endpoint, message&&), in place.
+    // the slot is released once deliver() returns.
+    template<typename F>
+    bool pop(F deliver)
+    {
+        Slot& slot = slots_[front_ & (Capacity - 1)];
+        if (!slot.published_.load(std::memory_order_acquire))
+            return false;
+
+        Post &p = post(slot);
+        deliver(p.endpoint, std::move(p.message));
+        p.~Post();
+        slot.published_.store(false, std::memory_order_relaxed);
+        ++front_;
+        reserved_.fetch_sub(1, std::memory_order_acq_rel); // releases the slot to producers
+        return true;
+    }
+};
+
+// post() is disabled: no storage.
+template<typename E, typename M>
+class PostQueue<E, M, 0> {};
+
+
+// TimerHandle identifies a timer started by Self::send_after() or World::send_after(), for
+// cancellation. A default-constructed handle identifies no timer.
+struct TimerHandle {
+    void *entry_;
+    std::uint32_t generation_;
+
+    TimerHandle() : entry_(0), generation_(0) {}
+    TimerHandle(void *entry, std::uint32_t generation) : entry_(entry), generation_(generation) {}
+};
+
+// TimerWheel is a hierarchical timing wheel (after Varghese and Lauck, "Hashed and Hierarchical
+// Timing Wheels", 1987) used by World to implement send_after(). Time is measured in ticks,
+// which World::advance_timers() advances.
+//
+// There are Levels wheels of SLOT_COUNT slots. A timer that expires within SLOT_COUNT ticks is
+// stored in a level 0 slot, one that expires within SLOT_COUNT^2 ticks in a level 1 slot, and
+// so on. Whenever level l wraps, the next slot of level l+1 is cascaded (its timers are
+// reinserted at lower levels). Each slot is an intrusive circular list, so starting and
+// cancelling a timer are O(1), and advancing is O(1) per tick plus O(levels) per timer over
+// its lifetime. Timers further away than SLOT_COUNT^Levels ticks are parked in the top level
+// and re-placed when they cascade.
+//
+// Timer entries are recycled through a free list, and retained until the wheel is destroyed.
+// The message is constructed in place when the timer starts and destroyed when it fires or
+// is cancelled. Each entry carries a generation count, which is incremented when the entry
+// is recycled, so a stale TimerHandle never cancels an unrelated timer.
+template<typename E, typename M, std::size_t Levels>
+class TimerWheel {
+    typedef E endpoint_type;
+    typedef M message_type;
+
+public:
+    enum { SLOT_BITS = 8, SLOT_COUNT = 1 << SLOT_BITS, SLOT_MASK = SLOT_COUNT - 1 };
+
+private:
+    static_assert(Levels * SLOT_BITS < 64, "too many timer wheel levels");
+
+    struct Link {
+        Link *next_, *prev_;
+    };
+
+    struct Entry : public Link {
+        std::uint64_t expiry_; // tick
+        std::uint32_t generation_;
+        endpoint_type endpoint_;
+        typename std::aligned_storage<sizeof(M), alignof(M)>::type storage_;
+
+        message_type& message() { return *reinterpret_cast<message_type*>(&storage_); }
+    };
+
+    Link slots_[Levels][SLOT_COUNT]; // list heads
+    std::uint64_t now_;
+    std::size_t count_; // number of pending timers
+    Entry *free_; // linked through next_
+
+    TimerWheel(const TimerWheel&);
+    TimerWheel& operator=(const TimerWheel&);
+
+    static void init_list(Link& head) { head.next_ = head.prev_ = &head; }
+
+    static void link_before(Link& head, Link *x)
+    {
+        x->next_ = &head;
+        x->prev_ = head.prev_;
+        head.prev_->next_ = x;
+        head.prev_ = x;
+    }
+
+    static void unlink(Link *x)
+    {
+        x->prev_->next_ = x->next_;
+        x->next_->prev_ = x->prev_;
+    }
+
+    // move the timers in slot to the (empty) list head
+    static void splice(Link& slot, Link& head)
+    {
+        if (slot.next_ == &slot) {
+            init_list(head);
+            return;
+        }
+        head.next_ = slot.next_;
+        head.prev_ = slot.prev_;
+        head.next_->prev_ = &head;
+        head.prev_->next_ = &head;
+        init_list(slot);
+    }
+
+    void place(Entry *e)
+    {
+        std::uint64_t expiry = e->expiry_;
+        const std::uint64_t delta = expiry - now_;
+        std::size_t level = 0;
+        while (level + 1 < Levels && delta >= (std::uint64_t(1) << ((level + 1) * SLOT_BITS)))
+            ++level;
+        if (level + 1 == Levels && delta >= (std::uint64_t(1) << (Levels * SLOT_BITS)))
+            expiry = now_ + (std::uint64_t(1) << (Levels * SLOT_BITS)) - 1; // out of range. park in the furthest slot
+        link_before(slots_[level][(expiry >> (level * SLOT_BITS)) & SLOT_MASK], e);
+    }
+
+    // the entry must have been unlinked. (and retired, if a handle to it may exist)
+    void recycle(Entry *e)
+    {
+        e->message().~message_type();
+        e->next_ = free_;
+        free_ = e;
+        --count_;
+    }
+
+public:
+    TimerWheel() : now_(0), count_(0), free_(0)
+    {
+        for (std::size_t i=0; i < Levels; ++i) {
+            for (std::size_t j=0; j < SLOT_COUNT; ++j)
+                init_list(slots_[i][j]);
+        }
+    }
+
+    ~TimerWheel()
+    {
+        for (std::size_t i=0; i < Levels; ++i) {
+            for (std::size_t j=0; j < SLOT_COUNT; ++j) {
+                Link& head = slots_[i][j];
+                while (head.next_ != &head) {
+                    Entry *e = static_cast<Entry*>(head.next_);
+                    unlink(e);
+                    recycle(e);
+                }
+            }
+        }
+        while (free_) {
+            Entry *e = free_;
+            free_ = static_cast<Entry*>(e->next_);
+            delete e;
+        }
+    }
+
+    std::uint64_t now() const { return now_; }
+    std::size_t size() const { return count_; }
+
+    // the timer fires delay ticks from now. a delay of 0 fires at the next tick
+    TimerHandle start(endpoint_type e, std::uint64_t delay, message_type&& m)
+    {
+        Entry *x = free_;
+        if (x) {
+            free_ = static_cast<Entry*>(x->next_);
+        } else {
+            x = new Entry;
+            x->generation_ = 0;
+        }
+        x->expiry_ = now_ + (delay > 0 ? delay : 1);
+        x->endpoint_ = e;
+        new (&x->storage_) message_type(std::move(m));
+        place(x);
+        ++count_;
+        return TimerHandle(x, x->generation_);
+    }
+
+    // returns false if the timer has already fired or been cancelled
+    bool cancel(const TimerHandle& h)
+    {
+        Entry *e = static_cast<Entry*>(h.entry_);
+        if (!e || e->generation_ != h.generation_)
+            return false;
+        unlink(e);
+        ++e->generation_; // retire outstanding handles
+        recycle(e);
+        return true;
+    }
+
+    // advance time by ticks, passing each expired timer's message to deliver(endpoint, message&&),
+    // in expiry order. deliver may start and cancel timers. returns the number of timers fired
+    template<typename F>
+    std::size_t advance(std::uint64_t ticks, F deliver)
+    {
+        std::size_t fired = 0;
+        for (; ticks > 0; --ticks) {
+            if (count_ == 0) { // nothing to cascade or fire
+                now_ += ticks;
+                break;
+            }
+
+            const std::uint64_t t = ++now_;
+            for (std::size_t level = 1; level < Levels && (t & ((std::uint64_t(1) << (level * SLOT_BITS)) - 1)) == 0; ++level) {
+                Link cascaded;
+                splice(slots_[level][(t >> (level * SLOT_BITS)) & SLOT_MASK], cascaded);
+                while (cascaded.next_ != &cascaded) {
+                    Entry *e = static_cast<Entry*>(cascaded.next_);
+                    unlink(e);
+                    place(e);
+                }
+            }
+
+            // deliver from a local list: the slot may receive new timers while we deliver,
+            // and deliver may cancel timers that are still in the list
+            Link expired;
+            splice(slots_[0][t & SLOT_MASK], expired);
+            while (expired.next_ != &expired) {
+                Entry *e = static_cast<Entry*>(expired.next_);
+                unlink(e);
+                ++e->generation_; // the handle is stale once the timer has fired
+                deliver(e->endpoint_, std::move(e->message()));
+                recycle(e);
+                ++fired;
+            }
+        }
+        return fired;
+    }
+};
+
+// send_after() is disabled: no storage.
+template<typename E, typename M>
+class TimerWheel<E, M, 0> {};
+
+
+// MailboxEntry is a message queued in the mailbox of an ActorT_mailbox actor (see RecursionGuard_mailbox).
+// The message is constructed in place when the entry is queued and destroyed after dispatch,
+// so entries on the free list hold no message (and M needn't be default-constructible).
+template<typename M>
+struct MailboxEntry {
+    MailboxEntry *next_;
+    int port_;
+    typename std::aligned_storage<sizeof(M), alignof(M)>::type storage_;
+
+    M& message() { return *reinterpret_cast<M*>(&storage_); }
+};
+
+// ActorMailbox is an intrusive FIFO of entries, embedded in each ActorT_mailbox actor.
+template<typename M>
+struct ActorMailbox {
+    typedef MailboxEntry<M> entry_type;
+
+    entry_type *front_, *back_;
+    bool draining_; // true while the backlog is being dispatched. prevents nested draining
+
+    ActorMailbox() : front_(0), back_(0), draining_(false) {}
+
+    bool empty() const { return front_ == 0; }
+
+    void push_back(entry_type *e)
+    {
+        e->next_ = 0;
+        if (back_)
+            back_->next_ = e;
+        else
+            front_ = e;
+        back_ = e;
+    }
+
+    // precondition: !empty()
+    entry_type* pop_front()
+    {
+        entry_type *e = front_;
+        front_ = e->next_;
+        if (front_ == 0)
+            back_ = 0;
+        return e;
+    }
+};
+
+// MailboxEntryPool recycles mailbox entries. Each World owns one. Entries are retained until
+// the World is destroyed, so in the steady state queueing a mailbox message doesn't allocate.
+template<typename M>
+class MailboxEntryPool {
+    typedef MailboxEntry<M> entry_type;
+
+    entry_type *free_;
+
+    MailboxEntryPool(const MailboxEntryPool&);
+    MailboxEntryPool& operator=(const MailboxEntryPool&);
+
+public:
+    MailboxEntryPool() : free_(0) {}
+
+    ~MailboxEntryPool()
+    {
+        while (free_) {
+            entry_type *e = free_;
+            free_ = e->next_;
+            delete e;
+        }
+    }
+
+    entry_type* allocate()
+    {
+        entry_type *e = free_;
+        if (e)
+            free_ = e->next_;
+        else
+            e = new entry_type;
+        return e;
+    }
+
+    void free(entry_type *e)
+    {
+        e->next_ = free_;
+        free_ = e;
+    }
+};
+
+
+// SlabAllocator provides storage for heap actors that are created and destroyed at a high rate
+// (see World::create() and ActorT::slab_allocated). Each World owns one.
+//
+// Blocks are segregated into size classes (multiples of GRANULE bytes). Each class has a LIFO
+// free list, so allocate() and free() are O(1), and the most recently freed (hence cache-hot)
+// block is reused first. Blocks are carved from chunks that are retained until the allocator
+// is destroyed. Blocks larger than MAX_BLOCK_SIZE use operator new.
+//
+// Chunks are aligned to, and padded to a multiple of, chunkAlignment. With cache-line alignment
+// no block shares a cache line with memory that doesn't belong to the allocator (see WorkerSlab
+// in ParallelWorld.h). Blocks are aligned to the largest power of two (up to chunkAlignment)
+// that divides their size class. Hence an object of type T is aligned when alignof(T) is at
+// most chunkAlignment (sizeof(T) is a multiple of alignof(T)). Blocks larger than
+// MAX_BLOCK_SIZE are also aligned to chunkAlignment.
+class SlabAllocator {
+public:
+    enum { GRANULE = 16, SIZE_CLASS_COUNT = 16, MAX_BLOCK_SIZE = GRANULE * SIZE_CLASS_COUNT, BLOCKS_PER_CHUNK = 64 };
+
+private:
+    struct FreeBlock {
+        FreeBlock *next_;
+    };
+
+    struct Chunk {
+        Chunk *next_;
+        void *allocation_; // as returned by operator new
+        // followed by BLOCKS_PER_CHUNK blocks
+    };
+
+    FreeBlock *free_[SIZE_CLASS_COUNT];
+    Chunk *chunks_;
+    const std::size_t chunkAlignment_;
+
+    SlabAllocator(const SlabAllocator&);
+    SlabAllocator& operator=(const SlabAllocator&);
+
+    static std::size_t size_class(std::size_t size) { return (size + GRANULE - 1) / GRANULE - 1; }
+
+    std::size_t align_up(std::size_t n) const { return (n + chunkAlignment_ - 1) & ~(chunkAlignment_ - 1); }
+
+    // operator new only guarantees max_align_t alignment. over-aligned large blocks are
+    // over-allocated, and the operator new allocation is stored in front of the block
+    bool large_blocks_over_aligned() const { return chunkAlignment_ > alignof(std::max_align_t); }
+
+    void* allocate_large(std::size_t size)
+    {
+        if (!large_blocks_over_aligned())
+            return ::operator new(size);
+        char *allocation = static_cast<char*>(::operator new(size + chunkAlignment_ + sizeof(void*)));
+        char *p = reinterpret_cast<char*>(align_up(reinterpret_cast<std::uintptr_t>(allocation + sizeof(void*))));
+        reinterpret_cast<void**>(p)[-1] = allocation;
+        return p;
+    }
+
+    void free_large(void *p)
+    {
+        ::operator delete(large_blocks_over_aligned() ? static_cast<void**>(p)[-1] : p);
+    }
+
+    void refill(std::size_t sizeClass)
+    {
+        const std::size_t blockSize = (sizeClass + 1) * GRANULE;
+        const std::size_t headerSize = align_up(sizeof(Chunk));
+        char *allocation = static_cast<char*>(::operator new(chunkAlignment_ - 1 + align_up(headerSize + blockSize * BLOCKS_PER_CHUNK)));
+        char *p = reinterpret_cast<char*>(align_up(reinterpret_cast<std::uintptr_t>(allocation)));
+        Chunk *c = reinterpret_cast<Chunk*>(p);
+        c->next_ = chunks_;
+        c->allocation_ = allocation;
+        chunks_ = c;
+
+        // thread the blocks onto the free list, such that they're allocated in address order
+        char *blocks = p + headerSize;
+        for (std::size_t i = BLOCKS_PER_CHUNK; i > 0; --i) {
+            FreeBlock *b = reinterpret_cast<FreeBlock*>(blocks + (i - 1) * blockSize);
+            b->next_ = free_[sizeClass];
+            free_[sizeClass] = b;
+        }
+    }
+
+public:
+    // chunkAlignment must be a power of two, at least GRANULE
+    explicit SlabAllocator(std::size_t chunkAlignment = GRANULE) : chunks_(0), chunkAlignment_(chunkAlignment)
+    {
+        assert(chunkAlignment >= GRANULE && (chunkAlignment & (chunkAlignment - 1)) == 0);
+        for (std::size_t i=0; i < SIZE_CLASS_COUNT; ++i)
+            free_[i] = 0;
+    }
+
+    ~SlabAllocator()
+    {
+        while (chunks_) {
+            Chunk *c = chunks_;
+            chunks_ = c->next_;
+            ::operator delete(c->allocation_);
+        }
+    }
+
+    std::size_t chunk_alignment() const { return chunkAlignment_; }
+
+    void* allocate(std::size_t size)
+    {
+        if (size > MAX_BLOCK_SIZE)
+            return allocate_large(size);
+
+        const std::size_t sizeClass = size_class(size);
+        if (!free_[sizeClass])
+            refill(sizeClass);
+        FreeBlock *b = free_[sizeClass];
+        free_[sizeClass] = b->next_;
+        return b;
+    }
+
+    // size must be the size passed to allocate()
+    void free(void *p, std::size_t size)
+    {
+        if (size > MAX_BLOCK_SIZE) {
+            free_large(p);
+            return;
+        }
+
+        const std::size_t sizeClass = size_class(size);
+        FreeBlock *b = static_cast<FreeBlock*>(p);
+        b->next_ = free_[sizeClass];
+        free_[sizeClass] = b;
+    }
+};
+
+
+// BumpArena provides storage for arena_allocated actors created during World::inject_transaction()
+// (see ActorT::arena_allocated). allocate() bumps a pointer. Nothing is freed individually:
+// reset() discards every allocation at once. Chunks are retained until the arena is destroyed,
+// so in the steady state allocation never calls operator new.
+class BumpArena {
+public:
+    enum { CHUNK_SIZE = 64 * 1024 };
+
+private:
+    struct Chunk {
+        Chunk *next_;
+        std::size_t size_; // payload bytes
+        // followed by the payload. (the header size keeps the payload max_align_t aligned)
+    };
+
+    Chunk *first_, *current_;
+    char *next_, *end_; // free space in current_
+    std::size_t chunkCount_;
+
+    BumpArena(const BumpArena&);
+    BumpArena& operator=(const BumpArena&);
+
+    static std::size_t header_size() { return (sizeof(Chunk) + alignof(std::max_align_t) - 1) & ~(alignof(std::max_align_t) - 1); }
+    static char* payload(Chunk *c) { return reinterpret_cast<char*>(c) + header_size(); }
+    static char* align(char *p, std::size_t alignment) { return reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(p) + alignment - 1) & ~(alignment - 1)); }
+
+    void use(Chunk *c)
+    {
+        current_ = c;
+        next_ = payload(c);
+        end_ = next_ + c->size_;
+    }
+
+    // make a chunk with at least size bytes (plus alignment slack) current
+    void advance(std::size_t size)
+    {
+        Chunk *c = current_ ? current_->next_ : first_;
+        if (!c || c->size_ < size) {
+            const std::size_t payloadSize = size > CHUNK_SIZE ? size : static_cast<std::size_t>(CHUNK_SIZE);
+            Chunk *n = static_cast<Chunk*>(::operator new(header_size() + payloadSize));
+            n->size_ = payloadSize;
+            if (current_) {
+                n->next_ = current_->next_;
+                current_->next_ = n;
+            } else {
+                n->next_ = first_;
+                first_ = n;
+            }
+            ++chunkCount_;
+            c = n;
+        }
+        use(c);
+    }
+
+public:
+    BumpArena() : first_(0), current_(0), next_(0), end_(0), chunkCount_(0) {}
+
+    ~BumpArena()
+    {
+        while (first_) {
+            Chunk *c = first_;
+            first_ = c->next_;
+            ::operator delete(c);
+        }
+    }
+
+    // alignment must be a power of two
+    void* allocate(std::size_t size, std::size_t alignment)
+    {
+        char *p = align(next_, alignment);
+        if (!next_ || p + size > end_) {
+            // chunk payloads are max_align_t aligned. greater alignments need slack
+            advance((alignment > alignof(std::max_align_t)) ? size + alignment - 1 : size);
+            p = align(next_, alignment);
+        }
+        next_ = p + size;
+        return p;
+    }
+
+    // discard all allocations. O(1)
+    void reset()
+    {
+        current_ = 0;
+        next_ = end_ = 0;
+    }
+
+    bool empty() const { return current_ == 0; }
+    std::size_t chunk_count() const { return chunkCount_; }
+};
+
+
+template<typename S, typename M, typename P>
+class World {
+    typedef S shared_context_type;
+    typedef M message_type;
+    typedef P world_policy_type;
+    typedef Actor<shared_context_type, message_type, world_policy_type> actor_type;
+    typedef typename actor_type::endpoint_type endpoint_type;
+    typedef World<shared_context_type, message_type, world_policy_type> world_type;
+    typedef typename actor_type::behavior_fn_ptr_type behavior_fn_ptr_type;
+
+    // the alignment of actors allocated by create()
+    enum { slab_alignment = (static_cast<std::size_t>(world_policy_type::actor_alignment) > static_cast<std::size_t>(SlabAllocator::GRANULE))
+        ? static_cast<std::size_t>(world_policy_type::actor_alignment) : static_cast<std::size_t>(SlabAllocator::GRANULE) };
+
+public:
+    // called when the World enters (overflowed is true) or leaves the overflowed state
+    typedef void (*deferred_send_watermark_fn_ptr_type)(world_type&, bool overflowed);
+    typedef typename world_policy_type::template deferred_send_queue<S, M, P>::type deferred_send_queue_type;
+
+private:
+    deferred_send_queue_type deferredSendQueue_;
+
+    typedef typename world_policy_type::tracer_type tracer_type;
+
+    // deferred send limits and counters (see DeferredSendOverflowAction)
+    std::size_t deferredSendHighWatermark_, deferredSendLowWatermark_;
+    std::size_t deferredSendPeakDepth_;
+    std::size_t deferredSendDropCount_;
+    bool deferredSendOverflowed_;
+    behavior_fn_ptr_type deferredSendOverflowHandler_;
+    deferred_send_watermark_fn_ptr_type deferredSendWatermarkHandler_;
+
+    MailboxEntryPool<message_type> mailboxEntryPool_;
+
+    PostQueue<endpoint_type, message_type, world_policy_type::post_queue_capacity> postQueue_;
+
+    TimerWheel<endpoint_type, message_type, world_policy_type::timer_wheel_levels> timers_;
+
+    SlabAllocator actorSlab_;
+
+    // storage for arena_allocated actors (see inject_transaction())
+    BumpArena actorArena_;
+    std::size_t arenaLiveCount_;
+    std::size_t transactionEscapeCount_;
+    bool inTransaction_;
+
+    // the lane of the message being sent by Self::send_in_lane(), until it is deferred or
+    // delivered. -1 otherwise: the lane is chosen by port
+    int deferredSendLane_;
+
+    shared_context_type sharedContext_;
+
+    // injects posted messages and expired timers
+    struct MessageInjector {
+        world_type& world_;
+        explicit MessageInjector(world_type& world) : world_(world) {}
+        void operator()(const endpoint_type& e, message_type&& m) const { world_.inject(e, std::move(m)); }
+    };
+
+    void set_deferred_send_overflowed(bool overflowed)
+    {
+        deferredSendOverflowed_ = overflowed;
+        if (deferredSendWatermarkHandler_)
+            deferredSendWatermarkHandler_(*this, overflowed);
+    }
+
+    // only queues that support DEFERRED_SEND_DROP_OLDEST need to implement drop_oldest()
+    void drop_oldest_deferred_send(std::true_type)
+    {
+        deferredSendQueue_.drop_oldest();
+        ++deferredSendDropCount_;
+    }
+
+    void drop_oldest_deferred_send(std::false_type) {}
+
+    void push_deferred_send(actor_type& a, int port, message_type&& m, int lane)
+    {
+        push_deferred_send(a, port, std::move(m), lane, has_deferred_send_lanes<deferred_send_queue_type>());
+        const std::size_t depth = deferredSendQueue_.size();
+        if (depth > deferredSendPeakDepth_)
+            deferredSendPeakDepth_ = depth;
+    }
+
+    void push_deferred_send(actor_type& a, int port, message_type&& m, int lane, std::true_type)
+    {
+        if (lane < 0)
+            deferredSendQueue_.push(a, port, std::move(m));
+        else
+            deferredSendQueue_.push(a, port, std::move(m), lane);
+    }
+
+    void push_deferred_send(actor_type& a, int port, message_type&& m, int /*lane*/, std::false_type)
+    {
+        deferredSendQueue_.push(a, port, std::move(m));
+    }
+
+    // apply the overflow action to a new deferred send. returns false if the send was consumed.
+    bool admit_deferred_send(actor_type& a, int port, message_type& m)
+    {
+        if (deferredSendHighWatermark_ == 0)
+            return true; // no limit
+
+        const std::size_t depth = deferredSendQueue_.size();
+        if (deferredSendOverflowed_ && depth <= deferredSendLowWatermark_)
+            set_deferred_send_overflowed(false);
+        else if (!deferredSendOverflowed_ && depth >= deferredSendHighWatermark_)
+            set_deferred_send_overflowed(true);
+
+        switch (static_cast<int>(world_policy_type::deferred_send_overflow_action)) {
+        case DEFERRED_SEND_DROP_OLDEST:
+            if (depth >= deferredSendHighWatermark_)
+                drop_oldest_deferred_send(std::integral_constant<bool, static_cast<int>(world_policy_type::deferred_send_overflow_action) == DEFERRED_SEND_DROP_OLDEST>());
+            return true;
+        case DEFERRED_SEND_DROP_NEWEST:
+            if (deferredSendOverflowed_) {
+                ++deferredSendDropCount_;
+                return false;
+            }
+            return true;
+        case DEFERRED_SEND_CALLBACK:
+            if (deferredSendOverflowed_) {
+                assert(deferredSendOverflowHandler_ != 0 && "DEFERRED_SEND_CALLBACK requires an overflow handler");
+                deferredSendOverflowHandler_(*this, a, port, std::move(m));
+                return false;
+            }
+            return true;
+        case DEFERRED_SEND_ASSERT:
+            assert(depth < deferredSendHighWatermark_ && "deferred send queue depth reached the high watermark");
+            return true;
+        }
+        return true;
+    }
+
+public:
+
+    World()
+        : deferredSendHighWatermark_(world_policy_type::deferred_send_high_watermark)
+        , deferredSendLowWatermark_(world_policy_type::deferred_send_low_watermark)
+        , deferredSendPeakDepth_(0)
+        , deferredSendDropCount_(0)
+        , deferredSendOverflowed_(false)
+        , deferredSendOverflowHandler_(0)
+        , deferredSendWatermarkHandler_(0)
+        , actorSlab_(slab_alignment)
+        , arenaLiveCount_(0)
+        , transactionEscapeCount_(0)
+        , inTransaction_(false)
+        , deferredSendLane_(-1) {}
+
+    // inject() sends messages to actors. should only be called from outside actor behaviors.
+
+    void inject(actor_type& a) { // sends value-initialized message on port 0
+        inject(a, 0, message_type());
+    }
+
+    void inject(const endpoint_type& e) { // sends value-initialized message on port 0
+        inject(e.actor(), e.port(), message_type());
+    }
+
+    // rvalue messages are moved, never copied. lvalue messages are copied once.
+
+    void inject(actor_type& a, const message_type& m) { // sends message m on port 0
+        inject(a, 0, message_type(m));
+    }
+
+    void inject(actor_type& a, message_type&& m) {
+        inject(a, 0, std::move(m));
+    }
+
+    void inject(const endpoint_type &e, const message_type& m) {
+        inject(e.actor(), e.port(), message_type(m));
+    }
+
+    void inject(const endpoint_type &e, message_type&& m) {
+        inject(e.actor(), e.port(), std::move(m));
+    }
+
+    void inject(actor_type& a, int port, const message_type& m) {
+        inject(a, port, message_type(m));
+    }
+
+    void inject(actor_type& a, int port, message_type&& m) {
+        // REVIEW: we should probably use an assert to guard against re-entering inject
+        tracer_type::inject_begin(a, port);
+        a.behaviorFn_(*this, a, port, std::move(m));
+        deferredSendQueue_.send_all(*this);
+        if (deferredSendOverflowed_)
+            set_deferred_send_overflowed(false); // the queue is empty
+        tracer_type::inject_end(a);
+    }
+
+
+    // post() queues messages for later injection. Unlike inject(), post() may be called from any
+    // thread (including real-time threads): it is wait-free and never allocates. Returns false
+    // if the queue is full. Posted messages are delivered when the World's thread calls
+    // inject_posted(). Requires a world policy with non-zero post_queue_capacity.
+
+    bool post(actor_type& a) { // posts value-initialized message on port 0
+        return post(a, 0, message_type());
+    }
+
+    bool post(const endpoint_type& e) { // posts value-initialized message on port 0
+        return post(e.actor(), e.port(), message_type());
+    }
+
+    bool post(actor_type& a, const message_type& m) { // posts message m on port 0
+        return post(a, 0, message_type(m));
+    }
+
+    bool post(actor_type& a, message_type&& m) {
+        return post(a, 0, std::move(m));
     }
-};
 
+    bool post(const endpoint_type &e, const message_type& m) {
+        return post(e.actor(), e.port(), message_type(m));
+    }
 
-template<typename actor_type>
-struct Endpoint {
-    enum { PORT_INDEX_MASK = 0x3 }; // Assume Actors are word-aligned. pack a port index into the low bits
+    bool post(const endpoint_type &e, message_type&& m) {
+        return post(e.actor(), e.port(), std::move(m));
+    }
 
-    intptr_t packed_;
+    bool post(actor_type& a, int port, const message_type& m) {
+        return post(a, port, message_type(m));
+    }
 
-    static Endpoint null() { return Endpoint(actor_type::null()); }
+    bool post(actor_type& a, int port, message_type&& m) {
+        static_assert(world_policy_type::post_queue_capacity > 0, "post() requires a world policy with non-zero post_queue_capacity");
+        return postQueue_.push(endpoint_type(a, port), std::move(m));
+    }
 
-    Endpoint() : packed_(Endpoint::null().packed_) {}
-    explicit Endpoint(actor_type& a) : packed_(reinterpret_cast<std::intptr_t>(&a)) {}
-    Endpoint(actor_type& a, int port) : packed_(reinterpret_cast<std::intptr_t>(&a) | port)
+    // inject_posted() injects up to maxCount posted messages, in the order that they were posted.
+    // Returns the number of messages injected. Should only be called from the World's thread,
+    // outside actor behaviors.
+    std::size_t inject_posted(std::size_t maxCount = static_cast<std::size_t>(-1))
     {
-        assert((port&PORT_INDEX_MASK) == port); // check for overflow of available port bits.
+        static_assert(world_policy_type::post_queue_capacity > 0, "inject_posted() requires a world policy with non-zero post_queue_capacity");
+        std::size_t count = 0;
+        while (count < maxCount && postQueue_.pop(MessageInjector(*this)))
+            ++count;
+        return count;
     }
 
-    actor_type& actor() const { return *reinterpret_cast<actor_type*>(packed_&(~static_cast<std::intptr_t>(PORT_INDEX_MASK))); }
-    int port() const { return static_cast<int>(packed_&PORT_INDEX_MASK); }
-};
 
+    // send_after() sends a message to e once delay ticks have elapsed. Ticks are advanced by
+    // advance_timers(), which the World's thread should call from its run loop, outside actor
+    // behaviors. Requires a world policy with non-zero timer_wheel_levels. Within behaviors use
+    // Self::send_after(). Pending timers that have not fired when the World is destroyed are
+    // discarded.
 
-// Implementation of DeferredSendQueue is just a detail. Might be most efficient
-// to use a stack-allocated fixed size ringbuffer: and pass a pointer to it into world.
-// FIXME runQueue_ doesn't need to be an instance variable.
-//  it could be pointer to queue allocated on the stack in inject().
-//  and we don't need a runqueue at all if there is no cyclic sending.
-// on the other hand, when we do need a runQueue_ we need to make it available
-// to all actors. hence why we pass World around.
+    TimerHandle send_after(const endpoint_type& e, std::uint64_t delay) { // sends value-initialized message
+        return send_after(e, delay, message_type());
+    }
 
+    TimerHandle send_after(const endpoint_type& e, std::uint64_t delay, const message_type& m) {
+        return send_after(e, delay, message_type(m));
+    }
 
-template<typename S, typename M>
-class DeferredSendQueue {
-    typedef S shared_context_type;
-    typedef M message_type;
-    typedef Actor<shared_context_type,message_type> actor_type;
-    typedef Endpoint<actor_type> endpoint_type;
-    typedef World<shared_context_type,message_type> world_type;
+    TimerHandle send_after(const endpoint_type& e, std::uint64_t delay, message_type&& m) {
+        static_assert(world_policy_type::timer_wheel_levels > 0, "send_after() requires a world policy with non-zero timer_wheel_levels");
+        return timers_.start(e, delay, std::move(m));
+    }
 
-    struct DeferredSend {
-        endpoint_type endpoint;
-        message_type message;
+    // returns false if the timer has already fired or been cancelled. O(1)
+    bool cancel_timer(const TimerHandle& h) { return timers_.cancel(h); }
 
-        DeferredSend() {}
-        DeferredSend(endpoint_type e, message_type m)
-            : endpoint(e)
-            , message(m) {}
-    };
+    // advance_timers() advances time by ticks and injects the messages of expired timers, in
+    // expiry order. Returns the number of timers fired.
+    std::size_t advance_timers(std::uint64_t ticks) { return timers_.advance(ticks, MessageInjector(*this)); }
 
-    std::list<DeferredSend> q_;
+    std::uint64_t timer_ticks() const { return timers_.now(); } // ticks elapsed since the World was created
+    std::size_t pending_timer_count() const { return timers_.size(); }
 
-public:
 
-    void push(actor_type& a, int port, message_type m)
-    {
-        q_.push_front((DeferredSend(endpoint_type(a, port), m)));
-    }
+    // create<T>() allocates and constructs an actor from the World's slab allocator, or for
+    // arena_allocated actors from the transaction arena. T must declare slab_allocated or
+    // arena_allocated (see ActorT). The actor is returned to the slab when it calls
+    // delete_later(). Within behaviors use Self::create().
 
-    void send_all(world_type& world)
+    template<typename T, typename... Args>
+    T* create(Args&&... args)
     {
-        // NOTE: dispatching may cause additional entries to be queued
-        // REVIEW: consider optionally performing send non-deterministically
-        while (!q_.empty()) {
-            DeferredSend &deferredSend = q_.back();
-            actor_type& a = deferredSend.endpoint.actor();
-            int port = deferredSend.endpoint.port();
-            a.behaviorFn_(world, a, port, deferredSend.message);
-            q_.pop_back();
+        static_assert(T::slab_allocated || T::arena_allocated, "create<T>() requires that T declares enum { slab_allocated = true } or enum { arena_allocated = true }");
+        static_assert(alignof(T) <= slab_alignment, "T is over-aligned for the World's slab allocator (raise the world policy's actor_alignment)");
+        void *p;
+        if (T::arena_allocated) {
+            assert(inTransaction_ && "arena_allocated actors may only be created during inject_transaction()");
+            p = actorArena_.allocate(sizeof(T), alignof(T));
+            ++arenaLiveCount_;
+        } else {
+            p = actorSlab_.allocate(sizeof(T));
+        }
+        try {
+            return new (p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            // arena storage can't be returned individually. it is reclaimed with the arena.
+            if (T::arena_allocated)
+                --arenaLiveCount_;
+            else
+                actorSlab_.free(p, sizeof(T));
+            throw;
         }
     }
-};
 
-template<typename S, typename M>
-class World {
-    typedef S shared_context_type;
-    typedef M message_type;
-    typedef Actor<shared_context_type, message_type> actor_type;
-    typedef Endpoint<actor_type> endpoint_type;
-    typedef World<shared_context_type, message_type> world_type;
+    SlabAllocator& actor_slab() { return actorSlab_; }
 
-    DeferredSendQueue<S, M> deferredSendQueue_;
 
-    shared_context_type sharedContext_;
+    // inject_transaction() is inject() for request-scoped actor graphs. arena_allocated actors
+    // created while the message and its deferred sends are dispatched are bump-allocated from
+    // the World's arena. When the dispatch is complete, if every arena actor has been deleted
+    // (with delete_later()) the whole arena is discarded with a single pointer reset, rather than
+    // freeing each actor. Otherwise the surviving actors have /escaped/: the arena is retained
+    // (and later transactions allocate after them) until a transaction ends with no arena actor
+    // alive. Escapes are counted by transaction_escape_count().
+    // Transactions do not nest.
 
-public:
+    void inject_transaction(actor_type& a) { // sends value-initialized message on port 0
+        inject_transaction(a, 0, message_type());
+    }
 
-    // inject() sends messages to actors. should only be called from outside actor behaviors.
+    void inject_transaction(const endpoint_type& e) { // sends value-initialized message on port 0
+        inject_transaction(e.actor(), e.port(), message_type());
+    }
 
-    void inject(actor_type& a) { // sends value-initialized message on port 0
-        inject(a, 0, message_type());
+    void inject_transaction(actor_type& a, const message_type& m) { // sends message m on port 0
+        inject_transaction(a, 0, message_type(m));
     }
 
-    void inject(const endpoint_type& e) { // sends value-initialized message on port 0
-        inject(e.actor(), e.port(), message_type());
+    void inject_transaction(actor_type& a, message_type&& m) {
+        inject_transaction(a, 0, std::move(m));
     }
 
-    void inject(actor_type& a, message_type m) { // sends message m on port 0
-        inject(a, 0, m);
+    void inject_transaction(const endpoint_type &e, const message_type& m) {
+        inject_transaction(e.actor(), e.port(), message_type(m));
     }
 
-    void inject(const endpoint_type &e, message_type m) {
-        inject(e.actor(), e.port(), m);
+    void inject_transaction(const endpoint_type &e, message_type&& m) {
+        inject_transaction(e.actor(), e.port(), std::move(m));
     }
 
-    void inject(actor_type& a, int port, message_type m) {
-        // REVIEW: we should probably use an assert to guard against re-entering inject
-        a.behaviorFn_(*this, a, port, m);
-        deferredSendQueue_.send_all(*this);
+    void inject_transaction(actor_type& a, int port, const message_type& m) {
+        inject_transaction(a, port, message_type(m));
+    }
+
+    void inject_transaction(actor_type& a, int port, message_type&& m) {
+        assert(!inTransaction_ && "transactions do not nest");
+        inTransaction_ = true;
+        inject(a, port, std::move(m));
+        inTransaction_ = false;
+        if (arenaLiveCount_ == 0)
+            actorArena_.reset();
+        else
+            ++transactionEscapeCount_;
+    }
+
+    std::size_t arena_live_count() const { return arenaLiveCount_; } // arena actors not yet deleted
+    std::size_t transaction_escape_count() const { return transactionEscapeCount_; } // transactions that ended with arena actors alive
+    const BumpArena& actor_arena() const { return actorArena_; }
+
+    // called when an arena_allocated actor has been deleted. its storage is reclaimed by the
+    // arena reset
+    void arena_actor_deleted()
+    {
+        assert(arenaLiveCount_ > 0);
+        --arenaLiveCount_;
+    }
+
+
+    // Deferred send queue limits. Only effective if the world policy specifies an overflow action
+    // other than DEFERRED_SEND_UNLIMITED. A high watermark of 0 disables the limit.
+    // The overflow handler receives sends rejected under DEFERRED_SEND_CALLBACK.
+
+    void set_deferred_send_watermarks(std::size_t high, std::size_t low)
+    {
+        assert(low <= high);
+        deferredSendHighWatermark_ = high;
+        deferredSendLowWatermark_ = low;
     }
 
+    void set_deferred_send_overflow_handler(behavior_fn_ptr_type handler) { deferredSendOverflowHandler_ = handler; }
+    void set_deferred_send_watermark_handler(deferred_send_watermark_fn_ptr_type handler) { deferredSendWatermarkHandler_ = handler; }
+
+    // Deferred send queue counters. Available with any overflow action. The depth counts sends
+    // waiting to be dispatched, not the one being dispatched, whatever the queue and order.
+
+    std::size_t deferred_send_depth() const { return deferredSendQueue_.size(); }
+    std::size_t deferred_send_peak_depth() const { return deferredSendPeakDepth_; }
+    void reset_deferred_send_peak_depth() { deferredSendPeakDepth_ = deferredSendQueue_.size(); }
+    std::size_t deferred_send_drop_count() const { return deferredSendDropCount_; }
+    bool deferred_send_overflowed() const { return deferredSendOverflowed_; }
+
+    // seed the generator used by DEFERRED_SEND_RANDOM order. the same seed gives the same schedule
+    void seed_deferred_send_order(std::uint64_t seed) { deferredSendQueue_.seed(seed); }
+
 
     // user-specified shared context available to all actors
 
@@ -178,12 +1814,233 @@ public:
 
     // defer_behavior is used by the implementation for deferring recursive sends.
 
-    static void defer_behavior(world_type& world, actor_type& a, int port, message_type m)
+    static void defer_behavior(world_type& world, actor_type& a, int port, message_type&& m)
+    {
+        const int lane = world.take_deferred_send_lane(); // taken even if the send is dropped
+        if (static_cast<int>(world_policy_type::deferred_send_overflow_action) != DEFERRED_SEND_UNLIMITED && !world.admit_deferred_send(a, port, m))
+            return;
+        world.push_deferred_send(a, port, std::move(m), lane);
+    }
+
+    // used by delete_later(): the delete message must not be dropped.
+    static void defer_without_limits(world_type& world, actor_type& a, int port, message_type&& m)
+    {
+        world.push_deferred_send(a, port, std::move(m), world.take_deferred_send_lane());
+    }
+
+    // the lane of a PriorityDeferredSendQueue for the next deferral (see Self::send_in_lane()).
+    // every activation clears it (see Self::Self()), so that a message delivered directly
+    // doesn't pass its lane on to the sends of its receiver.
+
+    void set_deferred_send_lane(int lane) { deferredSendLane_ = lane; }
+    bool deferred_send_lane_pending() const { return deferredSendLane_ >= 0; }
+
+    // the lane applies to the first deferral of the message, and is taken by it
+    int take_deferred_send_lane()
+    {
+        const int lane = deferredSendLane_;
+        deferredSendLane_ = -1;
+        return lane;
+    }
+
+    void clear_deferred_send_lane()
+    {
+        if (has_deferred_send_lanes<deferred_send_queue_type>::value)
+            deferredSendLane_ = -1;
+    }
+
+    // mailbox_entry_pool is used by the implementation of ActorT_mailbox actors.
+
+    MailboxEntryPool<message_type>& mailbox_entry_pool() { return mailboxEntryPool_; }
+};
+
+
+
+// Recursion guard policies select the implementation of Self used by an ActorT (see below).
+//
+// Message deferral re-entrance guard is only needed if cycles in the message
+// send graph can occur. In some use-cases this is predictable statically, for example:
+//  * Actors that don't send messages can't be re-entered.
+//  * Actor graphs that are guaranteed cycle-free (e.g. pipelines) can't be re-entered
+//
+// RecursionGuard: the general implementation. Cycles are permitted, recursive sends are deferred.
+//
+// RecursionGuard_nosend (ActorT_nosend):
+//  send() functions may not be used (compile-time error);
+//  Don't use defer behavior or save behaviorFnToRestore_;
+//  delete_later() and become() store new behaviors directly into myself_.behaviorFn_
+//
+// RecursionGuard_nocycles (ActorT_nocycles):
+//  Debug version: as for RecursionGuard but replace World::defer_behavior with a function that
+//  asserts false if a recursive message invocation is made.
+//  Release version: similar to RecursionGuard_nosend (except with send functions defined).
+//
+// RecursionGuard_mailbox (ActorT_mailbox):
+//  As for RecursionGuard, but recursive sends are appended to an intrusive mailbox inside the
+//  actor, rather than to the World's DeferredSendQueue. When the active behavior returns, the
+//  actor's whole backlog is dispatched in one go, while the actor is cache-hot.
+//  Messages to a mailbox actor are therefore processed sooner than they would be by the
+//  World's deferred queue, but behaviors are still never re-entered.
+//
+//  If the actor's current behavior is a batch behavior (see ActorT::batch_behavior) consecutive
+//  backlog entries for the same port are delivered to it in a single call.
+//
+// RecursionGuard_coalescing<N> (ActorT_coalescing):
+//  As for RecursionGuard, but ports 0 to N-1 are coalescing ("latest value wins") ports, e.g.
+//  for control-rate parameter updates. A recursive send to a coalescing port is stored in the
+//  actor, overwriting any message already pending on that port, and only the first such send
+//  queues an entry in the World's DeferredSendQueue. When that entry is dispatched the actor
+//  receives the latest message. So however many messages a port receives while the actor is
+//  busy, the behavior runs once for them, in the position of the first. Recursive sends to
+//  ports N and above are deferred as usual. Sends to an idle actor are not deferred, and so
+//  are never coalesced. N is at most 32, and at most the endpoint_type's PORT_COUNT.
+//  The message type needn't be default-constructible. Later messages are move-assigned over
+//  the stored one. As for any actor, delete_later() requires that no further messages will
+//  be delivered: the actor must not be deleted while a coalescing port is pending (asserted).
+//
+// The actor_state<A> member template is a base class of ActorT, for per-actor guard state.
+// A is the root actor type.
+
+enum ReentrantSendAction {
+    DEFER_REENTRANT_SENDS, // queue in World's DeferredSendQueue
+    ASSERT_ON_REENTRANT_SENDS,
+    MAILBOX_REENTRANT_SENDS, // queue in the actor's mailbox
+    COALESCE_REENTRANT_SENDS // keep the latest message per coalescing port, otherwise defer
+};
+
+struct RecursionGuardBase {
+    template<typename A> struct actor_state {}; // no state. (empty base optimization applies)
+};
+
+struct RecursionGuard : public RecursionGuardBase {
+    enum { can_send = true, guards_reentrance = true, reentrant_send_action = DEFER_REENTRANT_SENDS };
+};
+
+struct RecursionGuard_nosend : public RecursionGuardBase {
+    enum { can_send = false, guards_reentrance = false, reentrant_send_action = ASSERT_ON_REENTRANT_SENDS };
+};
+
+struct RecursionGuard_nocycles : public RecursionGuardBase {
+#ifdef NDEBUG
+    enum { can_send = true, guards_reentrance = false, reentrant_send_action = ASSERT_ON_REENTRANT_SENDS };
+#else
+    enum { can_send = true, guards_reentrance = true, reentrant_send_action = ASSERT_ON_REENTRANT_SENDS };
+#endif
+};
+
+struct RecursionGuard_mailbox {
+    enum { can_send = true, guards_reentrance = true, reentrant_send_action = MAILBOX_REENTRANT_SENDS };
+
+    enum { max_batch_size = 16 }; // messages per batch behavior invocation. batches are gathered on the stack
+
+    template<typename A>
+    struct actor_state {
+        ActorMailbox<typename A::message_type> mailbox_;
+
+        // set when a batch behavior is invoked. batchFn_ is used only while batchAdaptorFn_ is
+        // the current behavior, so installing some other behavior needn't reset them.
+        typename A::behavior_fn_ptr_type batchAdaptorFn_;
+        typename A::batch_behavior_fn_ptr_type batchFn_;
+
+        actor_state() : batchAdaptorFn_(0), batchFn_(0) {}
+    };
+};
+
+
+template<std::size_t N>
+struct RecursionGuard_coalescing {
+    static_assert(N > 0 && N <= 32, "RecursionGuard_coalescing supports 1 to 32 coalescing ports");
+
+    enum { can_send = true, guards_reentrance = true, reentrant_send_action = COALESCE_REENTRANT_SENDS };
+    enum { coalescing_port_count = N };
+
+    template<typename A>
+    struct actor_state {
+        static_assert(N <= static_cast<std::size_t>(A::endpoint_type::PORT_COUNT), "RecursionGuard_coalescing: more coalescing ports than the endpoint_type has ports");
+
+        typedef typename A::message_type message_type;
+
+        // the DeferredSendQueue entry for a pending port is addressed to the flusher, not to the
+        // actor, so that its dispatch can substitute the latest message (see Self::flush_coalesced_behavior)
+        struct Flusher : public A {
+            A *owner_;
+            Flusher() : owner_(0) {}
+        };
+
+        Flusher flusher_;
+        // the queued entry carries the first message. later messages are stored here, constructed
+        // in place on the first overwrite, and destroyed when the entry is dispatched
+        typename std::aligned_storage<sizeof(message_type), alignof(message_type)>::type latest_[N];
+        std::uint32_t pendingPorts_; // bit i is set while port i has a queued entry
+        std::uint32_t overwrittenPorts_; // bit i is set while latest_[i] holds a message
+        std::size_t coalescedCount_;
+
+        actor_state() : pendingPorts_(0), overwrittenPorts_(0), coalescedCount_(0) {}
+
+        ~actor_state()
+        {
+            // a pending port's queued entry addresses flusher_, which is about to be destroyed
+            assert(pendingPorts_ == 0 && "coalescing actor deleted while a coalescing port is pending");
+            for (std::size_t i=0; i < N; ++i) {
+                if (overwrittenPorts_ & (std::uint32_t(1) << i))
+                    latest(static_cast<int>(i)).~message_type();
+            }
+        }
+
+        message_type& latest(int port) { return *reinterpret_cast<message_type*>(&latest_[port]); }
+
+        // the number of messages that were overwritten before they were received
+        std::size_t coalesced_count() const { return coalescedCount_; }
+    };
+};
+
+
+// ReentrantSendHandler<action> selects the Self members that implement each ReentrantSendAction.
+// (Selecting via specialization ensures that e.g. the mailbox code is only instantiated for mailbox actors.)
+// behavior<self_type>() is the behavior to install while the actor is active.
+// after_behavior<self_type>() is invoked by ActorT::behavior() once the Self scope has ended.
+
+template<int reentrant_send_action>
+struct ReentrantSendHandler;
+
+template<>
+struct ReentrantSendHandler<DEFER_REENTRANT_SENDS> {
+    template<typename self_type>
+    static typename self_type::behavior_fn_ptr_type behavior() { return &self_type::world_type::defer_behavior; }
+
+    template<typename self_type>
+    static void after_behavior(typename self_type::world_type&, typename self_type::actor_type&) {}
+};
+
+template<>
+struct ReentrantSendHandler<ASSERT_ON_REENTRANT_SENDS> {
+    template<typename self_type>
+    static typename self_type::behavior_fn_ptr_type behavior() { return &self_type::assert_behavior; }
+
+    template<typename self_type>
+    static void after_behavior(typename self_type::world_type&, typename self_type::actor_type&) {}
+};
+
+template<>
+struct ReentrantSendHandler<MAILBOX_REENTRANT_SENDS> {
+    template<typename self_type>
+    static typename self_type::behavior_fn_ptr_type behavior() { return &self_type::mailbox_behavior; }
+
+    template<typename self_type>
+    static void after_behavior(typename self_type::world_type& world, typename self_type::actor_type& a)
     {
-        world.deferredSendQueue_.push(a, port, m);
+        self_type::drain_mailbox(world, a);
     }
 };
 
+template<>
+struct ReentrantSendHandler<COALESCE_REENTRANT_SENDS> {
+    template<typename self_type>
+    static typename self_type::behavior_fn_ptr_type behavior() { return &self_type::coalescing_behavior; }
+
+    template<typename self_type>
+    static void after_behavior(typename self_type::world_type&, typename self_type::actor_type&) {}
+};
 
 
 // Self is a scoped guard object intended to span the activation of a single behavior invocation.
@@ -203,18 +2060,24 @@ public:
 // the recursion guard. From this followed the need to implement become() and delete_later()
 // within Self -- since they depend on installing a new behavior while retaining deferral of 
 // new messages until the behavior returns.
-template <typename concrete_actor_type>
+//
+// The recursion guard policy G is fixed at compile time, so the tests on G below are
+// resolved statically and the unused branches cost nothing.
+template <typename concrete_actor_type, typename G = RecursionGuard>
 struct Self {
     typedef typename concrete_actor_type::shared_context_type shared_context_type;
     typedef typename concrete_actor_type::message_type message_type;
     typedef typename concrete_actor_type::behavior_fn_ptr_type behavior_fn_ptr_type;
+    typedef typename concrete_actor_type::batch_behavior_fn_ptr_type batch_behavior_fn_ptr_type;
     typedef typename concrete_actor_type::actor_type actor_type;
     typedef typename concrete_actor_type::endpoint_type endpoint_type;
     typedef typename concrete_actor_type::world_type world_type;
+    typedef typename actor_type::world_policy_type::tracer_type tracer_type;
+    typedef G recursion_guard_type;
 
     world_type& world_;
     actor_type& myself_;
-    behavior_fn_ptr_type behaviorFnToRestore_;
+    behavior_fn_ptr_type behaviorFnToRestore_; // only used if G::guards_reentrance
 
     Self& operator=(const Self&);
     Self(const Self&);
@@ -224,37 +2087,162 @@ struct Self {
     Self(world_type& world, actor_type& myself)
         : world_(world)
         , myself_(myself)
-        , behaviorFnToRestore_(myself_.behaviorFn_)
+        , behaviorFnToRestore_(0)
     {
-        // REVIEW: Possible optimisation:
-        //
-        // Message deferral re-entrance guard is only needed if cycles in the message
-        // send graph can occur. In some use-cases this is predictable statically, for example: 
-        //  * Actors that don't send messages can't be re-entered.
-        //  * Actor graphs that are guaranteed cycle-free (e.g. pipelines) can't be re-entered
-        // 
-        // As an optimisation, we may wish to provide the following alternative implementations of
-        // ActorT with different implementations of self:
-        //
-        // ActorT: the current implementation
-        //
-        // ActorT_nosend:
-        //  Remove send() functions from ActorT_nosend::Self;
-        //  Don't use defer behavior or save behaviorFnToRestore_;
-        //  delete_later() and become() can store new behaviors directly into myself_->behaviorFn_
-        //
-        // ActorT_nocycles:
-        //  Debug version: as for current impl but replace World::defer with a function that 
-        //  asserts false if a recursive message invocation is made.
-        //  Release version: similar to ActorT_nosend (except with send functions defined).
-
-        myself_.behaviorFn_ = world_type::defer_behavior;
+        world_.clear_deferred_send_lane();
+        if (G::guards_reentrance) {
+            behaviorFnToRestore_ = myself_.behaviorFn_;
+            myself_.behaviorFn_ = reentrant_send_behavior();
+        }
     }
 
     ~Self()
     {
         // stop deferring requests. restore old (or install new) behavior. 
-        myself_.behaviorFn_ = behaviorFnToRestore_;
+        if (G::guards_reentrance)
+            myself_.behaviorFn_ = behaviorFnToRestore_;
+    }
+
+    // the behavior installed while the actor is active. see ReentrantSendAction
+    static behavior_fn_ptr_type reentrant_send_behavior()
+    {
+        return ReentrantSendHandler<G::reentrant_send_action>::template behavior<Self>();
+    }
+
+    // installed by RecursionGuard_nocycles (debug builds only) while the behavior is active.
+    static void assert_behavior(world_type&, actor_type&, int /*port*/, message_type&& /*message*/)
+    {
+        assert(false && "recursive send to an actor that uses RecursionGuard_nocycles");
+    }
+
+    // installed by RecursionGuard_mailbox while the behavior is active.
+    static void mailbox_behavior(world_type& world, actor_type& a, int port, message_type&& m)
+    {
+        MailboxEntry<message_type> *e = world.mailbox_entry_pool().allocate();
+        e->port_ = port;
+        new (&e->storage_) message_type(std::move(m));
+        guard_state(a).mailbox_.push_back(e);
+    }
+
+    // dispatch the mailbox backlog. called after the Self scope has ended (see ReentrantSendHandler).
+    static void drain_mailbox(world_type& world, actor_type& a)
+    {
+        guard_state_type& state = guard_state(a);
+        ActorMailbox<message_type>& mb = state.mailbox_;
+        if (mb.draining_ || mb.empty())
+            return; // the outer-most activation drains
+
+        mb.draining_ = true;
+        do {
+            MailboxEntry<message_type> *e = mb.pop_front();
+            int port = e->port_;
+
+            if (a.behaviorFn_ == state.batchAdaptorFn_) {
+                // gather consecutive messages to the same port. move them out of the entries
+                // first: the batch behavior may queue (and hence allocate) further entries.
+                typename std::aligned_storage<sizeof(message_type), alignof(message_type)>::type batch[G::max_batch_size];
+                message_type *messages = reinterpret_cast<message_type*>(batch);
+                std::size_t count = 0;
+                for (;;) {
+                    new (&messages[count++]) message_type(std::move(e->message()));
+                    e->message().~message_type();
+                    world.mailbox_entry_pool().free(e);
+                    if (count == G::max_batch_size || mb.empty() || mb.front_->port_ != port)
+                        break;
+                    e = mb.pop_front();
+                }
+
+                state.batchFn_(world, a, port, messages, count); // may queue further entries
+
+                for (std::size_t i=0; i < count; ++i)
+                    messages[i].~message_type();
+            } else {
+                // dispatch in place. e has been popped, so further entries don't disturb it
+                a.behaviorFn_(world, a, port, std::move(e->message())); // may queue further entries
+                e->message().~message_type();
+                world.mailbox_entry_pool().free(e);
+            }
+        } while (!mb.empty());
+        mb.draining_ = false;
+    }
+
+    // installed by RecursionGuard_coalescing while the behavior is active.
+    static void coalescing_behavior(world_type& world, actor_type& a, int port, message_type&& m)
+    {
+        if (port >= static_cast<int>(G::coalescing_port_count)) {
+            world_type::defer_behavior(world, a, port, std::move(m));
+            return;
+        }
+
+        guard_state_type& state = guard_state(a);
+        const std::uint32_t bit = std::uint32_t(1) << port;
+        if (!(state.pendingPorts_ & bit)) {
+            state.pendingPorts_ |= bit;
+            state.flusher_.owner_ = &a;
+            state.flusher_.behaviorFn_ = &flush_coalesced_behavior;
+            // the entry must not be dropped by the overflow action: the port would stay pending
+            world_type::defer_without_limits(world, state.flusher_, port, std::move(m));
+            return;
+        }
+
+        world.take_deferred_send_lane(); // the message takes the queued entry's position, and its lane (see Self::send_in_lane())
+        ++state.coalescedCount_;
+        if (state.overwrittenPorts_ & bit) {
+            state.latest(port) = std::move(m);
+        } else {
+            new (&state.latest(port)) message_type(std::move(m));
+            state.overwrittenPorts_ |= bit;
+        }
+    }
+
+    // the behavior of a coalescing actor's flusher: delivers the latest message on port, either
+    // the queued message or, if it has been overwritten, the stored one.
+    static void flush_coalesced_behavior(world_type& world, actor_type& f, int port, message_type&& queued)
+    {
+        actor_type& a = *static_cast<typename guard_state_type::Flusher&>(f).owner_;
+        guard_state_type& state = guard_state(a);
+        const std::uint32_t bit = std::uint32_t(1) << port;
+        state.pendingPorts_ &= ~bit;
+        if (state.overwrittenPorts_ & bit) {
+            state.overwrittenPorts_ &= ~bit;
+            message_type m(std::move(state.latest(port)));
+            state.latest(port).~message_type();
+            a.behaviorFn_(world, a, port, std::move(m));
+        } else {
+            a.behaviorFn_(world, a, port, std::move(queued));
+        }
+    }
+
+    // record that adaptorFn is the current behavior, and that batchFn is its batch form.
+    // called by ActorT::batch_behavior()
+    static void set_batch_behavior(actor_type& a, behavior_fn_ptr_type adaptorFn, batch_behavior_fn_ptr_type batchFn)
+    {
+        guard_state_type& state = guard_state(a);
+        state.batchAdaptorFn_ = adaptorFn;
+        state.batchFn_ = batchFn;
+    }
+
+private:
+
+    typedef typename G::template actor_state<actor_type> guard_state_type;
+
+    static guard_state_type& guard_state(actor_type& a)
+    {
+        return *concrete_actor_type::downcast_to_concrete_actor_type(&a);
+    }
+
+    void install_behavior(behavior_fn_ptr_type behaviorFn)
+    {
+        if (G::guards_reentrance)
+            behaviorFnToRestore_ = behaviorFn; // installed when the behavior returns
+        else
+            myself_.behaviorFn_ = behaviorFn; // no re-entrance is possible, install immediately
+    }
+
+    void become_behavior(behavior_fn_ptr_type behaviorFn)
+    {
+        tracer_type::become(myself_, behaviorFn);
+        install_behavior(behaviorFn);
     }
 
 public:
@@ -263,14 +2251,44 @@ public:
     // no further messages will be delivered to it.
     void delete_later()
     {
-        behaviorFnToRestore_ = concrete_actor_type::delete_behavior; // become the delete behavior
-        world_type::defer_behavior(world_, myself_, 0, message_type()); // enqueue deferred message to self, which will cause the delete behavior to be invoked
+        tracer_type::delete_later(myself_);
+        if (concrete_actor_type::arena_allocated && std::is_trivially_destructible<concrete_actor_type>::value) {
+            // nothing to destroy or free: the storage is reclaimed when the arena is reset.
+            // (the arena isn't reset before the current transaction completes, so myself_
+            // remains valid while this behavior returns)
+            install_behavior(concrete_actor_type::deleted_behavior);
+            world_.arena_actor_deleted();
+            return;
+        }
+        install_behavior(concrete_actor_type::delete_behavior); // become the delete behavior
+        world_type::defer_without_limits(world_, myself_, 0, message_type()); // enqueue deferred message to self, which will cause the delete behavior to be invoked
     }
     
+    // f may take its message by value, by const reference or by rvalue reference (see ActorT::behavior)
+
     template < void (concrete_actor_type::*f)(Self&, int, message_type) >
     void become()
     {
-        behaviorFnToRestore_ = concrete_actor_type::behavior<f>;
+        become_behavior(concrete_actor_type::template behavior<f>);
+    }
+
+    template < void (concrete_actor_type::*f)(Self&, int, const message_type&) >
+    void become()
+    {
+        become_behavior(concrete_actor_type::template behavior<f>);
+    }
+
+    template < void (concrete_actor_type::*f)(Self&, int, message_type&&) >
+    void become()
+    {
+        become_behavior(concrete_actor_type::template behavior<f>);
+    }
+
+    // become a batch behavior. see ActorT::batch_behavior
+    template < void (concrete_actor_type::*f)(Self&, int, const message_type*, std::size_t) >
+    void become_batch()
+    {
+        become_behavior(concrete_actor_type::template batch_behavior<f>);
     }
     
 
@@ -285,36 +2303,108 @@ public:
         send(e.actor(), e.port(), message_type());
     }
 
-    void send(actor_type& a, message_type m) { // sends message m on port 0
-        send(a, 0, m);
+    // rvalue messages are moved, never copied. lvalue messages are copied once.
+    // e.g. send(a, std::move(m)) to forward a message that was received by rvalue reference.
+
+    void send(actor_type& a, const message_type& m) { // sends message m on port 0
+        send(a, 0, message_type(m));
+    }
+
+    void send(actor_type& a, message_type&& m) {
+        send(a, 0, std::move(m));
+    }
+
+    void send(const endpoint_type &e, const message_type& m) {
+        send(e.actor(), e.port(), message_type(m));
+    }
+
+    void send(const endpoint_type &e, message_type&& m) {
+        send(e.actor(), e.port(), std::move(m));
+    }
+
+    void send(actor_type& a, int port, const message_type& m) {
+        send(a, port, message_type(m));
+    }
+
+    void send(actor_type& a, int port, message_type&& m) {
+        static_assert(G::can_send, "send() is not available to ActorT_nosend actors");
+        a.behaviorFn_(world_, a, port, std::move(m));
     }
 
-    void send(const endpoint_type &e, message_type m) {
-        send(e.actor(), e.port(), m);
+    // send_in_lane() is send() with an explicit priority lane for the case that the send is
+    // deferred (the receiver is active). Requires a World with a PriorityDeferredSendQueue (see
+    // PriorityWorldPolicy). Sends to an idle receiver are delivered immediately, as for send().
+    // The lane is honoured by every recursion guard that defers into the World's queue,
+    // including the coalescing ports of ActorT_coalescing. It is an error (asserted) to send in
+    // a lane to an active ActorT_mailbox actor: its mailbox has no lanes.
+
+    void send_in_lane(int lane, const endpoint_type &e, const message_type& m) {
+        send_in_lane(lane, e.actor(), e.port(), message_type(m));
+    }
+
+    void send_in_lane(int lane, const endpoint_type &e, message_type&& m) {
+        send_in_lane(lane, e.actor(), e.port(), std::move(m));
+    }
+
+    void send_in_lane(int lane, actor_type& a, int port, const message_type& m) {
+        send_in_lane(lane, a, port, message_type(m));
+    }
+
+    void send_in_lane(int lane, actor_type& a, int port, message_type&& m) {
+        static_assert(G::can_send, "send_in_lane() is not available to ActorT_nosend actors");
+        static_assert(has_deferred_send_lanes<typename world_type::deferred_send_queue_type>::value, "send_in_lane() requires a PriorityDeferredSendQueue (see PriorityWorldPolicy)");
+        assert(lane >= 0);
+        world_.set_deferred_send_lane(lane);
+        a.behaviorFn_(world_, a, port, std::move(m));
+        // still pending only if the receiver was active and queued the message elsewhere
+        assert(!world_.deferred_send_lane_pending() && "send_in_lane(): the receiver's recursion guard doesn't queue in the World's deferred send queue (e.g. ActorT_mailbox), which would ignore the lane");
+        world_.clear_deferred_send_lane();
+    }
+
+    // create<T>() allocates a slab_allocated or arena_allocated actor. See World::create()
+    template<typename T, typename... Args>
+    T* create(Args&&... args) { return world_.template create<T>(std::forward<Args>(args)...); }
+
+    // send_after() sends a message after delay ticks. See World::send_after()
+
+    TimerHandle send_after(const endpoint_type& e, std::uint64_t delay) {
+        return world_.send_after(e, delay);
+    }
+
+    TimerHandle send_after(const endpoint_type& e, std::uint64_t delay, const message_type& m) {
+        return world_.send_after(e, delay, m);
     }
 
-    void send(actor_type& a, int port, message_type m) {
-        a.behaviorFn_(world_, a, port, m);
+    TimerHandle send_after(const endpoint_type& e, std::uint64_t delay, message_type&& m) {
+        return world_.send_after(e, delay, std::move(m));
     }
 
+    bool cancel_timer(const TimerHandle& h) { return world_.cancel_timer(h); }
+    std::uint64_t timer_ticks() const { return world_.timer_ticks(); } // see World::timer_ticks()
+
     shared_context_type& shared_context() { return world_.shared_context(); }
 };
 
 
 // ActorT is the most general base class for concrete Actor implementations.
-template <typename AS, typename DerivedT>
-struct ActorT : public Actor<typename AS::shared_context_type, typename AS::message_type> {
+// G is the recursion guard policy (see RecursionGuard above). The default permits cycles.
+template <typename AS, typename DerivedT, typename G = RecursionGuard>
+struct ActorT : public AS::actor_type, public G::template actor_state<typename AS::actor_type> {
 
     typedef typename AS::shared_context_type shared_context_type;
     typedef typename AS::message_type message_type;
+    typedef typename AS::world_type world_type;
 
     typedef typename AS::actor_type root_actor_type;
-    typedef ActorT<AS, DerivedT> actor_base_type;
+    typedef typename root_actor_type::behavior_fn_ptr_type behavior_fn_ptr_type;
+    typedef typename root_actor_type::batch_behavior_fn_ptr_type batch_behavior_fn_ptr_type;
+    typedef ActorT<AS, DerivedT, G> actor_base_type;
     typedef DerivedT concrete_actor_type;    
     
-    typedef Self<concrete_actor_type> self_type;
+    typedef Self<concrete_actor_type, G> self_type;
+    typedef typename AS::world_policy_type::tracer_type tracer_type;
 
-    static concrete_actor_type* downcast_to_concrete_actor_type(Actor *a)
+    static concrete_actor_type* downcast_to_concrete_actor_type(root_actor_type *a)
     {
         return static_cast<concrete_actor_type*>(a);
 
@@ -337,28 +2427,121 @@ struct ActorT : public Actor<typename AS::shared_context_type, typename AS::mess
         // a polymorphic object.
     }
 
-    static void delete_behavior(world_type&, root_actor_type& a, int, message_type)
+    // Actors allocated with World::create() or Self::create() must hide this declaration with
+    // enum { slab_allocated = true }; so that delete_later() returns them to the World's slab.
+    enum { slab_allocated = false };
+
+    // Alternatively, transient actors that are created during World::inject_transaction() may
+    // hide this declaration with enum { arena_allocated = true }; so that they are allocated
+    // from the World's arena (see inject_transaction()). If such an actor is trivially
+    // destructible, delete_later() takes effect immediately: no deferred delete message is sent.
+    enum { arena_allocated = false };
+
+    static void delete_behavior(world_type& world, root_actor_type& a, int, message_type&&)
+    {
+        concrete_actor_type *p = downcast_to_concrete_actor_type(&a);
+        if (concrete_actor_type::arena_allocated) {
+            p->~concrete_actor_type();
+            world.arena_actor_deleted();
+        } else if (concrete_actor_type::slab_allocated) {
+            p->~concrete_actor_type();
+            world.actor_slab().free(p, sizeof(concrete_actor_type));
+        } else {
+            delete p;
+        }
+    }
+
+    // installed by delete_later() in trivially destructible arena_allocated actors.
+    static void deleted_behavior(world_type&, root_actor_type&, int, message_type&&)
     {
-        delete downcast_to_concrete_actor_type(&a);
+        assert(false && "sending message to deleted actor");
     }
 
     // behavior<f>() is a thunk from member function to actor behavior function.
     // A distinct thunk is instantiated for each used behavior member function.
     // The intention is that this is a lightweight wrapper. Hopefully the compiler will inline the behavior method.
     // /Self/ implements a recursion guard (see above).
+    //
+    // Behavior methods may take their message in one of three ways:
+    //
+    //      void f(self_type& self, int port, message_type message);        // move-constructed from the sent message
+    //      void f(self_type& self, int port, const message_type& message); // no copy or move
+    //      void f(self_type& self, int port, message_type&& message);      // no copy or move. f may move from message
+    //
+    // Prefer the reference forms for large or move-only message types.
     template < void (concrete_actor_type::*f)(self_type&, int, message_type) >
-    static void behavior(world_type& world, root_actor_type& a, int port, message_type m)
+    static void behavior(world_type& world, root_actor_type& a, int port, message_type&& m)
+    {
+        tracer_type::behavior_begin(a, &behavior<f>, port);
+        {
+            self_type self(world, a);
+            // invoke behavior method f (template parameter) on instance of concrete_actor_type
+            (downcast_to_concrete_actor_type(&a)->*f)(self, port, std::move(m));
+        }
+        tracer_type::behavior_end(a, &behavior<f>);
+
+        ReentrantSendHandler<G::reentrant_send_action>::template after_behavior<self_type>(world, a);
+    }
+
+    template < void (concrete_actor_type::*f)(self_type&, int, const message_type&) >
+    static void behavior(world_type& world, root_actor_type& a, int port, message_type&& m)
+    {
+        tracer_type::behavior_begin(a, &behavior<f>, port);
+        {
+            self_type self(world, a);
+            (downcast_to_concrete_actor_type(&a)->*f)(self, port, m);
+        }
+        tracer_type::behavior_end(a, &behavior<f>);
+
+        ReentrantSendHandler<G::reentrant_send_action>::template after_behavior<self_type>(world, a);
+    }
+
+    template < void (concrete_actor_type::*f)(self_type&, int, message_type&&) >
+    static void behavior(world_type& world, root_actor_type& a, int port, message_type&& m)
+    {
+        tracer_type::behavior_begin(a, &behavior<f>, port);
+        {
+            self_type self(world, a);
+            (downcast_to_concrete_actor_type(&a)->*f)(self, port, std::move(m));
+        }
+        tracer_type::behavior_end(a, &behavior<f>);
+
+        ReentrantSendHandler<G::reentrant_send_action>::template after_behavior<self_type>(world, a);
+    }
+
+    // batch_behavior<f>() is a thunk from a batch behavior member function to actor behavior function.
+    // Batch behaviors receive a span of messages:
+    //
+    //      void f(self_type& self, int port, const message_type *messages, std::size_t count);
+    //
+    // When invoked as an ordinary behavior, count is 1. When the actor's mailbox backlog
+    // is drained, consecutive messages to the same port are delivered in one call (via batch_dispatch<f>).
+    // Only available to ActorT_mailbox actors: other actors have no backlog to batch.
+    template < void (concrete_actor_type::*f)(self_type&, int, const message_type*, std::size_t) >
+    static void batch_behavior(world_type& world, root_actor_type& a, int port, message_type&& m)
+    {
+        static_assert(static_cast<int>(G::reentrant_send_action) == MAILBOX_REENTRANT_SENDS, "batch behaviors require ActorT_mailbox");
+
+        self_type::set_batch_behavior(a, &batch_behavior<f>, &batch_dispatch<f>);
+        tracer_type::behavior_begin(a, &batch_behavior<f>, port);
+        batch_dispatch<f>(world, a, port, &m, 1);
+        tracer_type::behavior_end(a, &batch_behavior<f>);
+        ReentrantSendHandler<G::reentrant_send_action>::template after_behavior<self_type>(world, a);
+    }
+
+    // batch_dispatch<f>() delivers count messages to batch behavior f
+    template < void (concrete_actor_type::*f)(self_type&, int, const message_type*, std::size_t) >
+    static void batch_dispatch(world_type& world, root_actor_type& a, int port, const message_type *messages, std::size_t count)
     {
         self_type self(world, a);
-        // invoke behavior method f (template parameter) on instance of concrete_actor_type
-        (downcast_to_concrete_actor_type(&a)->*f)(self, port, m);
+        (downcast_to_concrete_actor_type(&a)->*f)(self, port, messages, count);
     }
 
 protected:
     
     void initial(self_type& self, int port, message_type message)
     {
-        assert(false & "no initial behavior defined");
+        assert(false && "no initial behavior defined");
     }
 
     // Derived classes have two options for initializing the base class:
@@ -369,14 +2552,36 @@ protected:
 };
 
 
-template< typename S = void*, typename M = void*>
+// ActorT_nosend is for actors that never send messages. They can't be re-entered,
+// so no recursion guard is installed.
+template <typename AS, typename DerivedT>
+using ActorT_nosend = ActorT<AS, DerivedT, RecursionGuard_nosend>;
+
+// ActorT_nocycles is for actors that are never re-entered, e.g. stages of an acyclic pipeline.
+// Debug builds assert on recursive sends. Release builds install no recursion guard.
+template <typename AS, typename DerivedT>
+using ActorT_nocycles = ActorT<AS, DerivedT, RecursionGuard_nocycles>;
+
+// ActorT_mailbox is for busy actors in cyclic graphs. Recursive sends are queued in the actor's
+// own mailbox, and the backlog is processed as soon as the active behavior returns.
+template <typename AS, typename DerivedT>
+using ActorT_mailbox = ActorT<AS, DerivedT, RecursionGuard_mailbox>;
+
+// ActorT_coalescing is for actors with control-rate ports 0 to N-1: a recursive send to one of
+// these ports replaces any message that is still pending on it.
+template <typename AS, typename DerivedT, std::size_t N>
+using ActorT_coalescing = ActorT<AS, DerivedT, RecursionGuard_coalescing<N> >;
+
+
+template< typename S = void*, typename M = void*, typename P = DefaultWorldPolicy>
 struct ActorSpace {
     typedef S shared_context_type;
     typedef M message_type;
+    typedef P world_policy_type;
 
-    typedef Actor<S,M> actor_type;
-    typedef Endpoint<actor_type> endpoint_type;
-    typedef World<S,M> world_type;
+    typedef Actor<S,M,P> actor_type;
+    typedef typename actor_type::endpoint_type endpoint_type;
+    typedef World<S,M,P> world_type;
 };
 
 } // end namespace Fractorp
@@ -0,0 +1,161 @@
+/*
+    Fractorp by Ross Bencina
+
+    "The whole is greater than the sum of its parts." -- Aristotle (attributed)
+*/
+
+#ifndef INCLUDED_FRACTORP_ACTORARRAY_H
+#define INCLUDED_FRACTORP_ACTORARRAY_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "Actor.h"
+
+namespace Fractorp {
+
+// Actor arrays. Broadcasting a message to N identical actors costs N sends, each an
+// indirect call on a separately allocated actor. An ActorArrayT is a single actor that
+// represents N elements. The derived class stores the element state in structure-of-arrays
+// form, typically one AlignedArray per field, and handles a broadcast with one loop over
+// those arrays, which the compiler can vectorize:
+//
+//      struct Voices : public ActorArrayT<AS, Voices> {
+//          AlignedArray<float> gain_, level_;
+//
+//          explicit Voices(std::size_t n) : ActorArrayT(n), gain_(n), level_(n) {}
+//
+//          void broadcast(self_type& self, const message_type& m) // all elements
+//          {
+//              float *gain = gain_.data();
+//              for (std::size_t i=0; i < element_count(); ++i)
+//                  gain[i] = m.gain;
+//          }
+//
+//          void receive(self_type& self, std::size_t i, const message_type& m) { gain_[i] = m.gain; } // element i
+//      };
+//
+//      world.inject(voices.broadcast_endpoint(), m); // or world.inject(voices, ActorArrayT<...>::BROADCAST_PORT, m)
+//      world.inject(voices.element_endpoint(3), m);
+//
+// A message on BROADCAST_PORT is received by broadcast(). A message on port i + 1 is received
+// by element i via receive(). The default broadcast() calls receive() for each element, so a
+// derived class need only define receive(); defining broadcast() replaces the per-element loop.
+// Element ports are limited by the endpoint's port bits (use FatEndpoint for up to 65535
+// elements). The broadcast port has no such limit.
+
+
+// AlignedArray<T> is a fixed size array whose storage is aligned to Alignment bytes, and
+// padded to a multiple of Alignment, so that SIMD kernels may process whole vectors without
+// a remainder loop. T must be trivially copyable. Elements are value-initialized.
+template<typename T, std::size_t Alignment = 64>
+class AlignedArray {
+    static_assert(std::is_trivially_copyable<T>::value, "AlignedArray elements must be trivially copyable");
+    static_assert(Alignment >= alignof(T) && (Alignment & (Alignment - 1)) == 0, "Alignment must be a power of two, at least alignof(T)");
+
+    T *data_;
+    std::size_t size_;
+    std::size_t paddedSize_;
+
+    AlignedArray(const AlignedArray&);
+    AlignedArray& operator=(const AlignedArray&);
+
+public:
+    explicit AlignedArray(std::size_t size)
+        : data_(0)
+        , size_(size)
+        , paddedSize_((size * sizeof(T) + Alignment - 1) / Alignment * Alignment / sizeof(T))
+    {
+        // over-allocate by Alignment and store the allocation pointer just before the data
+        void *allocation = std::malloc(paddedSize_ * sizeof(T) + Alignment + sizeof(void*));
+        if (!allocation)
+            throw std::bad_alloc();
+        std::uintptr_t address = reinterpret_cast<std::uintptr_t>(allocation) + sizeof(void*);
+        address = (address + Alignment - 1) & ~(static_cast<std::uintptr_t>(Alignment) - 1);
+        reinterpret_cast<void**>(address)[-1] = allocation;
+        data_ = reinterpret_cast<T*>(address);
+        for (std::size_t i=0; i < paddedSize_; ++i)
+            new (data_ + i) T();
+    }
+
+    ~AlignedArray() { std::free(reinterpret_cast<void**>(data_)[-1]); }
+
+    std::size_t size() const { return size_; }
+
+    // size() rounded up to a multiple of Alignment bytes. elements beyond size() are padding
+    std::size_t padded_size() const { return paddedSize_; }
+
+    T* data() { return data_; }
+    const T* data() const { return data_; }
+
+    T& operator[](std::size_t i) { assert(i < paddedSize_); return data_[i]; }
+    const T& operator[](std::size_t i) const { assert(i < paddedSize_); return data_[i]; }
+};
+
+
+// ActorArrayT is the base class of actor arrays (see above). G is the recursion guard policy
+// of the array.
+template<typename AS, typename DerivedT, typename G = RecursionGuard>
+struct ActorArrayT : public ActorT<AS, DerivedT, G> {
+    typedef ActorT<AS, DerivedT, G> actor_t_type;
+    typedef typename actor_t_type::message_type message_type;
+    typedef typename actor_t_type::world_type world_type;
+    typedef typename actor_t_type::root_actor_type root_actor_type;
+    typedef typename actor_t_type::self_type self_type;
+    typedef typename AS::endpoint_type endpoint_type;
+    typedef DerivedT concrete_actor_type;
+
+    enum { BROADCAST_PORT = 0 };
+
+    explicit ActorArrayT(std::size_t elementCount)
+        : actor_t_type(&array_behavior)
+        , elementCount_(elementCount) {}
+
+    std::size_t element_count() const { return elementCount_; }
+
+    endpoint_type broadcast_endpoint() { return endpoint_type(*this, BROADCAST_PORT); }
+
+    endpoint_type element_endpoint(std::size_t i)
+    {
+        assert(i < elementCount_);
+        return endpoint_type(*this, static_cast<int>(i + 1));
+    }
+
+    // the default broadcast: each element receives m in turn
+    void broadcast(self_type& self, const message_type& m)
+    {
+        concrete_actor_type *derived = actor_t_type::downcast_to_concrete_actor_type(this);
+        for (std::size_t i=0; i < elementCount_; ++i)
+            derived->receive(self, i, m);
+    }
+
+private:
+    std::size_t elementCount_;
+
+    static void array_behavior(world_type& world, root_actor_type& a, int port, message_type&& m)
+    {
+        concrete_actor_type *array = actor_t_type::downcast_to_concrete_actor_type(&a);
+        actor_t_type::tracer_type::behavior_begin(a, &array_behavior, port);
+        {
+            self_type self(world, a);
+            if (port == BROADCAST_PORT) {
+                array->broadcast(self, m);
+            } else {
+                assert(static_cast<std::size_t>(port - 1) < array->elementCount_);
+                array->receive(self, static_cast<std::size_t>(port - 1), m);
+            }
+        }
+        actor_t_type::tracer_type::behavior_end(a, &array_behavior);
+
+        ReentrantSendHandler<G::reentrant_send_action>::template after_behavior<self_type>(world, a);
+    }
+};
+
+} // end namespace Fractorp
+
+#endif /* INCLUDED_FRACTORP_ACTORARRAY_H */
@@ -0,0 +1,159 @@
+/*
+    Fractorp by Ross Bencina
+
+    "United we stand, divided we fall." -- Aesop (attributed)
+*/
+
+#include "ActorArray.h"
+
+#include <cstdio>
+
+using namespace Fractorp;
+
+typedef void* shared_context_type;
+
+struct ControlMessage {
+    enum Kind { SET_GAIN, RAMP, REPORT };
+    Kind kind;
+    float value;
+};
+
+typedef ActorSpace<shared_context_type, ControlMessage, FatEndpointWorldPolicy> AS1;
+
+
+struct Meter : public Fractorp::ActorT<AS1, Meter> {
+    float sum_;
+    int count_;
+
+    Meter() : sum_(0), count_(0) {}
+
+    void initial(self_type& /*self*/, int /*port*/, const message_type& m)
+    {
+        sum_ += m.value;
+        ++count_;
+    }
+};
+
+// Per-voice gain and level, stored as structure of arrays. A broadcast processes every voice
+// in one loop; a message to an element port affects a single voice.
+struct Voices : public Fractorp::ActorArrayT<AS1, Voices> {
+    AlignedArray<float> gain_;
+    AlignedArray<float> level_;
+    actor_type& meter_;
+
+    Voices(std::size_t n, actor_type *meter) : ActorArrayT(n), gain_(n), level_(n), meter_(*meter) {}
+
+    void broadcast(self_type& self, const message_type& m)
+    {
+        float *gain = gain_.data();
+        float *level = level_.data();
+        const std::size_t n = gain_.padded_size(); // padding elements are processed too: no remainder loop
+        switch (m.kind) {
+        case ControlMessage::SET_GAIN:
+            for (std::size_t i=0; i < n; ++i)
+                gain[i] = m.value;
+            break;
+        case ControlMessage::RAMP:
+            for (std::size_t i=0; i < n; ++i)
+                level[i] += gain[i] * m.value;
+            break;
+        case ControlMessage::REPORT:
+            {
+                float sum = 0;
+                for (std::size_t i=0; i < element_count(); ++i)
+                    sum += level[i];
+                ControlMessage result = { ControlMessage::REPORT, sum };
+                self.send(meter_, result);
+            }
+            break;
+        }
+    }
+
+    void receive(self_type& self, std::size_t i, const message_type& m)
+    {
+        if (m.kind == ControlMessage::SET_GAIN) {
+            gain_[i] = m.value;
+        } else if (m.kind == ControlMessage::REPORT) {
+            ControlMessage result = { ControlMessage::REPORT, level_[i] };
+            self.send(meter_, result);
+        }
+    }
+};
+
+// Uses the default broadcast, which delivers the message to each element in turn.
+struct Counters : public Fractorp::ActorArrayT<AS1, Counters> {
+    AlignedArray<int> counts_;
+
+    explicit Counters(std::size_t n) : ActorArrayT(n), counts_(n) {}
+
+    void receive(self_type& /*self*/, std::size_t i, const message_type& m) { counts_[i] += (int)m.value; }
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+void test1()
+{
+    std::printf("broadcast:\n");
+
+    AS1::world_type world;
+    Meter meter;
+    Voices voices(10000, &meter);
+    std::printf("elements: %d padded: %d aligned: %d\n", (int)voices.element_count(), (int)voices.gain_.padded_size(),
+        (int)(reinterpret_cast<std::uintptr_t>(voices.gain_.data()) % 64 == 0));
+
+    ControlMessage setGain = { ControlMessage::SET_GAIN, 0.5f };
+    ControlMessage ramp = { ControlMessage::RAMP, 2.0f };
+    ControlMessage report = { ControlMessage::REPORT, 0 };
+    world.inject(voices.broadcast_endpoint(), setGain);
+    world.inject(voices.broadcast_endpoint(), ramp);
+    world.inject(voices.broadcast_endpoint(), ramp);
+    world.inject(voices.broadcast_endpoint(), report);
+    std::printf("reports: %d sum: %g\n", meter.count_, meter.sum_);
+}
+
+void test2()
+{
+    std::printf("element ports:\n");
+
+    AS1::world_type world;
+    Meter meter;
+    Voices voices(100, &meter);
+
+    ControlMessage setGain = { ControlMessage::SET_GAIN, 3.0f };
+    ControlMessage ramp = { ControlMessage::RAMP, 1.0f };
+    ControlMessage report = { ControlMessage::REPORT, 0 };
+    world.inject(voices.element_endpoint(7), setGain);
+    world.inject(voices, Voices::BROADCAST_PORT, ramp);
+    world.inject(voices.element_endpoint(7), report);
+    world.inject(voices.element_endpoint(8), report);
+    std::printf("reports: %d sum: %g\n", meter.count_, meter.sum_);
+}
+
+void test3()
+{
+    std::printf("default broadcast:\n");
+
+    AS1::world_type world;
+    Counters counters(5);
+
+    ControlMessage one = { ControlMessage::SET_GAIN, 1.0f };
+    world.inject(counters.broadcast_endpoint(), one);
+    world.inject(counters.broadcast_endpoint(), one);
+    world.inject(counters.element_endpoint(2), one);
+    for (std::size_t i=0; i < counters.element_count(); ++i)
+        std::printf("%d ", counters.counts_[i]);
+    std::printf("\n");
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    (void)argc; (void)argv;
+
+    test1();
+    test2();
+    test3();
+
+    return 0;
+}
@@ -0,0 +1,638 @@
+/*
+    Fractorp by Ross Bencina
+
+    "What gets measured gets managed." -- Peter Drucker (attributed)
+*/
+
+// Dispatch micro-benchmarks. Writes a JSON document to stdout, one record per case:
+//
+//      { "name": ..., "messages": ..., "ns_per_message": ..., "cycles_per_message": ..., "allocations_per_message": ... }
+//
+// Build with optimization and without assertions, e.g.:
+//
+//      g++ -std=c++11 -O2 -DNDEBUG Actor_bench.cpp -o Actor_bench
+//      ./Actor_bench [message-count] > bench_output.txt
+//
+// cycles_per_message is measured with the time-stamp counter where available (x86), and is
+// null otherwise. allocations_per_message counts calls to the global operator new.
+
+#include "Actor.h"
+#include "ActorArray.h"
+#include "CompactActorGroup.h"
+#include "CoroutineActor.h"
+#include "StaticPipeline.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <new>
+#include <vector>
+
+#if defined(_MSC_VER)
+#include <intrin.h>
+#define FRACTORP_BENCH_HAS_TSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define FRACTORP_BENCH_HAS_TSC 1
+#endif
+
+using namespace Fractorp;
+
+//////////////////////////////////////////////////////////////////////////
+// allocation counting
+
+static long allocationCount_ = 0;
+
+void* operator new(std::size_t size)
+{
+    ++allocationCount_;
+    if (void *p = std::malloc(size ? size : 1))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept
+{
+    std::free(p);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+    std::free(p);
+}
+
+//////////////////////////////////////////////////////////////////////////
+// measurement
+
+static std::uint64_t read_cycle_counter()
+{
+#ifdef FRACTORP_BENCH_HAS_TSC
+    return __rdtsc();
+#else
+    return 0;
+#endif
+}
+
+struct Measurement {
+    std::chrono::steady_clock::time_point startTime_;
+    std::uint64_t startCycles_;
+    long startAllocations_;
+
+    Measurement()
+        : startTime_(std::chrono::steady_clock::now())
+        , startCycles_(read_cycle_counter())
+        , startAllocations_(allocationCount_) {}
+};
+
+static bool firstRecord_ = true;
+
+static void report(const char *name, const Measurement& m, long messageCount)
+{
+    std::uint64_t cycles = read_cycle_counter() - m.startCycles_;
+    std::chrono::steady_clock::time_point endTime = std::chrono::steady_clock::now();
+    long allocations = allocationCount_ - m.startAllocations_;
+    double ns = std::chrono::duration<double, std::nano>(endTime - m.startTime_).count();
+
+    std::printf("%s\n    { \"name\": \"%s\", \"messages\": %ld, \"ns_per_message\": %.3f, ",
+        firstRecord_ ? "" : ",", name, messageCount, ns / messageCount);
+#ifdef FRACTORP_BENCH_HAS_TSC
+    std::printf("\"cycles_per_message\": %.3f, ", (double)cycles / messageCount);
+#else
+    (void)cycles;
+    std::printf("\"cycles_per_message\": null, ");
+#endif
+    std::printf("\"allocations_per_message\": %.6f }", (double)allocations / messageCount);
+    firstRecord_ = false;
+}
+
+//////////////////////////////////////////////////////////////////////////
+// actors. message_type is an integer so that the work per message is negligible.
+
+typedef void* shared_context_type;
+typedef std::intptr_t message_type;
+
+// Counts messages. Volatile to prevent the compiler from eliding deliveries.
+template<typename AS>
+struct Sink : public ActorT<AS, Sink<AS> > {
+    typedef typename ActorT<AS, Sink<AS> >::self_type self_type;
+    volatile long count_;
+
+    Sink() : count_(0) {}
+
+    void initial(self_type& /*self*/, int /*port*/, message_type /*message*/) { count_ = count_ + 1; }
+};
+
+// On each injected message, sends N messages directly to a Sink.
+template<typename AS>
+struct DirectSender : public ActorT<AS, DirectSender<AS> > {
+    typedef typename ActorT<AS, DirectSender<AS> >::self_type self_type;
+    typedef typename AS::actor_type actor_type;
+    actor_type& sink_;
+    long n_;
+
+    DirectSender(actor_type *sink, long n) : sink_(*sink), n_(n) {}
+
+    void initial(self_type& self, int /*port*/, message_type /*message*/)
+    {
+        for (long i=0; i < n_; ++i)
+            self.send(sink_, i);
+    }
+};
+
+// Sends itself a message until the count reaches zero: every send is deferred.
+template<typename AS>
+struct RecursiveSender : public ActorT<AS, RecursiveSender<AS> > {
+    typedef typename ActorT<AS, RecursiveSender<AS> >::self_type self_type;
+
+    void initial(self_type& self, int /*port*/, message_type remaining)
+    {
+        if (remaining > 0)
+            self.send(*this, remaining - 1);
+    }
+};
+
+// Flips between two behaviors on every message.
+typedef ActorSpace<shared_context_type, message_type> BenchAS;
+
+struct Flipper : public ActorT<BenchAS, Flipper> {
+    typedef Flipper this_type;
+    volatile long count_;
+
+    Flipper() : ActorT(behavior<&this_type::flip>), count_(0) {}
+
+    void flip(self_type& self, int /*port*/, message_type /*message*/)
+    {
+        count_ = count_ + 1;
+        self.become<&this_type::flop>();
+    }
+
+    void flop(self_type& self, int /*port*/, message_type /*message*/)
+    {
+        count_ = count_ + 1;
+        self.become<&this_type::flip>();
+    }
+};
+
+// The coroutine equivalent of Flipper.
+struct FlipperCoroutine : public CoroutineActorT<BenchAS, FlipperCoroutine> {
+    volatile long count_;
+
+    FlipperCoroutine() : count_(0) {}
+
+    void resume(self_type& /*self*/, int /*port*/, message_type /*message*/)
+    {
+        FRACTORP_CO_BEGIN();
+        for (;;) {
+            count_ = count_ + 1;
+            FRACTORP_CO_AWAIT_ANY();
+            count_ = count_ + 1;
+            FRACTORP_CO_AWAIT_ANY();
+        }
+        FRACTORP_CO_END();
+    }
+};
+
+// 1024 Flippers as members of a compact actor group (see CompactActorGroup.h).
+typedef ActorSpace<shared_context_type, message_type, FatEndpointWorldPolicy> GroupAS;
+
+struct FlipperGroup : public CompactActorGroupT<GroupAS, FlipperGroup> {
+    enum { MEMBER_COUNT = 1024 };
+
+    FlipperGroup() : CompactActorGroupT(MEMBER_COUNT) {}
+
+    void flip(member_self_type& self, message_type&& /*message*/)
+    {
+        ++self.state();
+        self.become<&FlipperGroup::flop>();
+    }
+
+    void flop(member_self_type& self, message_type&& /*message*/)
+    {
+        ++self.state();
+        self.become<&FlipperGroup::flip>();
+    }
+
+    typedef BehaviorTable<member_behavior_type, &FlipperGroup::flip, &FlipperGroup::flop> behavior_table;
+};
+
+// Passes a token around a ring of 1024 actors (every send is deferred), and the same ring as
+// members of a compact actor group (every send is between members).
+struct RingNode : public ActorT<BenchAS, RingNode> {
+    RingNode *next_;
+
+    RingNode() : next_(0) {}
+
+    void initial(self_type& self, int /*port*/, message_type remaining)
+    {
+        if (remaining > 0)
+            self.send(*next_, remaining - 1);
+    }
+};
+
+struct RingGroup : public CompactActorGroupT<GroupAS, RingGroup> {
+    RingGroup() : CompactActorGroupT(FlipperGroup::MEMBER_COUNT) {}
+
+    void pass(member_self_type& self, message_type&& remaining)
+    {
+        if (remaining > 0)
+            self.send_member((self.member() + 1) & (FlipperGroup::MEMBER_COUNT - 1), remaining - 1);
+    }
+
+    typedef BehaviorTable<member_behavior_type, &RingGroup::pass> behavior_table;
+};
+
+// Broadcast to 10000 accumulators: as separate actors, each sent the message by a Broadcaster,
+// and as the elements of an ActorArray.
+struct Accumulator : public ActorT<BenchAS, Accumulator> {
+    std::int32_t total_;
+
+    Accumulator() : total_(0) {}
+
+    void initial(self_type& /*self*/, int /*port*/, message_type m) { total_ += (std::int32_t)m; }
+};
+
+struct Broadcaster : public ActorT<BenchAS, Broadcaster> {
+    std::vector<Accumulator>& targets_;
+
+    explicit Broadcaster(std::vector<Accumulator> *targets) : targets_(*targets) {}
+
+    void initial(self_type& self, int /*port*/, message_type m)
+    {
+        for (std::size_t i=0; i < targets_.size(); ++i)
+            self.send(targets_[i], m);
+    }
+};
+
+struct AccumulatorArray : public ActorArrayT<BenchAS, AccumulatorArray> {
+    AlignedArray<std::int32_t> totals_;
+
+    explicit AccumulatorArray(std::size_t n) : ActorArrayT(n), totals_(n) {}
+
+    void broadcast(self_type& /*self*/, message_type m)
+    {
+        std::int32_t *totals = totals_.data();
+        const std::int32_t x = (std::int32_t)m;
+        for (std::size_t i=0; i < totals_.padded_size(); ++i)
+            totals[i] += x;
+    }
+
+    void receive(self_type& /*self*/, std::size_t i, message_type m) { totals_[i] += (std::int32_t)m; }
+};
+
+// Creates a transient actor per message, which deletes itself on receipt of its first message.
+template<bool SLAB>
+struct Transient : public ActorT<BenchAS, Transient<SLAB> > {
+    typedef typename ActorT<BenchAS, Transient<SLAB> >::self_type self_type;
+    enum { slab_allocated = SLAB };
+
+    void initial(self_type& self, int /*port*/, message_type /*message*/) { self.delete_later(); }
+};
+
+template<bool SLAB>
+struct Spawner : public ActorT<BenchAS, Spawner<SLAB> > {
+    typedef typename ActorT<BenchAS, Spawner<SLAB> >::self_type self_type;
+
+    static Transient<SLAB>* make(self_type& self, std::true_type) { return self.template create<Transient<SLAB> >(); }
+    static Transient<SLAB>* make(self_type&, std::false_type) { return new Transient<SLAB>; }
+
+    void initial(self_type& self, int /*port*/, message_type remaining)
+    {
+        self.send(*make(self, std::integral_constant<bool, SLAB>()), 0);
+        if (remaining > 0)
+            self.send(*this, remaining - 1);
+    }
+};
+
+// Recursive factorial pipeline (see Actor_test.cpp). Builds a chain of depth n customers per injection.
+struct FactMessage;
+typedef ActorSpace<shared_context_type, FactMessage> FactAS;
+
+struct FactMessage {
+    unsigned long i; // unsigned: the product wraps for large depths
+    FactAS::actor_type *u;
+};
+
+struct FactCustomer : public ActorT<FactAS, FactCustomer> {
+    enum { slab_allocated = true };
+    unsigned long n;
+    FactAS::actor_type &u;
+
+    FactCustomer(unsigned long n_, FactAS::actor_type &u_) : n(n_), u(u_) {}
+
+    void initial(self_type& self, int, message_type communication)
+    {
+        FactMessage m = { n * communication.i, 0 };
+        self.send(u, m);
+        self.delete_later();
+    }
+};
+
+struct Factorial : public ActorT<FactAS, Factorial> {
+    void initial(self_type& self, int, message_type communication)
+    {
+        if (communication.i == 0) {
+            FactMessage m = { 1, 0 };
+            self.send(*communication.u, m);
+        } else {
+            FactMessage m = { communication.i - 1, self.create<FactCustomer>(communication.i, *communication.u) };
+            self.send(*this, m);
+        }
+    }
+};
+
+// As FactCustomer and Factorial, but the customers are arena_allocated (see World::inject_transaction()).
+struct ArenaFactCustomer : public ActorT<FactAS, ArenaFactCustomer> {
+    enum { arena_allocated = true };
+    unsigned long n;
+    FactAS::actor_type &u;
+
+    ArenaFactCustomer(unsigned long n_, FactAS::actor_type &u_) : n(n_), u(u_) {}
+
+    void initial(self_type& self, int, message_type communication)
+    {
+        FactMessage m = { n * communication.i, 0 };
+        self.send(u, m);
+        self.delete_later(); // immediate: no deferred delete message
+    }
+};
+
+struct ArenaFactorial : public ActorT<FactAS, ArenaFactorial> {
+    void initial(self_type& self, int, message_type communication)
+    {
+        if (communication.i == 0) {
+            FactMessage m = { 1, 0 };
+            self.send(*communication.u, m);
+        } else {
+            FactMessage m = { communication.i - 1, self.create<ArenaFactCustomer>(communication.i, *communication.u) };
+            self.send(*this, m);
+        }
+    }
+};
+
+struct FactResult : public ActorT<FactAS, FactResult> {
+    volatile unsigned long result_;
+
+    FactResult() : result_(0) {}
+
+    void initial(self_type&, int, message_type communication) { result_ = communication.i; }
+};
+
+// Pipeline stage, used both as a separate actor and fused into a StaticPipeline.
+struct Increment : public PipelineStageT<BenchAS, Increment> {
+    template<typename Out>
+    void receive(Out& out, int /*port*/, message_type m) { out.send(m + 1); }
+};
+
+//////////////////////////////////////////////////////////////////////////
+// cases
+
+template<typename AS>
+static void bench_direct_send(const char *name, long messageCount)
+{
+    typename AS::world_type world;
+    Sink<AS> sink;
+    enum { SENDS_PER_INJECT = 100 };
+    DirectSender<AS> sender(&sink, SENDS_PER_INJECT);
+
+    Measurement m;
+    for (long i=0; i < messageCount / SENDS_PER_INJECT; ++i)
+        world.inject(sender);
+    report(name, m, messageCount);
+}
+
+template<typename AS>
+static void bench_deferred_send(const char *name, long messageCount)
+{
+    typename AS::world_type world;
+    RecursiveSender<AS> sender;
+    enum { SENDS_PER_INJECT = 1000 };
+    world.inject(sender, SENDS_PER_INJECT); // warm up (the ring queue retains its overflow chunks)
+
+    Measurement m;
+    for (long i=0; i < messageCount / SENDS_PER_INJECT; ++i)
+        world.inject(sender, SENDS_PER_INJECT);
+    report(name, m, messageCount);
+}
+
+static void bench_become(long messageCount)
+{
+    BenchAS::world_type world;
+    Flipper flipper;
+
+    Measurement m;
+    for (long i=0; i < messageCount; ++i)
+        world.inject(flipper);
+    report("become", m, messageCount);
+}
+
+static void bench_coroutine(long messageCount)
+{
+    BenchAS::world_type world;
+    FlipperCoroutine flipper;
+
+    Measurement m;
+    for (long i=0; i < messageCount; ++i)
+        world.inject(flipper);
+    report("coroutine_await", m, messageCount);
+}
+
+// messages are delivered round robin to 1024 flippers
+static void bench_become_population(long messageCount)
+{
+    BenchAS::world_type world;
+    std::vector<Flipper> flippers(FlipperGroup::MEMBER_COUNT);
+
+    Measurement m;
+    for (long i=0; i < messageCount; ++i)
+        world.inject(flippers[i & (FlipperGroup::MEMBER_COUNT - 1)]);
+    report("become_1024_actors", m, messageCount);
+}
+
+static void bench_become_compact_group(long messageCount)
+{
+    GroupAS::world_type world;
+    FlipperGroup group;
+
+    Measurement m;
+    for (long i=0; i < messageCount; ++i)
+        world.inject(group, (int)(i & (FlipperGroup::MEMBER_COUNT - 1)), 0);
+    report("become_1024_group_members", m, messageCount);
+}
+
+static void bench_ring_actors(long messageCount)
+{
+    BenchAS::world_type world;
+    std::vector<RingNode> nodes(FlipperGroup::MEMBER_COUNT);
+    for (std::size_t i=0; i < nodes.size(); ++i)
+        nodes[i].next_ = &nodes[(i + 1) % nodes.size()];
+    enum { PASSES_PER_INJECT = 1000 };
+    world.inject(nodes[0], PASSES_PER_INJECT); // warm up
+
+    Measurement m;
+    for (long i=0; i < messageCount / (PASSES_PER_INJECT + 1); ++i)
+        world.inject(nodes[0], PASSES_PER_INJECT);
+    report("ring_1024_actors", m, messageCount / (PASSES_PER_INJECT + 1) * (PASSES_PER_INJECT + 1));
+}
+
+static void bench_ring_compact_group(long messageCount)
+{
+    GroupAS::world_type world;
+    RingGroup group;
+    enum { PASSES_PER_INJECT = 1000 };
+    world.inject(group, 0, PASSES_PER_INJECT); // warm up
+
+    Measurement m;
+    for (long i=0; i < messageCount / (PASSES_PER_INJECT + 1); ++i)
+        world.inject(group, 0, PASSES_PER_INJECT);
+    report("ring_1024_group_members", m, messageCount / (PASSES_PER_INJECT + 1) * (PASSES_PER_INJECT + 1));
+}
+
+enum { BROADCAST_FAN_OUT = 10000 };
+
+// messages counts deliveries to elements, not broadcasts
+static void bench_broadcast_actors(long messageCount)
+{
+    BenchAS::world_type world;
+    std::vector<Accumulator> targets(BROADCAST_FAN_OUT);
+    Broadcaster broadcaster(&targets);
+
+    Measurement m;
+    for (long i=0; i < messageCount / BROADCAST_FAN_OUT; ++i)
+        world.inject(broadcaster, 1);
+    report("broadcast_10000_actors", m, messageCount / BROADCAST_FAN_OUT * BROADCAST_FAN_OUT);
+}
+
+static void bench_broadcast_actor_array(long messageCount)
+{
+    BenchAS::world_type world;
+    AccumulatorArray array(BROADCAST_FAN_OUT);
+
+    Measurement m;
+    for (long i=0; i < messageCount / BROADCAST_FAN_OUT; ++i)
+        world.inject(array, AccumulatorArray::BROADCAST_PORT, 1);
+    report("broadcast_10000_array_elements", m, messageCount / BROADCAST_FAN_OUT * BROADCAST_FAN_OUT);
+}
+
+template<bool SLAB>
+static void bench_delete_later(const char *name, long messageCount)
+{
+    BenchAS::world_type world;
+    Spawner<SLAB> spawner;
+    enum { SPAWNS_PER_INJECT = 100 };
+    world.inject(spawner, SPAWNS_PER_INJECT); // warm up
+
+    // each spawn is 3 messages: to the spawner, to the transient, and the deferred delete.
+    Measurement m;
+    for (long i=0; i < messageCount / (3 * SPAWNS_PER_INJECT); ++i)
+        world.inject(spawner, SPAWNS_PER_INJECT - 1);
+    report(name, m, messageCount / (3 * SPAWNS_PER_INJECT) * 3 * SPAWNS_PER_INJECT);
+}
+
+static void bench_factorial(unsigned long depth, long messageCount)
+{
+    FactAS::world_type world;
+    Factorial factorial;
+    FactResult result;
+    FactMessage request = { depth, &result };
+    world.inject(factorial, request); // warm up
+
+    // each injection delivers depth + 1 messages to factorial, 2 per customer (including the delete), and 1 to the result
+    const long messagesPerInject = 3 * (long)depth + 2;
+    const long injectCount = messageCount / messagesPerInject + 1;
+
+    char name[64];
+    std::sprintf(name, "factorial_depth_%lu", depth);
+
+    Measurement m;
+    for (long i=0; i < injectCount; ++i)
+        world.inject(factorial, request);
+    report(name, m, injectCount * messagesPerInject);
+}
+
+static void bench_factorial_transaction(unsigned long depth, long messageCount)
+{
+    FactAS::world_type world;
+    ArenaFactorial factorial;
+    FactResult result;
+    FactMessage request = { depth, &result };
+    world.inject_transaction(factorial, request); // warm up
+
+    // each injection delivers depth + 1 messages to factorial, 1 per customer, and 1 to the result
+    const long messagesPerInject = 2 * (long)depth + 2;
+    const long injectCount = messageCount / messagesPerInject + 1;
+
+    char name[64];
+    std::sprintf(name, "factorial_transaction_depth_%lu", depth);
+
+    Measurement m;
+    for (long i=0; i < injectCount; ++i)
+        world.inject_transaction(factorial, request);
+    report(name, m, injectCount * messagesPerInject);
+}
+
+// each injection is delivered to 4 stages and the sink
+static void bench_pipeline_unfused(long messageCount)
+{
+    BenchAS::world_type world;
+    Sink<BenchAS> sink;
+    Increment stages[4];
+    for (int i=0; i < 3; ++i)
+        stages[i].set_next(BenchAS::endpoint_type(stages[i + 1]));
+    stages[3].set_next(BenchAS::endpoint_type(sink));
+
+    Measurement m;
+    for (long i=0; i < messageCount / 5; ++i)
+        world.inject(stages[0], i);
+    report("pipeline_4_stages_unfused", m, messageCount / 5 * 5);
+}
+
+static void bench_pipeline_fused(long messageCount)
+{
+    BenchAS::world_type world;
+    Sink<BenchAS> sink;
+    StaticPipeline<BenchAS, Increment, Increment, Increment, Increment> pipeline((BenchAS::endpoint_type(sink)));
+
+    Measurement m;
+    for (long i=0; i < messageCount / 5; ++i)
+        world.inject(pipeline, i);
+    report("pipeline_4_stages_fused", m, messageCount / 5 * 5);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    long messageCount = (argc > 1) ? std::atol(argv[1]) : 10000000;
+
+    typedef ActorSpace<shared_context_type, message_type> ListAS;
+    typedef ActorSpace<shared_context_type, message_type, RingBufferWorldPolicy<> > RingAS;
+
+    std::printf("{ \"benchmarks\": [");
+
+    bench_direct_send<ListAS>("direct_send", messageCount);
+    bench_deferred_send<ListAS>("deferred_send_list_queue", messageCount);
+    bench_deferred_send<RingAS>("deferred_send_ring_queue", messageCount);
+    bench_become(messageCount);
+    bench_become_population(messageCount);
+    bench_become_compact_group(messageCount);
+    bench_ring_actors(messageCount);
+    bench_ring_compact_group(messageCount);
+    bench_broadcast_actors(messageCount);
+    bench_broadcast_actor_array(messageCount);
+    bench_coroutine(messageCount);
+    bench_delete_later<false>("delete_later_operator_new", messageCount);
+    bench_delete_later<true>("delete_later_slab", messageCount);
+    bench_factorial(1, messageCount);
+    bench_factorial(10, messageCount);
+    bench_factorial(100, messageCount);
+    bench_factorial(1000, messageCount);
+    bench_factorial_transaction(10, messageCount);
+    bench_factorial_transaction(100, messageCount);
+    bench_factorial_transaction(1000, messageCount);
+    bench_pipeline_unfused(messageCount);
+    bench_pipeline_fused(messageCount);
+
+    std::printf("\n] }\n");
+
+    return 0;
+}
@@ -7,6 +7,10 @@
 #include "Actor.h"
 
 #include <cstdio>
+#include <memory>
+#include <stdexcept>
+#include <thread>
+#include <vector>
 
 using namespace Fractorp;
 
@@ -227,7 +231,11 @@ struct FactMessageType{
     AS2::actor_type *u;
 };
 
+// RecCustomer actors are short-lived. They're allocated from the World's slab allocator
+// (using self.create<RecCustomer>()). delete_later() returns them to the slab.
 struct RecCustomer : public Fractorp::ActorT < AS2, RecCustomer > {
+    enum { slab_allocated = true };
+
     int n;
     AS2::actor_type &u;
 
@@ -254,7 +262,7 @@ struct RecFactorial : public Fractorp::ActorT < AS2, RecFactorial > {
         } else {
             // recursively assemble a pipeline. 
             // The first RecCustomer created is the one that sends to PrintResult
-            AS2::actor_type *c = new RecCustomer(n, *u);
+            AS2::actor_type *c = self.create<RecCustomer>(n, *u);
             self.send(*this, {n-1, c} );
         }
     }
@@ -282,12 +290,983 @@ void test2()
 
 //////////////////////////////////////////////////////////////////////////
 
+// The world policy selects the deferred send queue implementation. RingBufferWorldPolicy
+// queues deferred sends without allocating (after warm-up). Here the ring and chunks are
+// tiny so that the overflow arena is exercised.
+
+typedef ActorSpace<shared_context_type, message_type, RingBufferWorldPolicy<4, 2> > AS3;
+
+// Recursively sends to itself, two messages per activation. Deferred sends are FIFO,
+// so the nodes of the implied binary tree are visited in breadth-first order: 0 1 2 ... 14
+struct BreadthFirst : public Fractorp::ActorT<AS3, BreadthFirst> {
+    void initial(self_type& self, int /*port*/, message_type message)
+    {
+        std::intptr_t n = reinterpret_cast<std::intptr_t>(message);
+        std::printf("%d ", (int)n);
+        if (n < 7) {
+            self.send(*this, reinterpret_cast<message_type>(2*n + 1));
+            self.send(*this, reinterpret_cast<message_type>(2*n + 2));
+        }
+    }
+};
+
+void test3()
+{
+    std::printf("breadth-first traversal using RingDeferredSendQueue:\n");
+
+    AS3::world_type world;
+    BreadthFirst breadthFirst;
+    for (int i=0; i < 3; ++i) { // the overflow chunks are retained and reused by subsequent injects
+        world.inject(breadthFirst);
+        std::printf("\n");
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Actors in an acyclic graph can't be re-entered, so they don't need the recursion guard.
+// ActorT_nocycles asserts on recursive sends in debug builds, and skips the guard in release builds.
+struct PipelineStage : public Fractorp::ActorT_nocycles<AS1, PipelineStage> {
+    endpoint_type next_;
+
+    explicit PipelineStage(endpoint_type next) : next_(next) {}
+
+    void initial(self_type& self, int /*port*/, message_type message)
+    {
+        self.send(next_, reinterpret_cast<message_type>(reinterpret_cast<std::intptr_t>(message) * 10));
+    }
+};
+
+// Actors that never send don't need the recursion guard either. become() and delete_later()
+// are still available. (Calling self.send() from an ActorT_nosend is a compile-time error.)
+struct PipelineSink : public Fractorp::ActorT_nosend<AS1, PipelineSink> {
+    typedef PipelineSink this_type;
+
+    PipelineSink() : ActorT(behavior<&this_type::odd>) {}
+
+private:
+    void odd(self_type& self, int /*port*/, message_type message)
+    {
+        std::printf("odd: %d\n", (int)reinterpret_cast<std::intptr_t>(message));
+        self.become<&this_type::even>();
+    }
+
+    void even(self_type& self, int /*port*/, message_type message)
+    {
+        std::printf("even: %d\n", (int)reinterpret_cast<std::intptr_t>(message));
+        self.become<&this_type::odd>();
+    }
+};
+
+void test4()
+{
+    std::printf("acyclic pipeline without recursion guards:\n");
+
+    AS1::world_type world;
+    PipelineSink sink;
+    PipelineStage stage2((AS1::endpoint_type(sink)));
+    PipelineStage stage1((AS1::endpoint_type(stage2)));
+    for (int i=1; i <= 4; ++i)
+        world.inject(stage1, reinterpret_cast<message_type>(i));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// ActorT_mailbox actors queue recursive sends in their own mailbox, rather than in the
+// World's deferred send queue. The backlog is processed as soon as the behavior returns.
+struct MailboxBurst : public Fractorp::ActorT_mailbox<AS1, MailboxBurst> {
+    void initial(self_type& self, int port, message_type message)
+    {
+        std::intptr_t n = reinterpret_cast<std::intptr_t>(message);
+        std::printf("> %d port: %d\n", (int)n, port);
+        if (n == 0) {
+            for (int i=1; i <= 3; ++i)
+                self.send(*this, i, reinterpret_cast<message_type>(i));
+        }
+        std::printf("< %d\n", (int)n);
+    }
+};
+
+void test5()
+{
+    std::printf("mailbox backlog:\n");
+
+    AS1::world_type world;
+    MailboxBurst burst;
+    world.inject(burst);
+
+    printf("sizeof(MailboxBurst) = %d\n", (int)sizeof(MailboxBurst));
+}
+
+// Mailbox actors can define batch behaviors, which receive the backlog for a port in one call.
+struct BatchSum : public Fractorp::ActorT_mailbox<AS1, BatchSum> {
+    typedef BatchSum this_type;
+
+    BatchSum() : ActorT(batch_behavior<&this_type::sum>) {}
+
+private:
+    void sum(self_type& self, int port, const message_type *messages, std::size_t count)
+    {
+        std::intptr_t total = 0;
+        for (std::size_t i=0; i < count; ++i)
+            total += reinterpret_cast<std::intptr_t>(messages[i]);
+        std::printf("port: %d count: %d sum: %d\n", port, (int)count, (int)total);
+
+        if (port == 0 && total == 0) { // the initial message: send a burst to ourselves
+            for (int i=1; i <= 10; ++i)
+                self.send(*this, 1, reinterpret_cast<message_type>(i));
+            self.send(*this, 2, reinterpret_cast<message_type>(100));
+            self.send(*this, 2, reinterpret_cast<message_type>(200));
+            self.send(*this, 1, reinterpret_cast<message_type>(1000));
+        }
+    }
+};
+
+void test6()
+{
+    std::printf("batch behavior:\n");
+
+    AS1::world_type world;
+    BatchSum batchSum;
+    world.inject(batchSum);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Other threads can feed messages to a World using post(). The World's thread delivers
+// them by calling inject_posted(). post() requires a non-zero post_queue_capacity.
+
+struct PostingWorldPolicy : public DefaultWorldPolicy {
+    enum { post_queue_capacity = 64 };
+};
+
+typedef ActorSpace<shared_context_type, message_type, PostingWorldPolicy> AS4;
+
+struct PostCounter : public Fractorp::ActorT<AS4, PostCounter> {
+    int count_;
+    std::intptr_t sum_;
+
+    PostCounter() : count_(0), sum_(0) {}
+
+    void initial(self_type& /*self*/, int /*port*/, message_type message)
+    {
+        ++count_;
+        sum_ += reinterpret_cast<std::intptr_t>(message);
+    }
+};
+
+void test7()
+{
+    std::printf("posting from other threads:\n");
+
+    AS4::world_type world;
+    PostCounter counter;
+
+    enum { PRODUCER_COUNT = 4, N = 10000 };
+    std::vector<std::thread> producers;
+    for (int i=0; i < PRODUCER_COUNT; ++i) {
+        producers.push_back(std::thread([&world, &counter]() {
+            for (int j=1; j <= N; ++j) {
+                while (!world.post(counter, reinterpret_cast<message_type>(j))) // retry while the queue is full
+                    std::this_thread::yield();
+            }
+        }));
+    }
+
+    while (counter.count_ < PRODUCER_COUNT * N) {
+        if (world.inject_posted(16) == 0)
+            std::this_thread::yield();
+    }
+
+    for (int i=0; i < PRODUCER_COUNT; ++i)
+        producers[i].join();
+
+    std::printf("count: %d sum: %ld (expected %ld)\n", counter.count_, (long)counter.sum_, (long)PRODUCER_COUNT * ((long)N * (N + 1) / 2));
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Move-only messages: ownership of the parcel passes from actor to actor, including
+// through the deferred send queue.
+
+typedef std::unique_ptr<int> Parcel;
+typedef ActorSpace<shared_context_type, Parcel> AS5;
+
+struct ParcelRelay : public Fractorp::ActorT<AS5, ParcelRelay> {
+    actor_type& next_;
+
+    explicit ParcelRelay(actor_type *next) : next_(*next) {}
+
+    void initial(self_type& self, int port, message_type&& parcel)
+    {
+        ++*parcel;
+        if (port == 0)
+            self.send(*this, 1, std::move(parcel)); // recursive send: moved into the deferred queue
+        else
+            self.send(next_, std::move(parcel));
+    }
+};
+
+struct ParcelSink : public Fractorp::ActorT<AS5, ParcelSink> {
+    int last_;
+
+    ParcelSink() : last_(-1) {}
+
+    void initial(self_type& /*self*/, int /*port*/, const message_type& parcel) { last_ = *parcel; }
+};
+
+void test8()
+{
+    std::printf("move-only messages:\n");
+
+    AS5::world_type world;
+    ParcelSink sink;
+    ParcelRelay relay(&sink);
+
+    for (int i=0; i < 3; ++i) {
+        world.inject(relay, Parcel(new int(i * 10)));
+        std::printf("parcel: %d\n", sink.last_);
+    }
+}
+
+
+// Counts copies and moves of messages.
+
+struct Counted {
+    static int copies_, moves_;
+    int value_;
+
+    Counted(int value=0) : value_(value) {}
+    Counted(const Counted& src) : value_(src.value_) { ++copies_; }
+    Counted(Counted&& src) : value_(src.value_) { ++moves_; }
+};
+
+int Counted::copies_ = 0;
+int Counted::moves_ = 0;
+
+typedef ActorSpace<shared_context_type, Counted, RingBufferWorldPolicy<> > AS6;
+
+struct CountedSink : public Fractorp::ActorT<AS6, CountedSink> {
+    int sum_;
+
+    CountedSink() : sum_(0) {}
+
+    void initial(self_type& /*self*/, int /*port*/, const message_type& m) { sum_ += m.value_; }
+};
+
+// port 0: forward directly to the sink. port 1: forward to port 0 via the deferred queue.
+struct CountedForwarder : public Fractorp::ActorT<AS6, CountedForwarder> {
+    actor_type& sink_;
+
+    explicit CountedForwarder(actor_type *sink) : sink_(*sink) {}
+
+    void initial(self_type& self, int port, message_type&& m)
+    {
+        if (port == 0)
+            self.send(sink_, std::move(m));
+        else
+            self.send(*this, 0, std::move(m));
+    }
+};
+
+void print_counts(const char *label)
+{
+    std::printf("%s copies: %d moves: %d\n", label, Counted::copies_, Counted::moves_);
+    Counted::copies_ = Counted::moves_ = 0;
+}
+
+void test9()
+{
+    std::printf("message copies:\n");
+
+    AS6::world_type world;
+    CountedSink sink;
+    CountedForwarder forwarder(&sink);
+
+    world.inject(forwarder, Counted(1));
+    print_counts("direct:");
+
+    world.inject(forwarder, 1, Counted(2));
+    print_counts("deferred:");
+
+    Counted m(3);
+    world.inject(forwarder, m);
+    print_counts("lvalue:");
+
+    std::printf("sum: %d\n", sink.sum_);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Wide port spaces: the port count derives from actor alignment, or is 16 bits with FatEndpoint.
+
+struct WidePortsWorldPolicy : public DefaultWorldPolicy {
+    enum { actor_alignment = 64 }; // 64 ports
+};
+
+typedef ActorSpace<shared_context_type, message_type, WidePortsWorldPolicy> AS7;
+typedef ActorSpace<shared_context_type, message_type, FatEndpointWorldPolicy> AS8;
+
+// A message to port 0 sends a message to each other port via an endpoint. The sends are
+// recursive, hence the endpoints are stored in the deferred send queue.
+template<typename AS, int PORT_COUNT>
+struct PortMixer : public Fractorp::ActorT<AS, PortMixer<AS, PORT_COUNT> > {
+    typedef typename ActorT<AS, PortMixer<AS, PORT_COUNT> >::self_type self_type;
+    typedef typename AS::endpoint_type endpoint_type;
+    enum { slab_allocated = true }; // test10 also creates mixers with World::create()
+
+    int count_;
+    long portSum_;
+
+    PortMixer() : count_(0), portSum_(0) {}
+
+    void initial(self_type& self, int port, message_type /*message*/)
+    {
+        ++count_;
+        portSum_ += port;
+        if (port == 0) {
+            for (int i=1; i < PORT_COUNT; ++i)
+                self.send(endpoint_type(*this, i));
+        }
+    }
+};
+
+template<typename AS, int PORT_COUNT>
+void test_port_mixer()
+{
+    typename AS::world_type world;
+    PortMixer<AS, PORT_COUNT> mixer;
+    world.inject(mixer);
+    std::printf("ports: %d (available %d) received: %d port sum: %ld (expected %ld) single word: %s\n",
+        PORT_COUNT, (int)AS::endpoint_type::PORT_COUNT, mixer.count_, mixer.portSum_, (long)PORT_COUNT * (PORT_COUNT - 1) / 2,
+        (sizeof(typename AS::endpoint_type) == sizeof(void*)) ? "yes" : "no");
+}
+
+void test10()
+{
+    std::printf("wide port spaces:\n");
+
+    test_port_mixer<AS7, 64>();
+    test_port_mixer<AS8, 1000>();
+
+    // heap actors are allocated at the policy's alignment
+    AS7::world_type world;
+    int alignedCount = 0, received = 0;
+    for (int i=0; i < 100; ++i) {
+        PortMixer<AS7, 64> *mixer = world.create<PortMixer<AS7, 64> >();
+        alignedCount += (reinterpret_cast<std::uintptr_t>(mixer) % 64 == 0);
+        world.inject(*mixer);
+        received += mixer->count_;
+    }
+    void *large = world.actor_slab().allocate(1000);
+    std::printf("created: 100 aligned: %d received: %d large block aligned: %d\n",
+        alignedCount, received, (int)(reinterpret_cast<std::uintptr_t>(large) % 64 == 0));
+    world.actor_slab().free(large, 1000);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Deferred send queue limits. A message to port 0 floods port 1 with ten recursive sends,
+// more than the high watermark of 4. Each policy handles the overflow differently.
+
+template<DeferredSendOverflowAction action>
+struct LimitedWorldPolicy : public DefaultWorldPolicy {
+    enum {
+        deferred_send_overflow_action = action,
+        deferred_send_high_watermark = 4,
+        deferred_send_low_watermark = 2
+    };
+};
+
+template<DeferredSendOverflowAction action>
+struct LimitedRingWorldPolicy : public RingBufferWorldPolicy<8, 8> {
+    enum {
+        deferred_send_overflow_action = action,
+        deferred_send_high_watermark = 4,
+        deferred_send_low_watermark = 2
+    };
+};
+
+typedef ActorSpace<shared_context_type, message_type, LimitedWorldPolicy<DEFERRED_SEND_DROP_OLDEST> > AS9;
+typedef ActorSpace<shared_context_type, message_type, LimitedRingWorldPolicy<DEFERRED_SEND_DROP_OLDEST> > AS10;
+typedef ActorSpace<shared_context_type, message_type, LimitedWorldPolicy<DEFERRED_SEND_DROP_NEWEST> > AS11;
+typedef ActorSpace<shared_context_type, message_type, LimitedWorldPolicy<DEFERRED_SEND_CALLBACK> > AS12;
+
+template<typename AS>
+struct Flooder : public Fractorp::ActorT<AS, Flooder<AS> > {
+    typedef typename ActorT<AS, Flooder<AS> >::self_type self_type;
+
+    void initial(self_type& self, int port, message_type message)
+    {
+        if (port == 0) {
+            for (std::intptr_t i=0; i < 10; ++i)
+                self.send(*this, 1, reinterpret_cast<message_type>(i));
+        } else {
+            std::printf(" %d", (int)reinterpret_cast<std::intptr_t>(message));
+        }
+    }
+};
+
+template<typename AS>
+void print_overflowed(typename AS::world_type& /*world*/, bool overflowed)
+{
+    std::printf(overflowed ? " [overflowed]" : " [ok]");
+}
+
+template<typename AS>
+void overflow_handler(typename AS::world_type& /*world*/, typename AS::actor_type& /*a*/, int /*port*/, message_type&& message)
+{
+    std::printf(" (%d)", (int)reinterpret_cast<std::intptr_t>(message));
+}
+
+template<typename AS>
+void test_flood(const char *label)
+{
+    typename AS::world_type world;
+    world.set_deferred_send_watermark_handler(&print_overflowed<AS>);
+    world.set_deferred_send_overflow_handler(&overflow_handler<AS>);
+    Flooder<AS> flooder;
+
+    std::printf("%s received:", label);
+    world.inject(flooder);
+    std::printf("\n  depth: %d peak: %d dropped: %d\n",
+        (int)world.deferred_send_depth(), (int)world.deferred_send_peak_depth(), (int)world.deferred_send_drop_count());
+}
+
+void test11()
+{
+    std::printf("deferred send limits:\n");
+
+    test_flood<AS1>("unlimited");
+    test_flood<AS9>("drop oldest");
+    test_flood<AS10>("drop oldest (ring)");
+    test_flood<AS11>("drop newest");
+    test_flood<AS12>("callback");
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Deferred send order. Depth-first (LIFO) traversal of a tree keeps the queue as short as the
+// tree is deep, whereas breadth-first (FIFO) traversal queues a whole level.
+
+template<DeferredSendOrder order>
+struct OrderedWorldPolicy : public DefaultWorldPolicy {
+    enum { deferred_send_order = order };
+};
+
+template<DeferredSendOrder order>
+struct OrderedRingWorldPolicy : public RingBufferWorldPolicy<4, 2> { // tiny, to exercise the overflow chunks
+    enum { deferred_send_order = order };
+};
+
+typedef ActorSpace<shared_context_type, message_type, OrderedWorldPolicy<DEFERRED_SEND_LIFO> > AS13;
+typedef ActorSpace<shared_context_type, message_type, OrderedWorldPolicy<DEFERRED_SEND_RANDOM> > AS14;
+typedef ActorSpace<shared_context_type, message_type, OrderedRingWorldPolicy<DEFERRED_SEND_LIFO> > AS15;
+typedef ActorSpace<shared_context_type, message_type, OrderedRingWorldPolicy<DEFERRED_SEND_RANDOM> > AS16;
+
+// Visits the nodes of a binary tree with nodeCount_ nodes, by sending each node's children to itself.
+template<typename AS>
+struct TreeWalker : public Fractorp::ActorT<AS, TreeWalker<AS> > {
+    typedef typename ActorT<AS, TreeWalker<AS> >::self_type self_type;
+
+    std::intptr_t nodeCount_;
+    bool print_;
+    std::intptr_t visited_;
+
+    TreeWalker(std::intptr_t nodeCount, bool print) : nodeCount_(nodeCount), print_(print), visited_(0) {}
+
+    void initial(self_type& self, int /*port*/, message_type message)
+    {
+        std::intptr_t n = reinterpret_cast<std::intptr_t>(message);
+        ++visited_;
+        if (print_)
+            std::printf("%d ", (int)n);
+        for (std::intptr_t child = 2*n + 1; child <= 2*n + 2; ++child) {
+            if (child < nodeCount_)
+                self.send(*this, reinterpret_cast<message_type>(child));
+        }
+    }
+};
+
+template<typename AS>
+void test_order(const char *label, std::uint64_t seed = 1)
+{
+    std::printf("%s: ", label);
+    {
+        typename AS::world_type world;
+        world.seed_deferred_send_order(seed);
+        TreeWalker<AS> walker(15, true);
+        world.inject(walker);
+    }
+
+    typename AS::world_type world;
+    world.seed_deferred_send_order(seed);
+    TreeWalker<AS> walker(4095, false);
+    world.inject(walker);
+    std::printf("\n  visited: %d peak depth: %d\n", (int)walker.visited_, (int)world.deferred_send_peak_depth());
+}
+
+void test12()
+{
+    std::printf("deferred send order:\n");
+
+    test_order<AS1>("fifo");
+    test_order<AS13>("lifo");
+    test_order<AS14>("random");
+    test_order<AS14>("random, same seed");
+    test_order<AS14>("random, another seed", 2);
+    test_order<AS3>("fifo (ring)");
+    test_order<AS15>("lifo (ring)");
+    test_order<AS16>("random (ring)");
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Delayed messages: send_after() starts a timer on the World's timer wheel. The World's thread
+// advances time with advance_timers(). send_after() requires a non-zero timer_wheel_levels.
+
+struct TimerWorldPolicy : public DefaultWorldPolicy {
+    enum { timer_wheel_levels = 3 };
+};
+
+typedef ActorSpace<shared_context_type, message_type, TimerWorldPolicy> AS17;
+
+// A per-connection idle timeout: each message on port 0 (activity) restarts the timeout,
+// which is delivered on port 1.
+struct IdleTimeout : public Fractorp::ActorT<AS17, IdleTimeout> {
+    enum { TIMEOUT = 100 };
+
+    TimerHandle timer_;
+    std::uint64_t timedOutAt_;
+
+    IdleTimeout() : timedOutAt_(0) {}
+
+    void initial(self_type& self, int port, message_type /*message*/)
+    {
+        if (port == 0) {
+            self.cancel_timer(timer_);
+            timer_ = self.send_after(endpoint_type(*this, 1), TIMEOUT);
+        } else {
+            timedOutAt_ = self.timer_ticks();
+        }
+    }
+};
+
+// Records the tick at which each message arrives.
+struct TickRecorder : public Fractorp::ActorT<AS17, TickRecorder> {
+    std::vector<std::uint64_t> ticks_;
+
+    void initial(self_type& self, int /*port*/, message_type /*message*/)
+    {
+        ticks_.push_back(self.timer_ticks());
+    }
+};
+
+void test13()
+{
+    std::printf("timers:\n");
+
+    {
+        AS17::world_type world;
+        enum { CONNECTION_COUNT = 100000 };
+        std::vector<IdleTimeout> connections(CONNECTION_COUNT);
+        for (std::size_t i=0; i < connections.size(); ++i)
+            world.inject(connections[i]);
+
+        world.advance_timers(50);
+        for (std::size_t i=0; i < connections.size(); i += 2)
+            world.inject(connections[i]); // activity restarts the timeout
+        std::printf("pending: %d\n", (int)world.pending_timer_count());
+
+        std::size_t fired = 0;
+        for (int i=0; i < 100; ++i)
+            fired += world.advance_timers(10); // in batches
+        std::size_t at100 = 0, at150 = 0;
+        for (std::size_t i=0; i < connections.size(); ++i) {
+            if (connections[i].timedOutAt_ == ((i % 2 == 0) ? 150 : 100))
+                ++((i % 2 == 0) ? at150 : at100);
+        }
+        std::printf("fired: %d timed out at 100: %d at 150: %d pending: %d\n",
+            (int)fired, (int)at100, (int)at150, (int)world.pending_timer_count());
+    }
+
+    {
+        AS17::world_type world;
+        TickRecorder recorder;
+        const std::uint64_t delays[] = { 0, 1, 255, 256, 257, 65535, 65536, 70000, 1 << 24, (std::uint64_t)1 << 25 };
+        const std::size_t delayCount = sizeof(delays) / sizeof(delays[0]);
+        for (std::size_t i=delayCount; i > 0; --i)
+            world.send_after(AS17::endpoint_type(recorder), delays[i - 1]);
+        TimerHandle cancelled = world.send_after(AS17::endpoint_type(recorder), 1000);
+        world.advance_timers(10);
+        bool first = world.cancel_timer(cancelled);
+        bool second = world.cancel_timer(cancelled);
+        std::printf("cancel: %d again: %d\n", (int)first, (int)second);
+
+        world.advance_timers(((std::uint64_t)1 << 25) + 1);
+        std::printf("fired at:");
+        for (std::size_t i=0; i < recorder.ticks_.size(); ++i)
+            std::printf(" %llu", (unsigned long long)recorder.ticks_[i]);
+        std::printf("\n");
+
+        TimerHandle stale = world.send_after(AS17::endpoint_type(recorder), 1);
+        world.advance_timers(1);
+        std::printf("cancel after firing: %d\n", (int)world.cancel_timer(stale));
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// Transactions: the factorial example again, with arena_allocated customers. Each
+// inject_transaction() bump-allocates its chain of customers from the World's arena, and
+// discards them all at once when the transaction completes.
+
+struct ArenaCustomer : public Fractorp::ActorT < AS2, ArenaCustomer > {
+    enum { arena_allocated = true };
+
+    int n;
+    AS2::actor_type &u;
+
+    ArenaCustomer(int n_, AS2::actor_type &u_) : n(n_), u(u_) {}
+
+    void initial(self_type& self, int, message_type communication)
+    {
+        int k = communication.i;
+        self.send(u, { n*k, 0 });
+        self.delete_later(); // no deferred delete message: ArenaCustomer is trivially destructible
+    }
+};
+
+struct ArenaFactorial : public Fractorp::ActorT < AS2, ArenaFactorial > {
+    void initial(self_type& self, int, message_type communication)
+    {
+        int n = communication.i;
+        AS2::actor_type *u = communication.u;
+
+        if (n == 0) {
+            self.send(*u, {1, (AS2::actor_type*)0} );
+        } else {
+            AS2::actor_type *c = self.create<ArenaCustomer>(n, *u);
+            self.send(*this, {n-1, c} );
+        }
+    }
+};
+
+struct CountResults : public Fractorp::ActorT < AS2, CountResults > {
+    int count_;
+
+    CountResults() : count_(0) {}
+
+    void initial(self_type&, int, message_type) { ++count_; }
+};
+
+// An arena actor with a destructor, which outlives the transaction that created it.
+struct Survivor : public Fractorp::ActorT < AS2, Survivor > {
+    enum { arena_allocated = true };
+
+    std::vector<int> history_;
+
+    void initial(self_type& self, int, message_type communication)
+    {
+        history_.push_back(communication.i);
+        if (communication.i < 0)
+            self.delete_later(); // the destructor runs when the deferred delete message is delivered
+    }
+};
+
+struct SurvivorFactory : public Fractorp::ActorT < AS2, SurvivorFactory > {
+    AS2::actor_type *survivor_;
+
+    SurvivorFactory() : survivor_(0) {}
+
+    void initial(self_type& self, int, message_type)
+    {
+        survivor_ = self.create<Survivor>();
+        self.send(*survivor_, {1, 0});
+    }
+};
+
+// Actors whose constructors may throw. create() returns the storage to the slab, and doesn't
+// count the arena actor as live.
+struct FragileCounter : public Fractorp::ActorT < AS2, FragileCounter > {
+    enum { slab_allocated = true };
+
+    static void *lastAddress_;
+
+    explicit FragileCounter(bool fail)
+    {
+        lastAddress_ = this;
+        if (fail)
+            throw std::runtime_error("FragileCounter");
+    }
+
+    void initial(self_type& self, int, message_type) { self.delete_later(); }
+};
+
+void *FragileCounter::lastAddress_ = 0;
+
+struct FragileArenaCounter : public Fractorp::ActorT < AS2, FragileArenaCounter > {
+    enum { arena_allocated = true };
+
+    FragileArenaCounter() { throw std::runtime_error("FragileArenaCounter"); }
+
+    void initial(self_type&, int, message_type) {}
+};
+
+struct FragileFactory : public Fractorp::ActorT < AS2, FragileFactory > {
+    int failures_;
+    bool reused_;
+
+    FragileFactory() : failures_(0), reused_(false) {}
+
+    void initial(self_type& self, int, message_type)
+    {
+        try {
+            self.create<FragileArenaCounter>();
+        } catch (const std::runtime_error&) {
+            ++failures_;
+        }
+
+        void *failed = 0;
+        try {
+            self.create<FragileCounter>(true);
+        } catch (const std::runtime_error&) {
+            ++failures_;
+            failed = FragileCounter::lastAddress_;
+        }
+        FragileCounter *c = self.create<FragileCounter>(false);
+        reused_ = (c == failed); // the slab's free list is LIFO
+        self.send(*c, {0, 0});
+    }
+};
+
+void test14()
+{
+    std::printf("transactions:");
+
+    AS2::world_type world;
+    ArenaFactorial arenaFactorial;
+    PrintResult printResult;
+    for (int i=0; i < 13; ++i) // 12! is the largest that fits in an int
+        world.inject_transaction(arenaFactorial, {i, &printResult});
+    CountResults countResults;
+    for (int i=0; i < 1000; ++i)
+        world.inject_transaction(arenaFactorial, {12, &countResults});
+    std::printf("results: %d arena chunks: %d live: %d reset: %d escapes: %d\n", countResults.count_, (int)world.actor_arena().chunk_count(),
+        (int)world.arena_live_count(), (int)world.actor_arena().empty(), (int)world.transaction_escape_count());
+
+    SurvivorFactory factory;
+    world.inject_transaction(factory);
+    std::printf("after escape: live: %d reset: %d escapes: %d\n",
+        (int)world.arena_live_count(), (int)world.actor_arena().empty(), (int)world.transaction_escape_count());
+
+    world.inject(*factory.survivor_, {-1, 0}); // survivor deletes itself, outside a transaction
+    world.inject_transaction(arenaFactorial, {3, &printResult});
+    std::printf("after delete: live: %d reset: %d escapes: %d\n",
+        (int)world.arena_live_count(), (int)world.actor_arena().empty(), (int)world.transaction_escape_count());
+
+    FragileFactory fragileFactory;
+    world.inject_transaction(fragileFactory);
+    std::printf("constructors threw: %d live: %d reset: %d escapes: %d slab block reused: %d\n", fragileFactory.failures_,
+        (int)world.arena_live_count(), (int)world.actor_arena().empty(), (int)world.transaction_escape_count(), (int)fragileFactory.reused_);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// ActorT_coalescing actors keep only the latest message sent to each control port while they
+// are busy. Here ports 0 (gain) and 1 (pan) coalesce, and port 2 (tick) is queued as usual.
+// Each tick asks the knob for updates, which arrive while the synth is still active.
+struct Knob;
+
+struct Synth : public Fractorp::ActorT_coalescing<AS1, Synth, 2> {
+    enum { GAIN_PORT, PAN_PORT, TICK_PORT };
+    actor_type *knob_;
+    int updateCount_;
+
+    Synth() : knob_(0), updateCount_(0) {}
+
+    void initial(self_type& self, int port, message_type message)
+    {
+        std::intptr_t n = reinterpret_cast<std::intptr_t>(message);
+        if (port == TICK_PORT) {
+            std::printf("tick %d\n", (int)n);
+            self.send(*knob_, message);
+        } else {
+            ++updateCount_;
+            std::printf("%s: %d\n", port == GAIN_PORT ? "gain" : "pan", (int)n);
+        }
+    }
+};
+
+// Sends a burst of 100 gain and 10 pan updates, then (for the first two ticks) another tick.
+struct Knob : public Fractorp::ActorT<AS1, Knob> {
+    actor_type& synth_;
+
+    explicit Knob(actor_type *synth) : synth_(*synth) {}
+
+    void initial(self_type& self, int /*port*/, message_type message)
+    {
+        std::intptr_t tick = reinterpret_cast<std::intptr_t>(message);
+        for (std::intptr_t i=1; i <= 100; ++i) {
+            self.send(synth_, Synth::GAIN_PORT, reinterpret_cast<message_type>(tick * 1000 + i));
+            if (i % 10 == 0)
+                self.send(synth_, Synth::PAN_PORT, reinterpret_cast<message_type>(tick * 1000 + i / 10));
+        }
+        if (tick < 2)
+            self.send(synth_, Synth::TICK_PORT, reinterpret_cast<message_type>(tick + 1));
+    }
+};
+
+// A move-only message type without a default constructor. Each reading sent to port 0 while
+// the gauge is busy overwrites the last. Readings are counted to check that none leak.
+struct Reading {
+    static int live_;
+    std::unique_ptr<int> value_;
+
+    explicit Reading(int value) : value_(new int(value)) { ++live_; }
+    Reading(Reading&& src) : value_(std::move(src.value_)) { ++live_; }
+    Reading& operator=(Reading&& src) { value_ = std::move(src.value_); return *this; }
+    ~Reading() { --live_; }
+};
+
+int Reading::live_ = 0;
+
+typedef ActorSpace<shared_context_type, Reading> AS19;
+
+struct Gauge : public Fractorp::ActorT_coalescing<AS19, Gauge, 1> {
+    int received_, last_;
+
+    Gauge() : received_(0), last_(-1) {}
+
+    void initial(self_type& self, int port, message_type&& reading)
+    {
+        ++received_;
+        if (port == 1) { // a burst of readings to itself, while it's active
+            for (int i=1; i <= 10; ++i)
+                self.send(*this, 0, Reading(*reading.value_ + i));
+        } else {
+            last_ = *reading.value_;
+        }
+    }
+};
+
+void test_coalescing_readings()
+{
+    AS19::world_type world;
+    {
+        Gauge gauge;
+        world.inject(gauge, 1, Reading(100));
+        world.inject(gauge, 1, Reading(200));
+        std::printf("readings received: %d last: %d coalesced: %d\n", gauge.received_, gauge.last_, (int)gauge.coalesced_count());
+    }
+    std::printf("live readings: %d\n", Reading::live_);
+}
+
+void test15()
+{
+    std::printf("coalescing ports:\n");
+
+    AS1::world_type world;
+    Synth synth;
+    Knob knob(&synth);
+    synth.knob_ = &knob;
+    world.inject(synth, Synth::TICK_PORT, reinterpret_cast<message_type>(0));
+    std::printf("updates received: %d coalesced: %d\n", synth.updateCount_, (int)synth.coalesced_count());
+
+    test_coalescing_readings();
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+// A PriorityWorldPolicy World dispatches deferred sends to the urgent port from lane 0, ahead
+// of the bulk sends in lane 1. With an aging limit of 3, lane 1 is served at least once for
+// every three lane 0 dispatches, even while urgent sends keep arriving.
+struct ControlWorldPolicy : public PriorityWorldPolicy<2, 3> {
+    enum { START_PORT, BULK_PORT, URGENT_PORT };
+    static int deferred_send_lane(int port) { return (port == URGENT_PORT) ? 0 : 1; }
+};
+
+typedef ActorSpace<shared_context_type, message_type, ControlWorldPolicy> AS18;
+
+// Sends 6 bulk messages and an urgent message to itself, then a bulk-port message in lane 0.
+// Each urgent message sends another, up to 104.
+struct Feed : public Fractorp::ActorT<AS18, Feed> {
+    void initial(self_type& self, int port, message_type message)
+    {
+        std::intptr_t n = reinterpret_cast<std::intptr_t>(message);
+        switch (port) {
+        case ControlWorldPolicy::START_PORT:
+            for (std::intptr_t i=1; i <= 6; ++i)
+                self.send(*this, ControlWorldPolicy::BULK_PORT, reinterpret_cast<message_type>(i));
+            self.send(*this, ControlWorldPolicy::URGENT_PORT, reinterpret_cast<message_type>(100));
+            self.send_in_lane(0, endpoint_type(*this, ControlWorldPolicy::BULK_PORT), reinterpret_cast<message_type>(200));
+            break;
+        case ControlWorldPolicy::BULK_PORT:
+            std::printf(" b%d", (int)n);
+            break;
+        case ControlWorldPolicy::URGENT_PORT:
+            std::printf(" U%d", (int)n);
+            if (n < 104)
+                self.send(*this, ControlWorldPolicy::URGENT_PORT, reinterpret_cast<message_type>(n + 1));
+            break;
+        }
+    }
+};
+
+// send_in_lane() to a coalescing port: the entry for port 0 is queued in lane 0, ahead of the
+// bulk sends, and the later send coalesces into it.
+struct Dial : public Fractorp::ActorT_coalescing<AS18, Dial, 1> {
+    void initial(self_type& self, int port, message_type message)
+    {
+        std::intptr_t n = reinterpret_cast<std::intptr_t>(message);
+        if (port == ControlWorldPolicy::URGENT_PORT) {
+            for (std::intptr_t i=1; i <= 3; ++i)
+                self.send(*this, ControlWorldPolicy::BULK_PORT, reinterpret_cast<message_type>(i));
+            self.send_in_lane(0, endpoint_type(*this, 0), reinterpret_cast<message_type>(10));
+            self.send(*this, 0, reinterpret_cast<message_type>(11));
+        } else {
+            std::printf(" %s%d", port == 0 ? "level" : "b", (int)n);
+        }
+    }
+};
+
+void test16()
+{
+    std::printf("priority lanes:");
+
+    AS18::world_type world;
+    Feed feed;
+    world.inject(feed, ControlWorldPolicy::START_PORT, 0);
+    std::printf("\npeak depth: %d\n", (int)world.deferred_send_peak_depth());
+
+    std::printf("coalescing port in lane 0:");
+    Dial dial;
+    world.inject(dial, ControlWorldPolicy::URGENT_PORT, 0);
+    std::printf("\ncoalesced: %d\n", (int)dial.coalesced_count());
+}
+
+//////////////////////////////////////////////////////////////////////////
+
 int main(int argc, char *argv[])
 {
     (void)argc, argv;
 
     test1();
     test2();
+    test3();
+    test4();
+    test5();
+    test6();
+    test7();
+    test8();
+    test9();
+    test10();
+    test11();
+    test12();
+    test13();
+    test14();
+    test15();
+    test16();
 
     return 0;
 }
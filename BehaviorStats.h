@@ -0,0 +1,438 @@
+/*
+    Fractorp by Ross Bencina
+
+    "The purpose of computing is insight, not numbers." -- Richard Hamming
+*/
+
+#ifndef INCLUDED_FRACTORP_BEHAVIORSTATS_H
+#define INCLUDED_FRACTORP_BEHAVIORSTATS_H
+
+#include <algorithm>
+#include <atomic>
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <vector>
+
+#include "Actor.h"
+#include "Trace.h"
+
+namespace Fractorp {
+
+// Per-behavior statistics. Select StatsTracer as the tracer_type of a world policy (e.g. use
+// StatsWorldPolicy) and install a BehaviorStatsTable on each thread that runs a World:
+//
+//      BehaviorStatsTable stats; // capacity, sample interval
+//      BehaviorStatsTable::Install install(&stats);
+//      world.inject(a);
+//      ...
+//      print_behavior_stats(stdout, stats, &names);
+//
+// Statistics are keyed by behavior function (behavior_fn_ptr_type), hence each become() state
+// is reported separately. For each behavior the table counts:
+//
+//  * invocations (every invocation is counted)
+//  * time in the behavior: total (including nested direct sends) and self (excluding them),
+//    with a log2-bucketed histogram of self time
+//  * residency: the time that messages to the behavior waited in the DeferredSendQueue
+//
+// Timing is sampled: one in sampleInterval top-level activations (an inject() or a deferred
+// dispatch) is timed, together with all of the behaviors that it invokes directly, and the
+// sends that it defers. Set the interval to 1 to time everything.
+//
+// A table is updated only by the thread that installed it, without locks. snapshot() may be
+// called from any thread: counters are read individually, so a snapshot taken while the World
+// is running may be slightly inconsistent. Recording never allocates. When the table is full,
+// further behaviors are accumulated in a single entry with behavior 0.
+
+
+// LatencyHistogram counts durations in log2 buckets: bucket 0 is [0, 2) ns, bucket i is [2^i, 2^(i+1)) ns.
+struct LatencyHistogram {
+    enum { BUCKET_COUNT = 40 }; // the last bucket includes everything over ~9 minutes
+
+    std::uint64_t buckets[BUCKET_COUNT];
+
+    LatencyHistogram() { std::fill(buckets, buckets + BUCKET_COUNT, std::uint64_t(0)); }
+
+    static std::size_t bucket_index(std::uint64_t ns)
+    {
+        if (ns < 2)
+            return 0;
+#if defined(__GNUC__)
+        std::size_t i = 63 - static_cast<std::size_t>(__builtin_clzll(ns));
+#else
+        std::size_t i = 0;
+        while (ns >>= 1)
+            ++i;
+#endif
+        return (i < BUCKET_COUNT) ? i : BUCKET_COUNT - 1;
+    }
+
+    static std::uint64_t bucket_upper_bound(std::size_t i) { return std::uint64_t(1) << (i + 1); }
+
+    std::uint64_t count() const
+    {
+        std::uint64_t result = 0;
+        for (std::size_t i=0; i < BUCKET_COUNT; ++i)
+            result += buckets[i];
+        return result;
+    }
+
+    // an upper bound on the p'th quantile (0 <= p <= 1). 0 if the histogram is empty
+    std::uint64_t quantile_upper_bound(double p) const
+    {
+        const std::uint64_t n = count();
+        if (n == 0)
+            return 0;
+        std::uint64_t target = static_cast<std::uint64_t>(p * static_cast<double>(n - 1)) + 1; // rank, 1-based
+        std::uint64_t seen = 0;
+        for (std::size_t i=0; i < BUCKET_COUNT; ++i) {
+            seen += buckets[i];
+            if (seen >= target)
+                return bucket_upper_bound(i);
+        }
+        return bucket_upper_bound(BUCKET_COUNT - 1);
+    }
+};
+
+
+// A snapshot of the statistics of one behavior. Times are in nanoseconds and cover sampled
+// invocations only.
+struct BehaviorStats {
+    std::uintptr_t behavior;
+    std::uint64_t invocations;
+    std::uint64_t sampledInvocations;
+    std::uint64_t totalNs;
+    std::uint64_t selfNs;
+    LatencyHistogram selfTime;
+    std::uint64_t residencyCount;
+    std::uint64_t residencyNs;
+    LatencyHistogram residency;
+};
+
+
+class BehaviorStatsTable {
+    typedef std::atomic<std::uint64_t> counter_type;
+
+    struct Entry {
+        std::atomic<std::uintptr_t> behavior; // 0 if unused
+        counter_type invocations;
+        counter_type sampledInvocations;
+        counter_type totalNs;
+        counter_type selfNs;
+        counter_type selfTime[LatencyHistogram::BUCKET_COUNT];
+        counter_type residencyCount;
+        counter_type residencyNs;
+        counter_type residency[LatencyHistogram::BUCKET_COUNT];
+    };
+
+    struct Frame {
+        Entry *entry;
+        std::uint64_t startNs;
+        std::uint64_t childNs; // time spent in nested behaviors
+        bool sampled;
+    };
+
+    enum { MAX_DEPTH = 64 }; // deeper nesting is counted, but not timed
+
+    std::vector<Entry> entries_; // open addressing, linear probing
+    const std::size_t mask_;
+    std::size_t used_;
+    Entry overflow_; // used once the table is full
+
+    std::uint64_t sampleInterval_, sampleCountdown_;
+
+    Frame stack_[MAX_DEPTH];
+    std::size_t depth_;
+
+    BehaviorStatsTable(const BehaviorStatsTable&);
+    BehaviorStatsTable& operator=(const BehaviorStatsTable&);
+
+    static BehaviorStatsTable*& current_slot()
+    {
+        static thread_local BehaviorStatsTable *current = 0;
+        return current;
+    }
+
+    // single writer: a relaxed load and store is sufficient, and cheaper than fetch_add
+    static void bump(counter_type& c, std::uint64_t n) { c.store(c.load(std::memory_order_relaxed) + n, std::memory_order_relaxed); }
+
+    static void clear(Entry& e)
+    {
+        e.behavior.store(0, std::memory_order_relaxed);
+        e.invocations.store(0, std::memory_order_relaxed);
+        e.sampledInvocations.store(0, std::memory_order_relaxed);
+        e.totalNs.store(0, std::memory_order_relaxed);
+        e.selfNs.store(0, std::memory_order_relaxed);
+        e.residencyCount.store(0, std::memory_order_relaxed);
+        e.residencyNs.store(0, std::memory_order_relaxed);
+        for (std::size_t i=0; i < LatencyHistogram::BUCKET_COUNT; ++i) {
+            e.selfTime[i].store(0, std::memory_order_relaxed);
+            e.residency[i].store(0, std::memory_order_relaxed);
+        }
+    }
+
+    static std::size_t hash(std::uintptr_t behavior) { return static_cast<std::size_t>((behavior >> 4) * 0x9E3779B1u); }
+
+    Entry& entry(std::uintptr_t behavior)
+    {
+        for (std::size_t i = hash(behavior) & mask_, probes = 0; probes <= mask_; i = (i + 1) & mask_, ++probes) {
+            std::uintptr_t key = entries_[i].behavior.load(std::memory_order_relaxed);
+            if (key == behavior)
+                return entries_[i];
+            if (key == 0) {
+                if (used_ == mask_) // keep an empty slot, so that lookups terminate
+                    break;
+                ++used_;
+                entries_[i].behavior.store(behavior, std::memory_order_release);
+                return entries_[i];
+            }
+        }
+        return overflow_;
+    }
+
+    static void snapshot_entry(const Entry& e, std::uintptr_t behavior, BehaviorStats& result)
+    {
+        result.behavior = behavior;
+        result.invocations = e.invocations.load(std::memory_order_relaxed);
+        result.sampledInvocations = e.sampledInvocations.load(std::memory_order_relaxed);
+        result.totalNs = e.totalNs.load(std::memory_order_relaxed);
+        result.selfNs = e.selfNs.load(std::memory_order_relaxed);
+        result.residencyCount = e.residencyCount.load(std::memory_order_relaxed);
+        result.residencyNs = e.residencyNs.load(std::memory_order_relaxed);
+        for (std::size_t i=0; i < LatencyHistogram::BUCKET_COUNT; ++i) {
+            result.selfTime.buckets[i] = e.selfTime[i].load(std::memory_order_relaxed);
+            result.residency.buckets[i] = e.residency[i].load(std::memory_order_relaxed);
+        }
+    }
+
+    static bool by_self_time(const BehaviorStats& a, const BehaviorStats& b) { return a.selfNs > b.selfNs; }
+
+public:
+    // capacity (a power of two) bounds the number of distinct behaviors: capacity - 1 are tracked individually.
+    explicit BehaviorStatsTable(std::size_t capacity = 256, std::size_t sampleInterval = 1)
+        : entries_(capacity)
+        , mask_(capacity - 1)
+        , used_(0)
+        , sampleInterval_(sampleInterval)
+        , sampleCountdown_(1)
+        , depth_(0)
+    {
+        assert(capacity > 1 && (capacity & (capacity - 1)) == 0 && "BehaviorStatsTable capacity must be a power of two");
+        assert(sampleInterval > 0);
+        for (std::size_t i=0; i < entries_.size(); ++i)
+            clear(entries_[i]);
+        clear(overflow_);
+    }
+
+    // Install makes table the calling thread's BehaviorStatsTable for the lifetime of the Install object.
+    class Install {
+        BehaviorStatsTable *previous_;
+        Install(const Install&);
+        Install& operator=(const Install&);
+    public:
+        explicit Install(BehaviorStatsTable *table) : previous_(current_slot()) { current_slot() = table; }
+        ~Install() { current_slot() = previous_; }
+    };
+
+    // the calling thread's table, or null
+    static BehaviorStatsTable* current() { return current_slot(); }
+
+    // should only be called by the installing thread, outside behaviors
+    void set_sample_interval(std::size_t sampleInterval)
+    {
+        assert(sampleInterval > 0);
+        sampleInterval_ = sampleInterval;
+        sampleCountdown_ = 1;
+    }
+
+    // zero all counters. should only be called by the installing thread, outside behaviors
+    void reset()
+    {
+        for (std::size_t i=0; i < entries_.size(); ++i)
+            clear(entries_[i]);
+        clear(overflow_);
+        used_ = 0;
+    }
+
+    // the statistics of each behavior, in decreasing order of self time. may be called from any thread
+    void snapshot(std::vector<BehaviorStats>& result) const
+    {
+        result.clear();
+        BehaviorStats s;
+        for (std::size_t i=0; i < entries_.size(); ++i) {
+            std::uintptr_t behavior = entries_[i].behavior.load(std::memory_order_acquire);
+            if (behavior != 0) {
+                snapshot_entry(entries_[i], behavior, s);
+                result.push_back(s);
+            }
+        }
+        if (overflow_.invocations.load(std::memory_order_relaxed) != 0 || overflow_.residencyCount.load(std::memory_order_relaxed) != 0) {
+            snapshot_entry(overflow_, 0, s);
+            result.push_back(s);
+        }
+        std::stable_sort(result.begin(), result.end(), &by_self_time);
+    }
+
+    // returns false if the behavior has no statistics. may be called from any thread
+    template<typename F>
+    bool find(F behavior, BehaviorStats& result) const
+    {
+        const std::uintptr_t key = BufferTracer::behavior_id(behavior);
+        for (std::size_t i = hash(key) & mask_, probes = 0; probes <= mask_; i = (i + 1) & mask_, ++probes) {
+            std::uintptr_t k = entries_[i].behavior.load(std::memory_order_acquire);
+            if (k == key) {
+                snapshot_entry(entries_[i], key, result);
+                return true;
+            }
+            if (k == 0)
+                break;
+        }
+        return false;
+    }
+
+    // recording. used by StatsTracer
+
+    // true if the active behavior is being timed
+    bool sampling() const { return depth_ > 0 && depth_ <= MAX_DEPTH && stack_[depth_ - 1].sampled; }
+
+    void behavior_begin(std::uintptr_t behavior)
+    {
+        Entry& e = entry(behavior);
+        bump(e.invocations, 1);
+
+        bool sampled;
+        if (depth_ == 0) {
+            sampled = (--sampleCountdown_ == 0);
+            if (sampled)
+                sampleCountdown_ = sampleInterval_;
+        } else {
+            sampled = sampling();
+        }
+
+        if (depth_ < MAX_DEPTH) {
+            Frame& f = stack_[depth_];
+            f.entry = &e;
+            f.sampled = sampled;
+            f.childNs = 0;
+            f.startNs = sampled ? TraceBuffer::now_ns() : 0;
+        }
+        ++depth_;
+    }
+
+    void behavior_end()
+    {
+        assert(depth_ > 0);
+        --depth_;
+        if (depth_ >= MAX_DEPTH || !stack_[depth_].sampled)
+            return;
+
+        const Frame& f = stack_[depth_];
+        const std::uint64_t elapsed = TraceBuffer::now_ns() - f.startNs;
+        const std::uint64_t self = (elapsed > f.childNs) ? elapsed - f.childNs : 0;
+        bump(f.entry->sampledInvocations, 1);
+        bump(f.entry->totalNs, elapsed);
+        bump(f.entry->selfNs, self);
+        bump(f.entry->selfTime[LatencyHistogram::bucket_index(self)], 1);
+        if (depth_ > 0)
+            stack_[depth_ - 1].childNs += elapsed;
+    }
+
+    void residency(std::uintptr_t behavior, std::uint64_t ns)
+    {
+        Entry& e = entry(behavior);
+        bump(e.residencyCount, 1);
+        bump(e.residencyNs, ns);
+        bump(e.residency[LatencyHistogram::bucket_index(ns)], 1);
+    }
+};
+
+
+// StatsTracer is a tracer_type that records into the calling thread's BehaviorStatsTable.
+struct StatsTracer {
+    struct deferred_send_state {
+        std::uint64_t queuedNs; // 0 if the message isn't being timed
+    };
+
+    template<typename A>
+    static void behavior_begin(const A& /*a*/, typename A::behavior_fn_ptr_type behavior, int /*port*/)
+    {
+        if (BehaviorStatsTable *table = BehaviorStatsTable::current())
+            table->behavior_begin(BufferTracer::behavior_id(behavior));
+    }
+
+    template<typename A>
+    static void behavior_end(const A& /*a*/, typename A::behavior_fn_ptr_type /*behavior*/)
+    {
+        if (BehaviorStatsTable *table = BehaviorStatsTable::current())
+            table->behavior_end();
+    }
+
+    template<typename A> static void inject_begin(const A& /*a*/, int /*port*/) {}
+    template<typename A> static void inject_end(const A& /*a*/) {}
+
+    template<typename A>
+    static void deferred_push(const A& /*a*/, int /*port*/, deferred_send_state& state)
+    {
+        BehaviorStatsTable *table = BehaviorStatsTable::current();
+        state.queuedNs = (table && table->sampling()) ? TraceBuffer::now_ns() : 0;
+    }
+
+    // the residency is attributed to the behavior that will receive the message
+    template<typename A>
+    static void deferred_pop(const A& a, int /*port*/, deferred_send_state& state)
+    {
+        if (state.queuedNs == 0)
+            return;
+        if (BehaviorStatsTable *table = BehaviorStatsTable::current())
+            table->residency(BufferTracer::behavior_id(a.behaviorFn_), TraceBuffer::now_ns() - state.queuedNs);
+    }
+
+    template<typename A> static void become(const A& /*a*/, typename A::behavior_fn_ptr_type /*behavior*/) {}
+    template<typename A> static void delete_later(const A& /*a*/) {}
+};
+
+struct StatsWorldPolicy : public DefaultWorldPolicy {
+    typedef StatsTracer tracer_type;
+};
+
+
+// print_behavior_stats() writes a table of the statistics, in decreasing order of self time.
+// Quantiles are histogram bucket upper bounds. names may be null.
+inline void print_behavior_stats(std::FILE *out, const BehaviorStatsTable& table, const TraceNames *names = 0)
+{
+    std::vector<BehaviorStats> stats;
+    table.snapshot(stats);
+
+    std::fprintf(out, "%-32s %10s %10s %10s %10s %10s %10s %10s %10s\n",
+        "behavior", "calls", "sampled", "self(ns)", "self p50", "self p99", "total(ns)", "wait(ns)", "wait p99");
+    for (std::size_t i=0; i < stats.size(); ++i) {
+        const BehaviorStats& s = stats[i];
+
+        char name[32];
+        const char *knownName = (names && s.behavior) ? names->find(s.behavior) : 0;
+        if (knownName)
+            std::snprintf(name, sizeof(name), "%s", knownName);
+        else if (s.behavior)
+            std::snprintf(name, sizeof(name), "0x%llx", static_cast<unsigned long long>(s.behavior));
+        else
+            std::snprintf(name, sizeof(name), "(other)");
+
+        const std::uint64_t sampled = s.sampledInvocations ? s.sampledInvocations : 1;
+        const std::uint64_t waits = s.residencyCount ? s.residencyCount : 1;
+        std::fprintf(out, "%-32s %10llu %10llu %10llu %10llu %10llu %10llu %10llu %10llu\n", name,
+            static_cast<unsigned long long>(s.invocations),
+            static_cast<unsigned long long>(s.sampledInvocations),
+            static_cast<unsigned long long>(s.selfNs / sampled),
+            static_cast<unsigned long long>(s.selfTime.quantile_upper_bound(0.5)),
+            static_cast<unsigned long long>(s.selfTime.quantile_upper_bound(0.99)),
+            static_cast<unsigned long long>(s.totalNs / sampled),
+            static_cast<unsigned long long>(s.residencyNs / waits),
+            static_cast<unsigned long long>(s.residency.quantile_upper_bound(0.99)));
+    }
+}
+
+} // end namespace Fractorp
+
+#endif /* INCLUDED_FRACTORP_BEHAVIORSTATS_H */
@@ -0,0 +1,194 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Premature optimization is the root of all evil." -- Donald Knuth
+*/
+
+#include "BehaviorStats.h"
+
+#include <cstdio>
+
+using namespace Fractorp;
+
+typedef void* shared_context_type;
+typedef std::intptr_t message_type;
+typedef ActorSpace<shared_context_type, message_type, StatsWorldPolicy> AS1;
+
+
+volatile std::uint64_t sink_;
+
+void busy_work(int iterations)
+{
+    for (int i=0; i < iterations; ++i)
+        sink_ = sink_ * 6364136223846793005ULL + 1442695040888963407ULL;
+}
+
+// Alternates between a fast and a slow state. Each message is passed to the collector, directly.
+struct FastSlow : public Fractorp::ActorT<AS1, FastSlow> {
+    actor_type& collector_;
+
+    explicit FastSlow(actor_type *collector) : collector_(*collector) {}
+
+    void fast(self_type& self, int /*port*/, message_type m)
+    {
+        self.send(collector_, m);
+        self.become<&FastSlow::slow>();
+    }
+
+    void slow(self_type& self, int /*port*/, message_type m)
+    {
+        busy_work(20000);
+        self.send(collector_, m);
+        self.become<&FastSlow::fast>();
+    }
+
+    void initial(self_type& self, int port, message_type m) { fast(self, port, m); }
+};
+
+struct Collector : public Fractorp::ActorT<AS1, Collector> {
+    message_type sum_;
+
+    Collector() : sum_(0) {}
+
+    void initial(self_type& /*self*/, int /*port*/, message_type m)
+    {
+        busy_work(100);
+        sum_ += m;
+    }
+};
+
+// Sends count messages to itself. The sends are deferred.
+struct Repeater : public Fractorp::ActorT<AS1, Repeater> {
+    void initial(self_type& self, int /*port*/, message_type m)
+    {
+        if (m > 0)
+            self.send(*this, m - 1);
+    }
+};
+
+
+void name_behaviors(TraceNames& names)
+{
+    names.set(&FastSlow::behavior<&FastSlow::initial>, "FastSlow::initial");
+    names.set(&FastSlow::behavior<&FastSlow::fast>, "FastSlow::fast");
+    names.set(&FastSlow::behavior<&FastSlow::slow>, "FastSlow::slow");
+    names.set(&Collector::behavior<&Collector::initial>, "Collector::initial");
+    names.set(&Repeater::behavior<&Repeater::initial>, "Repeater::initial");
+}
+
+template<typename F>
+void print_counts(const BehaviorStatsTable& table, F behavior, const char *label)
+{
+    BehaviorStats s;
+    if (table.find(behavior, s)) {
+        std::printf("%s calls: %d sampled: %d waits: %d\n", label,
+            (int)s.invocations, (int)s.sampledInvocations, (int)s.residencyCount);
+    } else {
+        std::printf("%s no statistics\n", label);
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void test1()
+{
+    std::printf("counts:\n");
+
+    BehaviorStatsTable stats;
+    BehaviorStatsTable::Install install(&stats);
+
+    AS1::world_type world;
+    Collector collector;
+    FastSlow fastSlow(&collector);
+    for (int i=0; i < 10; ++i)
+        world.inject(fastSlow, i);
+
+    Repeater repeater;
+    world.inject(repeater, 5);
+
+    print_counts(stats, &FastSlow::behavior<&FastSlow::initial>, "FastSlow::initial");
+    print_counts(stats, &FastSlow::behavior<&FastSlow::fast>, "FastSlow::fast");
+    print_counts(stats, &FastSlow::behavior<&FastSlow::slow>, "FastSlow::slow");
+    print_counts(stats, &Collector::behavior<&Collector::initial>, "Collector::initial");
+    print_counts(stats, &Repeater::behavior<&Repeater::initial>, "Repeater::initial");
+    std::printf("sum: %ld\n", (long)collector.sum_);
+
+    // the slow state has the most self time. (the fast state's total time includes the collector)
+    std::vector<BehaviorStats> snapshot;
+    stats.snapshot(snapshot);
+    TraceNames names;
+    name_behaviors(names);
+    std::printf("slowest: %s\n", names.find(snapshot[0].behavior));
+}
+
+void test2()
+{
+    std::printf("sampling:\n");
+
+    BehaviorStatsTable stats(256, 4); // time one in four activations
+    BehaviorStatsTable::Install install(&stats);
+
+    AS1::world_type world;
+    Repeater repeater;
+    world.inject(repeater, 99); // 1 injected and 99 deferred activations
+
+    print_counts(stats, &Repeater::behavior<&Repeater::initial>, "Repeater::initial");
+
+    stats.reset();
+    print_counts(stats, &Repeater::behavior<&Repeater::initial>, "after reset: Repeater::initial");
+}
+
+void test3()
+{
+    std::printf("full table:\n");
+
+    BehaviorStatsTable stats(2); // one individually tracked behavior
+    BehaviorStatsTable::Install install(&stats);
+
+    AS1::world_type world;
+    Collector collector;
+    Repeater repeater;
+    world.inject(collector, 1);
+    world.inject(repeater, 2);
+
+    std::vector<BehaviorStats> snapshot;
+    stats.snapshot(snapshot);
+    for (std::size_t i=0; i < snapshot.size(); ++i)
+        std::printf("%s calls: %d\n", snapshot[i].behavior ? "tracked" : "other", (int)snapshot[i].invocations);
+}
+
+void test4()
+{
+    std::printf("report:\n");
+
+    TraceNames names;
+    name_behaviors(names);
+
+    BehaviorStatsTable stats;
+    BehaviorStatsTable::Install install(&stats);
+
+    AS1::world_type world;
+    Collector collector;
+    FastSlow fastSlow(&collector);
+    Repeater repeater;
+    for (int i=0; i < 100; ++i) {
+        world.inject(fastSlow, i);
+        world.inject(repeater, 3);
+    }
+
+    print_behavior_stats(stdout, stats, &names);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    (void)argc; (void)argv;
+
+    test1();
+    test2();
+    test3();
+    test4();
+
+    return 0;
+}
@@ -0,0 +1,285 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Don't communicate by sharing memory; share memory by communicating." -- Rob Pike
+*/
+
+#ifndef INCLUDED_FRACTORP_CHANNEL_H
+#define INCLUDED_FRACTORP_CHANNEL_H
+
+#include <cassert>
+#include <cstddef>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "Actor.h"
+
+namespace Fractorp {
+
+// Channel<AS, T, N> is a CSP-style channel of values of type T with capacity for N buffered
+// values. (N may be 0, in which case put() and take() rendezvous.) A channel is a passive
+// object, not an actor. It is used from within the behaviors of actors in a single World.
+//
+// A send is unbounded: messages accumulate in the receiver (or the DeferredSendQueue) as fast
+// as the sender produces them. A channel provides backpressure instead. Operations block by
+// continuation: rather than blocking the thread, an operation that can't complete parks the
+// caller's ChannelWaiter on the channel and returns false. When the operation later completes,
+// the channel sends a (value-initialized) message to the waiter's continuation endpoint:
+//
+//  * put(self, w, value): if there is room, buffers value and returns true. Otherwise moves value
+//    into w and parks w. Once a taker has made room, value is buffered and w's continuation
+//    is notified. The producer should stop producing until then.
+//
+//  * take(self, w, value): if a value is available, moves it into value and returns true.
+//    Otherwise parks w. Once a value has been put, it is moved into w and w's continuation is
+//    notified. The consumer then retrieves it with w.take_value().
+//
+// Channels never allocate: the buffer is fixed-size, and waiters are intrusive. Each
+// producer or consumer owns its waiter (typically as a member), hence the number of parked
+// operations is bounded by the number of actors using the channel. A waiter may be parked
+// on at most one operation at a time. Parked waiters are served in FIFO order. A parked
+// operation may be abandoned with cancel().
+
+
+// ChannelWaiter stores a parked channel operation: its continuation, and for puts (or completed
+// takes) the value. E is the endpoint type.
+template<typename T, typename E>
+class ChannelWaiter {
+    template<typename AS, typename T2, std::size_t N> friend class Channel;
+
+    ChannelWaiter *next_;
+    E continuation_;
+    typename std::aligned_storage<sizeof(T), alignof(T)>::type value_;
+    bool hasValue_;
+    bool parked_;
+
+    ChannelWaiter(const ChannelWaiter&);
+    ChannelWaiter& operator=(const ChannelWaiter&);
+
+    T& value() { return *reinterpret_cast<T*>(&value_); }
+
+    void set_value(T&& value)
+    {
+        assert(!hasValue_);
+        new (&value_) T(std::move(value));
+        hasValue_ = true;
+    }
+
+    void clear_value()
+    {
+        value().~T();
+        hasValue_ = false;
+    }
+
+public:
+    // continuation is the endpoint that is sent a message when a parked operation completes.
+    explicit ChannelWaiter(const E& continuation)
+        : next_(0)
+        , continuation_(continuation)
+        , hasValue_(false)
+        , parked_(false) {}
+
+    ~ChannelWaiter()
+    {
+        assert(!parked_ && "destroying a ChannelWaiter that is parked on a channel");
+        if (hasValue_)
+            clear_value();
+    }
+
+    bool parked() const { return parked_; }
+
+    // true once a parked take() has completed, until take_value() is called
+    bool has_value() const { return hasValue_ && !parked_; }
+
+    // retrieve the value of a completed take()
+    T take_value()
+    {
+        assert(has_value());
+        T result(std::move(value()));
+        clear_value();
+        return result;
+    }
+};
+
+
+template<typename AS, typename T, std::size_t N>
+class Channel {
+public:
+    typedef T value_type;
+    typedef typename AS::endpoint_type endpoint_type;
+    typedef ChannelWaiter<T, endpoint_type> waiter_type;
+
+    enum { CAPACITY = N };
+
+private:
+    // FIFO of parked waiters
+    struct WaiterQueue {
+        waiter_type *front_, *back_;
+
+        WaiterQueue() : front_(0), back_(0) {}
+
+        bool empty() const { return front_ == 0; }
+
+        void push_back(waiter_type *w)
+        {
+            w->next_ = 0;
+            if (back_)
+                back_->next_ = w;
+            else
+                front_ = w;
+            back_ = w;
+        }
+
+        waiter_type* pop_front()
+        {
+            waiter_type *w = front_;
+            front_ = w->next_;
+            if (front_ == 0)
+                back_ = 0;
+            w->next_ = 0;
+            return w;
+        }
+
+        bool remove(waiter_type *w)
+        {
+            waiter_type *prev = 0;
+            for (waiter_type *i = front_; i; prev = i, i = i->next_) {
+                if (i == w) {
+                    (prev ? prev->next_ : front_) = w->next_;
+                    if (back_ == w)
+                        back_ = prev;
+                    w->next_ = 0;
+                    return true;
+                }
+            }
+            return false;
+        }
+    };
+
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type slot_type;
+
+    slot_type buffer_[N > 0 ? N : 1]; // ring buffer
+    std::size_t front_, size_;
+    WaiterQueue putters_; // parked puts. non-empty only if the buffer is full
+    WaiterQueue takers_; // parked takes. non-empty only if the buffer is empty
+
+    Channel(const Channel&);
+    Channel& operator=(const Channel&);
+
+    T& slot(std::size_t i) { return *reinterpret_cast<T*>(&buffer_[(front_ + i) % (N > 0 ? N : 1)]); }
+
+    void push_back(T&& value)
+    {
+        new (&slot(size_)) T(std::move(value));
+        ++size_;
+    }
+
+    void pop_front(T& value)
+    {
+        value = std::move(slot(0));
+        slot(0).~T();
+        front_ = (front_ + 1) % (N > 0 ? N : 1);
+        --size_;
+    }
+
+    template<typename self_type>
+    static void notify(self_type& self, waiter_type *w)
+    {
+        w->parked_ = false;
+        self.send(w->continuation_);
+    }
+
+public:
+    Channel() : front_(0), size_(0) {}
+
+    ~Channel()
+    {
+        assert(putters_.empty() && takers_.empty() && "destroying a Channel with parked waiters");
+        while (size_ > 0) {
+            slot(0).~T();
+            front_ = (front_ + 1) % (N > 0 ? N : 1);
+            --size_;
+        }
+    }
+
+    std::size_t size() const { return size_; }
+    bool empty() const { return size_ == 0; }
+    bool full() const { return size_ == N; }
+
+    // returns true if the value was transferred. otherwise w is parked (see above).
+    template<typename self_type>
+    bool put(self_type& self, waiter_type& w, T&& value)
+    {
+        assert(!w.parked_ && "ChannelWaiter is already parked");
+
+        if (!takers_.empty()) { // hand the value straight to the oldest parked taker. (the buffer is empty)
+            waiter_type *taker = takers_.pop_front();
+            taker->set_value(std::move(value));
+            notify(self, taker);
+            return true;
+        }
+
+        if (size_ < N) {
+            push_back(std::move(value));
+            return true;
+        }
+
+        w.set_value(std::move(value));
+        w.parked_ = true;
+        putters_.push_back(&w);
+        return false;
+    }
+
+    template<typename self_type>
+    bool put(self_type& self, waiter_type& w, const T& value) { return put(self, w, T(value)); }
+
+    // returns true if a value was moved into value. otherwise w is parked (see above).
+    template<typename self_type>
+    bool take(self_type& self, waiter_type& w, T& value)
+    {
+        assert(!w.parked_ && "ChannelWaiter is already parked");
+        assert(!w.hasValue_ && "call take_value() before taking again");
+
+        if (size_ > 0) {
+            pop_front(value);
+            if (!putters_.empty()) { // room for the oldest parked put
+                waiter_type *putter = putters_.pop_front();
+                push_back(std::move(putter->value()));
+                putter->clear_value();
+                notify(self, putter);
+            }
+            return true;
+        }
+
+        if (!putters_.empty()) { // unbuffered (N == 0) rendezvous
+            waiter_type *putter = putters_.pop_front();
+            value = std::move(putter->value());
+            putter->clear_value();
+            notify(self, putter);
+            return true;
+        }
+
+        w.parked_ = true;
+        takers_.push_back(&w);
+        return false;
+    }
+
+    // cancel a parked operation. the value of a cancelled put is destroyed.
+    // the continuation is not notified. O(number of parked waiters)
+    void cancel(waiter_type& w)
+    {
+        if (!w.parked_)
+            return;
+        bool removed = putters_.remove(&w) || takers_.remove(&w);
+        assert(removed && "ChannelWaiter is parked on a different channel");
+        (void)removed;
+        w.parked_ = false;
+        if (w.hasValue_)
+            w.clear_value();
+    }
+};
+
+} // end namespace Fractorp
+
+#endif /* INCLUDED_FRACTORP_CHANNEL_H */
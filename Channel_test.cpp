@@ -0,0 +1,138 @@
+/*
+    Fractorp by Ross Bencina
+
+    "They also serve who only stand and wait." -- John Milton
+*/
+
+#include "Channel.h"
+
+#include <cstdio>
+
+using namespace Fractorp;
+
+typedef void* shared_context_type;
+typedef int message_type;
+typedef ActorSpace<shared_context_type, message_type> AS1;
+
+typedef Channel<AS1, int, 4> IntChannel;
+typedef Channel<AS1, int, 0> RendezvousChannel;
+
+
+// Puts count values into a channel as fast as it can. Port 0 starts production,
+// port 1 is the continuation of a parked put.
+template<typename C>
+struct Producer : public Fractorp::ActorT<AS1, Producer<C> > {
+    typedef typename ActorT<AS1, Producer<C> >::self_type self_type;
+
+    C& channel_;
+    typename C::waiter_type waiter_;
+    int next_, count_;
+
+    Producer(C *channel, int count)
+        : channel_(*channel)
+        , waiter_(AS1::endpoint_type(*this, 1))
+        , next_(0)
+        , count_(count) {}
+
+    void initial(self_type& self, int port, message_type /*message*/)
+    {
+        if (port == 1)
+            std::printf("producer: resumed\n");
+
+        while (next_ < count_) {
+            if (!channel_.put(self, waiter_, next_++)) {
+                std::printf("producer: parked with %d buffered\n", (int)channel_.size());
+                return; // await the continuation
+            }
+        }
+    }
+};
+
+// Takes one value from a channel per message on port 0 (a "tick").
+// Port 1 is the continuation of a parked take.
+template<typename C>
+struct Consumer : public Fractorp::ActorT<AS1, Consumer<C> > {
+    typedef typename ActorT<AS1, Consumer<C> >::self_type self_type;
+
+    C& channel_;
+    typename C::waiter_type waiter_;
+
+    explicit Consumer(C *channel)
+        : channel_(*channel)
+        , waiter_(AS1::endpoint_type(*this, 1)) {}
+
+    void initial(self_type& self, int port, message_type /*message*/)
+    {
+        if (port == 0) {
+            if (waiter_.parked())
+                return; // still waiting for the previous take
+            int value;
+            if (channel_.take(self, waiter_, value))
+                std::printf("consumer: took %d\n", value);
+            else
+                std::printf("consumer: parked\n");
+        } else {
+            std::printf("consumer: resumed with %d\n", waiter_.take_value());
+        }
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+void test1()
+{
+    std::printf("bounded channel:\n");
+
+    AS1::world_type world;
+    IntChannel channel;
+    Producer<IntChannel> producer(&channel, 10);
+    Consumer<IntChannel> consumer(&channel);
+
+    world.inject(producer);
+    for (int i=0; i < 11; ++i) // the last take parks: the channel is empty
+        world.inject(consumer);
+
+    channel.cancel(consumer.waiter_);
+    std::printf("consumer parked after cancel: %s\n", consumer.waiter_.parked() ? "yes" : "no");
+}
+
+void test2()
+{
+    std::printf("consumer first:\n");
+
+    AS1::world_type world;
+    IntChannel channel;
+    Producer<IntChannel> producer(&channel, 2);
+    Consumer<IntChannel> consumer(&channel);
+
+    world.inject(consumer);
+    world.inject(producer);
+    world.inject(consumer);
+}
+
+void test3()
+{
+    std::printf("rendezvous channel:\n");
+
+    AS1::world_type world;
+    RendezvousChannel channel;
+    Producer<RendezvousChannel> producer(&channel, 3);
+    Consumer<RendezvousChannel> consumer(&channel);
+
+    world.inject(producer);
+    for (int i=0; i < 3; ++i)
+        world.inject(consumer);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    (void)argc; (void)argv;
+
+    test1();
+    test2();
+    test3();
+
+    return 0;
+}
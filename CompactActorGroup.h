@@ -0,0 +1,246 @@
+/*
+    Fractorp by Ross Bencina
+
+    "E pluribus unum." -- traditional motto
+*/
+
+#ifndef INCLUDED_FRACTORP_COMPACTACTORGROUP_H
+#define INCLUDED_FRACTORP_COMPACTACTORGROUP_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Actor.h"
+
+namespace Fractorp {
+
+// Compact actor groups. An ordinary actor holds a behavior function pointer and every
+// delivery is an indirect call through it. For large populations of small actors a
+// CompactActorGroupT stores each member as a 16-bit behavior index and a small state value
+// (32 bits per member with the default uint16_t state), and dispatches with a switch over a
+// compile-time table of the group's behaviors. Each behavior call is direct, and may be inlined.
+//
+// The group is a single actor. Member i is addressed by port i of the group, so the group's
+// endpoint type must have enough port bits for the members (FatEndpoint has 16):
+//
+//      struct Switches : public CompactActorGroupT<AS, Switches> {
+//          Switches() : CompactActorGroupT(1024) {}
+//
+//          void off(member_self_type& self, message_type&& m) { self.become<&Switches::on>(); }
+//          void on(member_self_type& self, message_type&& m) { self.become<&Switches::off>(); }
+//
+//          typedef BehaviorTable<member_behavior_type, &Switches::off, &Switches::on> behavior_table;
+//      };
+//
+//      world.inject(switches, 3, m); // deliver m to member 3
+//
+// The first behavior in the table is every member's initial behavior. Member behaviors receive
+// only their message (each member has a single port). They may send to other actors via the
+// member self, and to other members of the group with send_member(). Sends between members
+// never leave the group: they are queued by the group and delivered in FIFO order, before the
+// group's behavior returns, without an indirect call.
+//
+// The recursion guard is applied to the group as a whole: messages sent to the group from
+// outside while a member is active are deferred by the World as for any actor.
+
+
+namespace behavior_table_detail {
+
+template<typename T, typename... Ts>
+struct index_of; // undefined: the behavior is not in the table
+
+template<typename T, typename... Ts>
+struct index_of<T, T, Ts...> : std::integral_constant<int, 0> {};
+
+template<typename T, typename U, typename... Ts>
+struct index_of<T, U, Ts...> : std::integral_constant<int, 1 + index_of<T, Ts...>::value> {};
+
+// Dispatch<i, F, fs...>::call() tests the index against each behavior in turn. The chain is
+// resolved at compile time into a switch (typically a jump table) of direct calls.
+template<int i, typename F, F... fs>
+struct Dispatch;
+
+template<int i, typename F, F f, F... fs>
+struct Dispatch<i, F, f, fs...> {
+    template<typename C, typename S, typename M>
+    static void call(int index, C& target, S& self, M&& m)
+    {
+        if (index == i)
+            (target.*f)(self, std::forward<M>(m));
+        else
+            Dispatch<i + 1, F, fs...>::call(index, target, self, std::forward<M>(m));
+    }
+};
+
+template<int i, typename F>
+struct Dispatch<i, F> {
+    template<typename C, typename S, typename M>
+    static void call(int /*index*/, C& /*target*/, S& /*self*/, M&& /*m*/)
+    {
+        assert(false && "behavior index out of range");
+    }
+};
+
+} // end namespace behavior_table_detail
+
+// BehaviorTable<F, fs...> is a compile-time list of behavior member functions of type F.
+template<typename F, F... fs>
+struct BehaviorTable {
+    typedef F behavior_type;
+    enum { SIZE = sizeof...(fs) };
+    static_assert(SIZE > 0, "a BehaviorTable needs at least one behavior");
+    static_assert(SIZE <= 0x10000, "behavior indices are 16 bits");
+
+    // index_of<f>::value is the index of behavior f
+    template<F f>
+    struct index_of : behavior_table_detail::index_of<std::integral_constant<F, f>, std::integral_constant<F, fs>...> {};
+
+    template<typename C, typename S, typename M>
+    static void dispatch(int index, C& target, S& self, M&& m)
+    {
+        behavior_table_detail::Dispatch<0, F, fs...>::call(index, target, self, std::forward<M>(m));
+    }
+};
+
+
+// CompactActorGroupT is the base class of compact actor groups (see above). DerivedT must
+// declare behavior_table. G is the recursion guard policy of the group.
+template<typename AS, typename DerivedT, typename State = std::uint16_t, typename G = RecursionGuard>
+struct CompactActorGroupT : public ActorT<AS, DerivedT, G> {
+    typedef ActorT<AS, DerivedT, G> actor_t_type;
+    typedef typename actor_t_type::message_type message_type;
+    typedef typename actor_t_type::world_type world_type;
+    typedef typename actor_t_type::root_actor_type root_actor_type;
+    typedef typename actor_t_type::self_type self_type;
+    typedef typename AS::actor_type actor_type;
+    typedef typename AS::endpoint_type endpoint_type;
+    typedef DerivedT concrete_actor_type;
+    typedef State state_type;
+
+    struct Member {
+        std::uint16_t behavior_;
+        state_type state_;
+    };
+
+    class MemberSelf;
+    typedef MemberSelf member_self_type;
+    typedef void (concrete_actor_type::*member_behavior_type)(member_self_type&, message_type&&);
+
+    explicit CompactActorGroupT(std::size_t memberCount, state_type initialState = state_type())
+        : actor_t_type(&group_behavior)
+        , queueHead_(0)
+    {
+        assert(memberCount <= static_cast<std::size_t>(endpoint_type::PORT_COUNT) && "too many members for the endpoint's port bits");
+        Member m = { 0, initialState };
+        members_.assign(memberCount, m);
+    }
+
+    std::size_t member_count() const { return members_.size(); }
+
+    endpoint_type member_endpoint(std::size_t i) { return endpoint_type(*this, static_cast<int>(i)); }
+
+    int behavior_index(std::size_t i) const { return members_[i].behavior_; }
+
+    state_type& state(std::size_t i) { return members_[i].state_; }
+    const state_type& state(std::size_t i) const { return members_[i].state_; }
+
+    // MemberSelf is the self of a member behavior.
+    class MemberSelf {
+        CompactActorGroupT& group_;
+        self_type& self_;
+        std::uint16_t member_;
+
+        MemberSelf(const MemberSelf&);
+        MemberSelf& operator=(const MemberSelf&);
+
+        friend struct CompactActorGroupT;
+        MemberSelf(CompactActorGroupT& group, self_type& self, std::uint16_t member)
+            : group_(group), self_(self), member_(member) {}
+
+    public:
+        typedef typename self_type::shared_context_type shared_context_type;
+
+        std::size_t member() const { return member_; }
+        endpoint_type endpoint() { return group_.member_endpoint(member_); }
+
+        state_type& state() { return group_.members_[member_].state_; }
+
+        // become<f>() sets the behavior for the member's next message
+        template<member_behavior_type f>
+        void become() { group_.members_[member_].behavior_ = static_cast<std::uint16_t>(concrete_actor_type::behavior_table::template index_of<f>::value); }
+
+        // send to member i of this group. delivered after the current behavior returns
+        void send_member(std::size_t i, const message_type& m) { group_.queue_.emplace_back(static_cast<std::uint16_t>(i), m); }
+        void send_member(std::size_t i, message_type&& m) { group_.queue_.emplace_back(static_cast<std::uint16_t>(i), std::move(m)); }
+
+        void send(actor_type& a) { self_.send(a); }
+        void send(const endpoint_type& e) { self_.send(e); }
+        void send(actor_type& a, const message_type& m) { self_.send(a, m); }
+        void send(actor_type& a, message_type&& m) { self_.send(a, std::move(m)); }
+        void send(const endpoint_type& e, const message_type& m) { self_.send(e, m); }
+        void send(const endpoint_type& e, message_type&& m) { self_.send(e, std::move(m)); }
+        void send(actor_type& a, int port, const message_type& m) { self_.send(a, port, m); }
+        void send(actor_type& a, int port, message_type&& m) { self_.send(a, port, std::move(m)); }
+
+        // the group's self, e.g. for create() or send_after()
+        self_type& group_self() { return self_; }
+
+        shared_context_type& shared_context() { return self_.shared_context(); }
+    };
+
+private:
+    std::vector<Member> members_;
+    // sends between members. a vector rather than a deque so that its storage is retained
+    // between activations. entries before queueHead_ have been delivered
+    std::vector<std::pair<std::uint16_t, message_type> > queue_;
+    std::size_t queueHead_;
+
+    void dispatch(self_type& self, std::uint16_t member, message_type&& m)
+    {
+        assert(member < members_.size());
+        MemberSelf memberSelf(*this, self, member);
+        concrete_actor_type::behavior_table::dispatch(members_[member].behavior_,
+            *actor_t_type::downcast_to_concrete_actor_type(this), memberSelf, std::move(m));
+    }
+
+    // discards delivered entries once they are the majority, so that long chains of sends
+    // between members run in bounded space
+    void compact_queue()
+    {
+        if (queueHead_ >= 1024 && queueHead_ * 2 >= queue_.size()) {
+            queue_.erase(queue_.begin(), queue_.begin() + queueHead_);
+            queueHead_ = 0;
+        }
+    }
+
+    static void group_behavior(world_type& world, root_actor_type& a, int port, message_type&& m)
+    {
+        static_assert(std::is_same<typename concrete_actor_type::behavior_table::behavior_type, member_behavior_type>::value,
+            "behavior_table must be a BehaviorTable<member_behavior_type, ...>");
+
+        concrete_actor_type *group = actor_t_type::downcast_to_concrete_actor_type(&a);
+        actor_t_type::tracer_type::behavior_begin(a, &group_behavior, port);
+        {
+            self_type self(world, a);
+            group->dispatch(self, static_cast<std::uint16_t>(port), std::move(m));
+            while (group->queueHead_ < group->queue_.size()) {
+                std::pair<std::uint16_t, message_type> next(std::move(group->queue_[group->queueHead_++]));
+                group->dispatch(self, next.first, std::move(next.second));
+                group->compact_queue();
+            }
+            group->queue_.clear();
+            group->queueHead_ = 0;
+        }
+        actor_t_type::tracer_type::behavior_end(a, &group_behavior);
+
+        ReentrantSendHandler<G::reentrant_send_action>::template after_behavior<self_type>(world, a);
+    }
+};
+
+} // end namespace Fractorp
+
+#endif /* INCLUDED_FRACTORP_COMPACTACTORGROUP_H */
@@ -0,0 +1,152 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Two heads are better than one." -- proverb
+*/
+
+#include "CompactActorGroup.h"
+
+#include <cstdio>
+
+using namespace Fractorp;
+
+typedef void* shared_context_type;
+typedef std::intptr_t message_type;
+typedef ActorSpace<shared_context_type, message_type, FatEndpointWorldPolicy> AS1;
+
+
+// Each member counts its messages in its state, and alternates between two behaviors.
+struct Switches : public Fractorp::CompactActorGroupT<AS1, Switches> {
+    Switches() : CompactActorGroupT(1024) {}
+
+    void off(member_self_type& self, message_type&& /*m*/)
+    {
+        ++self.state();
+        self.become<&Switches::on>();
+    }
+
+    void on(member_self_type& self, message_type&& /*m*/)
+    {
+        ++self.state();
+        self.become<&Switches::off>();
+    }
+
+    typedef BehaviorTable<member_behavior_type, &Switches::off, &Switches::on> behavior_table;
+};
+
+struct Collector : public Fractorp::ActorT<AS1, Collector> {
+    message_type sum_;
+    int count_;
+
+    Collector() : sum_(0), count_(0) {}
+
+    void initial(self_type& /*self*/, int /*port*/, message_type m)
+    {
+        sum_ += m;
+        ++count_;
+    }
+};
+
+// Passes a token around a ring of members. Each pass decrements the token. The member that
+// receives zero reports its index to the collector.
+struct Ring : public Fractorp::CompactActorGroupT<AS1, Ring, std::uint32_t> {
+    actor_type& collector_;
+
+    Ring(std::size_t memberCount, actor_type *collector) : CompactActorGroupT(memberCount), collector_(*collector) {}
+
+    void pass(member_self_type& self, message_type&& m)
+    {
+        ++self.state();
+        if (m == 0)
+            self.send(collector_, (message_type)self.member());
+        else
+            self.send_member((self.member() + 1) % member_count(), m - 1);
+    }
+
+    typedef BehaviorTable<member_behavior_type, &Ring::pass> behavior_table;
+};
+
+// Sends to its own endpoint, which is deferred by the World's recursion guard (the group is
+// active). The second message is forwarded to the collector.
+struct Echo : public Fractorp::CompactActorGroupT<AS1, Echo> {
+    actor_type& collector_;
+
+    explicit Echo(actor_type *collector) : CompactActorGroupT(4), collector_(*collector) {}
+
+    void first(member_self_type& self, message_type&& m)
+    {
+        self.become<&Echo::second>();
+        self.send(self.endpoint(), m * 10);
+    }
+
+    void second(member_self_type& self, message_type&& m)
+    {
+        self.become<&Echo::first>();
+        self.send(collector_, m);
+    }
+
+    typedef BehaviorTable<member_behavior_type, &Echo::first, &Echo::second> behavior_table;
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+void test1()
+{
+    std::printf("switches:\n");
+
+    std::printf("member size: %d bytes\n", (int)sizeof(Switches::Member));
+
+    AS1::world_type world;
+    Switches switches;
+    for (std::size_t i=0; i < switches.member_count(); ++i) {
+        for (std::size_t j=0; j < i % 3; ++j)
+            world.inject(switches, (int)i, 0);
+    }
+
+    int onCount = 0, messageCount = 0;
+    for (std::size_t i=0; i < switches.member_count(); ++i) {
+        onCount += (switches.behavior_index(i) == Switches::behavior_table::index_of<&Switches::on>::value);
+        messageCount += switches.state(i);
+    }
+    std::printf("members: %d on: %d messages: %d\n", (int)switches.member_count(), onCount, messageCount);
+}
+
+void test2()
+{
+    std::printf("sends between members:\n");
+
+    AS1::world_type world;
+    Collector collector;
+    Ring ring(10, &collector);
+    world.inject(ring, 3, 95); // 95 passes from member 3 end at member 8
+
+    std::uint32_t passCount = 0;
+    for (std::size_t i=0; i < ring.member_count(); ++i)
+        passCount += ring.state(i);
+    std::printf("collected: %d last member: %d deliveries: %d\n", collector.count_, (int)collector.sum_, (int)passCount);
+}
+
+void test3()
+{
+    std::printf("deferred sends to the group:\n");
+
+    AS1::world_type world;
+    Collector collector;
+    Echo echo(&collector);
+    for (int i=0; i < 4; ++i)
+        world.inject(echo.member_endpoint(i), i + 1);
+    std::printf("collected: %d sum: %d\n", collector.count_, (int)collector.sum_);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    (void)argc; (void)argv;
+
+    test1();
+    test2();
+    test3();
+
+    return 0;
+}
@@ -0,0 +1,135 @@
+/*
+    Fractorp by Ross Bencina
+
+    "To be continued." -- Anonymous
+*/
+
+#ifndef INCLUDED_FRACTORP_COROUTINEACTOR_H
+#define INCLUDED_FRACTORP_COROUTINEACTOR_H
+
+#include <cassert>
+#include <utility>
+
+#include "Actor.h"
+
+namespace Fractorp {
+
+// Coroutine actors are stackless coroutines that suspend to await their next message.
+//
+// A multi-step protocol written with become() is a state machine: one behavior per state,
+// with the protocol's control flow spread across them. A coroutine actor instead writes the
+// protocol as straight-line code in a single resume() member function. The macros below
+// (a variant of Duff's device) turn resume() into a resumable function:
+//
+//      struct Greeter : public CoroutineActorT<AS, Greeter> {
+//          int count_; // state that persists across awaits must be stored in members
+//
+//          void resume(self_type& self, int port, message_type m)
+//          {
+//              FRACTORP_CO_BEGIN();
+//              for (count_=0; count_ < 3; ++count_) {
+//                  // m is the message that started or resumed the coroutine
+//                  FRACTORP_CO_AWAIT(1); // suspend until a message arrives on port 1
+//                  ...
+//              }
+//              FRACTORP_CO_END();
+//          }
+//      };
+//
+// The first message received starts the coroutine at FRACTORP_CO_BEGIN(). Hence protocols are
+// written as "handle m, then await the next message". By default the first message may arrive
+// on any port. Pass initialPort to the CoroutineActorT constructor to await a specific port.
+//
+// FRACTORP_CO_AWAIT(port) returns from resume(). The next message to that port resumes execution
+// after the await, with port and m set to the new message. FRACTORP_CO_AWAIT_ANY() accepts any port.
+// While the coroutine awaits a port, messages to other ports, and messages received after the
+// coroutine has finished, are passed to unexpected(). The default implementation asserts.
+// Hide it to handle such messages:
+//
+//      void unexpected(self_type& self, int port, message_type m);
+//
+// The only per-actor state is the resume point and the awaited port. There is no heap frame:
+// local variables are not preserved across awaits. (The compiler will report an error if an
+// initialized local variable is live across an await.) Don't use become() in a coroutine actor,
+// and don't await in a nested switch statement. Each await must be on its own source line.
+
+#define FRACTORP_CO_BEGIN() switch (this->coResumePoint_) { case 0:
+
+#define FRACTORP_CO_AWAIT(port) \
+    do { this->co_suspend(__LINE__, (port)); return; case __LINE__: ; } while (0)
+
+#define FRACTORP_CO_AWAIT_ANY() FRACTORP_CO_AWAIT(this->AWAIT_ANY_PORT)
+
+// finish the coroutine early
+#define FRACTORP_CO_RETURN() do { this->co_finish(); return; } while (0)
+
+#define FRACTORP_CO_END() } this->co_finish()
+
+
+// CoroutineActorT is the base class of coroutine actors. DerivedT must define resume() (see above).
+// G is the recursion guard policy (see ActorT).
+template<typename AS, typename DerivedT, typename G = RecursionGuard>
+struct CoroutineActorT : public ActorT<AS, DerivedT, G> {
+    typedef ActorT<AS, DerivedT, G> actor_t_type;
+    typedef typename actor_t_type::message_type message_type;
+    typedef typename actor_t_type::world_type world_type;
+    typedef typename actor_t_type::root_actor_type root_actor_type;
+    typedef typename actor_t_type::self_type self_type;
+    typedef DerivedT concrete_actor_type;
+
+    enum { AWAIT_ANY_PORT = -1, NO_PORT = -2 };
+
+    bool co_finished() const { return coResumePoint_ == FINISHED; }
+
+    // the port that the coroutine is waiting on, AWAIT_ANY_PORT, or NO_PORT once finished
+    int co_awaited_port() const { return coAwaitPort_; }
+
+protected:
+    enum { FINISHED = -1 };
+
+    int coResumePoint_; // 0 before the first message. otherwise the source line of the active await, or FINISHED
+    int coAwaitPort_; // NO_PORT once finished, so that a single test rejects unexpected messages
+
+    explicit CoroutineActorT(int initialPort = AWAIT_ANY_PORT)
+        : actor_t_type(&coroutine_behavior)
+        , coResumePoint_(0)
+        , coAwaitPort_(initialPort) {}
+
+    void co_suspend(int resumePoint, int port)
+    {
+        coResumePoint_ = resumePoint;
+        coAwaitPort_ = port;
+    }
+
+    void co_finish()
+    {
+        coResumePoint_ = FINISHED;
+        coAwaitPort_ = NO_PORT;
+    }
+
+    void unexpected(self_type& /*self*/, int /*port*/, message_type /*message*/)
+    {
+        assert(false && "coroutine actor received a message that it was not awaiting");
+    }
+
+private:
+    static void coroutine_behavior(world_type& world, root_actor_type& a, int port, message_type&& m)
+    {
+        concrete_actor_type *c = actor_t_type::downcast_to_concrete_actor_type(&a);
+        actor_t_type::tracer_type::behavior_begin(a, &coroutine_behavior, port);
+        {
+            self_type self(world, a);
+            if (c->coAwaitPort_ != AWAIT_ANY_PORT && c->coAwaitPort_ != port)
+                c->unexpected(self, port, std::move(m));
+            else
+                c->resume(self, port, std::move(m));
+        }
+        actor_t_type::tracer_type::behavior_end(a, &coroutine_behavior);
+
+        ReentrantSendHandler<G::reentrant_send_action>::template after_behavior<self_type>(world, a);
+    }
+};
+
+} // end namespace Fractorp
+
+#endif /* INCLUDED_FRACTORP_COROUTINEACTOR_H */
@@ -0,0 +1,162 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Begin at the beginning, and go on till you come to the end: then stop." -- Lewis Carroll
+*/
+
+#include "CoroutineActor.h"
+
+#include <cstdio>
+
+using namespace Fractorp;
+
+typedef void* shared_context_type;
+typedef std::intptr_t message_type;
+typedef ActorSpace<shared_context_type, message_type> AS1;
+
+
+// The coroutine equivalent of AlternatingActor (see Actor_test.cpp)
+struct AlternatingCoroutine : public Fractorp::CoroutineActorT<AS1, AlternatingCoroutine> {
+    void resume(self_type& /*self*/, int /*port*/, message_type /*message*/)
+    {
+        FRACTORP_CO_BEGIN();
+        for (;;) {
+            std::printf("a\n");
+            FRACTORP_CO_AWAIT_ANY();
+            std::printf("b\n");
+            FRACTORP_CO_AWAIT_ANY();
+        }
+        FRACTORP_CO_END();
+    }
+};
+
+
+// A session protocol: port 0 opens a session, port 1 delivers data, port 2 closes the session
+// and reports the sum of the data to the reporter. Messages that arrive out of turn are ignored.
+struct Session : public Fractorp::CoroutineActorT<AS1, Session> {
+    enum { OPEN = 0, DATA = 1, CLOSE = 2 };
+
+    actor_type& reporter_;
+    message_type sessionId_;
+    message_type sum_;
+
+    explicit Session(actor_type *reporter) : CoroutineActorT(OPEN), reporter_(*reporter), sessionId_(0), sum_(0) {}
+
+    void resume(self_type& self, int port, message_type m)
+    {
+        FRACTORP_CO_BEGIN();
+        for (;;) {
+            // m is an open request
+            sessionId_ = m;
+            sum_ = 0;
+            std::printf("open session %ld\n", (long)sessionId_);
+
+            for (;;) {
+                FRACTORP_CO_AWAIT_ANY();
+                if (port == CLOSE)
+                    break;
+                else if (port == DATA)
+                    sum_ += m;
+                else
+                    std::printf("ignored port %d in session %ld\n", port, (long)sessionId_);
+            }
+
+            self.send(reporter_, sum_);
+            FRACTORP_CO_AWAIT(OPEN);
+        }
+        FRACTORP_CO_END();
+    }
+
+    void unexpected(self_type& /*self*/, int port, message_type m)
+    {
+        std::printf("ignored port %d message %ld outside a session\n", port, (long)m);
+    }
+};
+
+struct PrintMessage : public Fractorp::ActorT<AS1, PrintMessage> {
+    void initial(self_type& /*self*/, int /*port*/, message_type m)
+    {
+        std::printf("session sum: %ld\n", (long)m);
+    }
+};
+
+
+// A coroutine that finishes after three messages.
+struct Countdown : public Fractorp::CoroutineActorT<AS1, Countdown> {
+    int remaining_;
+
+    Countdown() : remaining_(3) {}
+
+    void resume(self_type& /*self*/, int /*port*/, message_type /*message*/)
+    {
+        FRACTORP_CO_BEGIN();
+        while (remaining_ > 1) {
+            std::printf("countdown: %d\n", remaining_--);
+            FRACTORP_CO_AWAIT_ANY();
+        }
+        std::printf("countdown: %d. done\n", remaining_);
+        FRACTORP_CO_END();
+    }
+
+    void unexpected(self_type& /*self*/, int /*port*/, message_type /*message*/)
+    {
+        std::printf("countdown: finished\n");
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+void test1()
+{
+    std::printf("alternating coroutine:\n");
+
+    AS1::world_type world;
+    AlternatingCoroutine alternating;
+    for (int i=0; i < 4; ++i)
+        world.inject(alternating);
+}
+
+void test2()
+{
+    std::printf("session protocol:\n");
+
+    AS1::world_type world;
+    PrintMessage printer;
+    Session session(&printer);
+
+    world.inject(session, Session::DATA, 100); // no session is open
+    world.inject(session, Session::OPEN, 7);
+    world.inject(session, Session::DATA, 1);
+    world.inject(session, Session::DATA, 2);
+    world.inject(session, Session::OPEN, 8); // already open
+    world.inject(session, Session::DATA, 3);
+    world.inject(session, Session::CLOSE, 0);
+    world.inject(session, Session::CLOSE, 0); // already closed
+    world.inject(session, Session::OPEN, 9);
+    world.inject(session, Session::DATA, 10);
+    world.inject(session, Session::CLOSE, 0);
+}
+
+void test3()
+{
+    std::printf("finishing coroutine:\n");
+
+    AS1::world_type world;
+    Countdown countdown;
+    for (int i=0; i < 4; ++i)
+        world.inject(countdown);
+    std::printf("finished: %s\n", countdown.co_finished() ? "yes" : "no");
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    (void)argc; (void)argv;
+
+    test1();
+    test2();
+    test3();
+
+    return 0;
+}
@@ -0,0 +1,530 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Don't call us, we'll call you." -- the Hollywood principle
+*/
+
+#ifndef INCLUDED_FRACTORP_EVENTLOOP_H
+#define INCLUDED_FRACTORP_EVENTLOOP_H
+
+#include <cassert>
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>
+#include <sys/epoll.h>
+#include <unistd.h>
+
+#include "Actor.h"
+
+namespace Fractorp {
+
+// EventLoop is a single-threaded, run-to-completion I/O front end for a World (Linux epoll).
+// File descriptors are registered with an endpoint. When a descriptor becomes ready the loop
+// sends an IoEvent message to the endpoint with World::inject():
+//
+//  * receive(fd, e): the loop reads the data itself, into buffers from a BufferPool, and sends
+//    each buffer as an IO_DATA event. End of stream is sent as IO_CLOSED, and a read error as
+//    IO_ERROR. In both cases the descriptor is removed first (but not closed).
+//
+//  * notify(fd, e): the loop sends IO_READABLE and/or IO_WRITABLE events, and the actor does
+//    its own I/O, e.g. accept() on a listening socket.
+//
+// Messages refer to the received bytes through a ref-counted BufferRef, so the data is never
+// copied after the read: actors may pass the reference on, or hold it for as long as they need
+// the data. The buffer returns to its pool when the last reference is released. If the pool is
+// exhausted the descriptor is /starved/: the loop stops watching it for input (rather than
+// waking for it on every poll) until a buffer is released, when reading resumes.
+//
+// Each inject() runs the receiver's behavior and then drains the World's DeferredSendQueue,
+// so each chunk of input is processed to completion before the next is read:
+//
+//      BufferPool pool(2048);
+//      EventLoop<AS> loop(world, pool);
+//      loop.receive(socket, AS::endpoint_type(connection));
+//      loop.run(); // until an actor calls loop.stop()
+//
+// AS::message_type must be constructible from an IoEvent rvalue (e.g. message_type = IoEvent).
+// Buffers and the loop are not thread safe: use them only on the World's thread.
+//
+// REVIEW: io_uring completions would fit the same interface (the loop would own the reads and
+// deliver completed buffers), but would add a liburing dependency. epoll only for now.
+
+class BufferPool;
+
+// IoBuffer is a fixed-capacity byte buffer owned by a BufferPool. The data follows the header.
+class IoBuffer {
+    friend class BufferPool;
+    friend class BufferRef;
+
+    BufferPool *pool_;
+    IoBuffer *nextFree_;
+    std::size_t refCount_;
+    std::size_t size_;
+
+    IoBuffer(const IoBuffer&);
+    IoBuffer& operator=(const IoBuffer&);
+
+    explicit IoBuffer(BufferPool *pool) : pool_(pool), nextFree_(0), refCount_(0), size_(0) {}
+
+public:
+    char* data() { return reinterpret_cast<char*>(this + 1); }
+    const char* data() const { return reinterpret_cast<const char*>(this + 1); }
+
+    std::size_t size() const { return size_; } // number of valid bytes
+    inline std::size_t capacity() const;
+
+    void set_size(std::size_t size) { assert(size <= capacity()); size_ = size; }
+};
+
+
+// BufferRef is a counted reference to an IoBuffer. A default-constructed BufferRef is null.
+class BufferRef {
+    IoBuffer *buffer_;
+
+    inline void release();
+
+public:
+    BufferRef() : buffer_(0) {}
+
+    explicit BufferRef(IoBuffer *buffer) : buffer_(buffer)
+    {
+        if (buffer_)
+            ++buffer_->refCount_;
+    }
+
+    BufferRef(const BufferRef& rhs) : buffer_(rhs.buffer_)
+    {
+        if (buffer_)
+            ++buffer_->refCount_;
+    }
+
+    BufferRef(BufferRef&& rhs) : buffer_(rhs.buffer_) { rhs.buffer_ = 0; }
+
+    ~BufferRef() { release(); }
+
+    BufferRef& operator=(const BufferRef& rhs)
+    {
+        BufferRef(rhs).swap(*this);
+        return *this;
+    }
+
+    BufferRef& operator=(BufferRef&& rhs)
+    {
+        BufferRef(std::move(rhs)).swap(*this);
+        return *this;
+    }
+
+    void swap(BufferRef& other) { std::swap(buffer_, other.buffer_); }
+
+    void reset() { release(); }
+
+    explicit operator bool() const { return buffer_ != 0; }
+
+    IoBuffer* get() const { return buffer_; }
+    IoBuffer* operator->() const { assert(buffer_); return buffer_; }
+    IoBuffer& operator*() const { assert(buffer_); return *buffer_; }
+
+    std::size_t use_count() const { return buffer_ ? buffer_->refCount_ : 0; }
+};
+
+
+// BufferPool recycles IoBuffers of bufferSize bytes through a LIFO free list, so that the most
+// recently released (hence cache-hot) buffer is reused first. Buffers are allocated on demand,
+// up to maxBufferCount (0 is unlimited), and retained until the pool is destroyed.
+// All references must be released before the pool is destroyed.
+//
+// The available handler, if set, is called when a buffer is released after acquire() has
+// failed, i.e. when an exhausted pool has a buffer available again. (EventLoop uses it to
+// resume reading starved descriptors.)
+class BufferPool {
+    friend class BufferRef;
+
+public:
+    typedef void (*available_fn_ptr_type)(void *context);
+
+private:
+    const std::size_t bufferSize_;
+    const std::size_t maxBufferCount_;
+    std::size_t allocatedCount_;
+    std::size_t inUseCount_;
+    IoBuffer *free_;
+    std::vector<IoBuffer*> buffers_;
+    bool exhausted_; // acquire() has failed since the last recycle()
+    available_fn_ptr_type availableHandler_;
+    void *availableContext_;
+
+    BufferPool(const BufferPool&);
+    BufferPool& operator=(const BufferPool&);
+
+    void recycle(IoBuffer *b)
+    {
+        b->size_ = 0;
+        b->nextFree_ = free_;
+        free_ = b;
+        --inUseCount_;
+        if (exhausted_) {
+            exhausted_ = false;
+            if (availableHandler_)
+                availableHandler_(availableContext_);
+        }
+    }
+
+public:
+    explicit BufferPool(std::size_t bufferSize, std::size_t maxBufferCount = 0)
+        : bufferSize_(bufferSize)
+        , maxBufferCount_(maxBufferCount)
+        , allocatedCount_(0)
+        , inUseCount_(0)
+        , free_(0)
+        , exhausted_(false)
+        , availableHandler_(0)
+        , availableContext_(0) {}
+
+    ~BufferPool()
+    {
+        assert(inUseCount_ == 0 && "destroying a BufferPool with referenced buffers");
+        for (std::size_t i=0; i < buffers_.size(); ++i) {
+            buffers_[i]->~IoBuffer();
+            ::operator delete(buffers_[i]);
+        }
+    }
+
+    std::size_t buffer_size() const { return bufferSize_; }
+    std::size_t allocated_count() const { return allocatedCount_; }
+    std::size_t in_use_count() const { return inUseCount_; }
+
+    // returns a null reference if maxBufferCount buffers are in use
+    BufferRef acquire()
+    {
+        IoBuffer *b = free_;
+        if (b) {
+            free_ = b->nextFree_;
+        } else {
+            if (maxBufferCount_ != 0 && allocatedCount_ == maxBufferCount_) {
+                exhausted_ = true;
+                return BufferRef();
+            }
+            b = new (::operator new(sizeof(IoBuffer) + bufferSize_)) IoBuffer(this);
+            buffers_.push_back(b);
+            ++allocatedCount_;
+        }
+        ++inUseCount_;
+        return BufferRef(b);
+    }
+
+    // at most one handler. pass a null handler to clear it
+    void set_available_handler(available_fn_ptr_type handler, void *context)
+    {
+        availableHandler_ = handler;
+        availableContext_ = context;
+    }
+};
+
+inline std::size_t IoBuffer::capacity() const { return pool_->buffer_size(); }
+
+inline void BufferRef::release()
+{
+    if (buffer_ && --buffer_->refCount_ == 0)
+        buffer_->pool_->recycle(buffer_);
+    buffer_ = 0;
+}
+
+
+// IoEvent is the message sent by EventLoop.
+struct IoEvent {
+    enum Kind {
+        IO_DATA, // buffer holds the received bytes
+        IO_READABLE,
+        IO_WRITABLE,
+        IO_CLOSED, // end of stream. the descriptor has been removed from the loop
+        IO_ERROR // error holds errno. the descriptor has been removed from the loop
+    };
+
+    int fd;
+    int kind;
+    int error;
+    BufferRef buffer;
+
+    IoEvent() : fd(-1), kind(IO_DATA), error(0) {}
+    IoEvent(int fd_, Kind kind_, int error_ = 0) : fd(fd_), kind(kind_), error(error_) {}
+    IoEvent(int fd_, BufferRef&& buffer_) : fd(fd_), kind(IO_DATA), error(0), buffer(std::move(buffer_)) {}
+};
+
+
+template<typename AS>
+class EventLoop {
+public:
+    typedef typename AS::world_type world_type;
+    typedef typename AS::endpoint_type endpoint_type;
+    typedef typename AS::message_type message_type;
+
+    enum { MAX_EVENTS_PER_POLL = 64, MAX_READS_PER_EVENT = 16 };
+
+private:
+    enum Mode { NOT_REGISTERED, RECEIVE, NOTIFY };
+
+    struct Registration {
+        endpoint_type endpoint_;
+        std::uint32_t generation_; // distinguishes re-registrations of a reused descriptor
+        Mode mode_;
+        bool starved_; // RECEIVE descriptor not watched for input until a buffer is released
+
+        Registration() : generation_(0), mode_(NOT_REGISTERED), starved_(false) {}
+    };
+
+    world_type& world_;
+    BufferPool& pool_;
+    int epollFd_;
+    std::vector<Registration> registrations_; // indexed by descriptor
+    std::size_t registeredCount_;
+    std::vector<int> starved_; // may include descriptors that have since been removed
+    int error_;
+    bool stopping_;
+
+    EventLoop(const EventLoop&);
+    EventLoop& operator=(const EventLoop&);
+
+    bool add(int fd, const endpoint_type& e, Mode mode, std::uint32_t events)
+    {
+        assert(fd >= 0);
+        if (static_cast<std::size_t>(fd) >= registrations_.size())
+            registrations_.resize(fd + 1);
+        Registration& r = registrations_[fd];
+        assert(r.mode_ == NOT_REGISTERED && "descriptor is already registered");
+
+        epoll_event ev;
+        ev.events = events;
+        ev.data.u64 = event_data(fd, r.generation_ + 1);
+        if (::epoll_ctl(epollFd_, EPOLL_CTL_ADD, fd, &ev) != 0)
+            return false;
+
+        ++r.generation_;
+        r.endpoint_ = e;
+        r.mode_ = mode;
+        r.starved_ = false;
+        ++registeredCount_;
+        return true;
+    }
+
+    static std::uint64_t event_data(int fd, std::uint32_t generation) { return (static_cast<std::uint64_t>(generation) << 32) | static_cast<std::uint32_t>(fd); }
+
+    // stop watching a RECEIVE descriptor for input, because the pool is exhausted. EPOLLHUP
+    // and EPOLLERR can't be masked, so they are reported at most once (EPOLLONESHOT) and ignored.
+    void starve(int fd)
+    {
+        Registration& r = registrations_[fd];
+        epoll_event ev;
+        ev.events = EPOLLONESHOT;
+        ev.data.u64 = event_data(fd, r.generation_);
+        ::epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
+        r.starved_ = true;
+        starved_.push_back(fd);
+    }
+
+    static void buffer_available(void *context) { static_cast<EventLoop*>(context)->resume_starved(); }
+
+    // called when the pool has a buffer available again: watch the starved descriptors for input.
+    // a descriptor that isn't readable any more stays quiet, and one for which there are still too
+    // few buffers starves again.
+    void resume_starved()
+    {
+        std::vector<int> starved;
+        starved.swap(starved_);
+        for (std::size_t i=0; i < starved.size(); ++i) {
+            const int fd = starved[i];
+            Registration& r = registrations_[fd];
+            if (!r.starved_)
+                continue; // removed (and perhaps re-registered) since it starved
+            epoll_event ev;
+            ev.events = EPOLLIN | EPOLLRDHUP;
+            ev.data.u64 = event_data(fd, r.generation_);
+            ::epoll_ctl(epollFd_, EPOLL_CTL_MOD, fd, &ev);
+            r.starved_ = false;
+        }
+        starved.clear();
+        if (starved_.empty())
+            starved_.swap(starved); // keep the capacity
+    }
+
+    // the registration that an event was raised for, or null if it has since been removed
+    Registration* find(std::uint64_t data)
+    {
+        const std::size_t fd = static_cast<std::uint32_t>(data);
+        if (fd >= registrations_.size())
+            return 0;
+        Registration& r = registrations_[fd];
+        return (r.mode_ != NOT_REGISTERED && r.generation_ == static_cast<std::uint32_t>(data >> 32)) ? &r : 0;
+    }
+
+    void send(const endpoint_type& e, IoEvent&& event) { world_.inject(e, message_type(std::move(event))); }
+
+    // returns the number of messages sent
+    std::size_t read_available(int fd, std::uint64_t data)
+    {
+        std::size_t count = 0;
+        for (int i=0; i < MAX_READS_PER_EVENT; ++i) {
+            Registration *r = find(data);
+            if (!r)
+                break; // removed by a behavior
+
+            BufferRef buffer = pool_.acquire();
+            if (!buffer) {
+                starve(fd);
+                break;
+            }
+
+            ssize_t n = ::read(fd, buffer->data(), buffer->capacity());
+            if (n > 0) {
+                buffer->set_size(static_cast<std::size_t>(n));
+                send(r->endpoint_, IoEvent(fd, std::move(buffer)));
+                ++count;
+                if (static_cast<std::size_t>(n) < pool_.buffer_size())
+                    break; // probably drained. epoll will tell us otherwise
+            } else if (n == 0) {
+                endpoint_type e = r->endpoint_;
+                remove(fd);
+                send(e, IoEvent(fd, IoEvent::IO_CLOSED));
+                ++count;
+                break;
+            } else if (errno == EINTR) {
+                continue;
+            } else {
+                const int error = errno;
+                if (error == EAGAIN || error == EWOULDBLOCK)
+                    break;
+                endpoint_type e = r->endpoint_;
+                remove(fd);
+                send(e, IoEvent(fd, IoEvent::IO_ERROR, error));
+                ++count;
+                break;
+            }
+        }
+        return count;
+    }
+
+public:
+    EventLoop(world_type& world, BufferPool& pool)
+        : world_(world)
+        , pool_(pool)
+        , epollFd_(::epoll_create1(EPOLL_CLOEXEC))
+        , registeredCount_(0)
+        , error_(0)
+        , stopping_(false)
+    {
+        assert(epollFd_ >= 0 && "epoll_create1() failed");
+        pool_.set_available_handler(&EventLoop::buffer_available, this);
+    }
+
+    ~EventLoop()
+    {
+        pool_.set_available_handler(0, 0);
+        ::close(epollFd_);
+    }
+
+    // receive() reads fd whenever it is readable, and sends the data to e (see above).
+    // fd is made non-blocking. Returns false (with errno set) if fd can't be registered.
+    bool receive(int fd, const endpoint_type& e)
+    {
+        const int flags = ::fcntl(fd, F_GETFL);
+        if (flags < 0 || ::fcntl(fd, F_SETFL, flags | O_NONBLOCK) != 0)
+            return false;
+        return add(fd, e, RECEIVE, EPOLLIN | EPOLLRDHUP);
+    }
+
+    // notify() sends IO_READABLE and/or IO_WRITABLE events to e while fd is ready.
+    // Returns false (with errno set) if fd can't be registered.
+    bool notify(int fd, const endpoint_type& e, bool readable = true, bool writable = false)
+    {
+        assert(readable || writable);
+        return add(fd, e, NOTIFY, (readable ? static_cast<std::uint32_t>(EPOLLIN) : 0) | (writable ? static_cast<std::uint32_t>(EPOLLOUT) : 0));
+    }
+
+    // remove() stops watching fd. Pending events for fd are discarded. May be called from
+    // within behaviors. The descriptor is not closed.
+    bool remove(int fd)
+    {
+        if (fd < 0 || static_cast<std::size_t>(fd) >= registrations_.size() || registrations_[fd].mode_ == NOT_REGISTERED)
+            return false;
+        ::epoll_ctl(epollFd_, EPOLL_CTL_DEL, fd, 0);
+        registrations_[fd].mode_ = NOT_REGISTERED;
+        registrations_[fd].starved_ = false;
+        registrations_[fd].endpoint_ = endpoint_type();
+        --registeredCount_;
+        return true;
+    }
+
+    std::size_t registered_count() const { return registeredCount_; }
+
+    // the number of descriptors waiting for a buffer to be released (see BufferPool)
+    std::size_t starved_count() const
+    {
+        std::size_t count = 0;
+        for (std::size_t i=0; i < starved_.size(); ++i)
+            count += registrations_[starved_[i]].starved_;
+        return count;
+    }
+
+    // the errno of the epoll_wait() failure that stopped poll(), or 0
+    int error() const { return error_; }
+
+    // poll() waits up to timeoutMs (-1 is forever) for readiness, then dispatches the ready
+    // descriptors, each to completion. Returns the number of messages sent. If epoll_wait()
+    // fails, other than with EINTR, returns 0 and sets error().
+    std::size_t poll(int timeoutMs)
+    {
+        epoll_event events[MAX_EVENTS_PER_POLL];
+        int n = ::epoll_wait(epollFd_, events, MAX_EVENTS_PER_POLL, timeoutMs);
+        if (n < 0) {
+            if (errno != EINTR)
+                error_ = errno;
+            return 0;
+        }
+
+        std::size_t count = 0;
+        for (int i=0; i < n; ++i) {
+            const std::uint64_t data = events[i].data.u64;
+            Registration *r = find(data);
+            if (!r)
+                continue; // removed by an earlier event's behavior
+            const int fd = static_cast<int>(static_cast<std::uint32_t>(data));
+
+            if (r->mode_ == RECEIVE) {
+                if (!r->starved_) // a starved descriptor's (one shot) hang-up waits for a buffer
+                    count += read_available(fd, data);
+                continue;
+            }
+
+            if (events[i].events & (EPOLLIN | EPOLLHUP | EPOLLERR)) {
+                send(r->endpoint_, IoEvent(fd, IoEvent::IO_READABLE));
+                ++count;
+            }
+            if ((events[i].events & EPOLLOUT) && (r = find(data)) != 0) {
+                send(r->endpoint_, IoEvent(fd, IoEvent::IO_WRITABLE));
+                ++count;
+            }
+        }
+        return count;
+    }
+
+    // run() polls until stop() is called, until no descriptors are registered, or until
+    // epoll_wait() fails (see error()).
+    void run()
+    {
+        stopping_ = false;
+        error_ = 0;
+        while (!stopping_ && registeredCount_ > 0 && error_ == 0)
+            poll(-1);
+    }
+
+    // stop() may be called from within behaviors. run() returns after the current poll.
+    void stop() { stopping_ = true; }
+};
+
+} // end namespace Fractorp
+
+#endif /* INCLUDED_FRACTORP_EVENTLOOP_H */
@@ -0,0 +1,226 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Give every man thy ear, but few thy voice." -- William Shakespeare
+*/
+
+#include "EventLoop.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <sys/socket.h>
+#include <unistd.h>
+
+using namespace Fractorp;
+
+typedef void* shared_context_type;
+typedef IoEvent message_type;
+typedef ActorSpace<shared_context_type, message_type> AS1;
+typedef EventLoop<AS1> event_loop_type;
+
+
+// Accumulates received data. While holding_ is set it keeps a reference to every buffer.
+struct Collector : public Fractorp::ActorT<AS1, Collector> {
+    std::string data_;
+    int chunkCount_;
+    bool closed_;
+    bool holding_;
+    std::vector<BufferRef> held_;
+    event_loop_type *stopWhenClosed_;
+
+    Collector() : chunkCount_(0), closed_(false), holding_(false), stopWhenClosed_(0) {}
+
+    void initial(self_type& /*self*/, int /*port*/, const message_type& m)
+    {
+        if (m.kind == IoEvent::IO_DATA) {
+            data_.append(m.buffer->data(), m.buffer->size());
+            ++chunkCount_;
+            if (holding_)
+                held_.push_back(m.buffer);
+        } else if (m.kind == IoEvent::IO_CLOSED) {
+            closed_ = true;
+            if (stopWhenClosed_)
+                stopWhenClosed_->stop();
+        }
+    }
+};
+
+// Forwards each event to the collector via a send to itself (hence a deferred send). The
+// buffer reference is moved, not copied, and the data is never copied.
+struct Relay : public Fractorp::ActorT<AS1, Relay> {
+    actor_type& collector_;
+
+    explicit Relay(actor_type *collector) : collector_(*collector) {}
+
+    void initial(self_type& self, int port, message_type&& m)
+    {
+        if (port == 0)
+            self.send(*this, 1, std::move(m));
+        else
+            self.send(collector_, std::move(m));
+    }
+};
+
+// Writes a message to a pipe when it becomes writable, then stops watching it.
+struct Writer : public Fractorp::ActorT<AS1, Writer> {
+    event_loop_type& loop_;
+    const char *text_;
+
+    Writer(event_loop_type *loop, const char *text) : loop_(*loop), text_(text) {}
+
+    void initial(self_type& /*self*/, int /*port*/, const message_type& m)
+    {
+        if (m.kind == IoEvent::IO_WRITABLE) {
+            ssize_t n = ::write(m.fd, text_, std::strlen(text_));
+            (void)n;
+            loop_.remove(m.fd);
+            ::close(m.fd); // end of stream for the reader
+        }
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+void test1()
+{
+    std::printf("receive:\n");
+
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        return;
+
+    AS1::world_type world;
+    BufferPool pool(1024);
+    event_loop_type loop(world, pool);
+    Collector collector;
+    loop.receive(fds[0], AS1::endpoint_type(collector));
+
+    ssize_t n = ::write(fds[1], "hello, world", 12);
+    (void)n;
+    loop.poll(0);
+    std::printf("chunks: %d data: %s\n", collector.chunkCount_, collector.data_.c_str());
+
+    ::close(fds[1]);
+    loop.poll(0);
+    std::printf("closed: %d registered: %d buffers in use: %d\n", (int)collector.closed_, (int)loop.registered_count(), (int)pool.in_use_count());
+    ::close(fds[0]);
+}
+
+void test2()
+{
+    std::printf("pool exhaustion:\n");
+
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        return;
+
+    AS1::world_type world;
+    BufferPool pool(16, 4); // 4 buffers of 16 bytes
+    event_loop_type loop(world, pool);
+    Collector collector;
+    collector.holding_ = true;
+    loop.receive(fds[0], AS1::endpoint_type(collector));
+
+    char data[100];
+    for (int i=0; i < 100; ++i)
+        data[i] = 'a' + (i % 26);
+    ssize_t n = ::write(fds[1], data, sizeof(data));
+    (void)n;
+
+    loop.poll(0); // stops reading when the pool is exhausted
+    std::printf("received: %d chunks: %d buffers in use: %d starved: %d\n", (int)collector.data_.size(), collector.chunkCount_,
+        (int)pool.in_use_count(), (int)loop.starved_count());
+
+    collector.held_.clear();
+    collector.holding_ = false;
+    loop.poll(0);
+    std::printf("received: %d chunks: %d buffers allocated: %d in use: %d intact: %d starved: %d\n",
+        (int)collector.data_.size(), collector.chunkCount_, (int)pool.allocated_count(), (int)pool.in_use_count(),
+        (int)(collector.data_ == std::string(data, sizeof(data))), (int)loop.starved_count());
+
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
+
+void test3()
+{
+    std::printf("run to completion:\n");
+
+    int fds[2];
+    if (::pipe(fds) != 0)
+        return;
+
+    AS1::world_type world;
+    BufferPool pool(1024);
+    event_loop_type loop(world, pool);
+
+    Collector collector;
+    collector.stopWhenClosed_ = &loop;
+    Relay relay(&collector);
+    Writer writer(&loop, "ping");
+    loop.receive(fds[0], AS1::endpoint_type(relay));
+    loop.notify(fds[1], AS1::endpoint_type(writer), false, true);
+
+    loop.run();
+    std::printf("data: %s closed: %d buffers in use: %d\n", collector.data_.c_str(), (int)collector.closed_, (int)pool.in_use_count());
+    ::close(fds[0]);
+}
+
+void test4()
+{
+    std::printf("starved descriptors:\n");
+
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        return;
+
+    AS1::world_type world;
+    BufferPool pool(16, 2);
+    event_loop_type loop(world, pool);
+    Collector collector;
+    collector.holding_ = true;
+    loop.receive(fds[0], AS1::endpoint_type(collector));
+
+    char data[64];
+    std::memset(data, 'x', sizeof(data));
+    ssize_t n = ::write(fds[1], data, sizeof(data));
+    (void)n;
+    loop.poll(0);
+
+    // the unread input doesn't wake the loop while the pool is exhausted: poll() times out
+    const std::chrono::steady_clock::time_point start = std::chrono::steady_clock::now();
+    std::size_t sent = 0;
+    for (int i=0; i < 3; ++i)
+        sent += loop.poll(50);
+    const long elapsedMs = (long)std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+    std::printf("chunks: %d starved: %d sent while starved: %d blocked: %d\n",
+        collector.chunkCount_, (int)loop.starved_count(), (int)sent, (int)(elapsedMs >= 140));
+
+    // releasing a buffer resumes reading, and the hang-up is delivered after the data
+    ::close(fds[1]);
+    collector.holding_ = false;
+    collector.held_.clear();
+    while (!collector.closed_ && loop.poll(1000) != 0)
+        ;
+    std::printf("received: %d closed: %d starved: %d registered: %d\n",
+        (int)collector.data_.size(), (int)collector.closed_, (int)loop.starved_count(), (int)loop.registered_count());
+    ::close(fds[0]);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    (void)argc; (void)argv;
+
+    test1();
+    test2();
+    test3();
+    test4();
+
+    return 0;
+}
@@ -0,0 +1,1027 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Many hands make light work." -- John Heywood
+*/
+
+#ifndef INCLUDED_FRACTORP_PARALLELWORLD_H
+#define INCLUDED_FRACTORP_PARALLELWORLD_H
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "Actor.h" // Endpoint, SlabAllocator
+
+#ifndef FRACTORP_CACHE_LINE_SIZE
+#define FRACTORP_CACHE_LINE_SIZE 64
+#endif
+
+namespace Fractorp {
+
+// ParallelWorld runs actors on N worker threads.
+//
+// The single-threaded World delivers a send by calling the receiver's behavior directly,
+// and relies on Self to defer re-entrant sends. That can't work across threads: two
+// threads could call into the same actor at once. Instead, in a ParallelWorld:
+//
+//  * Every ParallelActor has an intrusive multi-producer/single-consumer mailbox, and a
+//    /scheduled/ flag. send() appends the message to the receiver's mailbox. The sender
+//    that sets the scheduled flag pushes the receiver onto its own worker's run queue.
+//
+//  * Each worker has a lock-free work-stealing deque (run queue) of scheduled actors.
+//    Workers pop from their own deque, and steal from the other workers' deques when idle.
+//
+//  * Only the worker that holds an actor's scheduled flag runs its behaviors. Hence an
+//    actor's behavior is never run concurrently with itself, and never re-entered. The
+//    worker drains a bounded number of mailbox messages per scheduling, then clears the flag.
+//
+// There is no ordering guarantee between messages sent by different actors.
+// Messages from one sender to one receiver are delivered in the order that they were sent.
+//
+// Actors are written in the same style as for World, deriving from ParallelActorT:
+//
+//      typedef ParallelActorSpace<S, M> PAS;
+//      struct MyActor : public ParallelActorT<PAS, MyActor> {
+//          void initial(self_type& self, int port, message_type message) { ... }
+//      };
+//
+// Cache line layout. Every send writes the receiver's mailbox head and scheduled flag, and
+// every behavior may write its behaviorFn_. Small actors that are allocated next to each other
+// but run on different workers therefore contend for cache lines (false sharing). Two controls
+// avoid this:
+//
+//  * The layout argument of ParallelActorT. CacheLineActorLayout aligns and pads each actor
+//    of a type to FRACTORP_CACHE_LINE_SIZE. The default, PackedActorLayout, doesn't.
+//
+//  * Worker-grouped allocation. Actors that declare enum { slab_allocated = true }; may be
+//    created with ParallelSelf::create() or ParallelWorld::create(). Each worker has its own
+//    slab allocator with cache-line aligned chunks, so an actor only shares cache lines with
+//    other actors created on the same worker. (Stealing may still run an actor elsewhere.)
+//    An actor created on one worker and deleted on another is returned to its owner's slab.
+//
+// Placement. By default any worker may run an actor. An actor may instead be pinned to a
+// worker, e.g. to keep audio-rate actors on a real-time thread:
+//
+//      a.pin_to(0); // before the first message is sent to a
+//      self.pin_to(self.worker_index()); // or from within a behavior
+//
+// A pinned actor is only ever run by its worker, and is never stolen. When it is scheduled from
+// another thread it is posted to the worker's inbox. A send from a behavior running on the
+// pinned worker is dispatched directly, as in World, whenever the receiver is idle and its
+// mailbox is empty: the behavior is called from within send(), without touching the mailbox.
+// Otherwise (the receiver is running, or has queued messages) the message is queued as usual,
+// so per-sender message order is preserved. Direct dispatch is nested at most
+// MAX_DIRECT_DISPATCH_DEPTH deep.
+
+template<typename S, typename M>
+struct ParallelActor;
+
+template<typename S, typename M>
+class ParallelWorker;
+
+template<typename S, typename M>
+class ParallelWorld;
+
+
+// Mailbox entry. Entries are recycled through per-worker free lists (see ParallelWorker).
+template<typename M>
+struct MailboxNode {
+    std::atomic<MailboxNode*> next_;
+    int port_;
+    M message_;
+
+    MailboxNode() : next_(0), port_(0), message_() {}
+};
+
+
+// Intrusive MPSC queue, after Dmitry Vyukov's "Intrusive MPSC node-based queue".
+// push() is wait-free and may be called from any thread. pop() may only be called by the
+// thread that currently holds the owning actor's scheduled flag.
+template<typename M>
+class Mailbox {
+    typedef MailboxNode<M> node_type;
+
+    std::atomic<node_type*> head_; // most recently pushed node. modified by producers
+    node_type *tail_; // next node to pop. consumer only
+    node_type stub_;
+
+    Mailbox(const Mailbox&);
+    Mailbox& operator=(const Mailbox&);
+
+public:
+    Mailbox() : head_(&stub_), tail_(&stub_) {}
+
+    void push(node_type *n)
+    {
+        n->next_.store(0, std::memory_order_relaxed);
+        node_type *prev = head_.exchange(n); // seq_cst: see ParallelWorker::run()
+        prev->next_.store(n, std::memory_order_release);
+    }
+
+    // Returns 0 if the mailbox is empty, or if a concurrent push() has not completed.
+    node_type* pop()
+    {
+        node_type *tail = tail_;
+        node_type *next = tail->next_.load(std::memory_order_acquire);
+        if (tail == &stub_) {
+            if (!next)
+                return 0;
+            tail_ = next;
+            tail = next;
+            next = next->next_.load(std::memory_order_acquire);
+        }
+
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+
+        if (tail != head_.load(std::memory_order_acquire))
+            return 0; // a push() is in progress
+
+        push(&stub_);
+        next = tail->next_.load(std::memory_order_acquire);
+        if (next) {
+            tail_ = next;
+            return tail;
+        }
+        return 0;
+    }
+
+    // Only meaningful to the consumer, after pop() has returned 0: true if a push()
+    // has started since the mailbox was drained.
+    bool pushed_since_drained() const { return head_.load() != &stub_; } // seq_cst
+};
+
+
+// Fixed-capacity work-stealing deque, after Le, Pop, Cohen and Nardelli,
+// "Correct and Efficient Work-Stealing for Weak Memory Models" (PPoPP 2013).
+// push() and pop() may only be called by the owning worker. steal() may be called by any thread.
+template<typename T, std::size_t Capacity>
+class WorkStealingDeque {
+    static_assert(Capacity > 0 && (Capacity & (Capacity - 1)) == 0, "Capacity must be a power of two");
+
+    // top_ is written by thieves, bottom_ and buffer_ by the owner
+    alignas(FRACTORP_CACHE_LINE_SIZE) std::atomic<std::ptrdiff_t> top_;
+    alignas(FRACTORP_CACHE_LINE_SIZE) std::atomic<std::ptrdiff_t> bottom_;
+    std::atomic<T*> buffer_[Capacity];
+
+    WorkStealingDeque(const WorkStealingDeque&);
+    WorkStealingDeque& operator=(const WorkStealingDeque&);
+
+public:
+    WorkStealingDeque() : top_(0), bottom_(0)
+    {
+        for (std::size_t i=0; i < Capacity; ++i)
+            buffer_[i].store(0, std::memory_order_relaxed);
+    }
+
+    // Returns false if the deque is full.
+    bool push(T *x)
+    {
+        std::ptrdiff_t b = bottom_.load(std::memory_order_relaxed);
+        std::ptrdiff_t t = top_.load(std::memory_order_acquire);
+        if (b - t >= static_cast<std::ptrdiff_t>(Capacity))
+            return false;
+        buffer_[b & (Capacity - 1)].store(x, std::memory_order_relaxed);
+        bottom_.store(b + 1, std::memory_order_release); // (the paper uses a release fence)
+        return true;
+    }
+
+    T* pop()
+    {
+        std::ptrdiff_t b = bottom_.load(std::memory_order_relaxed) - 1;
+        bottom_.store(b, std::memory_order_relaxed);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::ptrdiff_t t = top_.load(std::memory_order_relaxed);
+        if (t > b) { // empty
+            bottom_.store(b + 1, std::memory_order_relaxed);
+            return 0;
+        }
+
+        T *x = buffer_[b & (Capacity - 1)].load(std::memory_order_relaxed);
+        if (t == b) { // last element. race against thieves
+            if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+                x = 0;
+            bottom_.store(b + 1, std::memory_order_relaxed);
+        }
+        return x;
+    }
+
+    T* steal()
+    {
+        std::ptrdiff_t t = top_.load(std::memory_order_acquire);
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        std::ptrdiff_t b = bottom_.load(std::memory_order_acquire);
+        if (t >= b)
+            return 0;
+
+        T *x = buffer_[t & (Capacity - 1)].load(std::memory_order_relaxed);
+        if (!top_.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed))
+            return 0; // lost the race
+        return x;
+    }
+
+    // may be called by any thread. true if there was nothing to steal
+    bool empty() const { return top_.load(std::memory_order_acquire) >= bottom_.load(std::memory_order_acquire); }
+};
+
+
+// WorkerSlab is a worker's actor allocator. allocate() and free() may only be called by the
+// owning worker (or by any thread while the world is idle). free_remote() may be called from
+// any thread: the block is pushed onto a lock-free stack, and returned to the slab by the
+// owner's next allocate().
+class WorkerSlab {
+    struct RemoteBlock {
+        RemoteBlock *next_;
+        std::size_t size_;
+    };
+    static_assert(sizeof(RemoteBlock) <= SlabAllocator::GRANULE, "RemoteBlock must fit in the smallest block");
+
+    SlabAllocator slab_;
+    alignas(FRACTORP_CACHE_LINE_SIZE) std::atomic<RemoteBlock*> remoteFrees_; // written by other workers
+
+    WorkerSlab(const WorkerSlab&);
+    WorkerSlab& operator=(const WorkerSlab&);
+
+public:
+    WorkerSlab() : slab_(FRACTORP_CACHE_LINE_SIZE), remoteFrees_(0) {}
+
+    ~WorkerSlab() { reclaim_remote_frees(); }
+
+    void* allocate(std::size_t size)
+    {
+        reclaim_remote_frees();
+        return slab_.allocate(size);
+    }
+
+    void free(void *p, std::size_t size) { slab_.free(p, size); }
+
+    void free_remote(void *p, std::size_t size)
+    {
+        RemoteBlock *b = static_cast<RemoteBlock*>(p);
+        b->size_ = size;
+        RemoteBlock *head = remoteFrees_.load(std::memory_order_relaxed);
+        do {
+            b->next_ = head;
+        } while (!remoteFrees_.compare_exchange_weak(head, b, std::memory_order_release, std::memory_order_relaxed));
+    }
+
+    void reclaim_remote_frees()
+    {
+        if (!remoteFrees_.load(std::memory_order_relaxed))
+            return;
+        RemoteBlock *b = remoteFrees_.exchange(0, std::memory_order_acquire);
+        while (b) {
+            RemoteBlock *next = b->next_;
+            slab_.free(b, b->size_);
+            b = next;
+        }
+    }
+};
+
+
+// Layout arguments for ParallelActorT. Actors are aligned to the layout's alignment, or
+// their natural alignment if that is stricter. sizeof is padded to a multiple of the alignment.
+struct PackedActorLayout {
+    enum { alignment = 1 };
+};
+
+template<std::size_t N = FRACTORP_CACHE_LINE_SIZE>
+struct CacheLineActorLayout {
+    static_assert(N > 0 && (N & (N - 1)) == 0, "alignment must be a power of two");
+    enum { alignment = N };
+};
+
+
+template<typename S, typename M>
+struct ParallelActor {
+    typedef S shared_context_type;
+    typedef M message_type;
+    typedef ParallelActor<shared_context_type, message_type> actor_type;
+    typedef Endpoint<actor_type> endpoint_type;
+    typedef ParallelWorker<shared_context_type, message_type> world_type; // the per-thread view of the world
+
+    typedef void (*behavior_fn_ptr_type)(world_type&, actor_type&, int port, message_type message);
+
+    // only accessed by the worker that holds scheduled_
+    behavior_fn_ptr_type behaviorFn_;
+
+    Mailbox<message_type> mailbox_;
+    std::atomic<bool> scheduled_;
+
+    enum { NO_WORKER = 0xFFFF };
+
+    // index of the worker whose slab the actor was allocated from, or NO_WORKER.
+    // set by create()
+    std::uint16_t ownerWorker_;
+
+    // index of the worker the actor is pinned to, or NO_WORKER. written by the worker that
+    // holds scheduled_, read by senders
+    std::atomic<std::uint16_t> pinnedWorker_;
+
+    static ParallelActor& null() { static ParallelActor nullActor; return nullActor; }
+
+    ParallelActor() : behaviorFn_(&actor_type::nullBehavior), scheduled_(false), ownerWorker_(NO_WORKER), pinnedWorker_(NO_WORKER) {}
+    explicit ParallelActor(behavior_fn_ptr_type behaviorFn) : behaviorFn_(behaviorFn), scheduled_(false), ownerWorker_(NO_WORKER), pinnedWorker_(NO_WORKER) {}
+
+    // pin_to() and unpin() may be called before any message has been sent to the actor.
+    // Afterwards use ParallelSelf::pin_to().
+    void pin_to(std::size_t workerIndex) { pinnedWorker_.store(static_cast<std::uint16_t>(workerIndex), std::memory_order_relaxed); }
+    void unpin() { pinnedWorker_.store(NO_WORKER, std::memory_order_relaxed); }
+
+    // NO_WORKER if the actor is not pinned
+    std::size_t pinned_worker() const { return pinnedWorker_.load(std::memory_order_relaxed); }
+
+    // It's fatal to send a message to an uninitialized ParallelActor or actor ref.
+    static void nullBehavior(world_type&, actor_type&, int /*port*/, message_type /*message*/)
+    {
+        assert(false && "sending message to uninitialized actor or endpoint");
+    }
+
+private:
+    ParallelActor(const ParallelActor&);
+    ParallelActor& operator=(const ParallelActor&);
+};
+
+
+namespace parallel_detail {
+
+// operator new doesn't honour over-alignment before C++17
+inline void* allocate_aligned(std::size_t size, std::size_t alignment)
+{
+    if (alignment < sizeof(void*))
+        alignment = sizeof(void*);
+    char *allocation = static_cast<char*>(::operator new(size + alignment + sizeof(void*)));
+    char *p = reinterpret_cast<char*>((reinterpret_cast<std::uintptr_t>(allocation) + sizeof(void*) + alignment - 1) & ~(alignment - 1));
+    reinterpret_cast<void**>(p)[-1] = allocation;
+    return p;
+}
+
+inline void free_aligned(void *p)
+{
+    ::operator delete(reinterpret_cast<void**>(p)[-1]);
+}
+
+template<typename L, typename A>
+struct actor_alignment {
+    enum { value = static_cast<std::size_t>(L::alignment) > alignof(A) ? static_cast<std::size_t>(L::alignment) : alignof(A) };
+};
+
+template<typename T>
+void check_slab_creatable()
+{
+    static_assert(T::slab_allocated, "create<T>() requires that T declares enum { slab_allocated = true }");
+    static_assert(alignof(T) <= FRACTORP_CACHE_LINE_SIZE, "T is over-aligned for WorkerSlab");
+    static_assert(alignof(T) <= SlabAllocator::GRANULE || sizeof(T) <= SlabAllocator::MAX_BLOCK_SIZE,
+        "over-aligned actors must not be larger than SlabAllocator::MAX_BLOCK_SIZE");
+}
+
+} // end namespace parallel_detail
+
+
+// ParallelWorker is the per-thread context passed to behaviors of actors in a ParallelWorld.
+// Workers are cache-line aligned so that workers' run queues and slabs don't share lines.
+template<typename S, typename M>
+class ParallelWorker {
+    typedef S shared_context_type;
+    typedef M message_type;
+    typedef ParallelActor<shared_context_type, message_type> actor_type;
+    typedef MailboxNode<message_type> node_type;
+    typedef ParallelWorld<shared_context_type, message_type> parallel_world_type;
+
+    friend class ParallelWorld<shared_context_type, message_type>;
+
+    enum { RUN_QUEUE_CAPACITY = 4096, MESSAGES_PER_SCHEDULING = 64, MAX_DIRECT_DISPATCH_DEPTH = 16 };
+
+    parallel_world_type& parallelWorld_;
+    std::size_t index_;
+    WorkStealingDeque<actor_type, RUN_QUEUE_CAPACITY> runQueue_;
+    alignas(FRACTORP_CACHE_LINE_SIZE) node_type *freeNodes_; // thread-local free list. linked through next_
+    bool currentActorDeleted_;
+    int directDispatchDepth_;
+    std::deque<actor_type*> pinnedRunQueue_; // scheduled actors pinned to this worker. never stolen
+    WorkerSlab slab_;
+
+    // pinned actors scheduled by other threads
+    alignas(FRACTORP_CACHE_LINE_SIZE) std::mutex inboxMutex_;
+    std::vector<actor_type*> inbox_;
+    std::atomic<std::size_t> inboxSize_;
+
+    ParallelWorker(const ParallelWorker&);
+    ParallelWorker& operator=(const ParallelWorker&);
+
+    ParallelWorker(parallel_world_type& parallelWorld, std::size_t index)
+        : parallelWorld_(parallelWorld)
+        , index_(index)
+        , freeNodes_(0)
+        , currentActorDeleted_(false)
+        , directDispatchDepth_(0)
+        , inboxSize_(0) {}
+
+    ~ParallelWorker()
+    {
+        while (freeNodes_) {
+            node_type *n = freeNodes_;
+            freeNodes_ = n->next_.load(std::memory_order_relaxed);
+            delete n;
+        }
+    }
+
+    node_type* allocate_node()
+    {
+        node_type *n = freeNodes_;
+        if (n) {
+            freeNodes_ = n->next_.load(std::memory_order_relaxed);
+            return n;
+        }
+        return new node_type;
+    }
+
+    void free_node(node_type *n)
+    {
+        n->next_.store(freeNodes_, std::memory_order_relaxed);
+        freeNodes_ = n;
+    }
+
+    void schedule(actor_type& a)
+    {
+        const std::size_t pinned = a.pinned_worker();
+        assert((pinned == actor_type::NO_WORKER || pinned < parallelWorld_.worker_count()) && "actor is pinned to a nonexistent worker");
+        if (pinned == index_)
+            pinnedRunQueue_.push_back(&a);
+        else if (pinned != actor_type::NO_WORKER)
+            parallelWorld_.workers_[pinned]->post_to_inbox(a);
+        else if (!runQueue_.push(&a))
+            parallelWorld_.schedule_shared(a); // run queue is full
+        else
+            parallelWorld_.wake_idle_worker();
+    }
+
+    // may be called from any thread
+    void post_to_inbox(actor_type& a)
+    {
+        {
+            std::lock_guard<std::mutex> lock(inboxMutex_);
+            inbox_.push_back(&a);
+            inboxSize_.fetch_add(1, std::memory_order_release);
+        }
+        parallelWorld_.wake_idle_workers(); // this worker in particular
+    }
+
+    actor_type* take_pinned()
+    {
+        if (pinnedRunQueue_.empty() && inboxSize_.load(std::memory_order_acquire) != 0) {
+            std::lock_guard<std::mutex> lock(inboxMutex_);
+            pinnedRunQueue_.insert(pinnedRunQueue_.end(), inbox_.begin(), inbox_.end());
+            inboxSize_.fetch_sub(inbox_.size(), std::memory_order_release);
+            inbox_.clear();
+        }
+        if (pinnedRunQueue_.empty())
+            return 0;
+        actor_type *a = pinnedRunQueue_.front();
+        pinnedRunQueue_.pop_front();
+        return a;
+    }
+
+    // Release the actor. If a message arrived after the mailbox was drained, the sender may
+    // have seen scheduled_ == true and not scheduled the actor, so try to take it back. The
+    // seq_cst operations on scheduled_ and the mailbox head ensure that at least one of us sees
+    // the other's write.
+    void release(actor_type& a)
+    {
+        a.scheduled_.store(false);
+        if (a.mailbox_.pushed_since_drained() && !a.scheduled_.exchange(true))
+            schedule(a);
+    }
+
+    void post(actor_type& a, int port, message_type m)
+    {
+        node_type *n = allocate_node();
+        n->port_ = port;
+        n->message_ = m;
+        parallelWorld_.message_posted();
+        a.mailbox_.push(n);
+    }
+
+    // precondition: this worker holds a.scheduled_
+    void run(actor_type& a)
+    {
+        // processed messages are counted as done only once we have stopped touching a.
+        // until then wait_idle() can't return, so a can't be destroyed underneath us.
+        long done = 0;
+        for (int i=0; i < MESSAGES_PER_SCHEDULING; ++i) {
+            node_type *n = a.mailbox_.pop();
+            if (!n) {
+                release(a);
+                parallelWorld_.messages_done(done);
+                return;
+            }
+
+            int port = n->port_;
+            message_type m = n->message_;
+            free_node(n);
+
+            a.behaviorFn_(*this, a, port, m);
+            ++done;
+
+            if (currentActorDeleted_) {
+                currentActorDeleted_ = false;
+                parallelWorld_.messages_done(done);
+                return; // a no longer exists.
+            }
+        }
+
+        schedule(a); // give other actors a turn.
+        parallelWorld_.messages_done(done);
+    }
+
+    void run_loop()
+    {
+        int idleRounds = 0;
+        while (!parallelWorld_.stopping()) {
+            actor_type *a = take_pinned();
+            if (!a)
+                a = runQueue_.pop();
+            if (!a)
+                a = parallelWorld_.take_shared();
+            if (!a)
+                a = parallelWorld_.steal(index_);
+
+            if (a) {
+                run(*a);
+                idleRounds = 0;
+            } else if (++idleRounds < 64) {
+                std::this_thread::yield();
+            } else {
+                parallelWorld_.wait_for_work(*this);
+            }
+        }
+    }
+
+public:
+
+    // send() is used by ParallelSelf. It may only be called from within a behavior.
+    void send(actor_type& a, int port, message_type m)
+    {
+        if (a.pinned_worker() == index_ && directDispatchDepth_ < MAX_DIRECT_DISPATCH_DEPTH && !a.scheduled_.exchange(true)) {
+            // we hold a's scheduled flag. (pinning is re-checked now that its writer has released the flag)
+            if (!a.mailbox_.pushed_since_drained() && a.pinned_worker() == index_) {
+                ++directDispatchDepth_;
+                a.behaviorFn_(*this, a, port, m); // the message is covered by the sender's pending count
+                --directDispatchDepth_;
+                release(a);
+            } else {
+                post(a, port, m);
+                schedule(a);
+            }
+            return;
+        }
+
+        post(a, port, m);
+        if (!a.scheduled_.exchange(true))
+            schedule(a);
+    }
+
+    // called by the delete behavior after the actor has been deleted.
+    void current_actor_deleted() { currentActorDeleted_ = true; }
+
+    // create<T>() allocates and constructs an actor from this worker's slab. Use ParallelSelf::create()
+    template<typename T, typename... Args>
+    T* create(Args&&... args)
+    {
+        parallel_detail::check_slab_creatable<T>();
+        void *p = slab_.allocate(sizeof(T));
+        T *result;
+        try {
+            result = new (p) T(std::forward<Args>(args)...);
+        } catch (...) {
+            slab_.free(p, sizeof(T));
+            throw;
+        }
+        result->ownerWorker_ = static_cast<std::uint16_t>(index_);
+        return result;
+    }
+
+    // return the storage of a destroyed slab_allocated actor to its owner's slab
+    void free_actor(void *p, std::size_t size, std::size_t owner)
+    {
+        if (owner == index_)
+            slab_.free(p, size);
+        else
+            parallelWorld_.workers_[owner]->slab_.free_remote(p, size);
+    }
+
+    std::size_t worker_index() const { return index_; }
+
+    shared_context_type& shared_context() { return parallelWorld_.shared_context(); }
+};
+
+
+// ParallelSelf is the equivalent of Self for actors in a ParallelWorld. No recursion guard
+// is needed: all sends go via mailboxes, and the scheduled flag prevents re-entrance.
+template <typename concrete_actor_type>
+struct ParallelSelf {
+    typedef typename concrete_actor_type::shared_context_type shared_context_type;
+    typedef typename concrete_actor_type::message_type message_type;
+    typedef typename concrete_actor_type::behavior_fn_ptr_type behavior_fn_ptr_type;
+    typedef typename concrete_actor_type::actor_type actor_type;
+    typedef typename concrete_actor_type::endpoint_type endpoint_type;
+    typedef typename concrete_actor_type::world_type world_type;
+
+    world_type& world_;
+    actor_type& myself_;
+
+    ParallelSelf& operator=(const ParallelSelf&);
+    ParallelSelf(const ParallelSelf&);
+    ParallelSelf();
+
+    ParallelSelf(world_type& world, actor_type& myself)
+        : world_(world)
+        , myself_(myself) {}
+
+public:
+
+    // delete_later() should only be called if the Actor is certain that
+    // no further messages will be delivered to it.
+    void delete_later()
+    {
+        myself_.behaviorFn_ = concrete_actor_type::delete_behavior; // become the delete behavior
+        world_.send(myself_, 0, message_type()); // the delete behavior is invoked when this message is delivered
+    }
+
+    template < void (concrete_actor_type::*f)(ParallelSelf&, int, message_type) >
+    void become()
+    {
+        myself_.behaviorFn_ = concrete_actor_type::template behavior<f>;
+    }
+
+    // create<T>() allocates a slab_allocated actor from the current worker's slab.
+    template<typename T, typename... Args>
+    T* create(Args&&... args) { return world_.template create<T>(std::forward<Args>(args)...); }
+
+    // pin_to() pins this actor to a worker (see ParallelWorld above). Takes effect when the
+    // actor is next scheduled: the current behavior, and any messages already taken from the
+    // mailbox in this scheduling round, still run on the current worker.
+    void pin_to(std::size_t workerIndex) { myself_.pin_to(workerIndex); }
+    void unpin() { myself_.unpin(); }
+
+    std::size_t worker_index() const { return world_.worker_index(); }
+
+
+    // send() may only be used to send to other actors from within a behavior.
+    // Use ParallelWorld::inject() to send from non-behavior code.
+
+    void send(actor_type& a) { // sends value-initialized message on port 0
+        send(a, 0, message_type());
+    }
+
+    void send(const endpoint_type& e) { // sends value-initialized message on port 0
+        send(e.actor(), e.port(), message_type());
+    }
+
+    void send(actor_type& a, message_type m) { // sends message m on port 0
+        send(a, 0, m);
+    }
+
+    void send(const endpoint_type &e, message_type m) {
+        send(e.actor(), e.port(), m);
+    }
+
+    void send(actor_type& a, int port, message_type m) {
+        world_.send(a, port, m);
+    }
+
+    shared_context_type& shared_context() { return world_.shared_context(); }
+};
+
+
+// ParallelActorT is the base class for concrete actors in a ParallelWorld. See ActorT.
+// L is the layout (see PackedActorLayout and CacheLineActorLayout above).
+template <typename PAS, typename DerivedT, typename L = PackedActorLayout>
+struct alignas(parallel_detail::actor_alignment<L, typename PAS::actor_type>::value) ParallelActorT : public PAS::actor_type {
+
+    typedef typename PAS::shared_context_type shared_context_type;
+    typedef typename PAS::message_type message_type;
+    typedef typename PAS::world_type world_type;
+
+    typedef typename PAS::actor_type root_actor_type;
+    typedef typename root_actor_type::behavior_fn_ptr_type behavior_fn_ptr_type;
+    typedef ParallelActorT<PAS, DerivedT, L> actor_base_type;
+    typedef DerivedT concrete_actor_type;
+
+    typedef ParallelSelf<concrete_actor_type> self_type;
+
+    static concrete_actor_type* downcast_to_concrete_actor_type(root_actor_type *a)
+    {
+        return static_cast<concrete_actor_type*>(a); // see ActorT::downcast_to_concrete_actor_type
+    }
+
+    // Actors allocated with ParallelSelf::create() or ParallelWorld::create() must hide this
+    // declaration with enum { slab_allocated = true }; so that delete_later() returns them to
+    // their owning worker's slab.
+    enum { slab_allocated = false };
+
+    static void delete_behavior(world_type& world, root_actor_type& a, int, message_type)
+    {
+        concrete_actor_type *p = downcast_to_concrete_actor_type(&a);
+        if (concrete_actor_type::slab_allocated) {
+            const std::size_t owner = p->ownerWorker_;
+            p->~concrete_actor_type();
+            world.free_actor(p, sizeof(concrete_actor_type), owner);
+        } else {
+            delete p;
+        }
+        world.current_actor_deleted();
+    }
+
+    // behavior<f>() is a thunk from member function to actor behavior function. See ActorT::behavior.
+    template < void (concrete_actor_type::*f)(self_type&, int, message_type) >
+    static void behavior(world_type& world, root_actor_type& a, int port, message_type m)
+    {
+        self_type self(world, a);
+        (downcast_to_concrete_actor_type(&a)->*f)(self, port, m);
+    }
+
+protected:
+
+    void initial(self_type& self, int port, message_type message)
+    {
+        assert(false && "no initial behavior defined");
+    }
+
+    ParallelActorT() : root_actor_type( &behavior<&concrete_actor_type::initial> ) {}
+    ParallelActorT(behavior_fn_ptr_type initialBehaviorFn) : root_actor_type(initialBehaviorFn) {}
+};
+
+
+template<typename S, typename M>
+class ParallelWorld {
+    typedef S shared_context_type;
+    typedef M message_type;
+    typedef ParallelActor<shared_context_type, message_type> actor_type;
+    typedef Endpoint<actor_type> endpoint_type;
+    typedef ParallelWorker<shared_context_type, message_type> worker_type;
+    typedef MailboxNode<message_type> node_type;
+
+    friend class ParallelWorker<shared_context_type, message_type>;
+
+    // the members below are grouped into cache lines by how often they are written:
+    // stopping_ and sharedQueueSize_ are read by idle workers and rarely written,
+    // idleWorkerCount_ changes whenever a worker sleeps, and pendingMessageCount_ on every send.
+
+    std::vector<worker_type*> workers_;
+    std::vector<std::thread> threads_;
+    std::atomic<bool> stopping_;
+
+    // actors scheduled from outside the world, or when a worker's run queue is full.
+    std::mutex sharedQueueMutex_;
+    std::deque<actor_type*> sharedQueue_;
+    std::atomic<std::size_t> sharedQueueSize_;
+
+    alignas(FRACTORP_CACHE_LINE_SIZE) std::mutex idleMutex_;
+    std::condition_variable idleCondition_;
+    std::atomic<int> idleWorkerCount_;
+
+    // number of messages sent but not yet processed. used by wait_idle().
+    alignas(FRACTORP_CACHE_LINE_SIZE) std::atomic<long> pendingMessageCount_;
+    alignas(FRACTORP_CACHE_LINE_SIZE) std::mutex pendingMutex_;
+    std::condition_variable pendingCondition_;
+
+    shared_context_type sharedContext_;
+
+    ParallelWorld(const ParallelWorld&);
+    ParallelWorld& operator=(const ParallelWorld&);
+
+    bool stopping() const { return stopping_.load(std::memory_order_relaxed); }
+
+    void message_posted() { pendingMessageCount_.fetch_add(1, std::memory_order_relaxed); }
+
+    void messages_done(long n)
+    {
+        if (n != 0 && pendingMessageCount_.fetch_sub(n, std::memory_order_acq_rel) == n) {
+            std::lock_guard<std::mutex> lock(pendingMutex_);
+            pendingCondition_.notify_all();
+        }
+    }
+
+    void schedule_shared(actor_type& a)
+    {
+        {
+            std::lock_guard<std::mutex> lock(sharedQueueMutex_);
+            sharedQueue_.push_back(&a);
+            sharedQueueSize_.fetch_add(1, std::memory_order_release);
+        }
+        wake_idle_worker();
+    }
+
+    actor_type* take_shared()
+    {
+        if (sharedQueueSize_.load(std::memory_order_acquire) == 0)
+            return 0;
+        std::lock_guard<std::mutex> lock(sharedQueueMutex_);
+        if (sharedQueue_.empty())
+            return 0;
+        actor_type *a = sharedQueue_.front();
+        sharedQueue_.pop_front();
+        sharedQueueSize_.fetch_sub(1, std::memory_order_release);
+        return a;
+    }
+
+    actor_type* steal(std::size_t thiefIndex)
+    {
+        const std::size_t n = workers_.size();
+        for (std::size_t i=1; i < n; ++i) {
+            if (actor_type *a = workers_[(thiefIndex + i) % n]->runQueue_.steal())
+                return a;
+        }
+        return 0;
+    }
+
+    // called after work is published. the fence orders the publication before the load of
+    // idleWorkerCount_, and pairs with the fence in wait_for_work()
+    void wake_idle_worker()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idleWorkerCount_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(idleMutex_);
+            idleCondition_.notify_one();
+        }
+    }
+
+    void wake_idle_workers()
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst);
+        if (idleWorkerCount_.load(std::memory_order_relaxed) > 0) {
+            std::lock_guard<std::mutex> lock(idleMutex_);
+            idleCondition_.notify_all();
+        }
+    }
+
+    // schedule an actor from outside the world
+    void schedule_external(actor_type& a)
+    {
+        const std::size_t pinned = a.pinned_worker();
+        assert((pinned == actor_type::NO_WORKER || pinned < workers_.size()) && "actor is pinned to a nonexistent worker");
+        if (pinned != actor_type::NO_WORKER)
+            workers_[pinned]->post_to_inbox(a);
+        else
+            schedule_shared(a);
+    }
+
+    // true if worker w could find an actor to run: in its inbox, the shared queue or another
+    // worker's run queue. w's own run queues are empty when it goes idle.
+    bool has_work(const worker_type& w) const
+    {
+        if (w.inboxSize_.load(std::memory_order_acquire) != 0 || sharedQueueSize_.load(std::memory_order_acquire) != 0)
+            return true;
+        for (std::size_t i=0; i < workers_.size(); ++i) {
+            if (workers_[i] != &w && !workers_[i]->runQueue_.empty())
+                return true;
+        }
+        return false;
+    }
+
+    void wait_for_work(const worker_type& w)
+    {
+        // either the producer's wake_idle_worker() sees the incremented idleWorkerCount_ (and
+        // notifies under idleMutex_, which is held until wait() releases it) or has_work() sees
+        // the producer's work.
+        std::unique_lock<std::mutex> lock(idleMutex_);
+        idleWorkerCount_.fetch_add(1);
+        std::atomic_thread_fence(std::memory_order_seq_cst); // orders the increment before the loads in has_work()
+        while (!has_work(w) && !stopping())
+            idleCondition_.wait(lock);
+        idleWorkerCount_.fetch_sub(1);
+    }
+
+public:
+
+    explicit ParallelWorld(std::size_t workerCount = std::thread::hardware_concurrency())
+        : stopping_(false)
+        , sharedQueueSize_(0)
+        , idleWorkerCount_(0)
+        , pendingMessageCount_(0)
+        , sharedContext_()
+    {
+        if (workerCount == 0)
+            workerCount = 1;
+        assert(workerCount < actor_type::NO_WORKER);
+        for (std::size_t i=0; i < workerCount; ++i)
+            workers_.push_back(new (parallel_detail::allocate_aligned(sizeof(worker_type), alignof(worker_type))) worker_type(*this, i));
+        for (std::size_t i=0; i < workerCount; ++i)
+            threads_.push_back(std::thread(&worker_type::run_loop, workers_[i]));
+    }
+
+    // The world should be idle (see wait_idle()) when it is destroyed.
+    ~ParallelWorld()
+    {
+        stopping_.store(true);
+        {
+            std::lock_guard<std::mutex> lock(idleMutex_);
+            idleCondition_.notify_all();
+        }
+        for (std::size_t i=0; i < threads_.size(); ++i)
+            threads_[i].join();
+        for (std::size_t i=0; i < workers_.size(); ++i) {
+            workers_[i]->~worker_type();
+            parallel_detail::free_aligned(workers_[i]);
+        }
+    }
+
+    std::size_t worker_count() const { return workers_.size(); }
+
+
+    // create<T>() allocates and constructs an actor from the slab of worker workerIndex.
+    // T must declare slab_allocated (see ParallelActorT). The world must be idle (see wait_idle()).
+    // Within behaviors use ParallelSelf::create(). Actors created with create() must be deleted,
+    // with delete_later() or destroy(), before the world is destroyed.
+
+    template<typename T, typename... Args>
+    T* create(std::size_t workerIndex, Args&&... args)
+    {
+        return workers_[workerIndex]->template create<T>(std::forward<Args>(args)...);
+    }
+
+    // destroy() deletes an actor created with create(). The world must be idle.
+    template<typename T>
+    void destroy(T *a)
+    {
+        const std::size_t owner = a->ownerWorker_;
+        a->~T();
+        workers_[owner]->slab_.free(a, sizeof(T));
+    }
+
+
+    // inject() sends messages to actors. may be called from any thread except the worker threads.
+
+    void inject(actor_type& a) { // sends value-initialized message on port 0
+        inject(a, 0, message_type());
+    }
+
+    void inject(const endpoint_type& e) { // sends value-initialized message on port 0
+        inject(e.actor(), e.port(), message_type());
+    }
+
+    void inject(actor_type& a, message_type m) { // sends message m on port 0
+        inject(a, 0, m);
+    }
+
+    void inject(const endpoint_type &e, message_type m) {
+        inject(e.actor(), e.port(), m);
+    }
+
+    void inject(actor_type& a, int port, message_type m) {
+        node_type *n = new node_type; // recycled by whichever worker delivers it
+        n->port_ = port;
+        n->message_ = m;
+        message_posted();
+        a.mailbox_.push(n);
+        if (!a.scheduled_.exchange(true))
+            schedule_external(a);
+    }
+
+    // wait_idle() blocks until every message that has been sent has been processed.
+    void wait_idle()
+    {
+        std::unique_lock<std::mutex> lock(pendingMutex_);
+        while (pendingMessageCount_.load(std::memory_order_acquire) != 0)
+            pendingCondition_.wait(lock);
+    }
+
+    // the number of messages that have been sent but not yet processed. a snapshot, for
+    // monitoring queue depth: it may be stale by the time it is returned.
+    long pending_message_count() const { return pendingMessageCount_.load(std::memory_order_relaxed); }
+
+
+    // user-specified shared context available to all actors. all workers share a single instance.
+
+    void set_shared_context(const shared_context_type& s) { sharedContext_ = s; }
+    const shared_context_type& shared_context() const { return sharedContext_; }
+    shared_context_type& shared_context() { return sharedContext_; }
+};
+
+
+template< typename S = void*, typename M = void*>
+struct ParallelActorSpace {
+    typedef S shared_context_type;
+    typedef M message_type;
+
+    typedef ParallelActor<S,M> actor_type;
+    typedef Endpoint<actor_type> endpoint_type;
+    typedef ParallelWorker<S,M> world_type;
+    typedef ParallelWorld<S,M> parallel_world_type;
+};
+
+} // end namespace Fractorp
+
+#endif /* INCLUDED_FRACTORP_PARALLELWORLD_H */
@@ -0,0 +1,341 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Alone we can do so little; together we can do so much." -- Helen Keller
+*/
+
+#include "ParallelWorld.h"
+
+#include <cstdio>
+#include <set>
+
+using namespace Fractorp;
+
+typedef void* shared_context_type;
+typedef std::intptr_t message_type;
+typedef ParallelActorSpace<shared_context_type, message_type> PAS1;
+
+
+// Counts the messages it receives. count_ is not atomic: the ParallelWorld guarantees
+// that behaviors of a single actor are never run concurrently.
+struct Counter : public Fractorp::ParallelActorT<PAS1, Counter> {
+    long count_;
+    long sum_;
+
+    Counter() : count_(0), sum_(0) {}
+
+    void initial(self_type& /*self*/, int /*port*/, message_type message)
+    {
+        ++count_;
+        sum_ += message;
+    }
+};
+
+
+// Sends N messages to another actor.
+struct ParallelSendN : public Fractorp::ParallelActorT<PAS1, ParallelSendN> {
+    typedef ParallelSendN this_type;
+
+    ParallelSendN(endpoint_type other, int N)
+        : actor_base_type(behavior<&this_type::sendN>)
+        , other_(other)
+        , N_(N) {}
+
+private:
+    endpoint_type other_;
+    int N_;
+
+    void sendN(self_type& self, int /*port*/, message_type /*message*/)
+    {
+        for (int i=0; i < N_; ++i)
+            self.send(other_, i);
+    }
+};
+
+
+// Recursively builds a binary tree of heap-allocated actors, each of which reports to the
+// root Counter and then deletes itself. Work spreads across workers by stealing.
+struct TreeNode : public Fractorp::ParallelActorT<PAS1, TreeNode> {
+    actor_type& counter_;
+
+    explicit TreeNode(actor_type *counter) : counter_(*counter) {}
+
+    void initial(self_type& self, int /*port*/, message_type depth)
+    {
+        if (depth > 0) {
+            self.send(*new TreeNode(&counter_), depth - 1);
+            self.send(*new TreeNode(&counter_), depth - 1);
+        }
+        self.send(counter_, 1);
+        self.delete_later();
+    }
+};
+
+
+// Ping-pong between two actors: a cycle in the send graph.
+struct PingPong : public Fractorp::ParallelActorT<PAS1, PingPong> {
+    actor_type *other_;
+    long received_;
+
+    PingPong() : other_(0), received_(0) {}
+
+    void initial(self_type& self, int /*port*/, message_type remaining)
+    {
+        ++received_;
+        if (remaining > 0)
+            self.send(*other_, remaining - 1);
+    }
+};
+
+// As TreeNode, but cache-line aligned, and allocated from the slab of the worker that creates it.
+// Each node reports 1 to the counter if it is correctly aligned.
+struct AlignedTreeNode : public Fractorp::ParallelActorT<PAS1, AlignedTreeNode, CacheLineActorLayout<> > {
+    enum { slab_allocated = true };
+
+    actor_type& counter_;
+
+    explicit AlignedTreeNode(actor_type *counter) : counter_(*counter) {}
+
+    void initial(self_type& self, int /*port*/, message_type depth)
+    {
+        if (depth > 0) {
+            self.send(*self.create<AlignedTreeNode>(&counter_), depth - 1);
+            self.send(*self.create<AlignedTreeNode>(&counter_), depth - 1);
+        }
+        bool aligned = reinterpret_cast<std::uintptr_t>(this) % FRACTORP_CACHE_LINE_SIZE == 0;
+        self.send(counter_, aligned ? 1 : 1000000);
+        self.delete_later();
+    }
+};
+
+// A small slab-allocated actor with the default (packed) layout.
+struct PackedCounter : public Fractorp::ParallelActorT<PAS1, PackedCounter> {
+    enum { slab_allocated = true };
+    long count_;
+
+    PackedCounter() : count_(0) {}
+
+    void initial(self_type& /*self*/, int /*port*/, message_type /*message*/) { ++count_; }
+};
+
+// Counts the messages it receives, and the number of those that ran on a worker other than expected_.
+struct WorkerRecorder : public Fractorp::ParallelActorT<PAS1, WorkerRecorder> {
+    std::size_t expected_;
+    long count_;
+    long elsewhereCount_;
+
+    explicit WorkerRecorder(std::size_t expected) : expected_(expected), count_(0), elsewhereCount_(0) {}
+
+    void initial(self_type& self, int /*port*/, message_type /*message*/)
+    {
+        ++count_;
+        if (self.worker_index() != expected_)
+            ++elsewhereCount_;
+    }
+};
+
+// Sends to a callee pinned to the same worker. The callee counts the messages that were
+// delivered directly, while the caller's behavior was still running.
+struct Caller : public Fractorp::ParallelActorT<PAS1, Caller> {
+    actor_type *callee_;
+    bool inBehavior_;
+
+    Caller() : callee_(0), inBehavior_(false) {}
+
+    void initial(self_type& self, int /*port*/, message_type n)
+    {
+        inBehavior_ = true;
+        for (message_type i=0; i < n; ++i)
+            self.send(*callee_, i);
+        inBehavior_ = false;
+    }
+};
+
+struct Callee : public Fractorp::ParallelActorT<PAS1, Callee> {
+    Caller& caller_;
+    long count_;
+    long directCount_;
+
+    explicit Callee(Caller *caller) : caller_(*caller), count_(0), directCount_(0) {}
+
+    void initial(self_type& /*self*/, int /*port*/, message_type /*message*/)
+    {
+        ++count_;
+        if (caller_.inBehavior_)
+            ++directCount_;
+    }
+};
+
+// Pins itself to worker 3 on its first message.
+struct Migrator : public Fractorp::ParallelActorT<PAS1, Migrator> {
+    typedef Migrator this_type;
+
+    WorkerRecorder recorder_; // (only used for its counters)
+
+    Migrator()
+        : actor_base_type(behavior<&this_type::migrate>)
+        , recorder_(3) {}
+
+    void migrate(self_type& self, int /*port*/, message_type /*message*/)
+    {
+        self.pin_to(3);
+        self.become<&this_type::migrated>();
+    }
+
+    void migrated(self_type& self, int /*port*/, message_type /*message*/)
+    {
+        ++recorder_.count_;
+        if (self.worker_index() != 3)
+            ++recorder_.elsewhereCount_;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+void test1()
+{
+    std::printf("many senders to one receiver:\n");
+
+    PAS1::parallel_world_type world(4);
+    Counter counter;
+
+    enum { SENDER_COUNT = 16, N = 10000 };
+    ParallelSendN *senders[SENDER_COUNT];
+    for (int i=0; i < SENDER_COUNT; ++i)
+        senders[i] = new ParallelSendN(PAS1::endpoint_type(counter), N);
+    for (int i=0; i < SENDER_COUNT; ++i)
+        world.inject(*senders[i]);
+
+    world.wait_idle();
+    std::printf("count: %ld (expected %ld) sum: %ld (expected %ld)\n",
+        counter.count_, (long)SENDER_COUNT*N, counter.sum_, (long)SENDER_COUNT * ((long)N*(N-1)/2));
+
+    for (int i=0; i < SENDER_COUNT; ++i)
+        delete senders[i];
+}
+
+void test2()
+{
+    std::printf("binary tree of transient actors:\n");
+
+    PAS1::parallel_world_type world(4);
+    Counter counter;
+    world.inject(*new TreeNode(&counter), 14);
+    world.wait_idle();
+    std::printf("nodes: %ld (expected %ld)\n", counter.count_, (1L << 15) - 1);
+}
+
+void test3()
+{
+    std::printf("ping-pong:\n");
+
+    PAS1::parallel_world_type world(2);
+    PingPong a, b;
+    a.other_ = &b;
+    b.other_ = &a;
+    world.inject(a, 100001);
+    world.wait_idle();
+    std::printf("a received: %ld b received: %ld\n", a.received_, b.received_);
+}
+
+void test4()
+{
+    std::printf("cache line layout:\n");
+    std::printf("packed actor size: %d alignment: %d\n", (int)sizeof(PackedCounter), (int)alignof(PackedCounter));
+    std::printf("cache line actor size: %d alignment: %d\n", (int)sizeof(AlignedTreeNode), (int)alignof(AlignedTreeNode));
+
+    PAS1::parallel_world_type world(4);
+
+    // packed actors created on different workers never share a cache line
+    enum { ACTORS_PER_WORKER = 100 };
+    std::vector<PackedCounter*> actors;
+    std::set<std::uintptr_t> lines[4];
+    for (std::size_t i=0; i < 4; ++i) {
+        for (int j=0; j < ACTORS_PER_WORKER; ++j) {
+            PackedCounter *a = world.create<PackedCounter>(i);
+            actors.push_back(a);
+            lines[i].insert(reinterpret_cast<std::uintptr_t>(a) / FRACTORP_CACHE_LINE_SIZE);
+        }
+    }
+    int sharedLineCount = 0;
+    for (std::size_t i=0; i < 4; ++i) {
+        for (std::size_t j=i+1; j < 4; ++j) {
+            for (std::set<std::uintptr_t>::iterator k = lines[i].begin(); k != lines[i].end(); ++k)
+                sharedLineCount += (int)lines[j].count(*k);
+        }
+    }
+    std::printf("cache lines shared between workers: %d\n", sharedLineCount);
+
+    for (std::size_t i=0; i < actors.size(); ++i)
+        world.inject(*actors[i]);
+    world.wait_idle();
+    long total = 0;
+    for (std::size_t i=0; i < actors.size(); ++i) {
+        total += actors[i]->count_;
+        world.destroy(actors[i]);
+    }
+    std::printf("packed actor messages: %ld\n", total);
+
+    // a tree of cache-line actors. nodes that are stolen are deleted on a different worker
+    // from the one that created them, and returned to the creator's slab.
+    Counter counter;
+    for (std::size_t i=0; i < 4; ++i)
+        world.inject(*world.create<AlignedTreeNode>(i, &counter), 10);
+    world.wait_idle();
+    std::printf("aligned nodes: %ld (expected %ld) sum: %ld\n", counter.count_, 4 * ((1L << 11) - 1), counter.sum_);
+}
+
+void test5()
+{
+    std::printf("pinned actors:\n");
+
+    PAS1::parallel_world_type world(4);
+
+    // many unpinned senders to an actor pinned to worker 1
+    WorkerRecorder recorder(1);
+    recorder.pin_to(1);
+    enum { SENDER_COUNT = 8, N = 1000 };
+    ParallelSendN *senders[SENDER_COUNT];
+    for (int i=0; i < SENDER_COUNT; ++i)
+        senders[i] = new ParallelSendN(PAS1::endpoint_type(recorder), N);
+    for (int i=0; i < SENDER_COUNT; ++i)
+        world.inject(*senders[i]);
+    world.wait_idle();
+    std::printf("received: %ld (expected %ld) on other workers: %ld\n", recorder.count_, (long)SENDER_COUNT*N, recorder.elsewhereCount_);
+    for (int i=0; i < SENDER_COUNT; ++i)
+        delete senders[i];
+
+    // sends between actors pinned to the same worker are dispatched directly
+    Caller caller;
+    Callee callee(&caller);
+    caller.callee_ = &callee;
+    caller.pin_to(2);
+    callee.pin_to(2);
+    world.inject(caller, 100);
+    world.wait_idle();
+    std::printf("callee received: %ld directly: %ld\n", callee.count_, callee.directCount_);
+
+    // pinning from within a behavior
+    Migrator migrator;
+    world.inject(migrator);
+    world.wait_idle();
+    for (int i=0; i < 100; ++i)
+        world.inject(migrator);
+    world.wait_idle();
+    std::printf("migrated received: %ld on other workers: %ld\n", migrator.recorder_.count_, migrator.recorder_.elsewhereCount_);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    (void)argc; (void)argv;
+
+    test1();
+    test2();
+    test3();
+    test4();
+    test5();
+
+    return 0;
+}
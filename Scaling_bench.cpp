@@ -0,0 +1,599 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Slow and steady wins the race." -- Aesop
+*/
+
+// Scaling and soak benchmarks. Where Actor_bench.cpp measures the cost of a single dispatch,
+// this program builds large actor graphs and measures how throughput, latency and memory
+// change with the number of actors and threads. Writes a JSON document to stdout, one record
+// per case:
+//
+//      { "name": ..., "topology": ..., "engine": ..., "threads": ..., "actors": ..., "rounds": ...,
+//        "messages": ..., "messages_per_second": ..., "latency_p50_ns": ..., "latency_p99_ns": ...,
+//        "latency_p999_ns": ..., "latency_max_ns": ..., "peak_queue_depth": ..., "rss_kb": ...,
+//        "peak_rss_kb": ..., "repetition": ... }
+//
+// Build with optimization and without assertions, e.g.:
+//
+//      g++ -std=c++11 -O2 -DNDEBUG -pthread Scaling_bench.cpp -o Scaling_bench
+//      ./Scaling_bench [max-actors] [max-threads] [messages-per-case] [repetitions] > scaling_output.txt
+//
+// The defaults are 1000000 actors, std::thread::hardware_concurrency() threads, 2000000
+// messages and 1 repetition. Actor counts run from 1000 to max-actors in powers of ten (pass
+// 10000000 for the largest graphs). Each graph is run on a World ("world", one thread) and
+// on a ParallelWorld ("parallel") with 1, 2, 4, ... max-threads workers.
+//
+// Topologies. Each graph is made of many independent units. The actors are the benchmark
+// equivalents of the actors in Actor_test.cpp: forwarding stages as Log, fan-out as SendN,
+// token passing as SendNRecursive, and fan-in as the customers of RecFactorial.
+//
+//  * ring:       one ring of all the actors. a round passes a token 256 hops around the ring.
+//  * pipeline:   chains of 16 forwarding stages. a round passes a message down one chain.
+//  * tree:       4-ary trees of depth 4 (85 actors). a round fans a request out from the root
+//                to the 64 leaves, and fans the replies back in to the root.
+//  * all_to_all: groups of 16 actors. in a round every member sends to every other member.
+//
+// Successive rounds go to successive units, so over a case every actor is reached (each case
+// runs at least one round per unit, even when that exceeds messages-per-case).
+//
+// Measurements:
+//
+//  * messages_per_second counts deliveries, including the injected message of each round.
+//  * latency is per round: from injection until the last actor of the round completes it.
+//    A World runs one round per inject(). A ParallelWorld is kept loaded with up to 256 rounds
+//    in flight (fewer for small graphs, so that a unit never runs two rounds at once).
+//  * peak_queue_depth is World::deferred_send_peak_depth() for a World, and the peak of
+//    ParallelWorld::pending_message_count() (messages sent but not yet processed), sampled
+//    while injecting, for a ParallelWorld.
+//  * rss_kb is the resident set size at the end of the case, with the graph still allocated.
+//    peak_rss_kb is the high water mark of the process so far. It only increases, so in a soak
+//    run (repetitions > 1) a peak that keeps rising across repetitions indicates a leak.
+//
+// rss_kb and peak_rss_kb are null where they aren't available (rss_kb requires Linux).
+
+#include "Actor.h"
+#include "ParallelWorld.h"
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#define FRACTORP_BENCH_HAS_STATM 1
+#endif
+
+#if defined(__unix__) || defined(__APPLE__)
+#include <sys/resource.h>
+#define FRACTORP_BENCH_HAS_RUSAGE 1
+#endif
+
+using namespace Fractorp;
+
+typedef void* shared_context_type;
+typedef std::intptr_t message_type;
+
+//////////////////////////////////////////////////////////////////////////
+// measurement
+
+static std::int64_t now_ns()
+{
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// resident set size in KiB, or -1 if unavailable
+static long current_rss_kb()
+{
+#ifdef FRACTORP_BENCH_HAS_STATM
+    long pageCount = -1, residentCount = -1;
+    if (std::FILE *f = std::fopen("/proc/self/statm", "r")) {
+        if (std::fscanf(f, "%ld %ld", &pageCount, &residentCount) != 2)
+            residentCount = -1;
+        std::fclose(f);
+    }
+    return (residentCount < 0) ? -1 : residentCount * (sysconf(_SC_PAGESIZE) / 1024);
+#else
+    return -1;
+#endif
+}
+
+// peak resident set size of the process in KiB, or -1 if unavailable
+static long peak_rss_kb()
+{
+#ifdef FRACTORP_BENCH_HAS_RUSAGE
+    struct rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+        return -1;
+#if defined(__APPLE__)
+    return (long)(usage.ru_maxrss / 1024); // bytes
+#else
+    return (long)usage.ru_maxrss;
+#endif
+#else
+    return -1;
+#endif
+}
+
+// Records the start and completion time of every round. A round is completed by an actor,
+// possibly on a worker thread, and waited for by the injecting thread.
+class RoundLog {
+    std::vector<std::int64_t> startTimes_;
+    std::unique_ptr<std::atomic<std::int64_t>[]> endTimes_; // 0 until completed
+
+public:
+    explicit RoundLog(long roundCount)
+        : startTimes_(roundCount)
+        , endTimes_(new std::atomic<std::int64_t>[roundCount])
+    {
+        for (long i=0; i < roundCount; ++i)
+            endTimes_[i].store(0, std::memory_order_relaxed);
+    }
+
+    long size() const { return (long)startTimes_.size(); }
+
+    void start(long round) { startTimes_[round] = now_ns(); }
+    void complete(long round) { endTimes_[round].store(now_ns(), std::memory_order_release); }
+    bool completed(long round) const { return endTimes_[round].load(std::memory_order_acquire) != 0; }
+
+    // precondition: the round has completed
+    std::int64_t latency(long round) const { return endTimes_[round].load(std::memory_order_relaxed) - startTimes_[round]; }
+};
+
+//////////////////////////////////////////////////////////////////////////
+// engines. topologies are written once, against either a World or a ParallelWorld.
+
+struct WorldEngine {
+    typedef ActorSpace<shared_context_type, message_type> space_type;
+    typedef space_type::actor_type actor_type;
+
+    template<typename DerivedT>
+    struct actor_base { typedef ActorT<space_type, DerivedT> type; };
+
+    space_type::world_type world_;
+
+    explicit WorldEngine(std::size_t /*threadCount*/) {}
+
+    static const char* name() { return "world"; }
+    std::size_t thread_count() const { return 1; }
+
+    // actors are allocated from the World's slab, and released with the World.
+    template<typename T, typename... Args>
+    T* create(std::size_t /*unit*/, Args&&... args) { return world_.template create<T>(std::forward<Args>(args)...); }
+
+    template<typename T>
+    void destroy(T* /*a*/) {}
+
+    void inject(actor_type& a, int port, message_type m) { world_.inject(a, port, m); }
+    void wait_idle() {}
+
+    void sample_queue_depth() {}
+    long peak_queue_depth() const { return (long)world_.deferred_send_peak_depth(); }
+};
+
+struct ParallelEngine {
+    typedef ParallelActorSpace<shared_context_type, message_type> space_type;
+    typedef space_type::actor_type actor_type;
+
+    template<typename DerivedT>
+    struct actor_base { typedef ParallelActorT<space_type, DerivedT> type; };
+
+    space_type::parallel_world_type world_;
+    long peakQueueDepth_;
+
+    explicit ParallelEngine(std::size_t threadCount) : world_(threadCount), peakQueueDepth_(0) {}
+
+    static const char* name() { return "parallel"; }
+    std::size_t thread_count() const { return world_.worker_count(); }
+
+    // each unit's actors are allocated from one worker's slab. units are dealt round robin.
+    template<typename T, typename... Args>
+    T* create(std::size_t unit, Args&&... args) { return world_.template create<T>(unit % world_.worker_count(), std::forward<Args>(args)...); }
+
+    template<typename T>
+    void destroy(T *a) { world_.destroy(a); }
+
+    void inject(actor_type& a, int port, message_type m) { world_.inject(a, port, m); }
+    void wait_idle() { world_.wait_idle(); }
+
+    void sample_queue_depth() { peakQueueDepth_ = std::max(peakQueueDepth_, world_.pending_message_count()); }
+    long peak_queue_depth() const { return peakQueueDepth_; }
+};
+
+//////////////////////////////////////////////////////////////////////////
+// topologies
+
+// ring. messages carry the round in their high bits and the remaining hop count in the low bits.
+enum { HOP_BITS = 16, HOP_MASK = (1 << HOP_BITS) - 1 };
+
+template<typename E>
+struct RingNode : public E::template actor_base<RingNode<E> >::type {
+    typedef typename E::template actor_base<RingNode<E> >::type base_type;
+    typedef typename base_type::self_type self_type;
+    enum { slab_allocated = true };
+
+    RoundLog& log_;
+    RingNode *next_;
+
+    explicit RingNode(RoundLog *log) : log_(*log), next_(0) {}
+
+    void initial(self_type& self, int /*port*/, message_type m)
+    {
+        if ((m & HOP_MASK) == 0)
+            log_.complete(m >> HOP_BITS);
+        else
+            self.send(*next_, m - 1);
+    }
+};
+
+template<typename E>
+class RingTopology {
+    enum { HOPS = 256 };
+    E& engine_;
+    std::vector<RingNode<E>*> nodes_;
+
+public:
+    static const char* name() { return "ring"; }
+    static long unit_count(std::size_t actorCount) { return std::max<long>(1, (long)actorCount / HOPS); }
+    static long messages_per_round() { return HOPS + 1; }
+
+    RingTopology(E& engine, RoundLog& log, std::size_t actorCount) : engine_(engine)
+    {
+        for (std::size_t i=0; i < actorCount; ++i)
+            nodes_.push_back(engine_.template create<RingNode<E> >(i / HOPS, &log));
+        for (std::size_t i=0; i < actorCount; ++i)
+            nodes_[i]->next_ = nodes_[(i + 1) % actorCount];
+    }
+
+    ~RingTopology()
+    {
+        for (std::size_t i=0; i < nodes_.size(); ++i)
+            engine_.destroy(nodes_[i]);
+    }
+
+    std::size_t actor_count() const { return nodes_.size(); }
+
+    void inject(long round)
+    {
+        engine_.inject(*nodes_[(std::size_t)round * HOPS % nodes_.size()], 0, ((message_type)round << HOP_BITS) | HOPS);
+    }
+};
+
+// pipeline. each stage forwards to the next (as Log). the last stage completes the round.
+template<typename E>
+struct PipelineStage : public E::template actor_base<PipelineStage<E> >::type {
+    typedef typename E::template actor_base<PipelineStage<E> >::type base_type;
+    typedef typename base_type::self_type self_type;
+    enum { slab_allocated = true };
+
+    RoundLog& log_;
+    PipelineStage *next_;
+
+    explicit PipelineStage(RoundLog *log) : log_(*log), next_(0) {}
+
+    void initial(self_type& self, int /*port*/, message_type round)
+    {
+        if (next_)
+            self.send(*next_, round);
+        else
+            log_.complete(round);
+    }
+};
+
+template<typename E>
+class PipelineTopology {
+    enum { DEPTH = 16 };
+    E& engine_;
+    std::vector<PipelineStage<E>*> stages_; // DEPTH per chain, head first
+
+public:
+    static const char* name() { return "pipeline"; }
+    static long unit_count(std::size_t actorCount) { return std::max<long>(1, (long)actorCount / DEPTH); }
+    static long messages_per_round() { return DEPTH; }
+
+    PipelineTopology(E& engine, RoundLog& log, std::size_t actorCount) : engine_(engine)
+    {
+        const long chainCount = unit_count(actorCount);
+        for (long i=0; i < chainCount; ++i) {
+            for (int j=0; j < DEPTH; ++j)
+                stages_.push_back(engine_.template create<PipelineStage<E> >(i, &log));
+            for (int j=0; j < DEPTH - 1; ++j)
+                stages_[i * DEPTH + j]->next_ = stages_[i * DEPTH + j + 1];
+        }
+    }
+
+    ~PipelineTopology()
+    {
+        for (std::size_t i=0; i < stages_.size(); ++i)
+            engine_.destroy(stages_[i]);
+    }
+
+    std::size_t actor_count() const { return stages_.size(); }
+
+    void inject(long round)
+    {
+        const long chainCount = (long)(stages_.size() / DEPTH);
+        engine_.inject(*stages_[(round % chainCount) * DEPTH], 0, round);
+    }
+};
+
+// tree. requests fan out from the root to the leaves (as SendN), replies are gathered at each
+// interior node and passed up (as the RecFactorial customers). the root completes the round.
+enum { TREE_FANOUT = 4, TREE_INTERIOR_COUNT = 1 + 4 + 16, TREE_NODE_COUNT = TREE_INTERIOR_COUNT + 64 };
+
+template<typename E>
+struct TreeNode : public E::template actor_base<TreeNode<E> >::type {
+    typedef typename E::template actor_base<TreeNode<E> >::type base_type;
+    typedef typename base_type::self_type self_type;
+    enum { slab_allocated = true };
+    enum { REQUEST_PORT, REPLY_PORT };
+
+    RoundLog& log_;
+    TreeNode *parent_; // null for the root
+    TreeNode *children_[TREE_FANOUT]; // null for leaves
+    int replyCount_;
+
+    explicit TreeNode(RoundLog *log) : log_(*log), parent_(0), replyCount_(0)
+    {
+        for (int i=0; i < TREE_FANOUT; ++i)
+            children_[i] = 0;
+    }
+
+    void initial(self_type& self, int port, message_type round)
+    {
+        if (port == REQUEST_PORT) {
+            if (!children_[0]) {
+                self.send(*parent_, REPLY_PORT, round);
+            } else {
+                for (int i=0; i < TREE_FANOUT; ++i)
+                    self.send(*children_[i], REQUEST_PORT, round);
+            }
+        } else if (++replyCount_ == TREE_FANOUT) {
+            replyCount_ = 0;
+            if (parent_)
+                self.send(*parent_, REPLY_PORT, round);
+            else
+                log_.complete(round);
+        }
+    }
+};
+
+template<typename E>
+class TreeTopology {
+    E& engine_;
+    std::vector<TreeNode<E>*> nodes_; // TREE_NODE_COUNT per tree, in breadth-first order
+
+public:
+    static const char* name() { return "tree"; }
+    static long unit_count(std::size_t actorCount) { return std::max<long>(1, (long)actorCount / TREE_NODE_COUNT); }
+    static long messages_per_round() { return 1 + 2 * (TREE_NODE_COUNT - 1); } // inject, requests and replies
+
+    TreeTopology(E& engine, RoundLog& log, std::size_t actorCount) : engine_(engine)
+    {
+        const long treeCount = unit_count(actorCount);
+        for (long i=0; i < treeCount; ++i) {
+            for (int j=0; j < TREE_NODE_COUNT; ++j)
+                nodes_.push_back(engine_.template create<TreeNode<E> >(i, &log));
+            TreeNode<E> **tree = &nodes_[i * TREE_NODE_COUNT];
+            for (int j=0; j < TREE_INTERIOR_COUNT; ++j) {
+                for (int k=0; k < TREE_FANOUT; ++k) {
+                    tree[j]->children_[k] = tree[j * TREE_FANOUT + k + 1];
+                    tree[j * TREE_FANOUT + k + 1]->parent_ = tree[j];
+                }
+            }
+        }
+    }
+
+    ~TreeTopology()
+    {
+        for (std::size_t i=0; i < nodes_.size(); ++i)
+            engine_.destroy(nodes_[i]);
+    }
+
+    std::size_t actor_count() const { return nodes_.size(); }
+
+    void inject(long round)
+    {
+        const long treeCount = (long)(nodes_.size() / TREE_NODE_COUNT);
+        engine_.inject(*nodes_[(round % treeCount) * TREE_NODE_COUNT], TreeNode<E>::REQUEST_PORT, round);
+    }
+};
+
+// all-to-all. member 0 of a group starts the round and collects a report from each member
+// once that member has heard from every member of the group.
+enum { GROUP_SIZE = 16 };
+
+template<typename E>
+struct GroupMember : public E::template actor_base<GroupMember<E> >::type {
+    typedef typename E::template actor_base<GroupMember<E> >::type base_type;
+    typedef typename base_type::self_type self_type;
+    enum { slab_allocated = true };
+    enum { START_PORT, GO_PORT, DATA_PORT, REPORT_PORT };
+
+    RoundLog& log_;
+    GroupMember **group_; // GROUP_SIZE members, starting with member 0
+    int dataCount_;
+    int reportCount_;
+
+    explicit GroupMember(RoundLog *log) : log_(*log), group_(0), dataCount_(0), reportCount_(0) {}
+
+    void send_to_group(self_type& self, int port, message_type round)
+    {
+        for (int i=0; i < GROUP_SIZE; ++i)
+            self.send(*group_[i], port, round);
+    }
+
+    void initial(self_type& self, int port, message_type round)
+    {
+        switch (port) {
+        case START_PORT:
+            send_to_group(self, GO_PORT, round);
+            break;
+        case GO_PORT:
+            send_to_group(self, DATA_PORT, round);
+            break;
+        case DATA_PORT:
+            if (++dataCount_ == GROUP_SIZE) {
+                dataCount_ = 0;
+                self.send(*group_[0], REPORT_PORT, round);
+            }
+            break;
+        case REPORT_PORT:
+            if (++reportCount_ == GROUP_SIZE) {
+                reportCount_ = 0;
+                log_.complete(round);
+            }
+            break;
+        }
+    }
+};
+
+template<typename E>
+class AllToAllTopology {
+    E& engine_;
+    std::vector<GroupMember<E>*> members_; // GROUP_SIZE per group
+
+public:
+    static const char* name() { return "all_to_all"; }
+    static long unit_count(std::size_t actorCount) { return std::max<long>(1, (long)actorCount / GROUP_SIZE); }
+    static long messages_per_round() { return 1 + GROUP_SIZE + GROUP_SIZE * GROUP_SIZE + GROUP_SIZE; } // start, go, data and reports
+
+    AllToAllTopology(E& engine, RoundLog& log, std::size_t actorCount) : engine_(engine)
+    {
+        const long groupCount = unit_count(actorCount);
+        for (long i=0; i < groupCount; ++i) {
+            for (int j=0; j < GROUP_SIZE; ++j)
+                members_.push_back(engine_.template create<GroupMember<E> >(i, &log));
+        }
+        for (std::size_t i=0; i < members_.size(); ++i) // members_ is no longer resized
+            members_[i]->group_ = &members_[i - i % GROUP_SIZE];
+    }
+
+    ~AllToAllTopology()
+    {
+        for (std::size_t i=0; i < members_.size(); ++i)
+            engine_.destroy(members_[i]);
+    }
+
+    std::size_t actor_count() const { return members_.size(); }
+
+    void inject(long round)
+    {
+        const long groupCount = (long)(members_.size() / GROUP_SIZE);
+        engine_.inject(*members_[(round % groupCount) * GROUP_SIZE], GroupMember<E>::START_PORT, round);
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+// cases
+
+static bool firstRecord_ = true;
+
+static void print_nullable(const char *key, long value, const char *separator)
+{
+    if (value < 0)
+        std::printf("\"%s\": null%s", key, separator);
+    else
+        std::printf("\"%s\": %ld%s", key, value, separator);
+}
+
+template<typename E, template<typename> class Topology>
+static void run_case(std::size_t actorCount, std::size_t threadCount, long messageCount, int repetition)
+{
+    enum { MAX_ROUNDS_IN_FLIGHT = 256 };
+    typedef Topology<E> topology_type;
+
+    const long unitCount = topology_type::unit_count(actorCount);
+    const long roundCount = std::max(messageCount / topology_type::messages_per_round(), unitCount);
+    // consecutive rounds go to distinct units, so a unit never runs two rounds at once
+    const long window = std::min<long>(MAX_ROUNDS_IN_FLIGHT, unitCount);
+
+    E engine(threadCount);
+    RoundLog log(roundCount);
+    topology_type topology(engine, log, actorCount);
+
+    const std::int64_t startTime = now_ns();
+    for (long i=0; i < roundCount; ++i) {
+        if (i >= window) {
+            while (!log.completed(i - window))
+                std::this_thread::yield();
+        }
+        log.start(i);
+        topology.inject(i);
+        if ((i & 63) == 0)
+            engine.sample_queue_depth();
+    }
+    engine.wait_idle();
+    const double seconds = (now_ns() - startTime) * 1e-9;
+
+    std::vector<std::int64_t> latencies(roundCount);
+    for (long i=0; i < roundCount; ++i)
+        latencies[i] = log.latency(i);
+    std::sort(latencies.begin(), latencies.end());
+    struct Percentile {
+        static long at(const std::vector<std::int64_t>& sorted, double q) { return (long)sorted[std::min(sorted.size() - 1, (std::size_t)(q * sorted.size()))]; }
+    };
+
+    const long deliveryCount = roundCount * topology_type::messages_per_round();
+    const std::size_t builtActorCount = topology.actor_count();
+
+    std::printf("%s\n    { \"name\": \"%s_%s_%d_threads_%ld_actors\", \"topology\": \"%s\", \"engine\": \"%s\", \"threads\": %d, \"actors\": %ld, ",
+        firstRecord_ ? "" : ",", topology_type::name(), E::name(), (int)engine.thread_count(), (long)builtActorCount,
+        topology_type::name(), E::name(), (int)engine.thread_count(), (long)builtActorCount);
+    std::printf("\"rounds\": %ld, \"messages\": %ld, \"messages_per_second\": %.0f, ", roundCount, deliveryCount, deliveryCount / seconds);
+    std::printf("\"latency_p50_ns\": %ld, \"latency_p99_ns\": %ld, \"latency_p999_ns\": %ld, \"latency_max_ns\": %ld, ",
+        Percentile::at(latencies, 0.5), Percentile::at(latencies, 0.99), Percentile::at(latencies, 0.999), (long)latencies.back());
+    std::printf("\"peak_queue_depth\": %ld, ", engine.peak_queue_depth());
+    const long rss = current_rss_kb();
+    print_nullable("rss_kb", rss, ", ");
+    print_nullable("peak_rss_kb", std::max(peak_rss_kb(), rss), ", "); // the peak may lag the current value
+    std::printf("\"repetition\": %d }", repetition);
+    std::fflush(stdout);
+    firstRecord_ = false;
+}
+
+template<template<typename> class Topology>
+static void run_topology(std::size_t actorCount, std::size_t maxThreadCount, long messageCount, int repetition)
+{
+    run_case<WorldEngine, Topology>(actorCount, 1, messageCount, repetition);
+    for (std::size_t threadCount=1; ; threadCount *= 2) {
+        threadCount = std::min(threadCount, maxThreadCount);
+        run_case<ParallelEngine, Topology>(actorCount, threadCount, messageCount, repetition);
+        if (threadCount == maxThreadCount)
+            break;
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    long maxActorCount = (argc > 1) ? std::atol(argv[1]) : 1000000;
+    long maxThreadCount = (argc > 2) ? std::atol(argv[2]) : (long)std::thread::hardware_concurrency();
+    long messageCount = (argc > 3) ? std::atol(argv[3]) : 2000000;
+    int repetitionCount = (argc > 4) ? std::atoi(argv[4]) : 1;
+    if (maxThreadCount < 1)
+        maxThreadCount = 1;
+
+    std::printf("{ \"benchmarks\": [");
+
+    for (int repetition=0; repetition < repetitionCount; ++repetition) {
+        for (long actorCount=1000; actorCount <= maxActorCount; actorCount *= 10) {
+            run_topology<RingTopology>(actorCount, maxThreadCount, messageCount, repetition);
+            run_topology<PipelineTopology>(actorCount, maxThreadCount, messageCount, repetition);
+            run_topology<TreeTopology>(actorCount, maxThreadCount, messageCount, repetition);
+            run_topology<AllToAllTopology>(actorCount, maxThreadCount, messageCount, repetition);
+        }
+    }
+
+    std::printf("\n] }\n");
+
+    return 0;
+}
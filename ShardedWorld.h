@@ -0,0 +1,453 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Divide et impera." -- traditional maxim
+*/
+
+#ifndef INCLUDED_FRACTORP_SHARDEDWORLD_H
+#define INCLUDED_FRACTORP_SHARDEDWORLD_H
+
+#include <atomic>
+#include <cassert>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <mutex>
+#include <new>
+#include <thread>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+#include "Actor.h"
+
+#ifndef FRACTORP_CACHE_LINE_SIZE
+#define FRACTORP_CACHE_LINE_SIZE 64
+#endif
+
+namespace Fractorp {
+
+// ShardedWorld runs N ordinary single-threaded Worlds (shards), one per thread, and routes
+// messages between them. It is a lighter alternative to ParallelWorld for workloads that can
+// be partitioned: each actor is owned by one shard, and within a shard sends are ordinary
+// World sends, with no atomics. Only sends to actors owned by other shards cross threads.
+//
+// Actors are addressed across shards by ShardedEndpoint, an endpoint plus the index of the
+// owning shard. Behaviors send with ShardedWorld::send(), passing their Self:
+//
+//      void initial(self_type& self, int port, message_type m)
+//      {
+//          sharded_.send(self, peer_, m); // peer_ is a ShardedEndpoint
+//      }
+//
+// A send to an actor in the sender's shard is passed to Self::send(). A send to another shard
+// is staged in the ring from the sender's shard to the destination shard (one single-producer
+// single-consumer ring per ordered pair of shards). Each shard repeatedly drains its incoming
+// rings, injecting each message into its World, then flushes its outgoing rings: staged
+// messages are published in one batch per destination, at the end of the pass. If a ring is
+// full, messages wait in a local overflow queue and are published as the ring drains.
+//
+// Messages from one shard to another are delivered in the order that they were sent. There
+// is no ordering guarantee between messages from different shards.
+//
+// Actors must not be shared between shards: an actor may only be called by its own shard's
+// thread. Create actors while the ShardedWorld is idle (see wait_idle()), either with
+// create(), which uses the shard World's slab, or with new.
+
+
+// SpscRing is a bounded single-producer single-consumer queue. push() stages an item that
+// becomes visible to the consumer at the next flush(), so a batch of items costs one release
+// store. capacity must be a power of two.
+template<typename T>
+class SpscRing {
+    typedef typename std::aligned_storage<sizeof(T), alignof(T)>::type slot_type;
+
+    slot_type *slots_;
+    const std::size_t mask_;
+
+    // the consumer's and the producer's fields are separated by padding rather than alignas,
+    // because rings are allocated with operator new, which doesn't honour over-alignment before C++17
+    char padding0_[FRACTORP_CACHE_LINE_SIZE];
+    std::atomic<std::size_t> head_; // written by the consumer
+    std::size_t cachedTail_; // consumer only
+
+    char padding1_[FRACTORP_CACHE_LINE_SIZE];
+    std::atomic<std::size_t> tail_; // written by the producer, by flush()
+    std::size_t stagedTail_; // producer only
+    std::size_t cachedHead_; // producer only
+    char padding2_[FRACTORP_CACHE_LINE_SIZE];
+
+    SpscRing(const SpscRing&);
+    SpscRing& operator=(const SpscRing&);
+
+    T& at(std::size_t i) { return *reinterpret_cast<T*>(&slots_[i & mask_]); }
+
+public:
+    explicit SpscRing(std::size_t capacity)
+        : slots_(new slot_type[capacity])
+        , mask_(capacity - 1)
+        , head_(0)
+        , cachedTail_(0)
+        , tail_(0)
+        , stagedTail_(0)
+        , cachedHead_(0)
+    {
+        assert(capacity > 0 && (capacity & (capacity - 1)) == 0 && "SpscRing capacity must be a power of two");
+    }
+
+    // no other thread may be using the ring
+    ~SpscRing()
+    {
+        for (std::size_t i = head_.load(std::memory_order_relaxed); i != stagedTail_; ++i)
+            at(i).~T();
+        delete [] slots_;
+    }
+
+    // producer. returns false if the ring is full
+    bool push(T&& x)
+    {
+        if (stagedTail_ - cachedHead_ > mask_) {
+            cachedHead_ = head_.load(std::memory_order_acquire);
+            if (stagedTail_ - cachedHead_ > mask_)
+                return false;
+        }
+        new (&at(stagedTail_)) T(std::move(x));
+        ++stagedTail_;
+        return true;
+    }
+
+    // producer. publishes staged items. returns true if there were any
+    bool flush()
+    {
+        if (stagedTail_ == tail_.load(std::memory_order_relaxed))
+            return false;
+        tail_.store(stagedTail_, std::memory_order_release);
+        return true;
+    }
+
+    // consumer. true if a published item is available
+    bool ready() const { return head_.load(std::memory_order_relaxed) != tail_.load(std::memory_order_acquire); }
+
+    // consumer. passes the front item to f(T&&). returns false if no published item is available
+    template<typename F>
+    bool pop(F f)
+    {
+        const std::size_t head = head_.load(std::memory_order_relaxed);
+        if (head == cachedTail_) {
+            cachedTail_ = tail_.load(std::memory_order_acquire);
+            if (head == cachedTail_)
+                return false;
+        }
+        T& x = at(head);
+        f(std::move(x));
+        x.~T();
+        head_.store(head + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+
+// ShardedEndpoint addresses an actor in a ShardedWorld: the endpoint and the owning shard.
+template<typename E>
+struct ShardedEndpoint {
+    E endpoint;
+    std::uint16_t shard;
+
+    ShardedEndpoint() : shard(0) {}
+    ShardedEndpoint(const E& e, std::size_t shardIndex) : endpoint(e), shard(static_cast<std::uint16_t>(shardIndex)) {}
+};
+
+
+template<typename AS>
+class ShardedWorld {
+public:
+    typedef typename AS::shared_context_type shared_context_type;
+    typedef typename AS::message_type message_type;
+    typedef typename AS::actor_type actor_type;
+    typedef typename AS::endpoint_type endpoint_type;
+    typedef typename AS::world_type world_type;
+    typedef ShardedEndpoint<endpoint_type> sharded_endpoint_type;
+
+    enum { NO_SHARD = 0xFFFF };
+
+private:
+    struct Routed {
+        endpoint_type endpoint;
+        message_type message;
+
+        Routed(const endpoint_type& e, message_type&& m) : endpoint(e), message(std::move(m)) {}
+    };
+
+    typedef SpscRing<Routed> ring_type;
+
+    struct Injector {
+        world_type& world_;
+        explicit Injector(world_type& world) : world_(world) {}
+        void operator()(Routed&& r) const { world_.inject(r.endpoint, std::move(r.message)); }
+    };
+
+    struct Shard {
+        world_type world_;
+        std::vector<ring_type*> outgoing_; // indexed by destination shard. null for this shard
+        std::vector<ring_type*> incoming_; // indexed by source shard. owned by the source's outgoing_
+        std::vector<std::deque<Routed> > overflow_; // per destination, while its ring is full. shard thread only
+        std::size_t stagedCount_; // remote sends since the last flush. shard thread only
+
+        // messages injected from outside the ShardedWorld
+        std::mutex externalMutex_;
+        std::vector<Routed> external_;
+        std::atomic<bool> hasExternal_;
+
+        std::mutex idleMutex_;
+        std::condition_variable idleCondition_;
+        std::atomic<bool> sleeping_;
+
+        explicit Shard(std::size_t shardCount)
+            : outgoing_(shardCount, static_cast<ring_type*>(0))
+            , incoming_(shardCount, static_cast<ring_type*>(0))
+            , overflow_(shardCount)
+            , stagedCount_(0)
+            , hasExternal_(false)
+            , sleeping_(false) {}
+    };
+
+    std::vector<Shard*> shards_;
+    std::vector<std::thread> threads_;
+    std::atomic<bool> stopping_;
+
+    // number of messages sent to shards but not yet injected. used by wait_idle()
+    alignas(FRACTORP_CACHE_LINE_SIZE) std::atomic<long> pendingMessageCount_;
+    std::mutex pendingMutex_;
+    std::condition_variable pendingCondition_;
+
+    ShardedWorld(const ShardedWorld&);
+    ShardedWorld& operator=(const ShardedWorld&);
+
+    static std::size_t& current_shard_slot()
+    {
+        static thread_local std::size_t current = NO_SHARD;
+        return current;
+    }
+
+    void messages_posted(long n) { pendingMessageCount_.fetch_add(n, std::memory_order_relaxed); }
+
+    void messages_done(long n)
+    {
+        if (n != 0 && pendingMessageCount_.fetch_sub(n, std::memory_order_acq_rel) == n) {
+            std::lock_guard<std::mutex> lock(pendingMutex_);
+            pendingCondition_.notify_all();
+        }
+    }
+
+    void wake(Shard& s)
+    {
+        std::atomic_thread_fence(std::memory_order_seq_cst); // orders the caller's publication before the load below
+        if (s.sleeping_.load()) { // seq_cst: pairs with the fence in wait_for_work()
+            std::lock_guard<std::mutex> lock(s.idleMutex_);
+            s.idleCondition_.notify_one();
+        }
+    }
+
+    void wait_for_work(Shard& s)
+    {
+        // Dekker-style handshake with wake(): either wake() sees sleeping_ (and notifies under
+        // idleMutex_, which is held until wait() releases it) or has_work() sees the work.
+        std::unique_lock<std::mutex> lock(s.idleMutex_);
+        s.sleeping_.store(true);
+        std::atomic_thread_fence(std::memory_order_seq_cst); // orders the store before the loads in has_work()
+        while (!has_work(s) && !stopping_.load())
+            s.idleCondition_.wait(lock);
+        s.sleeping_.store(false);
+    }
+
+    bool has_work(Shard& s) const
+    {
+        if (s.hasExternal_.load())
+            return true;
+        for (std::size_t i=0; i < s.incoming_.size(); ++i) {
+            if (s.incoming_[i] && s.incoming_[i]->ready())
+                return true;
+        }
+        return false;
+    }
+
+    // publishes the shard's staged remote sends. returns false if any remain in overflow queues
+    bool flush(std::size_t index)
+    {
+        Shard& s = *shards_[index];
+        if (s.stagedCount_ != 0) {
+            messages_posted(static_cast<long>(s.stagedCount_)); // before publication, so that the count can't reach zero early
+            s.stagedCount_ = 0;
+        }
+
+        bool drained = true;
+        for (std::size_t d=0; d < shards_.size(); ++d) {
+            ring_type *ring = s.outgoing_[d];
+            if (!ring)
+                continue;
+            std::deque<Routed>& overflow = s.overflow_[d];
+            while (!overflow.empty() && ring->push(std::move(overflow.front())))
+                overflow.pop_front();
+            drained = drained && overflow.empty();
+            if (ring->flush())
+                wake(*shards_[d]);
+        }
+        return drained;
+    }
+
+    void run_loop(std::size_t index)
+    {
+        current_shard_slot() = index;
+        Shard& s = *shards_[index];
+        Injector inject(s.world_);
+        std::vector<Routed> external;
+
+        while (!stopping_.load(std::memory_order_relaxed)) {
+            long count = 0;
+            for (std::size_t i=0; i < shards_.size(); ++i) {
+                if (ring_type *ring = s.incoming_[i]) {
+                    while (ring->pop(inject))
+                        ++count;
+                }
+            }
+
+            if (s.hasExternal_.load(std::memory_order_acquire)) {
+                {
+                    std::lock_guard<std::mutex> lock(s.externalMutex_);
+                    external.swap(s.external_);
+                    s.hasExternal_.store(false, std::memory_order_relaxed);
+                }
+                for (std::size_t i=0; i < external.size(); ++i)
+                    inject(std::move(external[i]));
+                count += static_cast<long>(external.size());
+                external.clear();
+            }
+
+            const bool drained = flush(index);
+            messages_done(count);
+            if (count == 0 && drained)
+                wait_for_work(s);
+        }
+        current_shard_slot() = NO_SHARD;
+    }
+
+public:
+    // ringCapacity is the capacity of each of the shardCount * (shardCount - 1) rings, and
+    // must be a power of two.
+    explicit ShardedWorld(std::size_t shardCount = std::thread::hardware_concurrency(), std::size_t ringCapacity = 1024)
+        : stopping_(false)
+        , pendingMessageCount_(0)
+    {
+        if (shardCount == 0)
+            shardCount = 1;
+        assert(shardCount < NO_SHARD);
+        for (std::size_t i=0; i < shardCount; ++i)
+            shards_.push_back(new Shard(shardCount));
+        for (std::size_t i=0; i < shardCount; ++i) {
+            for (std::size_t j=0; j < shardCount; ++j) {
+                if (i != j)
+                    shards_[j]->incoming_[i] = shards_[i]->outgoing_[j] = new ring_type(ringCapacity);
+            }
+        }
+        for (std::size_t i=0; i < shardCount; ++i)
+            threads_.push_back(std::thread(&ShardedWorld::run_loop, this, i));
+    }
+
+    // The world should be idle (see wait_idle()) when it is destroyed.
+    ~ShardedWorld()
+    {
+        stopping_.store(true);
+        for (std::size_t i=0; i < shards_.size(); ++i)
+            wake(*shards_[i]);
+        for (std::size_t i=0; i < threads_.size(); ++i)
+            threads_[i].join();
+        for (std::size_t i=0; i < shards_.size(); ++i) {
+            for (std::size_t j=0; j < shards_.size(); ++j)
+                delete shards_[i]->outgoing_[j];
+        }
+        for (std::size_t i=0; i < shards_.size(); ++i)
+            delete shards_[i];
+    }
+
+    std::size_t shard_count() const { return shards_.size(); }
+
+    // the index of the calling shard thread, or NO_SHARD if called from another thread
+    static std::size_t current_shard_index() { return current_shard_slot(); }
+
+    // the World of shard i. may only be used while the ShardedWorld is idle, or by shard i's
+    // own actors
+    world_type& world(std::size_t i) { return shards_[i]->world_; }
+
+    // create<T>() allocates and constructs an actor from shard i's World (see World::create()).
+    // The ShardedWorld must be idle.
+    template<typename T, typename... Args>
+    T* create(std::size_t i, Args&&... args) { return shards_[i]->world_.template create<T>(std::forward<Args>(args)...); }
+
+    sharded_endpoint_type endpoint(std::size_t i, actor_type& a, int port = 0) { return sharded_endpoint_type(endpoint_type(a, port), i); }
+
+
+    // send() sends a message from a behavior running in one of the shards.
+
+    template<typename SelfT>
+    void send(SelfT& self, const sharded_endpoint_type& to, const message_type& m) {
+        send(self, to, message_type(m));
+    }
+
+    template<typename SelfT>
+    void send(SelfT& self, const sharded_endpoint_type& to, message_type&& m)
+    {
+        const std::size_t from = current_shard_slot();
+        assert(from != NO_SHARD && "ShardedWorld::send() may only be called from shard threads");
+        assert(to.shard < shards_.size());
+        if (to.shard == from) {
+            self.send(to.endpoint, std::move(m));
+            return;
+        }
+
+        Shard& s = *shards_[from];
+        ++s.stagedCount_;
+        std::deque<Routed>& overflow = s.overflow_[to.shard];
+        Routed r(to.endpoint, std::move(m));
+        if (!overflow.empty() || !s.outgoing_[to.shard]->push(std::move(r)))
+            overflow.push_back(std::move(r)); // (to preserve order, nothing is pushed to the ring while the overflow queue is nonempty)
+    }
+
+
+    // inject() sends a message from outside the ShardedWorld. may be called from any thread
+    // except the shard threads.
+
+    void inject(const sharded_endpoint_type& to) { // sends value-initialized message
+        inject(to, message_type());
+    }
+
+    void inject(const sharded_endpoint_type& to, const message_type& m) {
+        inject(to, message_type(m));
+    }
+
+    void inject(const sharded_endpoint_type& to, message_type&& m)
+    {
+        assert(current_shard_slot() == NO_SHARD && "use send() within shards");
+        assert(to.shard < shards_.size());
+        Shard& s = *shards_[to.shard];
+        messages_posted(1);
+        {
+            std::lock_guard<std::mutex> lock(s.externalMutex_);
+            s.external_.push_back(Routed(to.endpoint, std::move(m)));
+            s.hasExternal_.store(true, std::memory_order_release);
+        }
+        wake(s);
+    }
+
+    // wait_idle() blocks until every message that has been sent has been processed.
+    void wait_idle()
+    {
+        std::unique_lock<std::mutex> lock(pendingMutex_);
+        while (pendingMessageCount_.load(std::memory_order_acquire) != 0)
+            pendingCondition_.wait(lock);
+    }
+};
+
+} // end namespace Fractorp
+
+#endif /* INCLUDED_FRACTORP_SHARDEDWORLD_H */
@@ -0,0 +1,151 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Good fences make good neighbours." -- proverb
+*/
+
+#include "ShardedWorld.h"
+
+#include <cstdio>
+
+using namespace Fractorp;
+
+typedef void* shared_context_type;
+typedef std::intptr_t message_type;
+typedef ActorSpace<shared_context_type, message_type> AS1;
+typedef ShardedWorld<AS1> sharded_world_type;
+typedef sharded_world_type::sharded_endpoint_type sharded_endpoint_type;
+
+
+// Returns each message to its peer, decremented, until it reaches zero.
+struct Player : public Fractorp::ActorT<AS1, Player> {
+    enum { slab_allocated = true }; // test3 creates players in the shard Worlds
+    sharded_world_type& sharded_;
+    sharded_endpoint_type peer_;
+    std::size_t shard_;
+    long received_;
+    bool wrongShard_;
+
+    Player(sharded_world_type *sharded, std::size_t shard) : sharded_(*sharded), shard_(shard), received_(0), wrongShard_(false) {}
+
+    void initial(self_type& self, int /*port*/, message_type m)
+    {
+        ++received_;
+        wrongShard_ = wrongShard_ || sharded_world_type::current_shard_index() != shard_;
+        if (m > 0)
+            sharded_.send(self, peer_, m - 1);
+    }
+};
+
+// Sends count numbered messages to each of its targets in one activation.
+struct Spray : public Fractorp::ActorT<AS1, Spray> {
+    sharded_world_type& sharded_;
+    std::vector<sharded_endpoint_type> targets_;
+
+    explicit Spray(sharded_world_type *sharded) : sharded_(*sharded) {}
+
+    void initial(self_type& self, int /*port*/, message_type count)
+    {
+        for (message_type i=0; i < count; ++i) {
+            for (std::size_t j=0; j < targets_.size(); ++j)
+                sharded_.send(self, targets_[j], i);
+        }
+    }
+};
+
+// Checks that messages arrive in the order that they were sent.
+struct InOrder : public Fractorp::ActorT<AS1, InOrder> {
+    message_type next_;
+    bool ordered_;
+
+    InOrder() : next_(0), ordered_(true) {}
+
+    void initial(self_type& /*self*/, int /*port*/, message_type m)
+    {
+        ordered_ = ordered_ && m == next_;
+        next_ = m + 1;
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+void test1()
+{
+    std::printf("ping pong:\n");
+
+    sharded_world_type sharded(4);
+    Player *players[4];
+    for (std::size_t i=0; i < 4; ++i)
+        players[i] = new Player(&sharded, i);
+    for (std::size_t i=0; i < 4; ++i)
+        players[i]->peer_ = sharded.endpoint((i + 1) % 4, *players[(i + 1) % 4]); // a ring across the shards
+
+    sharded.inject(sharded.endpoint(0, *players[0]), 9999);
+    sharded.wait_idle();
+
+    long total = 0;
+    bool wrongShard = false;
+    for (std::size_t i=0; i < 4; ++i) {
+        total += players[i]->received_;
+        wrongShard = wrongShard || players[i]->wrongShard_;
+        delete players[i];
+    }
+    std::printf("shards: %d received: %ld wrong shard: %d\n", (int)sharded.shard_count(), total, (int)wrongShard);
+}
+
+void test2()
+{
+    std::printf("ordering and overflow:\n");
+
+    sharded_world_type sharded(3, 4); // 4 message rings: most messages overflow
+    Spray spray(&sharded);
+    InOrder local, remote1, remote2;
+    spray.targets_.push_back(sharded.endpoint(0, local));
+    spray.targets_.push_back(sharded.endpoint(1, remote1));
+    spray.targets_.push_back(sharded.endpoint(2, remote2));
+
+    sharded.inject(sharded.endpoint(0, spray), 10000);
+    sharded.wait_idle();
+    std::printf("local: %ld %d remote: %ld %d, %ld %d\n", (long)local.next_, (int)local.ordered_,
+        (long)remote1.next_, (int)remote1.ordered_, (long)remote2.next_, (int)remote2.ordered_);
+}
+
+void test3()
+{
+    std::printf("partitioned pairs:\n");
+
+    // 64 independent ping pong pairs, each pair split across two of 8 shards
+    enum { PAIR_COUNT = 64, SHARD_COUNT = 8 };
+    sharded_world_type sharded(SHARD_COUNT);
+    std::vector<Player*> players;
+    for (int i=0; i < PAIR_COUNT; ++i) {
+        const std::size_t a = i % SHARD_COUNT, b = (i + 3) % SHARD_COUNT;
+        Player *p = sharded.create<Player>(a, &sharded, a);
+        Player *q = sharded.create<Player>(b, &sharded, b);
+        p->peer_ = sharded.endpoint(b, *q);
+        q->peer_ = sharded.endpoint(a, *p);
+        players.push_back(p);
+        players.push_back(q);
+    }
+    for (int i=0; i < PAIR_COUNT; ++i)
+        sharded.inject(sharded.endpoint(i % SHARD_COUNT, *players[2 * i]), 1000);
+    sharded.wait_idle();
+
+    long total = 0;
+    for (std::size_t i=0; i < players.size(); ++i)
+        total += players[i]->received_;
+    std::printf("received: %ld\n", total);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    (void)argc; (void)argv;
+
+    test1();
+    test2();
+    test3();
+
+    return 0;
+}
@@ -0,0 +1,537 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Those who cannot remember the past are condemned to repeat it." -- George Santayana
+*/
+
+#ifndef INCLUDED_FRACTORP_SNAPSHOT_H
+#define INCLUDED_FRACTORP_SNAPSHOT_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+#include "Actor.h"
+
+namespace Fractorp {
+
+// Snapshots of actor graphs. A SnapshotWriter serializes a set of actors, their current
+// behaviors, their references to each other and a list of pending messages into a flat,
+// relocatable byte image. The image contains no addresses: actor references are stored as
+// indices into the image's actor table, and behaviors and actor types are stored as stable
+// 32-bit IDs derived from names. An image written by one build can therefore be loaded by
+// another, e.g. after being written to a file and memory-mapped, so long as the registered
+// names and the actors' snapshot() methods agree.
+//
+//      SnapshotRegistry<AS> registry;
+//      registry.add_type<Oscillator>("Oscillator");
+//      registry.add_behavior(&Oscillator::behavior<&Oscillator::running>, "Oscillator::running");
+//
+//      SnapshotWriter<AS> writer(registry);
+//      writer.add(oscillator); // every actor in the graph
+//      writer.add_pending(AS::endpoint_type(oscillator), m);
+//      std::vector<char> image;
+//      writer.write(image);
+//
+//      SnapshotReader<AS> reader(registry, world);
+//      std::vector<AS::actor_type*> actors; // in the order that they were added to the writer
+//      reader.restore(image.data(), image.size(), actors); // then injects the pending messages
+//
+// Snapshot types must be default constructible and define a snapshot() method that visits
+// their state. The same method is used to save and to restore:
+//
+//      template<typename Archive>
+//      void snapshot(Archive& ar)
+//      {
+//          ar.value(phase_);     // trivially copyable values, stored by value
+//          ar.actor(next_);      // actor_type* references, stored as indices (or null)
+//          ar.endpoint(output_); // endpoint_type references, stored as index and port
+//      }
+//
+// Restored actors of slab_allocated types are allocated from the World's slab with
+// World::create(), others with new. arena_allocated actors are transient and can't be
+// saved. Actor references must be held as pointers (references can't be re-seated), and
+// must refer to null or to actors that were added to the writer. A T* reference must refer
+// to an actor of type T: restore() checks it against the type recorded in the image.
+//
+// Snapshots are taken and restored from outside behaviors, when the World's deferred send
+// queue is always empty. Messages that are waiting elsewhere, e.g. posted messages or an
+// application's own queues, may be saved with add_pending(). Pending messages are stored as
+// raw bytes, so message_type must be trivially copyable and should not contain addresses.
+// Values are stored in native byte order: images are portable between builds, not between
+// architectures.
+
+
+namespace snapshot_detail {
+
+enum { IMAGE_MAGIC = 0x4e535246, IMAGE_VERSION = 1 }; // "FRSN"
+enum { NULL_ACTOR_INDEX = 0xFFFFFFFFu };
+
+// 32-bit FNV-1a
+inline std::uint32_t name_id(const char *name)
+{
+    std::uint32_t h = 2166136261u;
+    for (const char *p = name; *p; ++p)
+        h = (h ^ static_cast<unsigned char>(*p)) * 16777619u;
+    return h;
+}
+
+inline void put_u32(std::vector<char>& out, std::uint32_t x)
+{
+    const char *p = reinterpret_cast<const char*>(&x);
+    out.insert(out.end(), p, p + sizeof(x));
+}
+
+// a distinct address per type, used to find a type's registration
+template<typename T>
+struct TypeKey { static const char key; };
+
+template<typename T>
+const char TypeKey<T>::key = 0;
+
+} // end namespace snapshot_detail
+
+template<typename AS> class SnapshotWriter;
+template<typename AS> class SnapshotReader;
+
+
+// SnapshotRegistry maps actor types and behaviors to and from stable IDs.
+template<typename AS>
+class SnapshotRegistry {
+public:
+    typedef typename AS::actor_type actor_type;
+    typedef typename AS::world_type world_type;
+    typedef typename actor_type::behavior_fn_ptr_type behavior_fn_ptr_type;
+
+    struct TypeEntry {
+        std::uint32_t id;
+        const void *key;
+        actor_type* (*create)(world_type& world);
+        void (*destroy)(world_type& world, actor_type *a);
+        void (*save)(SnapshotWriter<AS>& writer, actor_type *a);
+        void (*load)(SnapshotReader<AS>& reader, actor_type *a);
+    };
+
+private:
+    std::vector<TypeEntry> types_;
+    std::vector<std::pair<std::uint32_t, behavior_fn_ptr_type> > behaviors_;
+
+    template<typename T>
+    static actor_type* create_actor(world_type& world, std::true_type) { return world.template create<T>(); }
+
+    template<typename T>
+    static actor_type* create_actor(world_type&, std::false_type) { return new T; }
+
+    template<typename T>
+    static actor_type* create(world_type& world) { return create_actor<T>(world, std::integral_constant<bool, T::slab_allocated>()); }
+
+    template<typename T>
+    static void destroy(world_type& world, actor_type *a)
+    {
+        T *p = static_cast<T*>(a);
+        if (T::slab_allocated) {
+            p->~T();
+            world.actor_slab().free(p, sizeof(T));
+        } else {
+            delete p;
+        }
+    }
+
+    template<typename T>
+    static void save(SnapshotWriter<AS>& writer, actor_type *a) { static_cast<T*>(a)->snapshot(writer); }
+
+    template<typename T>
+    static void load(SnapshotReader<AS>& reader, actor_type *a) { static_cast<T*>(a)->snapshot(reader); }
+
+public:
+    // name must be unique among the registered types. the ID is derived from the name only
+    template<typename T>
+    void add_type(const char *name)
+    {
+        static_assert(!T::arena_allocated, "arena_allocated actors are transient and can't be saved in a snapshot");
+        TypeEntry e = { snapshot_detail::name_id(name), &snapshot_detail::TypeKey<T>::key, &create<T>, &destroy<T>, &save<T>, &load<T> };
+        assert(!find_type(e.id) && "duplicate snapshot type ID");
+        types_.push_back(e);
+    }
+
+    // name must be unique among the registered behaviors. the ID is derived from the name only
+    void add_behavior(behavior_fn_ptr_type behavior, const char *name)
+    {
+        const std::uint32_t id = snapshot_detail::name_id(name);
+        assert(!find_behavior(id) && "duplicate snapshot behavior ID");
+        behaviors_.push_back(std::make_pair(id, behavior));
+    }
+
+    template<typename T>
+    const TypeEntry* find_type() const
+    {
+        for (std::size_t i=0; i < types_.size(); ++i) {
+            if (types_[i].key == &snapshot_detail::TypeKey<T>::key)
+                return &types_[i];
+        }
+        return 0;
+    }
+
+    const TypeEntry* find_type(std::uint32_t id) const
+    {
+        for (std::size_t i=0; i < types_.size(); ++i) {
+            if (types_[i].id == id)
+                return &types_[i];
+        }
+        return 0;
+    }
+
+    // returns false if the behavior is unregistered
+    bool find_behavior_id(behavior_fn_ptr_type behavior, std::uint32_t& id) const
+    {
+        for (std::size_t i=0; i < behaviors_.size(); ++i) {
+            if (behaviors_[i].second == behavior) {
+                id = behaviors_[i].first;
+                return true;
+            }
+        }
+        return false;
+    }
+
+    // returns null if the ID is unregistered
+    behavior_fn_ptr_type find_behavior(std::uint32_t id) const
+    {
+        for (std::size_t i=0; i < behaviors_.size(); ++i) {
+            if (behaviors_[i].first == id)
+                return behaviors_[i].second;
+        }
+        return 0;
+    }
+};
+
+
+// Image layout, all fields uint32:
+//
+//      magic, version, actor count, pending message count
+//      per actor: type ID, behavior ID, body size, body bytes
+//      per pending message: actor index, port, message bytes (sizeof(message_type))
+template<typename AS>
+class SnapshotWriter {
+public:
+    typedef typename AS::actor_type actor_type;
+    typedef typename AS::endpoint_type endpoint_type;
+    typedef typename AS::message_type message_type;
+    typedef SnapshotRegistry<AS> registry_type;
+
+private:
+    const registry_type& registry_;
+    std::vector<std::pair<actor_type*, const typename registry_type::TypeEntry*> > actors_;
+    std::vector<std::pair<endpoint_type, message_type> > pending_;
+
+    std::unordered_map<const actor_type*, std::uint32_t> indices_; // valid during write()
+    std::vector<char> *out_;
+    bool ok_;
+
+    SnapshotWriter(const SnapshotWriter&);
+    SnapshotWriter& operator=(const SnapshotWriter&);
+
+    std::uint32_t index_of(const actor_type *a)
+    {
+        if (!a)
+            return snapshot_detail::NULL_ACTOR_INDEX;
+        typename std::unordered_map<const actor_type*, std::uint32_t>::const_iterator i = indices_.find(a);
+        if (i == indices_.end()) {
+            assert(false && "snapshot actor refers to an actor that was not added to the writer");
+            ok_ = false;
+            return snapshot_detail::NULL_ACTOR_INDEX;
+        }
+        return i->second;
+    }
+
+public:
+    explicit SnapshotWriter(const registry_type& registry) : registry_(registry), out_(0), ok_(true) {}
+
+    // T must be registered with add_type<T>()
+    template<typename T>
+    void add(T& a)
+    {
+        const typename registry_type::TypeEntry *type = registry_.template find_type<T>();
+        assert(type && "snapshot actor type is not registered");
+        actors_.push_back(std::make_pair(static_cast<actor_type*>(&a), type));
+    }
+
+    void add_pending(const endpoint_type& e, const message_type& m)
+    {
+        static_assert(std::is_trivially_copyable<message_type>::value, "pending messages require a trivially copyable message_type");
+        pending_.push_back(std::make_pair(e, m));
+    }
+
+    std::size_t actor_count() const { return actors_.size(); }
+
+    // appends the image to out. returns false if an actor's type or behavior is unregistered,
+    // or an actor refers to an actor that was not added (the image is then incomplete)
+    bool write(std::vector<char>& out)
+    {
+        using namespace snapshot_detail;
+
+        ok_ = true;
+        indices_.clear();
+        for (std::size_t i=0; i < actors_.size(); ++i)
+            indices_[actors_[i].first] = static_cast<std::uint32_t>(i);
+
+        out_ = &out;
+        put_u32(out, IMAGE_MAGIC);
+        put_u32(out, IMAGE_VERSION);
+        put_u32(out, static_cast<std::uint32_t>(actors_.size()));
+        put_u32(out, static_cast<std::uint32_t>(pending_.size()));
+
+        for (std::size_t i=0; i < actors_.size(); ++i) {
+            actor_type *a = actors_[i].first;
+            const typename registry_type::TypeEntry *type = actors_[i].second;
+            std::uint32_t behaviorId = 0;
+            if (!type || !registry_.find_behavior_id(a->behaviorFn_, behaviorId)) {
+                assert(false && "snapshot actor type or current behavior is not registered");
+                ok_ = false;
+                continue;
+            }
+
+            put_u32(out, type->id);
+            put_u32(out, behaviorId);
+            const std::size_t sizeAt = out.size();
+            put_u32(out, 0); // body size, patched below
+            type->save(*this, a);
+            const std::uint32_t bodySize = static_cast<std::uint32_t>(out.size() - sizeAt - sizeof(std::uint32_t));
+            std::memcpy(&out[sizeAt], &bodySize, sizeof(bodySize));
+        }
+
+        for (std::size_t i=0; i < pending_.size(); ++i) {
+            put_u32(out, index_of(&pending_[i].first.actor()));
+            put_u32(out, static_cast<std::uint32_t>(pending_[i].first.port()));
+            const char *p = reinterpret_cast<const char*>(&pending_[i].second);
+            out.insert(out.end(), p, p + sizeof(message_type));
+        }
+
+        out_ = 0;
+        indices_.clear();
+        return ok_;
+    }
+
+    // archive interface, used by snapshot() methods during write()
+
+    template<typename T>
+    void value(const T& x)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshot values must be trivially copyable");
+        const char *p = reinterpret_cast<const char*>(&x);
+        out_->insert(out_->end(), p, p + sizeof(T));
+    }
+
+    void actor(actor_type *a) { snapshot_detail::put_u32(*out_, index_of(a)); }
+
+    template<typename T>
+    void actor(T *a) { actor(static_cast<actor_type*>(a)); }
+
+    void endpoint(const endpoint_type& e)
+    {
+        const actor_type *a = (&e.actor() == &actor_type::null()) ? 0 : &e.actor();
+        snapshot_detail::put_u32(*out_, index_of(a));
+        snapshot_detail::put_u32(*out_, static_cast<std::uint32_t>(e.port()));
+    }
+};
+
+
+template<typename AS>
+class SnapshotReader {
+public:
+    typedef typename AS::actor_type actor_type;
+    typedef typename AS::endpoint_type endpoint_type;
+    typedef typename AS::message_type message_type;
+    typedef typename AS::world_type world_type;
+    typedef SnapshotRegistry<AS> registry_type;
+
+private:
+    const registry_type& registry_;
+    world_type& world_;
+
+    // valid during restore()
+    const std::vector<actor_type*> *actors_;
+    const std::vector<const typename registry_type::TypeEntry*> *types_; // the type of each of actors_
+    const char *next_, *end_;
+    bool ok_;
+
+    SnapshotReader(const SnapshotReader&);
+    SnapshotReader& operator=(const SnapshotReader&);
+
+    bool read_bytes(void *dest, std::size_t size)
+    {
+        if (static_cast<std::size_t>(end_ - next_) < size) {
+            ok_ = false;
+            std::memset(dest, 0, size);
+            return false;
+        }
+        std::memcpy(dest, next_, size);
+        next_ += size;
+        return true;
+    }
+
+    std::uint32_t read_u32()
+    {
+        std::uint32_t x;
+        read_bytes(&x, sizeof(x));
+        return x;
+    }
+
+    actor_type* actor_at(std::uint32_t index)
+    {
+        if (index == snapshot_detail::NULL_ACTOR_INDEX)
+            return 0;
+        if (index >= actors_->size()) {
+            ok_ = false;
+            return 0;
+        }
+        return (*actors_)[index];
+    }
+
+    // a port read from the image. out of range ports are malformed: they would overflow into
+    // the actor bits of an endpoint_type
+    int read_port()
+    {
+        const std::uint32_t port = read_u32();
+        if (port >= static_cast<std::uint32_t>(endpoint_type::PORT_COUNT)) {
+            ok_ = false;
+            return 0;
+        }
+        return static_cast<int>(port);
+    }
+
+public:
+    SnapshotReader(const registry_type& registry, world_type& world)
+        : registry_(registry), world_(world), actors_(0), types_(0), next_(0), end_(0), ok_(true) {}
+
+    // restores the actors of image, appending them to actors in the order that they were
+    // added to the writer, then injects the pending messages. returns false, and creates no
+    // actors, if the image is malformed or names an unregistered type or behavior.
+    // should only be called from outside actor behaviors.
+    bool restore(const char *image, std::size_t size, std::vector<actor_type*>& actors)
+    {
+        using namespace snapshot_detail;
+
+        ok_ = true;
+        next_ = image;
+        end_ = image + size;
+        if (read_u32() != IMAGE_MAGIC || read_u32() != IMAGE_VERSION)
+            return false;
+        const std::uint32_t actorCount = read_u32();
+        const std::uint32_t pendingCount = read_u32();
+        if (!ok_)
+            return false;
+        if (actorCount > static_cast<std::size_t>(end_ - next_) / (3 * sizeof(std::uint32_t)))
+            return false; // each actor record has at least a type, a behavior and a body size
+
+        // validate the actor table before creating anything
+        struct Record {
+            const typename registry_type::TypeEntry *type;
+            typename actor_type::behavior_fn_ptr_type behavior;
+            const char *body;
+            std::uint32_t bodySize;
+        };
+        std::vector<Record> records;
+        records.reserve(actorCount);
+        for (std::uint32_t i=0; i < actorCount; ++i) {
+            Record r;
+            r.type = registry_.find_type(read_u32());
+            r.behavior = registry_.find_behavior(read_u32());
+            r.bodySize = read_u32();
+            r.body = next_;
+            if (!ok_ || !r.type || !r.behavior || static_cast<std::size_t>(end_ - next_) < r.bodySize)
+                return false;
+            next_ += r.bodySize;
+            records.push_back(r);
+        }
+        const char *pendingBegin = next_;
+        if (static_cast<std::size_t>(end_ - next_) / (2 * sizeof(std::uint32_t) + sizeof(message_type)) < pendingCount)
+            return false;
+
+        // create every actor, so that references can be resolved in any order
+        std::vector<actor_type*> created;
+        std::vector<const typename registry_type::TypeEntry*> createdTypes;
+        created.reserve(actorCount);
+        createdTypes.reserve(actorCount);
+        for (std::size_t i=0; i < records.size(); ++i) {
+            created.push_back(records[i].type->create(world_));
+            createdTypes.push_back(records[i].type);
+        }
+
+        actors_ = &created;
+        types_ = &createdTypes;
+        for (std::size_t i=0; i < records.size() && ok_; ++i) {
+            next_ = records[i].body;
+            end_ = records[i].body + records[i].bodySize;
+            records[i].type->load(*this, created[i]);
+            ok_ = ok_ && next_ == end_; // snapshot() must consume exactly the saved body
+            created[i]->behaviorFn_ = records[i].behavior;
+        }
+
+        std::vector<std::pair<endpoint_type, message_type> > pending;
+        next_ = pendingBegin;
+        end_ = image + size;
+        for (std::uint32_t i=0; i < pendingCount && ok_; ++i) {
+            actor_type *a = actor_at(read_u32());
+            const int port = read_port();
+            message_type m;
+            read_bytes(&m, sizeof(m));
+            if (!a)
+                ok_ = false;
+            else if (ok_)
+                pending.push_back(std::make_pair(endpoint_type(*a, port), m));
+        }
+        actors_ = 0;
+        types_ = 0;
+
+        if (!ok_) {
+            for (std::size_t i=0; i < created.size(); ++i)
+                records[i].type->destroy(world_, created[i]);
+            return false;
+        }
+
+        actors.insert(actors.end(), created.begin(), created.end());
+        for (std::size_t i=0; i < pending.size(); ++i)
+            world_.inject(pending[i].first, std::move(pending[i].second));
+        return true;
+    }
+
+    // archive interface, used by snapshot() methods during restore()
+
+    template<typename T>
+    void value(T& x)
+    {
+        static_assert(std::is_trivially_copyable<T>::value, "snapshot values must be trivially copyable");
+        read_bytes(&x, sizeof(T));
+    }
+
+    void actor(actor_type*& a) { a = actor_at(read_u32()); }
+
+    // T* references must name an actor restored as type T. otherwise the image is malformed
+    template<typename T>
+    void actor(T*& a)
+    {
+        const std::uint32_t index = read_u32();
+        actor_type *p = actor_at(index);
+        if (p && (*types_)[index] != registry_.template find_type<T>()) {
+            ok_ = false;
+            p = 0;
+        }
+        a = static_cast<T*>(p);
+    }
+
+    void endpoint(endpoint_type& e)
+    {
+        actor_type *a = actor_at(read_u32());
+        const int port = read_port();
+        e = (a && ok_) ? endpoint_type(*a, port) : endpoint_type::null();
+    }
+};
+
+} // end namespace Fractorp
+
+#endif /* INCLUDED_FRACTORP_SNAPSHOT_H */
@@ -0,0 +1,297 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Memory is the treasury and guardian of all things." -- Cicero
+*/
+
+#include "Snapshot.h"
+
+#include <cstdio>
+#include <cstring>
+
+using namespace Fractorp;
+
+typedef void* shared_context_type;
+typedef std::intptr_t message_type;
+typedef ActorSpace<shared_context_type, message_type> AS1;
+
+
+// Sums the messages it receives.
+struct Total : public Fractorp::ActorT<AS1, Total> {
+    message_type sum_;
+    int count_;
+
+    Total() : sum_(0), count_(0) {}
+
+    void initial(self_type& /*self*/, int /*port*/, message_type m)
+    {
+        sum_ += m;
+        ++count_;
+    }
+
+    template<typename Archive>
+    void snapshot(Archive& ar)
+    {
+        ar.value(sum_);
+        ar.value(count_);
+    }
+};
+
+// A chain of stages. Each stage adds its gain to the message and passes it on, either to the
+// next stage or, at the end of the chain, to output_. A muted stage passes the message unchanged.
+struct Stage : public Fractorp::ActorT<AS1, Stage> {
+    enum { slab_allocated = true };
+    message_type gain_;
+    Stage *next_;
+    endpoint_type output_;
+
+    Stage() : gain_(0), next_(0) {}
+
+    void pass(self_type& self, message_type m)
+    {
+        if (next_)
+            self.send(*next_, m);
+        else
+            self.send(output_, m);
+    }
+
+    void initial(self_type& self, int port, message_type m)
+    {
+        if (port == 1)
+            self.become<&Stage::muted>();
+        else
+            pass(self, m + gain_);
+    }
+
+    void muted(self_type& self, int port, message_type m)
+    {
+        if (port == 1)
+            self.become<&Stage::initial>();
+        else
+            pass(self, m);
+    }
+
+    template<typename Archive>
+    void snapshot(Archive& ar)
+    {
+        ar.value(gain_);
+        ar.actor(next_);
+        ar.endpoint(output_);
+    }
+};
+
+void register_types(SnapshotRegistry<AS1>& registry)
+{
+    registry.add_type<Total>("Total");
+    registry.add_type<Stage>("Stage");
+    registry.add_behavior(&Total::behavior<&Total::initial>, "Total::initial");
+    registry.add_behavior(&Stage::behavior<&Stage::initial>, "Stage::initial");
+    registry.add_behavior(&Stage::behavior<&Stage::muted>, "Stage::muted");
+}
+
+// builds a chain of stageCount stages whose output is a Total. actors[0] is the Total
+std::vector<AS1::actor_type*> build_chain(AS1::world_type& world, int stageCount, SnapshotWriter<AS1>& writer)
+{
+    std::vector<AS1::actor_type*> actors;
+    Total *total = new Total;
+    writer.add(*total);
+    actors.push_back(total);
+
+    Stage *next = 0;
+    for (int i=0; i < stageCount; ++i) {
+        Stage *s = world.create<Stage>();
+        s->gain_ = i + 1;
+        s->next_ = next;
+        if (!next)
+            s->output_ = AS1::endpoint_type(*total, 0);
+        writer.add(*s);
+        actors.push_back(s);
+        next = s;
+    }
+    return actors;
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void test1()
+{
+    std::printf("save and restore:\n");
+
+    SnapshotRegistry<AS1> registry;
+    register_types(registry);
+
+    std::vector<char> image;
+    {
+        AS1::world_type world;
+        SnapshotWriter<AS1> writer(registry);
+        std::vector<AS1::actor_type*> actors = build_chain(world, 1000, writer);
+        world.inject(*actors[500], 1, 0); // mute stage 500 (gain 500)
+        world.inject(*actors.back(), 0); // the head of the chain
+        std::printf("before: sum: %d\n", (int)static_cast<Total*>(actors[0])->sum_);
+
+        bool ok = writer.write(image);
+        std::printf("written: %d actors: %d bytes: %d\n", (int)ok, (int)writer.actor_count(), (int)image.size());
+
+        delete static_cast<Total*>(actors[0]); // stages are returned with the World's slab
+    }
+
+    AS1::world_type world;
+    SnapshotReader<AS1> reader(registry, world);
+    std::vector<AS1::actor_type*> actors;
+    bool ok = reader.restore(image.data(), image.size(), actors);
+    Total *total = static_cast<Total*>(actors[0]);
+    std::printf("restored: %d actors: %d sum: %d count: %d\n", (int)ok, (int)actors.size(), (int)total->sum_, total->count_);
+
+    // the restored chain is wired as before, and stage 500 is still muted
+    world.inject(*actors.back(), 0);
+    std::printf("after: sum: %d count: %d\n", (int)total->sum_, total->count_);
+    delete total;
+}
+
+void test2()
+{
+    std::printf("stable IDs:\n");
+
+    SnapshotRegistry<AS1> registry;
+    register_types(registry);
+
+    std::vector<char> image;
+    AS1::world_type world;
+    Total total;
+    Stage *stage = world.create<Stage>();
+    stage->output_ = AS1::endpoint_type(total, 0);
+    world.inject(*stage, 1, 0); // muted
+    SnapshotWriter<AS1> writer(registry);
+    writer.add(total);
+    writer.add(*stage);
+    writer.write(image);
+
+    // a rebuild may register in a different order: IDs are derived from names
+    {
+        SnapshotRegistry<AS1> reordered;
+        reordered.add_behavior(&Stage::behavior<&Stage::muted>, "Stage::muted");
+        reordered.add_behavior(&Stage::behavior<&Stage::initial>, "Stage::initial");
+        reordered.add_behavior(&Total::behavior<&Total::initial>, "Total::initial");
+        reordered.add_type<Stage>("Stage");
+        reordered.add_type<Total>("Total");
+
+        AS1::world_type world2;
+        SnapshotReader<AS1> reader(reordered, world2);
+        std::vector<AS1::actor_type*> actors;
+        bool ok = reader.restore(image.data(), image.size(), actors);
+        std::printf("reordered: %d muted: %d\n", (int)ok,
+            (int)(actors[1]->behaviorFn_ == &Stage::behavior<&Stage::muted>));
+        delete static_cast<Total*>(actors[0]);
+    }
+
+    // a missing behavior, or a truncated image, is rejected and nothing is created
+    {
+        SnapshotRegistry<AS1> partial;
+        partial.add_type<Stage>("Stage");
+        partial.add_type<Total>("Total");
+        partial.add_behavior(&Total::behavior<&Total::initial>, "Total::initial");
+        partial.add_behavior(&Stage::behavior<&Stage::initial>, "Stage::initial");
+
+        AS1::world_type world2;
+        SnapshotReader<AS1> reader(partial, world2);
+        std::vector<AS1::actor_type*> actors;
+        bool ok = reader.restore(image.data(), image.size(), actors);
+        std::printf("missing behavior: %d actors: %d\n", (int)ok, (int)actors.size());
+
+        SnapshotReader<AS1> reader2(registry, world2);
+        ok = reader2.restore(image.data(), image.size() - 1, actors);
+        std::printf("truncated: %d actors: %d\n", (int)ok, (int)actors.size());
+    }
+}
+
+void test3()
+{
+    std::printf("pending messages:\n");
+
+    SnapshotRegistry<AS1> registry;
+    register_types(registry);
+
+    std::vector<char> image;
+    {
+        AS1::world_type world;
+        SnapshotWriter<AS1> writer(registry);
+        std::vector<AS1::actor_type*> actors = build_chain(world, 3, writer); // gains 1, 2, 3
+        writer.add_pending(AS1::endpoint_type(*actors.back()), 10);
+        writer.add_pending(AS1::endpoint_type(*actors[0]), 100);
+        writer.write(image);
+        delete static_cast<Total*>(actors[0]);
+    }
+
+    AS1::world_type world;
+    SnapshotReader<AS1> reader(registry, world);
+    std::vector<AS1::actor_type*> actors;
+    reader.restore(image.data(), image.size(), actors);
+    Total *total = static_cast<Total*>(actors[0]);
+    std::printf("sum: %d count: %d\n", (int)total->sum_, total->count_);
+    delete total;
+
+    // a port that doesn't fit in an endpoint is rejected. the last pending message's port
+    // precedes its message
+    std::vector<char> corrupt(image);
+    const std::uint32_t badPort = 0xFFFF;
+    std::memcpy(&corrupt[corrupt.size() - sizeof(message_type) - sizeof(badPort)], &badPort, sizeof(badPort));
+    AS1::world_type world2;
+    SnapshotReader<AS1> reader2(registry, world2);
+    std::vector<AS1::actor_type*> actors2;
+    bool ok = reader2.restore(corrupt.data(), corrupt.size(), actors2);
+    std::printf("bad port: %d actors: %d\n", (int)ok, (int)actors2.size());
+}
+
+void test4()
+{
+    std::printf("malformed images:\n");
+
+    SnapshotRegistry<AS1> registry;
+    register_types(registry);
+
+    std::vector<char> image;
+    {
+        AS1::world_type world;
+        SnapshotWriter<AS1> writer(registry);
+        std::vector<AS1::actor_type*> actors = build_chain(world, 2, writer);
+        writer.write(image);
+        delete static_cast<Total*>(actors[0]);
+    }
+
+    // an actor count that the image is too small to hold is rejected, without reserving storage for it
+    std::vector<char> header(image.begin(), image.begin() + 4 * sizeof(std::uint32_t));
+    const std::uint32_t hugeCount = 0xFFFFFFFF;
+    std::memcpy(&header[2 * sizeof(std::uint32_t)], &hugeCount, sizeof(hugeCount));
+    AS1::world_type world;
+    SnapshotReader<AS1> reader(registry, world);
+    std::vector<AS1::actor_type*> actors;
+    bool ok = reader.restore(header.data(), header.size(), actors);
+    std::printf("huge actor count: %d actors: %d\n", (int)ok, (int)actors.size());
+
+    // the last stage's next_ is followed by its output_ endpoint. pointing it at the Total
+    // (actor 0) gives a Stage* that refers to a Total, which is rejected
+    std::vector<char> corrupt(image);
+    const std::uint32_t totalIndex = 0;
+    std::memcpy(&corrupt[corrupt.size() - 3 * sizeof(std::uint32_t)], &totalIndex, sizeof(totalIndex));
+    ok = reader.restore(corrupt.data(), corrupt.size(), actors);
+    std::printf("wrong actor type: %d actors: %d\n", (int)ok, (int)actors.size());
+
+    // the unmodified image is accepted
+    ok = reader.restore(image.data(), image.size(), actors);
+    std::printf("unmodified: %d actors: %d\n", (int)ok, (int)actors.size());
+    delete static_cast<Total*>(actors[0]);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    (void)argc; (void)argv;
+
+    test1();
+    test2();
+    test3();
+    test4();
+
+    return 0;
+}
@@ -0,0 +1,179 @@
+/*
+    Fractorp by Ross Bencina
+
+    "The shortest distance between two points is a straight line." -- Archimedes (attributed)
+*/
+
+#ifndef INCLUDED_FRACTORP_STATICPIPELINE_H
+#define INCLUDED_FRACTORP_STATICPIPELINE_H
+
+#include <cstddef>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+
+#include "Actor.h"
+
+namespace Fractorp {
+
+// Static pipelines fuse a fixed chain of actors into a single actor.
+//
+// Every send between ordinary actors is an indirect call through the receiver's behaviorFn_,
+// which the compiler can't inline. When a graph is fixed at compile time, e.g. a chain of
+// processing stages, the target of each send is known statically. StaticPipeline<AS, Stages...>
+// exploits this: it is one actor that contains each stage by value. A send from stage i is
+// a direct call to stage i+1, so the whole chain can be inlined into a single behavior.
+// Only the send from the last stage, to the pipeline's downstream endpoint, is dynamic.
+//
+// Stages derive from PipelineStageT and define a single receive() member template. Stages
+// send to the next stage via /out/, rather than via self:
+//
+//      struct Scale : public PipelineStageT<AS, Scale> {
+//          template<typename Out>
+//          void receive(Out& out, int port, message_type m) { out.send(m * 2); }
+//      };
+//
+// out.send(m) sends m on port 0 of the next stage. out.send(port, m) sends on the given port.
+//
+// The same stage type may be used as an ordinary (unfused) actor: a PipelineStageT is an
+// ActorT_nocycles whose behavior calls receive() with an output that sends to the stage's
+// next() endpoint. In that case out.send(m) sends to next() (on next()'s port).
+//
+// Fused stages are not actors in their own right: they can't become() or delete_later(),
+// and they must not send to each other except via /out/ (hence no cycles inside a pipeline).
+
+
+// DynamicStageOutput sends to an endpoint via self, i.e. through the receiver's behaviorFn_.
+// It is used by unfused stages, and by the last stage of a StaticPipeline.
+template<typename self_type>
+class DynamicStageOutput {
+    typedef typename self_type::message_type message_type;
+    typedef typename self_type::endpoint_type endpoint_type;
+
+    self_type& self_;
+    const endpoint_type& next_;
+
+public:
+    DynamicStageOutput(self_type& self, const endpoint_type& next) : self_(self), next_(next) {}
+
+    void send(const message_type& m) { self_.send(next_, m); }
+    void send(message_type&& m) { self_.send(next_, std::move(m)); }
+
+    void send(int port, const message_type& m) { self_.send(next_.actor(), port, m); }
+    void send(int port, message_type&& m) { self_.send(next_.actor(), port, std::move(m)); }
+
+    typename self_type::shared_context_type& shared_context() { return self_.shared_context(); }
+};
+
+
+// PipelineStageT is the base class of pipeline stages (see above). G is the recursion guard
+// policy used when the stage runs as an ordinary actor. Stages are acyclic by default.
+template<typename AS, typename DerivedT, typename G = RecursionGuard_nocycles>
+struct PipelineStageT : public ActorT<AS, DerivedT, G> {
+    typedef ActorT<AS, DerivedT, G> actor_t_type;
+    typedef typename actor_t_type::message_type message_type;
+    typedef typename actor_t_type::world_type world_type;
+    typedef typename actor_t_type::root_actor_type root_actor_type;
+    typedef typename actor_t_type::self_type self_type;
+    typedef typename AS::endpoint_type endpoint_type;
+    typedef DerivedT concrete_actor_type;
+
+    PipelineStageT() : actor_t_type(&stage_behavior) {}
+
+    // the downstream endpoint used when the stage runs as an ordinary actor
+    const endpoint_type& next() const { return next_; }
+    void set_next(const endpoint_type& next) { next_ = next; }
+
+private:
+    endpoint_type next_;
+
+    static void stage_behavior(world_type& world, root_actor_type& a, int port, message_type&& m)
+    {
+        concrete_actor_type *stage = actor_t_type::downcast_to_concrete_actor_type(&a);
+        actor_t_type::tracer_type::behavior_begin(a, &stage_behavior, port);
+        {
+            self_type self(world, a);
+            DynamicStageOutput<self_type> out(self, stage->next_);
+            stage->receive(out, port, std::move(m));
+        }
+        actor_t_type::tracer_type::behavior_end(a, &stage_behavior);
+
+        ReentrantSendHandler<G::reentrant_send_action>::template after_behavior<self_type>(world, a);
+    }
+};
+
+
+// StaticPipeline<AS, Stages...> is an actor that runs Stages in sequence (see above).
+// Messages sent to the pipeline are received by the first stage. Messages sent by the
+// last stage are sent to downstream().
+template<typename AS, typename... Stages>
+struct StaticPipeline : public ActorT<AS, StaticPipeline<AS, Stages...> > {
+    typedef StaticPipeline<AS, Stages...> this_type;
+    typedef ActorT<AS, this_type> actor_t_type;
+    typedef typename actor_t_type::message_type message_type;
+    typedef typename actor_t_type::self_type self_type;
+    typedef typename AS::endpoint_type endpoint_type;
+
+    enum { STAGE_COUNT = sizeof...(Stages) };
+    static_assert(STAGE_COUNT > 0, "a StaticPipeline needs at least one stage");
+
+    StaticPipeline() {}
+    explicit StaticPipeline(const endpoint_type& downstream) : downstream_(downstream) {}
+
+    template<std::size_t i>
+    typename std::tuple_element<i, std::tuple<Stages...> >::type& stage() { return std::get<i>(stages_); }
+
+    const endpoint_type& downstream() const { return downstream_; }
+    void set_downstream(const endpoint_type& downstream) { downstream_ = downstream; }
+
+    void initial(self_type& self, int port, message_type&& m)
+    {
+        typename output<0>::type out(make_output<0>(self));
+        std::get<0>(stages_).receive(out, port, std::move(m));
+    }
+
+private:
+    std::tuple<Stages...> stages_;
+    endpoint_type downstream_;
+
+    // FusedStageOutput<i> is the output of stage i: a direct call to stage i+1.
+    template<std::size_t i>
+    class FusedStageOutput {
+        this_type& pipeline_;
+        self_type& self_;
+
+    public:
+        FusedStageOutput(this_type& pipeline, self_type& self) : pipeline_(pipeline), self_(self) {}
+
+        void send(const message_type& m) { send(0, message_type(m)); }
+        void send(message_type&& m) { send(0, std::move(m)); }
+
+        void send(int port, const message_type& m) { send(port, message_type(m)); }
+        void send(int port, message_type&& m)
+        {
+            typename output<i + 1>::type out(pipeline_.template make_output<i + 1>(self_));
+            std::get<i + 1>(pipeline_.stages_).receive(out, port, std::move(m));
+        }
+
+        typename self_type::shared_context_type& shared_context() { return self_.shared_context(); }
+    };
+
+    // output<i>::type is the type of the output passed to stage i
+    template<std::size_t i>
+    struct output {
+        typedef typename std::conditional<i + 1 == STAGE_COUNT, DynamicStageOutput<self_type>, FusedStageOutput<i> >::type type;
+    };
+
+    template<std::size_t i>
+    typename output<i>::type make_output(self_type& self) { return make_output<i>(self, std::integral_constant<bool, i + 1 == STAGE_COUNT>()); }
+
+    template<std::size_t i>
+    DynamicStageOutput<self_type> make_output(self_type& self, std::true_type) { return DynamicStageOutput<self_type>(self, downstream_); }
+
+    template<std::size_t i>
+    FusedStageOutput<i> make_output(self_type& self, std::false_type) { return FusedStageOutput<i>(*this, self); }
+};
+
+} // end namespace Fractorp
+
+#endif /* INCLUDED_FRACTORP_STATICPIPELINE_H */
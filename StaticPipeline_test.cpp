@@ -0,0 +1,112 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Simplicity is prerequisite for reliability." -- Edsger W. Dijkstra
+*/
+
+#include "StaticPipeline.h"
+
+#include <cstdio>
+
+using namespace Fractorp;
+
+typedef void* shared_context_type;
+typedef std::intptr_t message_type;
+typedef ActorSpace<shared_context_type, message_type> AS1;
+
+
+// Pipeline stages. Each can run as an ordinary actor, or fused into a StaticPipeline.
+
+struct Scale : public Fractorp::PipelineStageT<AS1, Scale> {
+    message_type factor_;
+
+    Scale() : factor_(1) {}
+
+    template<typename Out>
+    void receive(Out& out, int /*port*/, message_type m) { out.send(m * factor_); }
+};
+
+struct Offset : public Fractorp::PipelineStageT<AS1, Offset> {
+    message_type offset_;
+
+    Offset() : offset_(0) {}
+
+    template<typename Out>
+    void receive(Out& out, int /*port*/, message_type m) { out.send(m + offset_); }
+};
+
+// Sends each message on port 0, and its negation on port 1.
+struct Split : public Fractorp::PipelineStageT<AS1, Split> {
+    template<typename Out>
+    void receive(Out& out, int /*port*/, message_type m)
+    {
+        out.send(0, m);
+        out.send(1, -m);
+    }
+};
+
+// Passes messages through, preserving the port.
+struct Tap : public Fractorp::PipelineStageT<AS1, Tap> {
+    template<typename Out>
+    void receive(Out& out, int port, message_type m) { out.send(port, m); }
+};
+
+
+struct PrintMessage : public Fractorp::ActorT<AS1, PrintMessage> {
+    void initial(self_type& /*self*/, int port, message_type m)
+    {
+        std::printf("port: %d message: %ld\n", port, (long)m);
+    }
+};
+
+//////////////////////////////////////////////////////////////////////////
+
+void test1()
+{
+    std::printf("unfused stages:\n");
+
+    AS1::world_type world;
+    PrintMessage printer;
+    Scale scale;
+    Offset offset;
+    Split split;
+    Tap tap;
+
+    scale.factor_ = 10;
+    offset.offset_ = 1;
+
+    scale.set_next(AS1::endpoint_type(offset));
+    offset.set_next(AS1::endpoint_type(split));
+    split.set_next(AS1::endpoint_type(tap));
+    tap.set_next(AS1::endpoint_type(printer));
+
+    for (int i=0; i < 3; ++i)
+        world.inject(scale, i);
+}
+
+void test2()
+{
+    std::printf("fused stages:\n");
+
+    AS1::world_type world;
+    PrintMessage printer;
+    StaticPipeline<AS1, Scale, Offset, Split, Tap> pipeline((AS1::endpoint_type(printer)));
+
+    pipeline.stage<0>().factor_ = 10;
+    pipeline.stage<1>().offset_ = 1;
+
+    for (int i=0; i < 3; ++i)
+        world.inject(pipeline, i);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    (void)argc; (void)argv;
+
+    test1();
+    test2();
+
+    return 0;
+}
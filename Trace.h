@@ -0,0 +1,269 @@
+/*
+    Fractorp by Ross Bencina
+
+    "The devil is in the details." -- proverb
+*/
+
+#ifndef INCLUDED_FRACTORP_TRACE_H
+#define INCLUDED_FRACTORP_TRACE_H
+
+#include <atomic>
+#include <cassert>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <utility>
+#include <vector>
+
+#include "Actor.h"
+
+namespace Fractorp {
+
+// Hot path tracing. Select BufferTracer as the tracer_type of a world policy (e.g. use
+// TracingWorldPolicy) and each instrumentation hook (see NullTracer in Actor.h) records a
+// timestamped TraceEvent into the calling thread's TraceBuffer:
+//
+//      TraceBuffer buffer(4096, 1); // capacity, thread id
+//      TraceBuffer::Install install(&buffer); // record this thread's events into buffer
+//      world.inject(a);
+//      ...
+//      TraceBuffer *buffers[] = { &buffer };
+//      write_chrome_trace(file, buffers, 1);
+//
+// A TraceBuffer is a single-producer single-consumer lock-free ring: the thread that installed
+// it records events, and another thread may concurrently drain them with pop() or
+// write_chrome_trace(). Recording never blocks or allocates. When the buffer is full new events
+// are dropped (and counted), so traces of long runs should be drained periodically.
+// Threads without an installed buffer record nothing.
+//
+// write_chrome_trace() writes the Chrome trace event JSON format, which can be loaded into
+// chrome://tracing or the Perfetto UI. Behaviors appear as slices named by TraceNames, or by
+// the address of their behavior function (a distinct thunk per behavior member function).
+
+
+struct TraceEvent {
+    enum Kind {
+        BEHAVIOR_BEGIN,
+        BEHAVIOR_END,
+        INJECT_BEGIN,
+        INJECT_END,
+        DEFERRED_PUSH,
+        DEFERRED_POP,
+        BECOME,
+        DELETE_LATER
+    };
+
+    std::uint64_t timestampNs; // steady_clock
+    std::uintptr_t actor;
+    std::uintptr_t behavior; // behavior function address, for BEHAVIOR_BEGIN, BEHAVIOR_END and BECOME. otherwise 0
+    std::int32_t port; // for BEHAVIOR_BEGIN, INJECT_BEGIN, DEFERRED_PUSH and DEFERRED_POP. otherwise 0
+    std::int32_t kind;
+};
+
+
+class TraceBuffer {
+    std::vector<TraceEvent> events_;
+    const std::size_t mask_;
+    const int threadId_;
+
+    alignas(64) std::atomic<std::size_t> head_; // written by the producer
+    alignas(64) std::atomic<std::size_t> tail_; // written by the consumer
+    std::atomic<std::size_t> dropCount_;
+
+    TraceBuffer(const TraceBuffer&);
+    TraceBuffer& operator=(const TraceBuffer&);
+
+    static TraceBuffer*& current_slot()
+    {
+        static thread_local TraceBuffer *current = 0;
+        return current;
+    }
+
+public:
+    // capacity must be a power of two. threadId identifies the buffer's thread in exported traces.
+    TraceBuffer(std::size_t capacity, int threadId)
+        : events_(capacity)
+        , mask_(capacity - 1)
+        , threadId_(threadId)
+        , head_(0)
+        , tail_(0)
+        , dropCount_(0)
+    {
+        assert(capacity > 0 && (capacity & (capacity - 1)) == 0 && "TraceBuffer capacity must be a power of two");
+    }
+
+    // Install makes buffer the calling thread's TraceBuffer for the lifetime of the Install object.
+    class Install {
+        TraceBuffer *previous_;
+        Install(const Install&);
+        Install& operator=(const Install&);
+    public:
+        explicit Install(TraceBuffer *buffer) : previous_(current_slot()) { current_slot() = buffer; }
+        ~Install() { current_slot() = previous_; }
+    };
+
+    // the calling thread's buffer, or null
+    static TraceBuffer* current() { return current_slot(); }
+
+    int thread_id() const { return threadId_; }
+    std::size_t dropped_count() const { return dropCount_.load(std::memory_order_relaxed); }
+
+    static std::uint64_t now_ns()
+    {
+        return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count());
+    }
+
+    // producer
+    void record(TraceEvent::Kind kind, std::uintptr_t actor, std::uintptr_t behavior, int port)
+    {
+        const std::size_t head = head_.load(std::memory_order_relaxed);
+        if (head - tail_.load(std::memory_order_acquire) == events_.size()) {
+            dropCount_.store(dropCount_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+            return;
+        }
+
+        TraceEvent& e = events_[head & mask_];
+        e.timestampNs = now_ns();
+        e.actor = actor;
+        e.behavior = behavior;
+        e.port = port;
+        e.kind = kind;
+        head_.store(head + 1, std::memory_order_release);
+    }
+
+    // consumer. returns false if the buffer is empty
+    bool pop(TraceEvent& result)
+    {
+        const std::size_t tail = tail_.load(std::memory_order_relaxed);
+        if (tail == head_.load(std::memory_order_acquire))
+            return false;
+        result = events_[tail & mask_];
+        tail_.store(tail + 1, std::memory_order_release);
+        return true;
+    }
+};
+
+
+// BufferTracer is a tracer_type that records into the calling thread's TraceBuffer.
+struct BufferTracer {
+    struct deferred_send_state {};
+
+    template<typename F>
+    static std::uintptr_t behavior_id(F behavior) { return reinterpret_cast<std::uintptr_t>(behavior); }
+
+    template<typename A>
+    static void record(TraceEvent::Kind kind, const A& a, std::uintptr_t behavior, int port)
+    {
+        if (TraceBuffer *buffer = TraceBuffer::current())
+            buffer->record(kind, reinterpret_cast<std::uintptr_t>(&a), behavior, port);
+    }
+
+    template<typename A> static void behavior_begin(const A& a, typename A::behavior_fn_ptr_type behavior, int port) { record(TraceEvent::BEHAVIOR_BEGIN, a, behavior_id(behavior), port); }
+    template<typename A> static void behavior_end(const A& a, typename A::behavior_fn_ptr_type behavior) { record(TraceEvent::BEHAVIOR_END, a, behavior_id(behavior), 0); }
+    template<typename A> static void inject_begin(const A& a, int port) { record(TraceEvent::INJECT_BEGIN, a, 0, port); }
+    template<typename A> static void inject_end(const A& a) { record(TraceEvent::INJECT_END, a, 0, 0); }
+    template<typename A> static void deferred_push(const A& a, int port, deferred_send_state&) { record(TraceEvent::DEFERRED_PUSH, a, 0, port); }
+    template<typename A> static void deferred_pop(const A& a, int port, deferred_send_state&) { record(TraceEvent::DEFERRED_POP, a, 0, port); }
+    template<typename A> static void become(const A& a, typename A::behavior_fn_ptr_type behavior) { record(TraceEvent::BECOME, a, behavior_id(behavior), 0); }
+    template<typename A> static void delete_later(const A& a) { record(TraceEvent::DELETE_LATER, a, 0, 0); }
+};
+
+struct TracingWorldPolicy : public DefaultWorldPolicy {
+    typedef BufferTracer tracer_type;
+};
+
+
+// TraceNames maps behavior functions to names for export, e.g.
+//
+//      names.set(&Foo::behavior<&Foo::initial>, "Foo::initial");
+class TraceNames {
+    std::vector<std::pair<std::uintptr_t, const char*> > names_;
+
+public:
+    // name must outlive the TraceNames object
+    template<typename F>
+    void set(F behavior, const char *name) { names_.push_back(std::make_pair(BufferTracer::behavior_id(behavior), name)); }
+
+    // returns null if the behavior is unnamed
+    const char* find(std::uintptr_t behavior) const
+    {
+        for (std::size_t i=0; i < names_.size(); ++i) {
+            if (names_[i].first == behavior)
+                return names_[i].second;
+        }
+        return 0;
+    }
+};
+
+
+namespace trace_detail {
+
+inline void write_behavior_name(std::FILE *out, const TraceNames *names, std::uintptr_t behavior)
+{
+    const char *name = names ? names->find(behavior) : 0;
+    if (name) // names are assumed not to require JSON escaping
+        std::fprintf(out, "\"%s\"", name);
+    else
+        std::fprintf(out, "\"behavior 0x%llx\"", static_cast<unsigned long long>(behavior));
+}
+
+inline void write_event(std::FILE *out, const TraceEvent& e, int threadId, const TraceNames *names)
+{
+    static const char* const kindNames[] = {
+        "behavior", "behavior", "inject", "inject", "deferred push", "deferred pop", "become", "delete_later"
+    };
+    static const char kindPhases[] = { 'B', 'E', 'B', 'E', 'i', 'i', 'i', 'i' };
+
+    std::fprintf(out, "{\"name\":");
+    if (e.kind == TraceEvent::BEHAVIOR_BEGIN || e.kind == TraceEvent::BEHAVIOR_END)
+        write_behavior_name(out, names, e.behavior);
+    else
+        std::fprintf(out, "\"%s\"", kindNames[e.kind]);
+
+    // timestamps are in microseconds
+    std::fprintf(out, ",\"cat\":\"fractorp\",\"ph\":\"%c\",\"ts\":%llu.%03u,\"pid\":1,\"tid\":%d",
+        kindPhases[e.kind], static_cast<unsigned long long>(e.timestampNs / 1000), static_cast<unsigned>(e.timestampNs % 1000), threadId);
+    if (kindPhases[e.kind] == 'i')
+        std::fprintf(out, ",\"s\":\"t\"");
+
+    std::fprintf(out, ",\"args\":{\"actor\":\"0x%llx\"", static_cast<unsigned long long>(e.actor));
+    switch (e.kind) {
+    case TraceEvent::BEHAVIOR_BEGIN:
+    case TraceEvent::INJECT_BEGIN:
+    case TraceEvent::DEFERRED_PUSH:
+    case TraceEvent::DEFERRED_POP:
+        std::fprintf(out, ",\"port\":%d", static_cast<int>(e.port));
+        break;
+    case TraceEvent::BECOME:
+        std::fprintf(out, ",\"behavior\":");
+        write_behavior_name(out, names, e.behavior);
+        break;
+    }
+    std::fprintf(out, "}}");
+}
+
+} // end namespace trace_detail
+
+// write_chrome_trace() drains the buffers and writes their events as a Chrome trace JSON
+// object. Returns the number of events written. names may be null.
+inline std::size_t write_chrome_trace(std::FILE *out, TraceBuffer* const *buffers, std::size_t bufferCount, const TraceNames *names = 0)
+{
+    std::size_t count = 0;
+    std::fprintf(out, "{\"traceEvents\":[\n");
+    for (std::size_t i=0; i < bufferCount; ++i) {
+        TraceEvent e;
+        while (buffers[i]->pop(e)) {
+            if (count++ > 0)
+                std::fprintf(out, ",\n");
+            trace_detail::write_event(out, e, buffers[i]->thread_id(), names);
+        }
+    }
+    std::fprintf(out, "\n],\"displayTimeUnit\":\"ns\"}\n");
+    return count;
+}
+
+} // end namespace Fractorp
+
+#endif /* INCLUDED_FRACTORP_TRACE_H */
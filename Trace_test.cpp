@@ -0,0 +1,163 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Not everything that counts can be counted." -- William Bruce Cameron
+*/
+
+#include "Trace.h"
+
+#include <cstdio>
+#include <thread>
+
+using namespace Fractorp;
+
+typedef void* shared_context_type;
+typedef std::intptr_t message_type;
+typedef ActorSpace<shared_context_type, message_type, TracingWorldPolicy> AS1;
+
+
+// Counts down by sending to itself (hence the sends are deferred), alternating between two behaviors.
+struct Countdown : public Fractorp::ActorT<AS1, Countdown> {
+    void initial(self_type& self, int /*port*/, message_type m)
+    {
+        if (m > 0)
+            self.send(*this, m - 1);
+        self.become<&Countdown::other>();
+    }
+
+    void other(self_type& self, int /*port*/, message_type m)
+    {
+        if (m > 0)
+            self.send(*this, 1, m - 1);
+        self.become<&Countdown::initial>();
+    }
+};
+
+// A transient actor that deletes itself after its first message.
+struct Transient : public Fractorp::ActorT<AS1, Transient> {
+    void initial(self_type& self, int /*port*/, message_type /*message*/)
+    {
+        self.delete_later();
+    }
+};
+
+
+void name_behaviors(TraceNames& names)
+{
+    names.set(&Countdown::behavior<&Countdown::initial>, "Countdown::initial");
+    names.set(&Countdown::behavior<&Countdown::other>, "Countdown::other");
+    names.set(&Transient::behavior<&Transient::initial>, "Transient::initial");
+}
+
+void print_events(TraceBuffer& buffer, const TraceNames& names)
+{
+    static const char* const kindNames[] = {
+        "behavior begin", "behavior end", "inject begin", "inject end", "deferred push", "deferred pop", "become", "delete_later"
+    };
+
+    TraceEvent e;
+    while (buffer.pop(e)) {
+        const char *name = names.find(e.behavior);
+        std::printf("%s", kindNames[e.kind]);
+        if (name)
+            std::printf(" %s", name);
+        if (e.kind == TraceEvent::BEHAVIOR_BEGIN || e.kind == TraceEvent::DEFERRED_PUSH || e.kind == TraceEvent::DEFERRED_POP)
+            std::printf(" port: %d", (int)e.port);
+        std::printf("\n");
+    }
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+void test1()
+{
+    std::printf("recorded events:\n");
+
+    TraceNames names;
+    name_behaviors(names);
+
+    TraceBuffer buffer(256, 1);
+    TraceBuffer::Install install(&buffer);
+
+    AS1::world_type world;
+    Countdown countdown;
+    world.inject(countdown, 2);
+    world.inject(*new Transient);
+
+    print_events(buffer, names);
+}
+
+void test2()
+{
+    std::printf("dropped events:\n");
+
+    TraceBuffer buffer(8, 1);
+    TraceBuffer::Install install(&buffer);
+
+    AS1::world_type world;
+    Countdown countdown;
+    world.inject(countdown, 10);
+
+    std::printf("dropped: %d\n", (int)buffer.dropped_count());
+}
+
+void test3()
+{
+    std::printf("untraced thread:\n");
+
+    TraceBuffer buffer(256, 1);
+    TraceBuffer::Install install(&buffer);
+
+    std::thread t([]() {
+        AS1::world_type world;
+        Countdown countdown;
+        world.inject(countdown, 10); // no buffer is installed on this thread
+    });
+    t.join();
+
+    TraceEvent e;
+    std::printf("events: %s\n", buffer.pop(e) ? "some" : "none");
+}
+
+void test4()
+{
+    std::printf("chrome trace:\n");
+
+    TraceNames names;
+    name_behaviors(names);
+
+    TraceBuffer mainBuffer(256, 1), workerBuffer(256, 2);
+
+    std::thread worker([&workerBuffer]() {
+        TraceBuffer::Install install(&workerBuffer);
+        AS1::world_type world;
+        Countdown countdown;
+        world.inject(countdown, 1);
+    });
+
+    {
+        TraceBuffer::Install install(&mainBuffer);
+        AS1::world_type world;
+        world.inject(*new Transient);
+    }
+
+    worker.join();
+
+    TraceBuffer *buffers[] = { &mainBuffer, &workerBuffer };
+    std::size_t count = write_chrome_trace(stdout, buffers, 2, &names);
+    std::printf("events written: %d\n", (int)count);
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    (void)argc; (void)argv;
+
+    test1();
+    test2();
+    test3();
+    test4();
+
+    return 0;
+}
@@ -0,0 +1,413 @@
+/*
+    Fractorp by Ross Bencina
+
+    "A place for everything, and everything in its place." -- Isabella Beeton
+*/
+
+#ifndef INCLUDED_FRACTORP_TYPEDPORTS_H
+#define INCLUDED_FRACTORP_TYPEDPORTS_H
+
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+#include <type_traits>
+#include <utility>
+
+#include "Actor.h"
+
+namespace Fractorp {
+
+// Typed ports let the actors of one ActorSpace exchange messages of different types, without
+// shoehorning every message into a single struct (and hence into the size of the largest one).
+//
+// The message types used in the space are listed once, in a MessageTypes<> list. Each type
+// has a compact type index, resolved at compile time. The space's message_type is
+// TypedMessage<>: a pointer to the payload plus its type index.
+//
+//  * A direct send passes a pointer to the sender's payload. nothing is copied.
+//
+//  * A deferred send moves the payload into a variable-sized record in a bump arena (see
+//    ArenaDeferredSendQueue). Each record occupies only as much space as its own type needs.
+//
+// Each actor declares the message type of each of its ports with a PortTypes<> list.
+// port_endpoint<N>(actor) returns a TypedEndpoint that only accepts messages of port N's type:
+//
+//      struct Request { ... };
+//      typedef TypedActorSpace<S, MessageTypes<Request, int> > TAS;
+//
+//      struct Server : public ActorT<TAS, Server> {
+//          typedef PortTypes<Request, int> port_types; // port 0 receives Request, port 1 receives int
+//
+//          void initial(self_type& self, int port, message_type&& m)
+//          {
+//              if (port == 0) { Request& r = m.get<Request>(); ... }
+//              else { int i = m.get<int>(); ... }
+//          }
+//      };
+//
+//      port_endpoint<1>(server).send(self, 42);
+//
+// A TypedMessage refers to its payload, it doesn't own it, so it can't be copied or moved.
+// Hence typed spaces can't be used with ActorT_mailbox or World::post(). Behaviors must take
+// the message by reference (not by value). Send payloads as rvalues: copy explicitly if needed.
+
+
+// MessageTypes<Ts...> is the list of message types used in a TypedActorSpace.
+// The type index of Ts[i] is i.
+template<typename... Ts>
+struct MessageTypes;
+
+template<>
+struct MessageTypes<> {
+    enum { count = 0 };
+
+    template<typename T>
+    struct index_of { enum { value = -1 }; };
+};
+
+template<typename T0, typename... Ts>
+struct MessageTypes<T0, Ts...> {
+    enum { count = 1 + sizeof...(Ts) };
+
+    // index_of<T>::value is the type index of T, or -1 if T isn't listed
+    template<typename T>
+    struct index_of {
+        enum { tail_index = MessageTypes<Ts...>::template index_of<T>::value };
+        enum { value = std::is_same<T, T0>::value ? 0 : (tail_index < 0 ? -1 : 1 + tail_index) };
+    };
+
+    // at<i>::type is the type with index i
+    template<std::size_t i, typename dummy = void>
+    struct at { typedef typename MessageTypes<Ts...>::template at<i - 1>::type type; };
+
+    template<typename dummy>
+    struct at<0, dummy> { typedef T0 type; };
+
+    // type-erased operations, indexed by type index. Only instantiated once the types are complete.
+
+    struct TypeOps {
+        std::size_t size, alignment;
+        void (*move_construct)(void *dest, void *src);
+        void (*destroy)(void *p);
+    };
+
+    template<typename T>
+    static void move_construct_fn(void *dest, void *src) { new (dest) T(std::move(*static_cast<T*>(src))); }
+
+    template<typename T>
+    static void destroy_fn(void *p) { static_cast<T*>(p)->~T(); }
+
+    static const TypeOps& ops(int typeIndex)
+    {
+        static const TypeOps table[] = {
+            { sizeof(T0), alignof(T0), &move_construct_fn<T0>, &destroy_fn<T0> },
+            { sizeof(Ts), alignof(Ts), &move_construct_fn<Ts>, &destroy_fn<Ts> }...
+        };
+        assert(typeIndex >= 0 && typeIndex < count);
+        return table[typeIndex];
+    }
+
+    // the largest size and alignment of any listed type
+    static std::size_t max_size() { return max_of(&TypeOps::size); }
+    static std::size_t max_alignment() { return max_of(&TypeOps::alignment); }
+
+private:
+    static std::size_t max_of(std::size_t TypeOps::*field)
+    {
+        std::size_t result = 0;
+        for (int i=0; i < count; ++i)
+            result = (ops(i).*field > result) ? ops(i).*field : result;
+        return result;
+    }
+};
+
+
+// TypedMessage refers to a payload of one of the types in TL (a MessageTypes<> list).
+// A value-initialized TypedMessage is empty. (e.g. World::inject(a) and delete_later() send empty messages.)
+template<typename TL>
+class TypedMessage {
+    void *payload_;
+    std::int16_t typeIndex_; // TL::count when empty
+
+    TypedMessage(const TypedMessage&);
+    TypedMessage& operator=(const TypedMessage&);
+
+public:
+    typedef TL message_types;
+
+    enum { EMPTY_TYPE_INDEX = TL::count };
+
+    TypedMessage() : payload_(0), typeIndex_(EMPTY_TYPE_INDEX) {}
+
+    // wrap an rvalue payload, e.g. self.send(a, port, Request(...)). The receiver may move from it.
+    template<typename T>
+    TypedMessage(T&& payload,
+        typename std::enable_if<!std::is_reference<T>::value && (TL::template index_of<T>::value >= 0)>::type* = 0)
+        : payload_(&payload)
+        , typeIndex_(static_cast<std::int16_t>(TL::template index_of<T>::value)) {}
+
+    // used by the implementation to refer to a payload stored in a deferred send record
+    TypedMessage(void *payload, int typeIndex)
+        : payload_(payload)
+        , typeIndex_(static_cast<std::int16_t>(typeIndex)) {}
+
+    bool empty() const { return typeIndex_ == EMPTY_TYPE_INDEX; }
+    int type_index() const { return typeIndex_; }
+    void* payload() const { return payload_; }
+
+    template<typename T>
+    bool is() const { return typeIndex_ == TL::template index_of<T>::value; }
+
+    template<typename T>
+    T& get() const
+    {
+        static_assert(TL::template index_of<T>::value >= 0, "T is not listed in the space's MessageTypes");
+        assert(is<T>() && "message type does not match the receiving port");
+        return *static_cast<T*>(payload_);
+    }
+};
+
+
+// ArenaDeferredSendQueue stores deferred sends of TypedMessages as variable-sized records in a
+// bump arena. A record is a header (endpoint and type index) followed by the payload, which is
+// move-constructed into the arena. Records are appended to a FIFO of fixed-size chunks, and are
+// dispatched in place. Drained chunks are kept on a spare list, and the last chunk is rewound
+// once the queue is empty, so in the steady state no allocation takes place.
+template<typename S, typename M, typename P, std::size_t ChunkSize>
+class ArenaDeferredSendQueue {
+    typedef S shared_context_type;
+    typedef M message_type;
+    typedef Actor<shared_context_type,message_type,P> actor_type;
+    typedef typename actor_type::endpoint_type endpoint_type;
+    typedef World<shared_context_type,message_type,P> world_type;
+    typedef typename message_type::message_types message_types;
+
+    // records are dispatched in place, so the oldest record can't be dropped during send_all()
+    static_assert(static_cast<int>(P::deferred_send_overflow_action) != DEFERRED_SEND_DROP_OLDEST,
+        "ArenaDeferredSendQueue does not support DEFERRED_SEND_DROP_OLDEST");
+
+    // records are variable-sized, so they can only be consumed from the front
+    static_assert(static_cast<int>(P::deferred_send_order) == DEFERRED_SEND_FIFO,
+        "ArenaDeferredSendQueue only supports DEFERRED_SEND_FIFO");
+
+    struct RecordHeader : public P::tracer_type::deferred_send_state {
+        endpoint_type endpoint;
+        std::uint32_t size; // of the whole record, including header and padding
+        std::int16_t typeIndex;
+        std::uint16_t payloadOffset; // from the start of the record
+    };
+
+    struct Chunk {
+        Chunk *next_;
+        std::size_t begin_, end_; // [begin_, end_) are live records
+        typename std::aligned_storage<ChunkSize, alignof(std::max_align_t)>::type bytes_;
+
+        char* at(std::size_t offset) { return reinterpret_cast<char*>(&bytes_) + offset; }
+    };
+
+    Chunk *front_, *back_; // FIFO of chunks. null when no chunks are linked
+    Chunk *spareChunks_;
+    std::size_t size_; // number of records
+
+    ArenaDeferredSendQueue(const ArenaDeferredSendQueue&);
+    ArenaDeferredSendQueue& operator=(const ArenaDeferredSendQueue&);
+
+    static std::size_t align_up(std::size_t n, std::size_t alignment) { return (n + alignment - 1) & ~(alignment - 1); }
+
+    static RecordHeader& header(Chunk *c, std::size_t offset) { return *reinterpret_cast<RecordHeader*>(c->at(offset)); }
+
+    // the largest record any listed type can need at the start of a chunk
+    static std::size_t max_record_size()
+    {
+        return align_up(align_up(sizeof(RecordHeader), message_types::max_alignment()) + message_types::max_size(), alignof(RecordHeader));
+    }
+
+    Chunk* new_chunk()
+    {
+        Chunk *c = spareChunks_;
+        if (c)
+            spareChunks_ = c->next_;
+        else
+            c = new Chunk;
+        c->next_ = 0;
+        c->begin_ = c->end_ = 0;
+        return c;
+    }
+
+    void retire_front()
+    {
+        Chunk *c = front_;
+        front_ = c->next_;
+        if (front_ == 0)
+            back_ = 0;
+        c->next_ = spareChunks_;
+        spareChunks_ = c;
+    }
+
+    static void free_chunks(Chunk *c)
+    {
+        while (c) {
+            Chunk *next = c->next_;
+            delete c;
+            c = next;
+        }
+    }
+
+    static void destroy_payload(RecordHeader& h)
+    {
+        if (h.typeIndex != message_type::EMPTY_TYPE_INDEX)
+            message_types::ops(h.typeIndex).destroy(reinterpret_cast<char*>(&h) + h.payloadOffset);
+    }
+
+public:
+    ArenaDeferredSendQueue() : front_(0), back_(0), spareChunks_(0), size_(0) {}
+
+    ~ArenaDeferredSendQueue()
+    {
+        for (Chunk *c = front_; c; c = c->next_) {
+            for (std::size_t offset = c->begin_; offset != c->end_; offset += header(c, offset).size)
+                destroy_payload(header(c, offset));
+        }
+        free_chunks(front_);
+        free_chunks(spareChunks_);
+    }
+
+    bool empty() const { return front_ == 0 || (front_ == back_ && front_->begin_ == front_->end_); }
+
+    std::size_t size() const { return size_; }
+
+    void push(actor_type& a, int port, message_type&& m)
+    {
+        assert(max_record_size() <= ChunkSize && "ArenaWorldPolicy ChunkSize is too small for some MessageTypes");
+
+        std::size_t payloadSize = 0, payloadAlignment = 1;
+        if (!m.empty()) {
+            payloadSize = message_types::ops(m.type_index()).size;
+            payloadAlignment = message_types::ops(m.type_index()).alignment;
+        }
+        assert(payloadAlignment <= alignof(std::max_align_t) && "over-aligned message types are not supported");
+
+        if (back_ == 0)
+            front_ = back_ = new_chunk();
+
+        // chunks are max-aligned, so payloads are aligned relative to the start of the chunk
+        std::size_t offset = back_->end_;
+        std::size_t payloadOffset = align_up(offset + sizeof(RecordHeader), payloadAlignment) - offset;
+        std::size_t recordSize = align_up(payloadOffset + payloadSize, alignof(RecordHeader));
+        if (offset + recordSize > ChunkSize) {
+            Chunk *c = new_chunk();
+            back_->next_ = c;
+            back_ = c;
+
+            offset = 0;
+            payloadOffset = align_up(sizeof(RecordHeader), payloadAlignment);
+            recordSize = align_up(payloadOffset + payloadSize, alignof(RecordHeader));
+        }
+
+        char *record = back_->at(offset);
+        RecordHeader *h = new (record) RecordHeader;
+        h->endpoint = endpoint_type(a, port);
+        h->size = static_cast<std::uint32_t>(recordSize);
+        h->typeIndex = static_cast<std::int16_t>(m.type_index());
+        h->payloadOffset = static_cast<std::uint16_t>(payloadOffset);
+        if (!m.empty())
+            message_types::ops(m.type_index()).move_construct(record + payloadOffset, m.payload());
+        back_->end_ = offset + recordSize;
+        ++size_;
+        P::tracer_type::deferred_push(a, port, *h);
+    }
+
+    void send_all(world_type& world)
+    {
+        // NOTE: dispatching may cause additional records to be appended. records are dispatched
+        // in place: chunks aren't reused until they have been retired, so the record remains valid.
+        while (!empty()) {
+            Chunk *c = front_;
+            if (c->begin_ == c->end_) { // exhausted, and not the last chunk
+                retire_front();
+                continue;
+            }
+
+            RecordHeader& h = header(c, c->begin_);
+            actor_type& a = h.endpoint.actor();
+            P::tracer_type::deferred_pop(a, h.endpoint.port(), h);
+            a.behaviorFn_(world, a, h.endpoint.port(), message_type(reinterpret_cast<char*>(&h) + h.payloadOffset, h.typeIndex));
+            destroy_payload(h);
+            c->begin_ += h.size;
+            --size_;
+        }
+
+        if (back_)
+            back_->begin_ = back_->end_ = 0; // rewind the arena
+    }
+};
+
+
+// Deferred sends of TypedMessages are stored in an ArenaDeferredSendQueue with chunks of ChunkSize bytes.
+template<std::size_t ChunkSize = 4096>
+struct ArenaWorldPolicy : public DefaultWorldPolicy {
+    template<typename S, typename M, typename P>
+    struct deferred_send_queue { typedef ArenaDeferredSendQueue<S, M, P, ChunkSize> type; };
+};
+
+
+// An ActorSpace whose actors exchange the message types listed in TL (a MessageTypes<> list).
+template<typename S, typename TL, typename P = ArenaWorldPolicy<> >
+struct TypedActorSpace : public ActorSpace<S, TypedMessage<TL>, P> {
+    typedef TL message_types;
+};
+
+
+// PortTypes<Ts...> declares the message type of each port of an actor: port i receives Ts[i].
+// Actors declare it as a member typedef named port_types (see port_endpoint below).
+template<typename... Ts>
+struct PortTypes {
+    enum { count = sizeof...(Ts) };
+
+    template<int port>
+    struct at { typedef typename MessageTypes<Ts...>::template at<port>::type type; };
+};
+
+
+// TypedEndpoint is an Endpoint that only accepts messages of type T.
+// A is the root actor type (Actor<S,M,P>).
+template<typename A, typename T>
+struct TypedEndpoint {
+    typedef typename A::endpoint_type endpoint_type;
+    typedef typename A::message_type message_type;
+    typedef T port_message_type;
+
+    static_assert(message_type::message_types::template index_of<T>::value >= 0, "T is not listed in the space's MessageTypes");
+
+    endpoint_type endpoint_;
+
+    TypedEndpoint() {}
+    explicit TypedEndpoint(const endpoint_type& e) : endpoint_(e) {}
+
+    const endpoint_type& endpoint() const { return endpoint_; }
+
+    // send from within a behavior
+    template<typename self_type>
+    void send(self_type& self, T&& payload) const { self.send(endpoint_, message_type(std::move(payload))); }
+
+    // send from outside actor behaviors. see World::inject()
+    template<typename world_type>
+    void inject(world_type& world, T&& payload) const { world.inject(endpoint_, message_type(std::move(payload))); }
+};
+
+// port_endpoint<port>(a) returns a TypedEndpoint for the given port of actor a, typed
+// according to a's port_types.
+template<int port, typename C>
+TypedEndpoint<typename C::root_actor_type, typename C::port_types::template at<port>::type> port_endpoint(C& a)
+{
+    static_assert(port < C::port_types::count, "port is not declared in the actor's port_types");
+    typedef typename C::root_actor_type root_actor_type;
+    typedef TypedEndpoint<root_actor_type, typename C::port_types::template at<port>::type> typed_endpoint_type;
+    static_assert(port < typed_endpoint_type::endpoint_type::PORT_COUNT, "port exceeds the ports available to the space's endpoint_type");
+    return typed_endpoint_type(typename typed_endpoint_type::endpoint_type(static_cast<root_actor_type&>(a), port));
+}
+
+} // end namespace Fractorp
+
+#endif /* INCLUDED_FRACTORP_TYPEDPORTS_H */
@@ -0,0 +1,147 @@
+/*
+    Fractorp by Ross Bencina
+
+    "Horses for courses." -- Proverb
+*/
+
+#include "TypedPorts.h"
+
+#include <cstdio>
+#include <string>
+
+using namespace Fractorp;
+
+typedef void* shared_context_type; // not used
+
+//////////////////////////////////////////////////////////////////////////
+// Recursive factorial (see Actor_test.cpp test2), with a message type per port
+// instead of a single shoehorned struct.
+
+struct FactRequest;
+typedef TypedActorSpace<shared_context_type, MessageTypes<FactRequest, unsigned long> > TAS1;
+
+typedef TypedEndpoint<TAS1::actor_type, unsigned long> ResultEndpoint;
+
+struct FactRequest {
+    unsigned long n;
+    ResultEndpoint customer;
+
+    FactRequest(unsigned long n_, ResultEndpoint customer_) : n(n_), customer(customer_) {}
+};
+
+struct FactCustomer : public Fractorp::ActorT<TAS1, FactCustomer> {
+    typedef PortTypes<unsigned long> port_types;
+
+    unsigned long n_;
+    ResultEndpoint customer_;
+
+    FactCustomer(unsigned long n, ResultEndpoint customer) : n_(n), customer_(customer) {}
+
+    void initial(self_type& self, int /*port*/, message_type&& m)
+    {
+        customer_.send(self, n_ * m.get<unsigned long>());
+        self.delete_later();
+    }
+};
+
+struct Factorial : public Fractorp::ActorT<TAS1, Factorial> {
+    typedef PortTypes<FactRequest> port_types;
+
+    void initial(self_type& self, int /*port*/, message_type&& m)
+    {
+        FactRequest& request = m.get<FactRequest>();
+        if (request.n == 0) {
+            request.customer.send(self, 1);
+        } else {
+            FactCustomer *c = new FactCustomer(request.n, request.customer);
+            port_endpoint<0>(*this).send(self, FactRequest(request.n - 1, port_endpoint<0>(*c))); // deferred
+        }
+    }
+};
+
+struct PrintResult : public Fractorp::ActorT<TAS1, PrintResult> {
+    typedef PortTypes<unsigned long> port_types;
+
+    void initial(self_type& /*self*/, int /*port*/, const message_type& m)
+    {
+        std::printf("%lu\n", m.get<unsigned long>());
+    }
+};
+
+void test1()
+{
+    std::printf("typed factorial:\n");
+
+    TAS1::world_type world;
+    Factorial factorial;
+    PrintResult printer;
+
+    for (unsigned long i=0; i < 13; ++i)
+        port_endpoint<0>(factorial).inject(world, FactRequest(i, port_endpoint<0>(printer)));
+}
+
+//////////////////////////////////////////////////////////////////////////
+// Messages of different sizes, including types with non-trivial destructors,
+// deferred through an arena with small chunks.
+
+struct Blob {
+    int id_;
+    char bytes_[60];
+
+    explicit Blob(int id) : id_(id) {}
+};
+
+typedef TypedActorSpace<shared_context_type, MessageTypes<char, double, std::string, Blob>, ArenaWorldPolicy<128> > TAS2;
+
+struct Mixer : public Fractorp::ActorT<TAS2, Mixer> {
+    typedef PortTypes<char, double, std::string, Blob> port_types;
+
+    void initial(self_type& self, int port, message_type&& m)
+    {
+        switch (port) {
+        case 0:
+            std::printf("char: %c\n", m.get<char>());
+            for (int i=0; i < 3; ++i) { // recursive sends: each is deferred
+                port_endpoint<1>(*this).send(self, i * 0.5);
+                port_endpoint<2>(*this).send(self, std::string("a string long enough to be heap allocated #") + char('0' + i));
+                port_endpoint<3>(*this).send(self, Blob(i));
+            }
+            break;
+        case 1:
+            std::printf("double: %g\n", m.get<double>());
+            break;
+        case 2:
+            {
+                std::string s(std::move(m.get<std::string>())); // the receiver may move from the payload
+                std::printf("string: %s\n", s.c_str());
+            }
+            break;
+        case 3:
+            std::printf("blob: %d\n", m.get<Blob>().id_);
+            break;
+        }
+    }
+};
+
+void test2()
+{
+    std::printf("heterogeneous deferred sends:\n");
+
+    TAS2::world_type world;
+    Mixer mixer;
+
+    port_endpoint<0>(mixer).inject(world, 'x');
+    port_endpoint<0>(mixer).inject(world, 'y'); // reuses the arena chunks
+}
+
+//////////////////////////////////////////////////////////////////////////
+
+int main(int argc, char *argv[])
+{
+    (void)argc; (void)argv;
+
+    test1();
+    test2();
+
+    return 0;
+}